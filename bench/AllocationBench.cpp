@@ -0,0 +1,95 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "Bench.h"
+
+#include "blockchain.h"
+#include "crypto.h"
+
+namespace {
+std::atomic<uint64_t> allocations(0);
+
+/**
+* Counts the heap allocations made while running a function
+*
+* @param func the function to run
+* @return the number of calls to operator new it made
+*/
+uint64_t countAllocations(const std::function<void()>& func) {
+    const uint64_t before = allocations;
+    func();
+    return allocations - before;
+}
+
+void reportAllocations(const std::string& label, const uint64_t count, const unsigned int txCount) {
+    CryptoKernel::Bench::note(label, std::to_string(count) + " allocations, " +
+                              std::to_string(count / txCount) + " per tx");
+}
+}
+
+// Replacing the global allocator counts every allocation in the process
+void* operator new(std::size_t size) {
+    allocations++;
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if(ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+BENCHMARK(blockAllocations) {
+    // Heap allocations made handling a block of 5000 transactions the way
+    // validation does: copying it around, walking its transactions and
+    // converting it to and from JSON
+    const unsigned int txCount = 5000;
+
+    std::set<CryptoKernel::Blockchain::transaction> txs;
+    for(unsigned int i = 0; i < txCount; i++) {
+        const CryptoKernel::uint256 outputId(CryptoKernel::Crypto::sha256(std::to_string(i)));
+        const CryptoKernel::Blockchain::input inp(outputId, Json::Value());
+        const CryptoKernel::Blockchain::output out(100000000, i, Json::Value());
+        txs.insert(CryptoKernel::Blockchain::transaction({inp}, {out}, 1530888581));
+    }
+
+    const CryptoKernel::Blockchain::output reward(100000000, txCount, Json::Value());
+    const CryptoKernel::Blockchain::transaction coinbaseTx({}, {reward}, 1530888581, true);
+    const CryptoKernel::Blockchain::block newBlock(txs, coinbaseTx, CryptoKernel::uint256(),
+                                                   1530888581, Json::Value(), 2);
+
+    reportAllocations("copy block", countAllocations([&]() {
+        const CryptoKernel::Blockchain::block copy = newBlock;
+    }), txCount);
+
+    uint64_t checksum = 0;
+    reportAllocations("walk transactions", countAllocations([&]() {
+        for(const auto& tx : newBlock.getTransactions()) {
+            for(const auto& inp : tx.getInputs()) {
+                checksum += inp.getOutputId() == inp.getId();
+            }
+            for(const auto& out : tx.getOutputs()) {
+                checksum += out.getValue();
+            }
+            checksum += tx.getOutputSetId() == tx.getId();
+        }
+    }), txCount);
+
+    Json::Value blockJson;
+    reportAllocations("block to JSON", countAllocations([&]() {
+        blockJson = newBlock.toJson();
+    }), txCount);
+
+    reportAllocations("block from JSON", countAllocations([&]() {
+        const CryptoKernel::Blockchain::block parsed(blockJson);
+    }), txCount);
+
+    CryptoKernel::Bench::note("checksum", std::to_string(checksum));
+}
@@ -0,0 +1,82 @@
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+namespace CryptoKernel {
+namespace Bench {
+/**
+* A single registered benchmark
+*/
+struct Case {
+    std::string name;
+    std::function<void()> func;
+};
+
+/**
+* Returns the list of benchmarks registered with the BENCHMARK macro
+*/
+inline std::vector<Case>& registry() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+class Registrar {
+public:
+    Registrar(const std::string& name, std::function<void()> func) {
+        registry().push_back({name, func});
+    }
+};
+
+/**
+* Wall clock timer started on construction
+*/
+class Timer {
+public:
+    Timer() : start(std::chrono::steady_clock::now()) {}
+
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+/**
+* Prints a result line in a fixed format
+*
+* @param label a description of what was measured
+* @param ops the number of operations performed
+* @param seconds the time taken to perform them
+*/
+inline void report(const std::string& label, const uint64_t ops, const double seconds) {
+    std::cout << std::left << std::setw(48) << label
+              << std::right << std::setw(12) << ops << " ops "
+              << std::setw(12) << std::fixed << std::setprecision(0)
+              << (seconds > 0 ? ops / seconds : 0) << " ops/s "
+              << std::setw(10) << std::setprecision(1)
+              << (ops > 0 ? seconds * 1e9 / ops : 0) << " ns/op" << std::endl;
+}
+
+/**
+* Prints a free-form measurement such as a size or ratio
+*/
+inline void note(const std::string& label, const std::string& value) {
+    std::cout << std::left << std::setw(48) << label << value << std::endl;
+}
+}
+}
+
+#define BENCHMARK(name) \
+    static void name(); \
+    static CryptoKernel::Bench::Registrar name##Registrar(#name, name); \
+    static void name()
+
+#endif // BENCH_H_INCLUDED
@@ -0,0 +1,58 @@
+#ifndef BENCHNODE_H_INCLUDED
+#define BENCHNODE_H_INCLUDED
+
+#include <memory>
+#include <string>
+
+#include "blockchain.h"
+#include "log.h"
+#include "consensus/regtest.h"
+
+namespace CryptoKernel {
+namespace Bench {
+class BenchChain : public CryptoKernel::Blockchain {
+public:
+    BenchChain(CryptoKernel::Log* log, const std::string& dbDir) :
+        CryptoKernel::Blockchain(log, dbDir) {}
+
+private:
+    std::string getCoinbaseOwner(const std::string& publicKey) {
+        return publicKey;
+    }
+
+    uint64_t getBlockReward(const uint64_t height) {
+        return 100000000;
+    }
+};
+
+/**
+* A regtest chain over the in-memory engine, removed again on destruction
+*/
+class BenchNode {
+public:
+    BenchNode(CryptoKernel::Log* log, const std::string& dbDir,
+              const std::string& genesis = "genesisbench.json") {
+        this->dbDir = dbDir;
+        CryptoKernel::Storage::destroy(dbDir);
+        blockchain.reset(new BenchChain(log, dbDir));
+        consensus.reset(new CryptoKernel::Consensus::Regtest(blockchain.get()));
+        blockchain->loadChain(consensus.get(), genesis);
+        consensus->start();
+    }
+
+    ~BenchNode() {
+        blockchain.reset();
+        consensus.reset();
+        CryptoKernel::Storage::destroy(dbDir);
+    }
+
+    std::unique_ptr<BenchChain> blockchain;
+    std::unique_ptr<CryptoKernel::Consensus::Regtest> consensus;
+
+private:
+    std::string dbDir;
+};
+}
+}
+
+#endif // BENCHNODE_H_INCLUDED
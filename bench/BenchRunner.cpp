@@ -0,0 +1,18 @@
+#include <string>
+
+#include "Bench.h"
+
+int main(int argc, char* argv[]) {
+    const std::string filter = argc > 1 ? argv[1] : "";
+
+    for(const auto& benchCase : CryptoKernel::Bench::registry()) {
+        if(benchCase.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        std::cout << "== " << benchCase.name << std::endl;
+        benchCase.func();
+    }
+
+    return 0;
+}
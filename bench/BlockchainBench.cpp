@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+#include "Bench.h"
+#include "BenchNode.h"
+
+#include "blockchain.h"
+#include "crypto.h"
+#include "log.h"
+#include "consensus/regtest.h"
+
+namespace {
+using CryptoKernel::Bench::BenchNode;
+
+/**
+* Mines coinbase-only blocks and fills the mempool with signed
+* transactions spending every one of their outputs
+*
+* @param node the node to mine on
+* @param crypto the key pair to mine to and sign with
+* @param txCount the number of blocks to mine and transactions to submit
+*/
+void fillMempool(BenchNode& node, CryptoKernel::Crypto& crypto, const unsigned int txCount) {
+    const std::string pubKey = crypto.getPublicKey();
+
+    for(unsigned int i = 0; i < txCount; i++) {
+        node.consensus->mineBlock(true, pubKey);
+    }
+
+    // Distinct nonces, as the spent outputs all have the same value
+    uint64_t nonce = 0;
+    for(const auto& out : node.blockchain->getUnspentOutputs(pubKey)) {
+        Json::Value data;
+        data["publicKey"] = pubKey;
+        const CryptoKernel::Blockchain::output newOut(out.getValue() - 20000, nonce++, data);
+
+        Json::Value spendData;
+        spendData["signature"] = crypto.sign(out.getId().toString() +
+                                             CryptoKernel::Blockchain::transaction::getOutputSetId({newOut}).toString());
+        const CryptoKernel::Blockchain::input inp(out.getId(), spendData);
+
+        node.blockchain->submitTransaction(CryptoKernel::Blockchain::transaction({inp}, {newOut},
+                                           1530888581));
+    }
+}
+
+/**
+* Builds a chain of coinbase-only blocks and a block on top of it that
+* spends every one of their outputs with a signed transaction
+*
+* @param log the log to use
+* @param txCount the number of transactions in the final block
+* @param history set to the blocks leading up to the final block
+* @return the final block
+*/
+CryptoKernel::Blockchain::block buildBlock(CryptoKernel::Log* log, const unsigned int txCount,
+                                           std::vector<Json::Value>& history) {
+    BenchNode node(log, "memory:benchsourcedb");
+    CryptoKernel::Crypto crypto(true);
+    fillMempool(node, crypto, txCount);
+
+    for(uint64_t height = 2; height <= txCount + 1; height++) {
+        history.push_back(node.blockchain->getBlockByHeight(height).toJson());
+    }
+
+    Json::Value blockJson = node.blockchain->generateVerifyingBlock(crypto.getPublicKey()).toJson();
+    blockJson["consensusData"]["isBetter"] = true;
+    return CryptoKernel::Blockchain::block(blockJson);
+}
+}
+
+BENCHMARK(blockVerify) {
+    // Time to validate one block of signed transactions, by block size and
+    // the number of threads verifying
+    CryptoKernel::Log log("bench.log");
+    std::remove("genesisbench.json");
+
+    const unsigned int cores = std::max(1U, std::thread::hardware_concurrency());
+    std::vector<unsigned int> threadCounts;
+    for(unsigned int threads = 1; threads < cores; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(cores);
+
+    for(const unsigned int txCount : {50, 200, 800}) {
+        std::vector<Json::Value> history;
+        const CryptoKernel::Blockchain::block newBlock = buildBlock(&log, txCount, history);
+
+        for(const unsigned int threads : threadCounts) {
+            BenchNode node(&log, "memory:benchverifydb");
+            for(const auto& blockJson : history) {
+                node.blockchain->submitBlock(CryptoKernel::Blockchain::block(blockJson));
+            }
+            node.blockchain->setVerifyThreads(threads);
+
+            CryptoKernel::Bench::Timer timer;
+            const bool accepted = std::get<0>(node.blockchain->submitBlock(newBlock));
+            const double seconds = timer.seconds();
+
+            if(!accepted) {
+                CryptoKernel::Bench::note("block of " + std::to_string(txCount) + " txs",
+                                          "rejected");
+                continue;
+            }
+
+            CryptoKernel::Bench::report("block of " + std::to_string(txCount) + " txs, " +
+                                        std::to_string(threads) + " threads", txCount, seconds);
+        }
+    }
+
+    std::remove("genesisbench.json");
+}
+
+BENCHMARK(blockConnectWarm) {
+    // Time to connect a block whose transactions were already verified on
+    // entering the mempool, against the same block arriving unannounced
+    CryptoKernel::Log log("bench.log");
+    std::remove("genesisbench.json");
+
+    for(const unsigned int txCount : {200, 800}) {
+        std::vector<Json::Value> history;
+        const CryptoKernel::Blockchain::block newBlock = buildBlock(&log, txCount, history);
+
+        for(const bool warm : {false, true}) {
+            BenchNode node(&log, "memory:benchconnectdb");
+            for(const auto& blockJson : history) {
+                node.blockchain->submitBlock(CryptoKernel::Blockchain::block(blockJson));
+            }
+
+            if(warm) {
+                for(const auto& tx : newBlock.getTransactions()) {
+                    node.blockchain->submitTransaction(tx);
+                }
+            }
+
+            const CryptoKernel::SignatureCache::Stats before =
+                node.blockchain->getSignatureCacheStats();
+
+            CryptoKernel::Bench::Timer timer;
+            const bool accepted = std::get<0>(node.blockchain->submitBlock(newBlock));
+            const double seconds = timer.seconds();
+
+            const std::string name = "block of " + std::to_string(txCount) + " txs, " +
+                                     (warm ? "warm" : "cold") + " mempool";
+            if(!accepted) {
+                CryptoKernel::Bench::note(name, "rejected");
+                continue;
+            }
+
+            CryptoKernel::Bench::report(name, txCount, seconds);
+
+            const CryptoKernel::SignatureCache::Stats after =
+                node.blockchain->getSignatureCacheStats();
+            CryptoKernel::Bench::note(name + " signature cache",
+                                      std::to_string(after.hits - before.hits) + " hits, " +
+                                      std::to_string(after.misses - before.misses) + " misses");
+        }
+    }
+
+    std::remove("genesisbench.json");
+}
+
+BENCHMARK(blockTemplate) {
+    // Time to produce new work for a miner, the first time after the
+    // mempool changed and again while it has not
+    CryptoKernel::Log log("bench.log");
+    std::remove("genesisbench.json");
+
+    const unsigned int txCount = 800;
+    BenchNode node(&log, "memory:benchtemplatedb");
+    CryptoKernel::Crypto crypto(true);
+    fillMempool(node, crypto, txCount);
+
+    const std::string pubKey = crypto.getPublicKey();
+
+    CryptoKernel::Bench::Timer firstTimer;
+    node.blockchain->generateVerifyingBlock(pubKey);
+    CryptoKernel::Bench::report("template of " + std::to_string(txCount) + " txs, changed",
+                                1, firstTimer.seconds());
+
+    const unsigned int repeats = 100;
+    CryptoKernel::Bench::Timer cachedTimer;
+    for(unsigned int i = 0; i < repeats; i++) {
+        node.blockchain->generateVerifyingBlock(pubKey);
+    }
+    CryptoKernel::Bench::report("template of " + std::to_string(txCount) + " txs, unchanged",
+                                repeats, cachedTimer.seconds());
+
+    std::remove("genesisbench.json");
+}
+
+BENCHMARK(reorg) {
+    // Time for a chain of coinbase-only blocks to replace the last 100
+    // blocks of the main chain, each holding signed transactions
+    CryptoKernel::Log log("bench.log");
+    std::remove("genesisbench.json");
+
+    const unsigned int depth = 100;
+    const unsigned int txsPerBlock = 20;
+
+    BenchNode node(&log, "memory:benchreorgdb");
+    CryptoKernel::Crypto crypto(true);
+    const std::string pubKey = crypto.getPublicKey();
+
+    // Coinbase outputs to start one chain of spends each from
+    for(unsigned int i = 0; i < txsPerBlock; i++) {
+        node.consensus->mineBlock(true, pubKey);
+    }
+
+    std::vector<Json::Value> history;
+    const uint64_t forkHeight = node.blockchain->getBlockDB("tip").getHeight();
+    for(uint64_t height = 2; height <= forkHeight; height++) {
+        history.push_back(node.blockchain->getBlockByHeight(height).toJson());
+    }
+
+    std::set<CryptoKernel::Blockchain::dbOutput> unspent = node.blockchain->getUnspentOutputs(pubKey);
+    std::vector<CryptoKernel::Blockchain::output> heads(unspent.begin(), unspent.end());
+    uint64_t nonce = 0;
+    for(unsigned int i = 0; i < depth; i++) {
+        for(auto& head : heads) {
+            Json::Value data;
+            data["publicKey"] = pubKey;
+            const CryptoKernel::Blockchain::output newOut(head.getValue() - 20000, nonce++, data);
+
+            Json::Value spendData;
+            spendData["signature"] = crypto.sign(head.getId().toString() +
+                                                 CryptoKernel::Blockchain::transaction::getOutputSetId({newOut}).toString());
+            const CryptoKernel::Blockchain::input inp(head.getId(), spendData);
+
+            node.blockchain->submitTransaction(CryptoKernel::Blockchain::transaction({inp}, {newOut},
+                                               1530888581));
+            head = newOut;
+        }
+        node.consensus->mineBlock(true, pubKey);
+    }
+
+    // The competing branch, mined on a second node from the fork point.
+    // Only its last block claims to be better, so the rest are saved as
+    // candidates and connected together by the reorg.
+    std::vector<Json::Value> branch;
+    {
+        BenchNode other(&log, "memory:benchreorgbranchdb");
+        for(const auto& blockJson : history) {
+            other.blockchain->submitBlock(CryptoKernel::Blockchain::block(blockJson));
+        }
+        for(unsigned int i = 0; i <= depth; i++) {
+            other.consensus->mineBlock(true, pubKey);
+            Json::Value blockJson = other.blockchain->getBlockByHeight(forkHeight + i + 1).toJson();
+            blockJson["consensusData"]["isBetter"] = i == depth;
+            branch.push_back(blockJson);
+        }
+    }
+
+    for(unsigned int i = 0; i < depth; i++) {
+        node.blockchain->submitBlock(CryptoKernel::Blockchain::block(branch[i]));
+    }
+
+    const CryptoKernel::Blockchain::block newTip(branch.back());
+    CryptoKernel::Bench::Timer timer;
+    const bool accepted = std::get<0>(node.blockchain->submitBlock(newTip));
+    const double seconds = timer.seconds();
+
+    const std::string name = std::to_string(depth) + " block reorg, " +
+                             std::to_string(txsPerBlock) + " txs per block";
+    if(!accepted || node.blockchain->getBlockDB("tip").getId() != newTip.getId()) {
+        CryptoKernel::Bench::note(name, "rejected");
+    } else {
+        CryptoKernel::Bench::report(name, depth, seconds);
+    }
+
+    std::remove("genesisbench.json");
+}
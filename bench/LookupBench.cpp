@@ -0,0 +1,159 @@
+#include <map>
+#include <set>
+
+#include "Bench.h"
+
+#include "crypto.h"
+#include "idmap.h"
+#include "merkletree.h"
+
+namespace {
+/**
+* Makes ids shaped like real ones, which are SHA256 hashes
+*
+* @param count the number of ids to make
+* @param salt distinguishes one set of ids from another
+*/
+std::vector<CryptoKernel::uint256> makeIds(const unsigned int count, const std::string& salt) {
+    std::vector<CryptoKernel::uint256> ids;
+    ids.reserve(count);
+    for(unsigned int i = 0; i < count; i++) {
+        ids.push_back(CryptoKernel::uint256(CryptoKernel::Crypto::sha256(salt + std::to_string(i))));
+    }
+    return ids;
+}
+
+/**
+* Converts ids to BigNums, the id type before uint256, for comparison
+*/
+std::vector<CryptoKernel::BigNum> toBigNums(const std::vector<CryptoKernel::uint256>& ids) {
+    std::vector<CryptoKernel::BigNum> returning;
+    returning.reserve(ids.size());
+    for(const auto& id : ids) {
+        returning.push_back(id.toBigNum());
+    }
+    return returning;
+}
+}
+
+BENCHMARK(idLookup) {
+    // The mempool's conflict checks: looking up output ids that are mostly
+    // absent in a map of 100000 entries, by container
+    const unsigned int count = 100000;
+    const std::vector<CryptoKernel::uint256> presentKeys = makeIds(count, "present");
+    const std::vector<CryptoKernel::uint256> absentKeys = makeIds(count, "absent");
+    const std::vector<CryptoKernel::BigNum> present = toBigNums(presentKeys);
+    const std::vector<CryptoKernel::BigNum> absent = toBigNums(absentKeys);
+
+    uint64_t found = 0;
+
+    std::map<CryptoKernel::BigNum, CryptoKernel::BigNum> ordered;
+    CryptoKernel::Bench::Timer orderedInsertTimer;
+    for(const auto& id : present) {
+        ordered.insert(std::make_pair(id, id));
+    }
+    CryptoKernel::Bench::report("std::map<BigNum> insert", count, orderedInsertTimer.seconds());
+
+    CryptoKernel::Bench::Timer orderedHitTimer;
+    for(const auto& id : present) {
+        found += ordered.count(id);
+    }
+    CryptoKernel::Bench::report("std::map<BigNum> hit", count, orderedHitTimer.seconds());
+
+    CryptoKernel::Bench::Timer orderedMissTimer;
+    for(const auto& id : absent) {
+        found += ordered.count(id);
+    }
+    CryptoKernel::Bench::report("std::map<BigNum> miss", count, orderedMissTimer.seconds());
+
+    CryptoKernel::Bench::Timer orderedEraseTimer;
+    for(const auto& id : present) {
+        ordered.erase(id);
+    }
+    CryptoKernel::Bench::report("std::map<BigNum> erase", count, orderedEraseTimer.seconds());
+
+    CryptoKernel::IdMap<CryptoKernel::uint256> hashed;
+    CryptoKernel::Bench::Timer hashedInsertTimer;
+    for(const auto& key : presentKeys) {
+        hashed.insert(key, key);
+    }
+    CryptoKernel::Bench::report("IdMap<uint256> insert", count, hashedInsertTimer.seconds());
+
+    CryptoKernel::Bench::Timer hashedHitTimer;
+    for(const auto& key : presentKeys) {
+        found += hashed.contains(key);
+    }
+    CryptoKernel::Bench::report("IdMap<uint256> hit", count, hashedHitTimer.seconds());
+
+    CryptoKernel::Bench::Timer hashedMissTimer;
+    for(const auto& key : absentKeys) {
+        found += hashed.contains(key);
+    }
+    CryptoKernel::Bench::report("IdMap<uint256> miss", count, hashedMissTimer.seconds());
+
+    CryptoKernel::Bench::Timer hashedEraseTimer;
+    for(const auto& key : presentKeys) {
+        hashed.erase(key);
+    }
+    CryptoKernel::Bench::report("IdMap<uint256> erase", count, hashedEraseTimer.seconds());
+
+    CryptoKernel::Bench::note("found", std::to_string(found));
+}
+
+BENCHMARK(duplicateCheck) {
+    // Checking the 10000 output ids of a block for repeats, by container
+    const unsigned int count = 10000;
+    const unsigned int repeats = 20;
+    const std::vector<CryptoKernel::uint256> ids = makeIds(count, "output");
+    const std::vector<CryptoKernel::BigNum> bigNumIds = toBigNums(ids);
+
+    uint64_t unique = 0;
+
+    CryptoKernel::Bench::Timer orderedTimer;
+    for(unsigned int i = 0; i < repeats; i++) {
+        std::set<CryptoKernel::BigNum> seen;
+        for(const auto& id : bigNumIds) {
+            seen.insert(id);
+        }
+        unique += seen.size();
+    }
+    CryptoKernel::Bench::report("std::set<BigNum>", count * repeats, orderedTimer.seconds());
+
+    CryptoKernel::Bench::Timer hashedTimer;
+    for(unsigned int i = 0; i < repeats; i++) {
+        CryptoKernel::IdSet seen;
+        seen.reserve(ids.size());
+        for(const auto& id : ids) {
+            seen.insert(id);
+        }
+        unique += seen.size();
+    }
+    CryptoKernel::Bench::report("IdSet", count * repeats, hashedTimer.seconds());
+
+    CryptoKernel::Bench::note("unique", std::to_string(unique));
+}
+
+BENCHMARK(merkleRoot) {
+    // The transaction merkle root of a block of 5000 transactions, built as
+    // a tree and computed directly
+    const unsigned int count = 5000;
+    const unsigned int repeats = 10;
+    const std::vector<CryptoKernel::uint256> ids = makeIds(count, "tx");
+    const std::set<CryptoKernel::uint256> leaves(ids.begin(), ids.end());
+
+    std::string treeRoot;
+    CryptoKernel::Bench::Timer treeTimer;
+    for(unsigned int i = 0; i < repeats; i++) {
+        treeRoot = CryptoKernel::MerkleNode::makeMerkleTree(leaves)->getMerkleRoot().toString();
+    }
+    CryptoKernel::Bench::report("makeMerkleTree", count * repeats, treeTimer.seconds());
+
+    std::string directRoot;
+    CryptoKernel::Bench::Timer directTimer;
+    for(unsigned int i = 0; i < repeats; i++) {
+        directRoot = CryptoKernel::MerkleNode::calculateRoot(leaves).toString();
+    }
+    CryptoKernel::Bench::report("calculateRoot", count * repeats, directTimer.seconds());
+
+    CryptoKernel::Bench::note("roots match", treeRoot == directRoot ? "yes" : "no");
+}
@@ -0,0 +1,144 @@
+#include "Bench.h"
+
+#include "ckmath.h"
+#include "crypto.h"
+
+namespace {
+const unsigned int count = 100000;
+
+/**
+* Makes values shaped like ids and targets, which are SHA256 hashes
+*/
+std::vector<CryptoKernel::uint256> makeValues(const std::string& salt) {
+    std::vector<CryptoKernel::uint256> values;
+    values.reserve(count);
+    for(unsigned int i = 0; i < count; i++) {
+        values.push_back(CryptoKernel::uint256(CryptoKernel::Crypto::sha256(salt + std::to_string(i))));
+    }
+    return values;
+}
+
+/**
+* Times an operation over every pair of values, once with BigNum and once
+* with uint256
+*
+* @param name the operation
+* @param bigNumOp the operation on BigNums, returning something to check
+* @param uint256Op the same on uint256s
+*/
+template<typename BigNumOp, typename Uint256Op>
+void compare(const std::string& name, const std::vector<CryptoKernel::uint256>& lhs,
+             const std::vector<CryptoKernel::uint256>& rhs, BigNumOp bigNumOp,
+             Uint256Op uint256Op) {
+    std::vector<CryptoKernel::BigNum> bigLhs;
+    std::vector<CryptoKernel::BigNum> bigRhs;
+    for(unsigned int i = 0; i < count; i++) {
+        bigLhs.push_back(lhs[i].toBigNum());
+        bigRhs.push_back(rhs[i].toBigNum());
+    }
+
+    uint64_t checksum = 0;
+
+    CryptoKernel::Bench::Timer bigNumTimer;
+    for(unsigned int i = 0; i < count; i++) {
+        checksum += bigNumOp(bigLhs[i], bigRhs[i]);
+    }
+    CryptoKernel::Bench::report("BigNum " + name, count, bigNumTimer.seconds());
+
+    CryptoKernel::Bench::Timer uint256Timer;
+    for(unsigned int i = 0; i < count; i++) {
+        checksum += uint256Op(lhs[i], rhs[i]);
+    }
+    CryptoKernel::Bench::report("uint256 " + name, count, uint256Timer.seconds());
+
+    CryptoKernel::Bench::note(name + " checksum", std::to_string(checksum));
+}
+}
+
+BENCHMARK(bigNumVsUint256) {
+    // The operations ids and proof of work targets go through, with the
+    // OpenSSL-backed BigNum and the inline uint256
+    const std::vector<CryptoKernel::uint256> lhs = makeValues("lhs");
+    const std::vector<CryptoKernel::uint256> rhs = makeValues("rhs");
+
+    std::vector<CryptoKernel::uint256> divisors;
+    for(unsigned int i = 0; i < count; i++) {
+        divisors.push_back(rhs[i] >> 128);
+    }
+
+    std::vector<CryptoKernel::uint256> counts;
+    for(unsigned int i = 0; i < count; i++) {
+        counts.push_back(CryptoKernel::uint256(i % 4032 + 1));
+    }
+
+    compare("copy", lhs, rhs, [](const CryptoKernel::BigNum& a, const CryptoKernel::BigNum&) {
+        const CryptoKernel::BigNum copy = a;
+        return copy == a;
+    }, [](const CryptoKernel::uint256& a, const CryptoKernel::uint256&) {
+        const CryptoKernel::uint256 copy = a;
+        return copy == a;
+    });
+
+    compare("compare", lhs, rhs, [](const CryptoKernel::BigNum& a, const CryptoKernel::BigNum& b) {
+        return a < b;
+    }, [](const CryptoKernel::uint256& a, const CryptoKernel::uint256& b) {
+        return a < b;
+    });
+
+    compare("add", lhs, rhs, [](const CryptoKernel::BigNum& a, const CryptoKernel::BigNum& b) {
+        return (a + b) < a;
+    }, [](const CryptoKernel::uint256& a, const CryptoKernel::uint256& b) {
+        return (a + b) < a;
+    });
+
+    compare("subtract", lhs, rhs, [](const CryptoKernel::BigNum& a, const CryptoKernel::BigNum& b) {
+        return (a - b) < a;
+    }, [](const CryptoKernel::uint256& a, const CryptoKernel::uint256& b) {
+        return (a - b) < a;
+    });
+
+    compare("multiply", lhs, rhs, [](const CryptoKernel::BigNum& a, const CryptoKernel::BigNum& b) {
+        return (a * b) < a;
+    }, [](const CryptoKernel::uint256& a, const CryptoKernel::uint256& b) {
+        return (a * b) < a;
+    });
+
+    compare("divide", lhs, divisors, [](const CryptoKernel::BigNum& a, const CryptoKernel::BigNum& b) {
+        return (a / b) < b;
+    }, [](const CryptoKernel::uint256& a, const CryptoKernel::uint256& b) {
+        return (a / b) < b;
+    });
+
+    // The step of the KGW difficulty average
+    compare("divide by count", lhs, counts, [](const CryptoKernel::BigNum& a, const CryptoKernel::BigNum& b) {
+        return (a / b) < a;
+    }, [](const CryptoKernel::uint256& a, const CryptoKernel::uint256& b) {
+        return (a / b) < a;
+    });
+
+    compare("to hex", lhs, rhs, [](const CryptoKernel::BigNum& a, const CryptoKernel::BigNum&) {
+        return a.toString().size();
+    }, [](const CryptoKernel::uint256& a, const CryptoKernel::uint256&) {
+        return a.toString().size();
+    });
+
+    std::vector<std::string> hex;
+    for(const auto& value : lhs) {
+        hex.push_back(value.toString());
+    }
+
+    uint64_t checksum = 0;
+    CryptoKernel::Bench::Timer bigNumParseTimer;
+    for(const auto& text : hex) {
+        checksum += CryptoKernel::BigNum(text) < CryptoKernel::BigNum(text);
+    }
+    CryptoKernel::Bench::report("BigNum from hex", count * 2, bigNumParseTimer.seconds());
+
+    CryptoKernel::Bench::Timer uint256ParseTimer;
+    for(const auto& text : hex) {
+        checksum += CryptoKernel::uint256(text) < CryptoKernel::uint256(text);
+    }
+    CryptoKernel::Bench::report("uint256 from hex", count * 2, uint256ParseTimer.seconds());
+
+    CryptoKernel::Bench::note("from hex checksum", std::to_string(checksum));
+}
@@ -0,0 +1,72 @@
+#include <random>
+
+#include "Bench.h"
+
+#include "blockchain.h"
+#include "crypto.h"
+
+namespace {
+/**
+* Builds unsigned transactions with distinct inputs and outputs. The
+* mempool does not verify what it holds, so they need not be valid.
+*/
+std::vector<CryptoKernel::Blockchain::transaction> makeTransactions(const unsigned int first,
+        const unsigned int count) {
+    std::vector<CryptoKernel::Blockchain::transaction> txs;
+    txs.reserve(count);
+
+    for(unsigned int i = first; i < first + count; i++) {
+        const CryptoKernel::uint256 outputId(CryptoKernel::Crypto::sha256(std::to_string(i)));
+        const CryptoKernel::Blockchain::input inp(outputId, Json::Value());
+        const CryptoKernel::Blockchain::output out(100000000, i, Json::Value());
+        txs.push_back(CryptoKernel::Blockchain::transaction({inp}, {out}, 1530888581));
+    }
+
+    return txs;
+}
+}
+
+BENCHMARK(mempoolFill) {
+    // Inserting, selecting a block from and evicting out of a mempool of
+    // 100k transactions with random fees
+    const unsigned int count = 100000;
+    const std::vector<CryptoKernel::Blockchain::transaction> txs = makeTransactions(0, count);
+
+    std::default_random_engine generator(42);
+    std::uniform_int_distribution<uint64_t> distribution(1000, 1000000);
+    std::vector<uint64_t> fees;
+    uint64_t totalBytes = 0;
+    for(const auto& tx : txs) {
+        fees.push_back(distribution(generator));
+        totalBytes += tx.size();
+    }
+
+    CryptoKernel::Blockchain::Mempool mempool(totalBytes);
+
+    CryptoKernel::Bench::Timer insertTimer;
+    for(unsigned int i = 0; i < count; i++) {
+        mempool.insert(txs[i], fees[i]);
+    }
+    CryptoKernel::Bench::report("insert", count, insertTimer.seconds());
+
+    CryptoKernel::Bench::Timer selectTimer;
+    const size_t selected = mempool.getTransactions().size();
+    CryptoKernel::Bench::report("select block template", selected, selectTimer.seconds());
+
+    // Halving the limit evicts the cheaper half
+    CryptoKernel::Bench::Timer evictTimer;
+    mempool.setMaxSize(totalBytes / 2);
+    CryptoKernel::Bench::report("evict", count - mempool.count(), evictTimer.seconds());
+
+    // Every insert into a full mempool now has to evict
+    const std::vector<CryptoKernel::Blockchain::transaction> extra = makeTransactions(count, 10000);
+    CryptoKernel::Bench::Timer fullTimer;
+    unsigned int accepted = 0;
+    for(const auto& tx : extra) {
+        if(mempool.insert(tx, distribution(generator))) {
+            accepted++;
+        }
+    }
+    CryptoKernel::Bench::report("insert when full", extra.size(), fullTimer.seconds());
+    CryptoKernel::Bench::note("accepted when full", std::to_string(accepted));
+}
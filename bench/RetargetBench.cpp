@@ -0,0 +1,63 @@
+#include <random>
+
+#include "Bench.h"
+
+#include "retarget.h"
+
+namespace {
+const uint64_t blockTarget = 150;
+
+CryptoKernel::uint256 readTarget(const CryptoKernel::BlockIndex::Entry& entry) {
+    return CryptoKernel::uint256(entry.consensusData["target"].asString());
+}
+}
+
+BENCHMARK(kgwRetarget) {
+    // Targets for every block of a 20000 block chain, re-reading the
+    // window for each retarget as scanning the ancestors did, and keeping
+    // it between retargets
+    const uint64_t count = 20000;
+    std::mt19937_64 rng(1530888581);
+
+    CryptoKernel::BlockIndex index;
+    std::vector<CryptoKernel::uint256> ids;
+    uint64_t timestamp = 1530888581;
+    for(uint64_t height = 1; height <= count; height++) {
+        CryptoKernel::BlockIndex::Entry entry;
+        entry.id = CryptoKernel::uint256(height);
+        entry.previousId = ids.empty() ? CryptoKernel::uint256() : ids.back();
+        entry.height = height;
+        timestamp += rng() % (2 * blockTarget);
+        entry.timestamp = timestamp;
+        entry.consensusData["target"] = ((CryptoKernel::KGWRetarget::minDifficulty >>
+                                          (rng() % 4)) - CryptoKernel::uint256(rng())).toString();
+        entry.consensusData["totalWork"] = std::to_string(height);
+        entry.status = CryptoKernel::BlockIndex::Status::MainChain;
+        index.add(entry);
+        index.connect(entry.id);
+        ids.push_back(entry.id);
+    }
+
+    const CryptoKernel::KGWRetarget::Ancestry ancestry = [&index](
+    const CryptoKernel::uint256& id, const size_t n) {
+        return index.getAncestry(id, n);
+    };
+
+    uint64_t checksum = 0;
+
+    CryptoKernel::Bench::Timer coldTimer;
+    for(const CryptoKernel::uint256& id : ids) {
+        CryptoKernel::KGWRetarget retarget(blockTarget, ancestry, readTarget);
+        checksum += retarget.calculateTarget(id).toString().size();
+    }
+    CryptoKernel::Bench::report("KGW target, window read each time", count, coldTimer.seconds());
+
+    CryptoKernel::KGWRetarget retarget(blockTarget, ancestry, readTarget);
+    CryptoKernel::Bench::Timer rollingTimer;
+    for(const CryptoKernel::uint256& id : ids) {
+        checksum += retarget.calculateTarget(id).toString().size();
+    }
+    CryptoKernel::Bench::report("KGW target, rolling window", count, rollingTimer.seconds());
+
+    CryptoKernel::Bench::note("checksum", std::to_string(checksum));
+}
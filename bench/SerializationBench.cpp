@@ -0,0 +1,55 @@
+#include "Bench.h"
+
+#include "blockchain.h"
+#include "crypto.h"
+
+BENCHMARK(blockSerialization) {
+    // Encoding and decoding a block of 5000 transactions in the binary
+    // form, against json text as blocks are stored and sent today
+    const unsigned int txCount = 5000;
+    const unsigned int repeats = 5;
+
+    std::set<CryptoKernel::Blockchain::transaction> txs;
+    for(unsigned int i = 0; i < txCount; i++) {
+        const CryptoKernel::uint256 outputId(CryptoKernel::Crypto::sha256(std::to_string(i)));
+        Json::Value spendData;
+        spendData["signature"] = CryptoKernel::Crypto::sha256("signature" + std::to_string(i));
+        const CryptoKernel::Blockchain::input inp(outputId, spendData);
+        const CryptoKernel::Blockchain::output out(100000000, i, Json::Value());
+        txs.insert(CryptoKernel::Blockchain::transaction({inp}, {out}, 1530888581));
+    }
+
+    const CryptoKernel::Blockchain::output reward(100000000, txCount, Json::Value());
+    const CryptoKernel::Blockchain::transaction coinbaseTx({}, {reward}, 1530888581, true);
+    const CryptoKernel::Blockchain::block newBlock(txs, coinbaseTx, CryptoKernel::uint256(),
+                                                   1530888581, Json::Value(), 2);
+
+    std::string text;
+    CryptoKernel::Bench::Timer jsonEncodeTimer;
+    for(unsigned int i = 0; i < repeats; i++) {
+        text = CryptoKernel::Storage::toString(newBlock.toJson());
+    }
+    CryptoKernel::Bench::report("encode json", txCount * repeats, jsonEncodeTimer.seconds());
+
+    std::string binary;
+    CryptoKernel::Bench::Timer binaryEncodeTimer;
+    for(unsigned int i = 0; i < repeats; i++) {
+        binary = newBlock.toBinary();
+    }
+    CryptoKernel::Bench::report("encode binary", txCount * repeats, binaryEncodeTimer.seconds());
+
+    CryptoKernel::Bench::Timer jsonDecodeTimer;
+    for(unsigned int i = 0; i < repeats; i++) {
+        const CryptoKernel::Blockchain::block parsed(CryptoKernel::Storage::toJson(text));
+    }
+    CryptoKernel::Bench::report("decode json", txCount * repeats, jsonDecodeTimer.seconds());
+
+    CryptoKernel::Bench::Timer binaryDecodeTimer;
+    for(unsigned int i = 0; i < repeats; i++) {
+        CryptoKernel::Blockchain::block::fromBinary(binary);
+    }
+    CryptoKernel::Bench::report("decode binary", txCount * repeats, binaryDecodeTimer.seconds());
+
+    CryptoKernel::Bench::note("json size", std::to_string(text.size()) + " bytes");
+    CryptoKernel::Bench::note("binary size", std::to_string(binary.size()) + " bytes");
+}
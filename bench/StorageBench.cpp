@@ -0,0 +1,313 @@
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+#include "Bench.h"
+
+#include "storage.h"
+
+namespace {
+Json::Value makeOutput(const unsigned int i) {
+    Json::Value output;
+    output["value"] = Json::UInt64(5000000000 + i);
+    output["nonce"] = Json::UInt64(1234567890123 + i);
+    output["data"]["publicKey"] =
+        "BMVPkHmIw0cTnSz6QJTcpeSN8sRd2FZWRtgbwyVh6pNf6cBe4fDlSivIb0IdaKlgFyuX2LHuO0b1mWwqc0mPgNg=";
+    output["data"]["contract"] = Json::nullValue;
+    output["creationTx"] =
+        "f2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd2";
+    return output;
+}
+
+Json::Value makeBlock() {
+    Json::Value block;
+    block["height"] = Json::UInt64(123456);
+    block["timestamp"] = Json::UInt64(1510000000);
+    block["previousBlockId"] =
+        "8f434346648f6b96df89dda901c5176b10a6d83961dd3c1ac88b59b2dc327aa4";
+    block["transactionMerkleRoot"] =
+        "a591a6d40bf420404a011733cfb7b190d62c65bf0bcda32b57b277d9ad9f146e";
+    block["coinbaseTx"]["outputs"][0] = makeOutput(0);
+    block["coinbaseTx"]["timestamp"] = Json::UInt64(1510000000);
+    block["consensusData"]["target"] = "fffff000000000000000000000000000000000000000000000000000000000";
+    block["consensusData"]["totalWork"] = "1a2b3c4d5e6f7a8b9c";
+    block["consensusData"]["nonce"] = Json::UInt64(987654321);
+    for(unsigned int i = 0; i < 100; i++) {
+        block["transactions"].append(
+            "3b7e72edbcb5be3d84b7e1a8e4b2b5c0f9d1c6a7e8f3b2d4c5a6b7c8d9e0f1a" +
+            std::to_string(i % 10));
+    }
+    return block;
+}
+
+void compare(const std::string& name, const Json::Value& value, const unsigned int iterations) {
+    const std::string text = CryptoKernel::Storage::toString(value);
+    const std::string binary = CryptoKernel::Storage::toBinary(value);
+
+    CryptoKernel::Bench::note(name + " json bytes", std::to_string(text.size()));
+    CryptoKernel::Bench::note(name + " binary bytes", std::to_string(binary.size()));
+
+    size_t sink = 0;
+    {
+        CryptoKernel::Bench::Timer timer;
+        for(unsigned int i = 0; i < iterations; i++) {
+            sink += CryptoKernel::Storage::toString(value).size();
+        }
+        CryptoKernel::Bench::report(name + " json encode", iterations, timer.seconds());
+    }
+    {
+        CryptoKernel::Bench::Timer timer;
+        for(unsigned int i = 0; i < iterations; i++) {
+            sink += CryptoKernel::Storage::toBinary(value).size();
+        }
+        CryptoKernel::Bench::report(name + " binary encode", iterations, timer.seconds());
+    }
+    {
+        CryptoKernel::Bench::Timer timer;
+        for(unsigned int i = 0; i < iterations; i++) {
+            sink += CryptoKernel::Storage::toJson(text).size();
+        }
+        CryptoKernel::Bench::report(name + " json decode", iterations, timer.seconds());
+    }
+    {
+        CryptoKernel::Bench::Timer timer;
+        for(unsigned int i = 0; i < iterations; i++) {
+            sink += CryptoKernel::Storage::fromBinary(binary).size();
+        }
+        CryptoKernel::Bench::report(name + " binary decode", iterations, timer.seconds());
+    }
+
+    if(sink == 0) {
+        std::cout << std::endl;
+    }
+}
+}
+
+BENCHMARK(storageEncoding) {
+    compare("output", makeOutput(1), 100000);
+    compare("block", makeBlock(), 5000);
+}
+
+BENCHMARK(storageKeySchema) {
+    // Shaped like the block database: an output row and an owner index row
+    // per output, plus a transaction and input row
+    const unsigned int outputs = 100000;
+    const std::string publicKey =
+        "BMVPkHmIw0cTnSz6QJTcpeSN8sRd2FZWRtgbwyVh6pNf6cBe4fDlSivIb0IdaKlgFyuX2LHuO0b1mWwqc0mPgNg=";
+
+    std::mt19937_64 rng(42);
+    const auto randomId = [&]() {
+        static const char digits[] = "0123456789abcdef";
+        std::string id;
+        for(unsigned int i = 0; i < 64; i++) {
+            id.push_back(digits[rng() % 16]);
+        }
+        return id.substr(id.find_first_not_of('0'));
+    };
+
+    std::vector<std::string> ids;
+    for(unsigned int i = 0; i < outputs; i++) {
+        ids.push_back(randomId());
+    }
+
+    CryptoKernel::Storage::Table textTable("utxos");
+    CryptoKernel::Storage::Table compactTable("utxos", 3);
+
+    uint64_t textBytes = 0;
+    uint64_t compactBytes = 0;
+    {
+        CryptoKernel::Bench::Timer timer;
+        for(const auto& id : ids) {
+            textBytes += textTable.getKey(id).size() * 3;
+            textBytes += textTable.getKey(publicKey + id, 0).size();
+        }
+        CryptoKernel::Bench::report("text key build", outputs * 4, timer.seconds());
+    }
+    {
+        CryptoKernel::Bench::Timer timer;
+        for(const auto& id : ids) {
+            compactBytes += compactTable.getKey(id).size() * 3;
+            compactBytes += compactTable.getKey(publicKey + "/" + id, 0).size();
+        }
+        CryptoKernel::Bench::report("compact key build", outputs * 4, timer.seconds());
+    }
+    {
+        size_t sink = 0;
+        const std::string rawKey = compactTable.getKey(ids[0]);
+        CryptoKernel::Bench::Timer timer;
+        for(unsigned int i = 0; i < outputs; i++) {
+            sink += compactTable.fromKey(rawKey).size();
+        }
+        CryptoKernel::Bench::report("compact key decode", outputs, timer.seconds());
+        if(sink == 0) {
+            std::cout << std::endl;
+        }
+    }
+
+    CryptoKernel::Bench::note("text key bytes", std::to_string(textBytes));
+    CryptoKernel::Bench::note("compact key bytes", std::to_string(compactBytes));
+    CryptoKernel::Bench::note("compact / text", std::to_string(double(compactBytes) / textBytes));
+}
+
+BENCHMARK(storageScan) {
+    // An owner index scan like getUnspentOutputs, over the in-memory engine
+    // so the numbers reflect the iterator rather than the disk
+    const unsigned int rows = 100000;
+    const std::string owner = "BMVPkHmIw0cTnSz6QJTcpeSN8sRd2FZWRtgbwyVh6pNf6cBe4fDlSivIb0IdaKlgFyuX2LHuO0b1mWwqc0mPgNg=/";
+
+    CryptoKernel::Storage::destroy("memory:benchscan");
+    std::unique_ptr<CryptoKernel::Storage> database(new CryptoKernel::Storage("memory:benchscan",
+            false, 0, false, true));
+    CryptoKernel::Storage::Table table("utxos", 3);
+
+    {
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database->begin());
+        const Json::Value output = makeOutput(1);
+        for(unsigned int i = 0; i < rows; i++) {
+            char id[65];
+            snprintf(id, sizeof(id), "f2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b76050%016x", i);
+            table.put(dbTx.get(), owner + id, output, 0);
+        }
+        dbTx->commit();
+    }
+
+    size_t sink = 0;
+    {
+        CryptoKernel::Bench::Timer timer;
+        CryptoKernel::Storage::Table::Iterator it(&table, database.get(), nullptr, owner, 0);
+        for(it.SeekToFirst(); it.Valid(); it.Next()) {
+            sink += it.keySlice().size();
+        }
+        CryptoKernel::Bench::report("scan keys", rows, timer.seconds());
+    }
+    {
+        CryptoKernel::Bench::Timer timer;
+        CryptoKernel::Storage::Table::Iterator it(&table, database.get(), nullptr, owner, 0);
+        for(it.SeekToFirst(); it.Valid(); it.Next()) {
+            sink += it.rawValue().size();
+        }
+        CryptoKernel::Bench::report("scan raw values", rows, timer.seconds());
+    }
+    {
+        CryptoKernel::Bench::Timer timer;
+        CryptoKernel::Storage::Table::Iterator it(&table, database.get(), nullptr, owner, 0);
+        for(it.SeekToFirst(); it.Valid(); it.Next()) {
+            sink += it.key().size() + it.value()["value"].asUInt64();
+        }
+        CryptoKernel::Bench::report("scan decoded keys and values", rows, timer.seconds());
+    }
+
+    database.reset();
+    CryptoKernel::Storage::destroy("memory:benchscan");
+
+    if(sink == 0) {
+        std::cout << std::endl;
+    }
+}
+
+BENCHMARK(storageGroupCommit) {
+    // Synced commits of independent keys, as the wallet does, with more and
+    // more writers committing at once
+    const unsigned int commits = 2000;
+    const Json::Value output = makeOutput(1);
+
+    for(const unsigned int writers : {1, 2, 4, 8, 16}) {
+        CryptoKernel::Storage::destroy("./benchcommitdb");
+        std::unique_ptr<CryptoKernel::Storage> database(new CryptoKernel::Storage("./benchcommitdb",
+                true, 8, false, true));
+
+        CryptoKernel::Bench::Timer timer;
+        std::vector<std::thread> threads;
+        for(unsigned int i = 0; i < writers; i++) {
+            threads.emplace_back([&, i]() {
+                for(unsigned int j = i; j < commits; j += writers) {
+                    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database->begin());
+                    dbTx->put(std::to_string(j), output);
+                    dbTx->commit();
+                }
+            });
+        }
+        for(auto& thread : threads) {
+            thread.join();
+        }
+        CryptoKernel::Bench::report("synced commits, " + std::to_string(writers) + " writers",
+                                    commits, timer.seconds());
+
+        database.reset();
+        CryptoKernel::Storage::destroy("./benchcommitdb");
+    }
+}
+
+BENCHMARK(storageConcurrentCommits) {
+    // Writers that each update a private key and a shared counter, retrying
+    // on conflicts, while readers iterate the table
+    const unsigned int writers = 4;
+    const unsigned int readers = 4;
+    const unsigned int commitsPerWriter = 500;
+
+    CryptoKernel::Storage::destroy("./benchstressdb");
+    std::unique_ptr<CryptoKernel::Storage> database(new CryptoKernel::Storage("./benchstressdb",
+            false, 10, true, true, 1));
+    CryptoKernel::Storage::Table table("myTable");
+
+    {
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database->begin());
+        table.put(dbTx.get(), "shared", Json::Value(0));
+        dbTx->commit();
+    }
+
+    std::atomic<bool> writing(true);
+    std::atomic<uint64_t> conflicts(0);
+    std::atomic<uint64_t> reads(0);
+
+    CryptoKernel::Bench::Timer timer;
+    std::vector<std::thread> threads;
+    for(unsigned int i = 0; i < writers; i++) {
+        threads.emplace_back([&, i]() {
+            for(unsigned int j = 0; j < commitsPerWriter; j++) {
+                while(true) {
+                    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database->begin());
+                    table.put(dbTx.get(), std::to_string(i) + "/" + std::to_string(j), Json::Value(j));
+                    table.put(dbTx.get(), "shared", table.get(dbTx.get(), "shared").asUInt64() + 1);
+                    try {
+                        dbTx->commit();
+                        break;
+                    } catch(const CryptoKernel::Storage::ConflictException& e) {
+                        conflicts++;
+                    }
+                }
+            }
+        });
+    }
+
+    for(unsigned int i = 0; i < readers; i++) {
+        threads.emplace_back([&]() {
+            while(writing) {
+                CryptoKernel::Storage::Table::Iterator it(&table, database.get());
+                for(it.SeekToFirst(); it.Valid(); it.Next()) {
+                    it.value();
+                    reads++;
+                }
+            }
+        });
+    }
+
+    for(unsigned int i = 0; i < writers; i++) {
+        threads[i].join();
+    }
+    writing = false;
+    for(unsigned int i = writers; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    const double seconds = timer.seconds();
+    CryptoKernel::Bench::report("contended commits, " + std::to_string(writers) + " writers",
+                                writers * commitsPerWriter, seconds);
+    CryptoKernel::Bench::report("iterated rows, " + std::to_string(readers) + " readers",
+                                reads, seconds);
+    CryptoKernel::Bench::note("conflicts retried", std::to_string(conflicts));
+
+    database.reset();
+    CryptoKernel::Storage::destroy("./benchstressdb");
+}
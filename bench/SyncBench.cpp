@@ -0,0 +1,210 @@
+#ifndef _WIN32
+
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Bench.h"
+#include "BenchNode.h"
+
+#include "blockchain.h"
+#include "crypto.h"
+#include "log.h"
+#include "network.h"
+#include "consensus/regtest.h"
+
+namespace {
+using CryptoKernel::Bench::BenchNode;
+
+const uint64_t blockCount = 4000;
+// Seeds listen on the ports after this one
+const unsigned int syncPort = 49600;
+
+/**
+* Starts a node in a child process that imports the chain and serves it
+* until it is killed
+*
+* @param dir the working directory of the node, without a peers.txt so it
+*        only accepts connections
+* @param genesis the genesis block file
+* @param blocks the blocks after genesis
+* @param port the port to listen on
+* @return the process id of the node, once it is listening
+*/
+pid_t startSeed(const std::string& dir, const std::string& genesis,
+                const std::vector<Json::Value>& blocks, const unsigned int port) {
+    int ready[2];
+    if(pipe(ready) != 0) {
+        throw std::runtime_error("Could not create a pipe to the seed node");
+    }
+
+    const pid_t pid = fork();
+    if(pid < 0) {
+        throw std::runtime_error("Could not start a seed node");
+    } else if(pid == 0) {
+        close(ready[0]);
+        if(chdir(dir.c_str()) != 0) {
+            _exit(1);
+        }
+
+        CryptoKernel::Log log("seed" + std::to_string(port) + ".log");
+        BenchNode node(&log, "memory:syncbenchseed", genesis);
+        for(const auto& blockJson : blocks) {
+            node.blockchain->submitBlock(CryptoKernel::Blockchain::block(blockJson));
+        }
+
+        CryptoKernel::Network network(&log, node.blockchain.get(), port,
+                                      "memory:syncbenchseedpeers");
+
+        const char byte = 1;
+        if(write(ready[1], &byte, 1) != 1) {
+            _exit(1);
+        }
+        close(ready[1]);
+
+        while(true) {
+            pause();
+        }
+    }
+
+    close(ready[1]);
+    char byte;
+    const bool started = read(ready[0], &byte, 1) == 1;
+    close(ready[0]);
+
+    if(!started) {
+        waitpid(pid, nullptr, 0);
+        throw std::runtime_error("Seed node failed to start");
+    }
+
+    return pid;
+}
+
+/**
+* Syncs a new node from seed nodes over loopback
+*
+* @param base the directory holding the genesis file and the nodes'
+*        working directories
+* @param blocks the blocks after genesis the seeds serve
+* @param seedCount the number of seed nodes
+* @param startup set to the seconds before the first block arrived
+* @param synced set to the number of blocks synced
+* @return the seconds from the first block arriving to the last
+*/
+double syncFromSeeds(const std::string& base, const std::vector<Json::Value>& blocks,
+                     const unsigned int seedCount, double& startup, uint64_t& synced) {
+    const std::string genesis = base + "/genesis.json";
+
+    std::vector<pid_t> seeds;
+    std::ofstream peersFile(base + "/sync/peers.txt");
+    for(unsigned int i = 0; i < seedCount; i++) {
+        const unsigned int port = syncPort + 1 + i;
+        seeds.push_back(startSeed(base + "/seeds", genesis, blocks, port));
+        peersFile << "127.0.0.1:" << port << std::endl;
+    }
+    peersFile.close();
+
+    char cwd[4096];
+    if(getcwd(cwd, sizeof(cwd)) == nullptr || chdir((base + "/sync").c_str()) != 0) {
+        throw std::runtime_error("Could not enter the sync node's directory");
+    }
+
+    double seconds = 0;
+    {
+        CryptoKernel::Log log("sync.log");
+        BenchNode node(&log, "memory:syncbenchnode", genesis);
+
+        CryptoKernel::Bench::Timer timer;
+        std::unique_ptr<CryptoKernel::Bench::Timer> syncTimer;
+        CryptoKernel::Network network(&log, node.blockchain.get(), syncPort,
+                                      "memory:syncbenchpeers");
+
+        uint64_t height = 1;
+        while(height < blocks.size() + 1 && timer.seconds() < 600) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            height = node.blockchain->getBlockDB("tip").getHeight();
+            if(height > 1 && !syncTimer) {
+                startup = timer.seconds();
+                syncTimer.reset(new CryptoKernel::Bench::Timer());
+            }
+        }
+
+        if(syncTimer) {
+            seconds = syncTimer->seconds();
+        }
+        synced = height - 1;
+    }
+
+    for(const pid_t seed : seeds) {
+        kill(seed, SIGKILL);
+        waitpid(seed, nullptr, 0);
+    }
+
+    std::remove("sync.log");
+    std::remove("peers.txt");
+    if(chdir(cwd) != 0) {
+        throw std::runtime_error("Could not return to the working directory");
+    }
+
+    for(unsigned int i = 0; i < seedCount; i++) {
+        std::remove((base + "/seeds/seed" + std::to_string(syncPort + 1 + i) + ".log").c_str());
+    }
+
+    return seconds;
+}
+}
+
+BENCHMARK(loopbackSync) {
+    // Blocks per second synced by a new node from one seed node and from
+    // several, each in its own process on loopback. The node waits for its
+    // first connections before it asks for anything, so that time is
+    // reported apart.
+    char baseTemplate[] = "/tmp/cksyncbenchXXXXXX";
+    if(mkdtemp(baseTemplate) == nullptr) {
+        throw std::runtime_error("Could not create a directory for the sync benchmark");
+    }
+    const std::string base = baseTemplate;
+    mkdir((base + "/seeds").c_str(), 0700);
+    mkdir((base + "/sync").c_str(), 0700);
+
+    // Mined before any seed is forked, so no other threads are running then
+    std::vector<Json::Value> blocks;
+    {
+        CryptoKernel::Log log(base + "/mine.log");
+        BenchNode node(&log, "memory:syncbenchminer", base + "/genesis.json");
+        CryptoKernel::Crypto crypto(true);
+        for(uint64_t i = 0; i < blockCount; i++) {
+            node.consensus->mineBlock(true, crypto.getPublicKey());
+        }
+
+        for(uint64_t height = 2; height <= blockCount + 1; height++) {
+            blocks.push_back(node.blockchain->getBlockByHeight(height).toJson());
+        }
+    }
+
+    for(const unsigned int seedCount : {1, 4}) {
+        double startup = 0;
+        uint64_t synced = 0;
+        const double seconds = syncFromSeeds(base, blocks, seedCount, startup, synced);
+
+        const std::string name = "sync from " + std::to_string(seedCount) +
+                                 (seedCount == 1 ? " seed" : " seeds");
+        CryptoKernel::Bench::report(name, synced, seconds);
+        CryptoKernel::Bench::note(name + ", seconds to first block", std::to_string(startup));
+    }
+
+    std::remove((base + "/mine.log").c_str());
+    std::remove((base + "/genesis.json").c_str());
+    rmdir((base + "/seeds").c_str());
+    rmdir((base + "/sync").c_str());
+    rmdir(base.c_str());
+}
+
+#endif
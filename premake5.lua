@@ -86,4 +86,13 @@ project "test"
     links(cklibs)
     postbuildcommands{"%{cfg.linktarget.abspath}"}
 
-    linkSystemSpecific()
\ No newline at end of file
+    linkSystemSpecific()
+
+project "bench"
+
+    kind "ConsoleApp"
+    files {"bench/**.cpp", "bench/**.h"}
+    links {"ck"}
+    links(cklibs)
+
+    linkSystemSpecific()
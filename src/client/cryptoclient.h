@@ -192,6 +192,15 @@ public:
         else
         { throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, result.toStyledString()); }
     }
+    Json::Value getstoragestats() throw (jsonrpc::JsonRpcException) {
+        Json::Value p;
+        p = Json::nullValue;
+        Json::Value result = this->CallMethod("getstoragestats",p);
+        if (result.isObject())
+        { return result; }
+        else
+        { throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, result.toStyledString()); }
+    }
     Json::Value dumpprivkeys(const std::string& account,
                              const std::string& password) throw (jsonrpc::JsonRpcException) {
         Json::Value p;
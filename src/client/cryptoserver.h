@@ -76,6 +76,9 @@ public:
         this->bindAndAddMethod(jsonrpc::Procedure("getpeerinfo", jsonrpc::PARAMS_BY_NAME,
                                jsonrpc::JSON_OBJECT, NULL),
                                &CryptoRPCServer::getpeerinfoI);
+        this->bindAndAddMethod(jsonrpc::Procedure("getstoragestats", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, NULL),
+                               &CryptoRPCServer::getstoragestatsI);
         this->bindAndAddMethod(jsonrpc::Procedure("dumpprivkeys", jsonrpc::PARAMS_BY_NAME,
                                jsonrpc::JSON_OBJECT, "account",jsonrpc::JSON_STRING,
                                "password", jsonrpc::JSON_STRING, NULL), &CryptoRPCServer::dumpprivkeysI);
@@ -147,6 +150,9 @@ public:
     inline virtual void getpeerinfoI(const Json::Value &request, Json::Value &response) {
         response = this->getpeerinfo();
     }
+    inline virtual void getstoragestatsI(const Json::Value &request, Json::Value &response) {
+        response = this->getstoragestats();
+    }
     inline virtual void dumpprivkeysI(const Json::Value &request, Json::Value &response) {
         response = this->dumpprivkeys(request["account"].asString(), request["password"].asString());
     }
@@ -177,6 +183,7 @@ public:
     virtual Json::Value importprivkey(const std::string& name, const std::string& key,
                                       const std::string& password) = 0;
     virtual Json::Value getpeerinfo() = 0;
+    virtual Json::Value getstoragestats() = 0;
     virtual Json::Value dumpprivkeys(const std::string& account, const std::string& password) = 0;
     virtual std::string getoutputsetid(const Json::Value& outputs) = 0;
     virtual std::string signmessage(const std::string& message, const std::string& publickey, const std::string& password) = 0;
@@ -208,6 +215,7 @@ public:
     virtual Json::Value importprivkey(const std::string& name, const std::string& key,
                                       const std::string& password);
     virtual Json::Value getpeerinfo();
+    virtual Json::Value getstoragestats();
     virtual Json::Value dumpprivkeys(const std::string& account, const std::string& password);
     virtual std::string getoutputsetid(const Json::Value& outputs);
     virtual std::string signmessage(const std::string& message, const std::string& publickey, const std::string& password);
@@ -179,6 +179,8 @@ int main(int argc, char* argv[]) {
                 }
             } else if(command == "getpeerinfo") {
                 std::cout << client.getpeerinfo() << std::endl;
+            } else if(command == "getstoragestats") {
+                std::cout << client.getstoragestats() << std::endl;
             } else if(command == "gettransaction") {
                 if(argc == 3 + offset) {
                     std::cout << client.gettransaction(std::string(argv[2 + offset])).toStyledString() << std::endl;
@@ -203,6 +205,7 @@ int main(int argc, char* argv[]) {
                           << "getblockbyheight [height]\n"
                           << "getinfo\n"
                           << "getpeerinfo\n"
+                          << "getstoragestats\n"
                           << "gettransaction [id]\n"
                           << "importprivkey [accountname] [privkey]\n"
                           << "listaccounts\n"
@@ -28,9 +28,15 @@ CryptoKernel::MulticoinLoader::MulticoinLoader(const std::string& configFile,
 
         newCoin->blockchain.reset(new DynamicBlockchain(log,
                                                         coin["blockdb"].asString(),
+                                                        coin.get("blockdbcache", 32).asUInt(),
+                                                        coin["blockdbprofile"],
+                                                        coin["bulkimportprofile"],
                                                         coinbaseOwnerFunc,
                                                         subsidyFunc));
 
+        newCoin->blockchain->setUtxoCacheSize(coin.get("utxocache", 100).asUInt());
+        newCoin->blockchain->setMempoolSize(coin.get("mempoolsize", 300).asUInt());
+
         newCoin->consensusAlgo = getConsensusAlgo(coin["consensus"]["type"].asString(),
                                                   coin["consensus"]["params"],
                                                   config,
@@ -39,17 +45,21 @@ CryptoKernel::MulticoinLoader::MulticoinLoader(const std::string& configFile,
         newCoin->blockchain->loadChain(newCoin->consensusAlgo.get(),
                                       coin["genesisblock"].asString());
 
+        newCoin->blockchain->setMetricsInterval(coin.get("storagemetricsinterval", 0).asUInt());
+
         newCoin->consensusAlgo->start();
 
         newCoin->network.reset(new Network(log, newCoin->blockchain.get(),
                                            coin["port"].asUInt(),
-                                           coin["peerdb"].asString()));
+                                           coin["peerdb"].asString(),
+                                           coin["peerdbprofile"]));
 
         if(!coin["walletdb"].empty()) {
             newCoin->wallet.reset(new Wallet(newCoin->blockchain.get(),
                                             newCoin->network.get(),
                                             log,
-                                            coin["walletdb"].asString()));
+                                            coin["walletdb"].asString(),
+                                            coin["walletdbprofile"]));
         }
 
         newCoin->httpserver.reset(new jsonrpc::HttpServerLocal(coin["rpcport"].asUInt(),
@@ -126,9 +136,12 @@ std::unique_ptr<CryptoKernel::Consensus> CryptoKernel::MulticoinLoader::getConse
 CryptoKernel::MulticoinLoader::
 DynamicBlockchain::DynamicBlockchain(Log* GlobalLog,
                                      const std::string& dbDir,
+                                     const unsigned int cacheSize,
+                                     const Json::Value& dbProfile,
+                                     const Json::Value& bulkProfile,
                                      std::function<std::string(const std::string&)> getCoinbaseOwnerFunc,
                                      std::function<uint64_t(const uint64_t)> getBlockRewardFunc) :
-CryptoKernel::Blockchain(GlobalLog, dbDir) {
+CryptoKernel::Blockchain(GlobalLog, dbDir, cacheSize, dbProfile, bulkProfile) {
     this->getCoinbaseOwnerFunc = getCoinbaseOwnerFunc;
     this->getBlockRewardFunc = getBlockRewardFunc;
 }
@@ -44,6 +44,9 @@ namespace CryptoKernel {
                 public:
                     DynamicBlockchain(Log* GlobalLog,
                                       const std::string& dbDir,
+                                      const unsigned int cacheSize,
+                                      const Json::Value& dbProfile,
+                                      const Json::Value& bulkProfile,
                                       std::function<std::string(const std::string&)> getCoinbaseOwnerFunc,
                                       std::function<uint64_t(const uint64_t)> getBlockRewardFunc);
 
@@ -63,6 +63,26 @@ Json::Value CryptoServer::getinfo() {
 
     returning["mempool"]["size"] = buffer.str();
 
+    const CryptoKernel::Storage::CacheStats cacheStats = blockchain->getCacheStats();
+    returning["dbcache"]["hits"] = cacheStats.hits;
+    returning["dbcache"]["misses"] = cacheStats.misses;
+    returning["dbcache"]["entries"] = cacheStats.entries;
+
+    buffer.str("");
+    buffer << std::setprecision(3)
+           << (cacheStats.bytes / double(1024 * 1024))
+           << " / "
+           << (cacheStats.capacity / double(1024 * 1024))
+           << " MB";
+
+    returning["dbcache"]["size"] = buffer.str();
+
+    const CryptoKernel::SignatureCache::Stats sigStats = blockchain->getSignatureCacheStats();
+    returning["sigcache"]["hits"] = Json::UInt64(sigStats.hits);
+    returning["sigcache"]["misses"] = Json::UInt64(sigStats.misses);
+    returning["sigcache"]["entries"] = Json::UInt64(sigStats.entries);
+    returning["sigcache"]["capacity"] = Json::UInt64(sigStats.capacity);
+
     return returning;
 }
 
@@ -352,6 +372,10 @@ Json::Value CryptoServer::getpeerinfo() {
     return returning;
 }
 
+Json::Value CryptoServer::getstoragestats() {
+    return blockchain->getStorageMetrics();
+}
+
 Json::Value CryptoServer::dumpprivkeys(const std::string& account,
                                        const std::string& password) {
     Json::Value returning;
@@ -376,13 +400,12 @@ Json::Value CryptoServer::dumpprivkeys(const std::string& account,
 }
 
 std::string CryptoServer::getoutputsetid(const Json::Value& outputs) {
-    std::set<CryptoKernel::BigNum> outputIds;
+    std::set<CryptoKernel::uint256> outputIds;
     for(const auto& out : outputs) {
         outputIds.insert(CryptoKernel::Blockchain::output(out).getId());
     }
 
-    return CryptoKernel::MerkleNode::makeMerkleTree(outputIds)->getMerkleRoot()
-           .toString();
+    return CryptoKernel::MerkleNode::calculateRoot(outputIds).toString();
 }
 
 std::string CryptoServer::signmessage(const std::string& message,
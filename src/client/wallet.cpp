@@ -24,12 +24,16 @@
 CryptoKernel::Wallet::Wallet(CryptoKernel::Blockchain* blockchain,
                              CryptoKernel::Network* network,
                              CryptoKernel::Log* log,
-                             const std::string& dbDir) {
+                             const std::string& dbDir,
+                             const Json::Value& dbProfile) {
     this->blockchain = blockchain;
     this->network = network;
     this->log = log;
 
-    walletdb.reset(new CryptoKernel::Storage(dbDir, true, 8, false));
+    CryptoKernel::LevelDBEngine::Options defaults;
+    defaults.cache = 8;
+    walletdb.reset(new CryptoKernel::Storage(dbDir, true,
+                   CryptoKernel::Storage::loadProfile(dbProfile, defaults)));
     accounts.reset(new CryptoKernel::Storage::Table("accounts"));
     utxos.reset(new CryptoKernel::Storage::Table("utxos"));
     transactions.reset(new CryptoKernel::Storage::Table("transactions"));
@@ -41,7 +41,8 @@ public:
     Wallet(CryptoKernel::Blockchain* blockchain,
            CryptoKernel::Network* network,
            CryptoKernel::Log* log,
-           const std::string& dbDir);
+           const std::string& dbDir,
+           const Json::Value& dbProfile = Json::Value());
 
     ~Wallet();
 
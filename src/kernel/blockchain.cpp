@@ -32,26 +32,122 @@
 #include "schnorr.h"
 #include "merkletree.h"
 
+const std::string CryptoKernel::Blockchain::utxoTipKey = "utxotip";
+const uint64_t CryptoKernel::Blockchain::Mempool::maxSelectedBytes = 3.9 * 1024 * 1024;
+
 CryptoKernel::Blockchain::Blockchain(CryptoKernel::Log* GlobalLog,
-                                     const std::string& dbDir) {
+                                     const std::string& dbDir,
+                                     const unsigned int cacheSize,
+                                     const Json::Value& dbProfile,
+                                     const Json::Value& bulkProfile) {
     status = false;
     this->dbDir = dbDir;
-    blockdb.reset(new CryptoKernel::Storage(dbDir, false, 20, true));
-    blocks.reset(new CryptoKernel::Storage::Table("blocks"));
-    transactions.reset(new CryptoKernel::Storage::Table("transactions"));
-    utxos.reset(new CryptoKernel::Storage::Table("utxos"));
-    stxos.reset(new CryptoKernel::Storage::Table("stxos"));
-    inputs.reset(new CryptoKernel::Storage::Table("inputs"));
-    candidates.reset(new CryptoKernel::Storage::Table("candidates"));
+    this->cacheSize = cacheSize;
+
+    LevelDBEngine::Options defaults;
+    defaults.cache = 20;
+    defaults.bloomBits = 10;
+    this->dbProfile = Storage::loadProfile(dbProfile, defaults);
+
+    // Importing blocks is almost all writes, so buffer far more of them in
+    // memory before flushing to disk
+    defaults = this->dbProfile;
+    defaults.writeBuffer = 64;
+    this->bulkProfile = Storage::loadProfile(bulkProfile, defaults);
+    bulkImport = false;
+    metricsInterval = 0;
     log = GlobalLog;
+    blocks.reset(new CryptoKernel::Storage::Table("blocks", 1));
+    transactions.reset(new CryptoKernel::Storage::Table("transactions", 2));
+    utxos.reset(new CryptoKernel::Storage::Table("utxos", 3));
+    stxos.reset(new CryptoKernel::Storage::Table("stxos", 4));
+    inputs.reset(new CryptoKernel::Storage::Table("inputs", 5));
+    candidates.reset(new CryptoKernel::Storage::Table("candidates", 6));
+    undos.reset(new CryptoKernel::Storage::Table("undo", 7));
+    unflushed.reset(new CryptoKernel::Storage::Table("unflushed", 8));
+    utxoCache.reset(new UtxoCache(utxos.get(), uint64_t(100) * 1024 * 1024));
+    sigCache.reset(new SignatureCache(100000));
+    setVerifyThreads(std::thread::hardware_concurrency());
+    openDB();
+}
+
+void CryptoKernel::Blockchain::openDB() {
+    blockdb.reset(new CryptoKernel::Storage(dbDir, false, bulkImport ? bulkProfile : dbProfile,
+                                            true, cacheSize));
+
+    std::unique_ptr<Storage::Transaction> dbTx(blockdb->beginReadOnly());
+    blockdb->rekey("compactkeys", [&](const std::string& key) {
+        return toCompactKey(dbTx.get(), key);
+    });
+}
+
+std::string CryptoKernel::Blockchain::toCompactKey(Storage::Transaction* dbTx,
+                                                   const std::string& key) {
+    const size_t nameEnd = key.find('/');
+    if(nameEnd == std::string::npos) {
+        return key;
+    }
+
+    const std::string name = key.substr(0, nameEnd);
+    Storage::Table* table = nullptr;
+    for(Storage::Table* t : {blocks.get(), transactions.get(), utxos.get(), stxos.get(),
+                             inputs.get(), candidates.get(), undos.get(), unflushed.get()}) {
+        if(name == t->getName()) {
+            table = t;
+        }
+    }
+
+    const size_t indexEnd = key.find('/', nameEnd + 1);
+    if(table == nullptr || indexEnd == std::string::npos) {
+        return key;
+    }
+
+    const int index = std::stoi(key.substr(nameEnd + 1, indexEnd - nameEnd - 1)) - 1;
+    const std::string tableKey = key.substr(indexEnd + 1);
+
+    if(index == 0 && (table == utxos.get() || table == stxos.get())) {
+        // Text owner index rows are the public key and output id with no
+        // separator, so find where the id starts by looking for its record
+        for(size_t idLength = 64; idLength > 32; idLength--) {
+            if(tableKey.size() <= idLength) {
+                continue;
+            }
+
+            const std::string outputId = tableKey.substr(tableKey.size() - idLength);
+            if(outputId[0] == '0') {
+                continue;
+            }
+
+            if(!dbTx->get(name + "/0/" + outputId).isNull()
+               || !table->get(dbTx, outputId).isNull()) {
+                return table->getKey(ownerKey(tableKey.substr(0, tableKey.size() - idLength),
+                                              outputId), 0);
+            }
+        }
+
+        log->printf(LOG_LEVEL_WARN, "blockchain::toCompactKey(): Dropping dangling index row " + key);
+        return std::string();
+    }
+
+    return table->getKey(tableKey, index);
+}
+
+std::string CryptoKernel::Blockchain::ownerKey(const std::string& publicKey,
+                                               const std::string& outputId) {
+    return publicKey + "/" + outputId;
 }
 
 bool CryptoKernel::Blockchain::loadChain(CryptoKernel::Consensus* consensus,
                                          const std::string& genesisBlockFile) {
     this->consensus = consensus;
-    std::unique_ptr<Storage::Transaction> dbTransaction(blockdb->begin());
-    const bool tipExists = blocks->get(dbTransaction.get(), "tip").isObject();
-    dbTransaction->abort();
+    bool tipExists;
+    {
+        // Must be gone before emptyDB() replaces the storage it belongs to
+        std::unique_ptr<Storage::Transaction> dbTransaction(blockdb->begin());
+        tipExists = blocks->get(dbTransaction.get(), "tip").isObject();
+        dbTransaction->abort();
+    }
+
     if(!tipExists) {
         emptyDB();
         bool newGenesisBlock = false;
@@ -88,8 +184,12 @@ bool CryptoKernel::Blockchain::loadChain(CryptoKernel::Consensus* consensus,
             f << CryptoKernel::Storage::toString(Block.toJson(), true);
             f.close();
         }
+    } else {
+        loadIndex();
     }
 
+    recoverUtxos();
+
     const block genesisBlock = getBlockByHeight(1);
     genesisBlockId = genesisBlock.getId();
 
@@ -99,7 +199,281 @@ bool CryptoKernel::Blockchain::loadChain(CryptoKernel::Consensus* consensus,
 }
 
 CryptoKernel::Blockchain::~Blockchain() {
+    setMetricsInterval(0);
+
+    if(status) {
+        try {
+            flushUtxos();
+        } catch(const std::runtime_error& e) {
+            log->printf(LOG_LEVEL_ERR, std::string("blockchain::~Blockchain(): Failed to flush "
+                        "unspent outputs: ") + e.what());
+        }
+    }
+}
 
+void CryptoKernel::Blockchain::flushUtxos() {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    const size_t changes = utxoCache->dirtyCount();
+    if(changes == 0 && unflushedBlocks.empty()) {
+        return;
+    }
+
+    std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
+    utxoCache->begin(dbTx.get());
+    flushUtxos(dbTx.get());
+    try {
+        dbTx->commit();
+    } catch(const std::runtime_error& e) {
+        utxoCache->abort();
+        throw;
+    }
+    utxoCache->commit();
+    unflushedBlocks.clear();
+
+    log->printf(LOG_LEVEL_INFO, "blockchain::flushUtxos(): Wrote " + std::to_string(changes) +
+                " unspent output changes");
+}
+
+void CryptoKernel::Blockchain::flushUtxos(Storage::Transaction* dbTx) {
+    utxoCache->flush();
+    dbTx->put(utxoTipKey, blockIndex.getTip().id.toString());
+    for(const std::string& id : unflushedBlocks) {
+        unflushed->erase(dbTx, id);
+    }
+}
+
+void CryptoKernel::Blockchain::recoverUtxos() {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
+
+    const Json::Value flushedTip = dbTx->get(utxoTipKey);
+    const dbBlock tip = getBlockDB(dbTx.get(), "tip");
+    if(flushedTip.isString() && flushedTip.asString() == tip.getId().toString()) {
+        return;
+    }
+
+    // Databases from before the cache wrote every change straight to the
+    // table, so they are already current
+    std::stack<dbBlock> replay;
+    if(flushedTip.isString()) {
+        // Disconnecting a block flushes the cache, so the flushed block can
+        // only have left the main chain if the database is damaged. The
+        // outputs it created are then gone, so the table cannot be rebuilt.
+        dbBlock current = tip;
+        try {
+            while(current.getId().toString() != flushedTip.asString()) {
+                replay.push(current);
+                current = getBlockDB(dbTx.get(), current.getPreviousBlockId().toString());
+            }
+        } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
+            throw std::runtime_error("Last flushed block " + flushedTip.asString() +
+                                     " is not in the main chain, the block database "
+                                     "must be rebuilt");
+        }
+
+        log->printf(LOG_LEVEL_INFO, "blockchain::recoverUtxos(): Replaying " +
+                    std::to_string(replay.size()) + " blocks that were not flushed");
+    }
+
+    while(!replay.empty()) {
+        const std::string id = replay.top().getId().toString();
+        const Json::Value created = unflushed->get(dbTx.get(), id);
+        if(!created.isObject()) {
+            throw std::runtime_error("Outputs created by unflushed block " + id + " are missing");
+        }
+
+        // Outputs spent in the same block they were created in are erased
+        // after all of its outputs are added
+        for(const std::string& outputId : created.getMemberNames()) {
+            utxos->put(dbTx.get(), outputId, created[outputId]);
+        }
+
+        for(const uint256& txId : replay.top().getTransactions()) {
+            const dbTransaction tx = dbTransaction(transactions->get(dbTx.get(), txId.toString()));
+            for(const uint256& inputId : tx.getInputs()) {
+                const dbInput inp = dbInput(inputs->get(dbTx.get(), inputId.toString()));
+                utxos->erase(dbTx.get(), inp.getOutputId().toString());
+            }
+        }
+
+        unflushed->erase(dbTx.get(), id);
+        replay.pop();
+    }
+
+    dbTx->put(utxoTipKey, tip.getId().toString());
+    dbTx->commit();
+}
+
+void CryptoKernel::Blockchain::loadIndex() {
+    std::unique_ptr<Storage::Transaction> dbTx(blockdb->beginReadOnly());
+    blockIndex.clear();
+
+    const auto readTable = [&](Storage::Table* table) {
+        std::vector<BlockIndex::Entry> entries;
+        std::unique_ptr<Storage::Table::Iterator> it(new Storage::Table::Iterator(table, blockdb.get(), dbTx->snapshot));
+        for(it->SeekToFirst(); it->Valid(); it->Next()) {
+            const std::string key = it->key();
+            if(key == "tip") {
+                continue;
+            }
+
+            // Only the fields the index keeps, so the block is not rebuilt
+            const Json::Value& jsonBlock = it->value();
+            BlockIndex::Entry entry;
+            entry.id = uint256(key);
+            entry.previousId = uint256(jsonBlock["previousBlockId"].asString());
+            entry.height = jsonBlock["height"].asUInt64();
+            entry.timestamp = jsonBlock["timestamp"].asUInt64();
+            entry.consensusData = jsonBlock["consensusData"];
+            entries.push_back(std::move(entry));
+        }
+
+        // Parents come before their children in height order
+        std::sort(entries.begin(), entries.end(), [](const BlockIndex::Entry& a,
+                                                     const BlockIndex::Entry& b) {
+            return a.height < b.height;
+        });
+
+        return entries;
+    };
+
+    // The blocks table holds exactly the main chain
+    for(const BlockIndex::Entry& entry : readTable(blocks.get())) {
+        blockIndex.add(entry);
+        blockIndex.connect(entry.id);
+    }
+
+    for(const BlockIndex::Entry& entry : readTable(candidates.get())) {
+        try {
+            blockIndex.add(entry);
+        } catch(const std::runtime_error& e) {
+            log->printf(LOG_LEVEL_WARN, "blockchain::loadIndex(): Skipping candidate " +
+                        entry.id.toString() + ": " + e.what());
+        }
+    }
+
+    log->printf(LOG_LEVEL_INFO, "blockchain::loadIndex(): Indexed " +
+                std::to_string(blockIndex.size()) + " blocks, main chain height " +
+                std::to_string(blockIndex.getHeight()));
+}
+
+std::vector<CryptoKernel::BlockIndex::Entry> CryptoKernel::Blockchain::getAncestry(
+    const uint256& id, const size_t count) {
+    if(!blockIndex.contains(id)) {
+        throw NotFoundException("Block " + id.toString());
+    }
+
+    return blockIndex.getAncestry(id, count);
+}
+
+CryptoKernel::Blockchain::header CryptoKernel::Blockchain::getHeader(const uint256& id) {
+    return header(getBlockDB(id.toString()));
+}
+
+std::vector<CryptoKernel::uint256> CryptoKernel::Blockchain::getLocator() {
+    // Otherwise a block disconnected part way through leaves a gap in the
+    // heights being read
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+
+    std::vector<uint256> locator;
+
+    uint64_t height = blockIndex.getHeight();
+    uint64_t step = 1;
+    while(height > 1) {
+        locator.push_back(blockIndex.getByHeight(height).id);
+        if(locator.size() >= 10) {
+            step *= 2;
+        }
+        height = height > step ? height - step : 1;
+    }
+
+    if(blockIndex.getHeight() > 0) {
+        locator.push_back(blockIndex.getByHeight(1).id);
+    }
+
+    return locator;
+}
+
+std::vector<CryptoKernel::Blockchain::header> CryptoKernel::Blockchain::getHeaders(
+    const std::vector<uint256>& locator, const size_t count) {
+    std::unique_ptr<Storage::Transaction> dbTx(blockdb->beginReadOnly());
+
+    // Only main chain blocks are in the blocks table
+    uint64_t height = 1;
+    for(const uint256& id : locator) {
+        const Json::Value stored = blocks->get(dbTx.get(), id.toString());
+        if(stored.isObject()) {
+            height = dbBlock(stored).getHeight();
+            break;
+        }
+    }
+
+    std::vector<header> headers;
+    while(headers.size() < count) {
+        const Json::Value id = blocks->get(dbTx.get(), std::to_string(height + 1), 0);
+        if(!id.isString()) {
+            break;
+        }
+
+        headers.push_back(header(getBlockDB(dbTx.get(), id.asString(), true)));
+        height++;
+    }
+
+    return headers;
+}
+
+void CryptoKernel::Blockchain::checkHeaders(const std::vector<header>& headers,
+                                             const size_t from) {
+    if(from >= headers.size()) {
+        return;
+    }
+
+    const uint64_t now = std::time(nullptr);
+
+    const header first = from == 0 ? getHeader(headers.front().getPreviousBlockId()) :
+                         headers[from - 1];
+    const header* last = &first;
+    for(size_t i = from; i < headers.size(); i++) {
+        const header& next = headers[i];
+        if(next.getPreviousBlockId() != last->getId()) {
+            throw InvalidElementException("Header " + next.getId().toString() +
+                                          " does not follow on from the one before it");
+        }
+
+        if(next.getHeight() != last->getHeight() + 1) {
+            throw InvalidElementException("Header " + next.getId().toString() +
+                                          " has the wrong height");
+        }
+
+        // The same allowance as for blocks announced by peers
+        if(next.getTimestamp() > now + 2 * 60 * 60) {
+            throw InvalidElementException("Header " + next.getId().toString() +
+                                          " is too far in the future");
+        }
+
+        if(!consensus->checkHeader(headers, i, *last)) {
+            throw InvalidElementException("Header " + next.getId().toString() +
+                                          " breaks the consensus rules");
+        }
+
+        last = &next;
+    }
+}
+
+bool CryptoKernel::Blockchain::isChainBetter(const header& tip) {
+    // The index has a new tip before submitBlock commits it to the block
+    // database, so wait for any submission to finish
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+
+    if(blockIndex.contains(tip.getId())) {
+        return false;
+    }
+
+    return consensus->isHeaderBetter(tip, getHeader(blockIndex.getTip().id));
+}
+
+bool CryptoKernel::Blockchain::isChainBetter(const header& tip, const header& otherTip) {
+    return consensus->isHeaderBetter(tip, otherTip);
 }
 
 std::set<CryptoKernel::Blockchain::transaction>
@@ -146,7 +520,7 @@ CryptoKernel::Blockchain::block CryptoKernel::Blockchain::buildBlock(
     std::set<transaction> transactions;
 
     try {
-        for(const BigNum& txid : dbblock.getTransactions()) {
+        for(const uint256& txid : dbblock.getTransactions()) {
             transactions.insert(getTransaction(dbTx, txid.toString()));
         }
 
@@ -201,11 +575,16 @@ CryptoKernel::Blockchain::output CryptoKernel::Blockchain::getOutput(
 
 CryptoKernel::Blockchain::output CryptoKernel::Blockchain::getOutput(
     Storage::Transaction* dbTx, const std::string& id) {
-    Json::Value outputJson = utxos->get(dbTx, id);
+    Json::Value outputJson = utxoCache->get(dbTx, id);
     if(!outputJson.isObject()) {
         outputJson = stxos->get(dbTx, id);
         if(!outputJson.isObject()) {
-            throw NotFoundException("Output " + id);
+            // The cache may know of a spend newer than this snapshot, while
+            // the table still has the output
+            outputJson = utxos->get(dbTx, id);
+            if(!outputJson.isObject()) {
+                throw NotFoundException("Output " + id);
+            }
         }
     }
 
@@ -214,11 +593,16 @@ CryptoKernel::Blockchain::output CryptoKernel::Blockchain::getOutput(
 
 CryptoKernel::Blockchain::dbOutput CryptoKernel::Blockchain::getOutputDB(
     Storage::Transaction* dbTx, const std::string& id) {
-    Json::Value outputJson = utxos->get(dbTx, id);
+    Json::Value outputJson = utxoCache->get(dbTx, id);
     if(!outputJson.isObject()) {
         outputJson = stxos->get(dbTx, id);
         if(!outputJson.isObject()) {
-            throw NotFoundException("Output " + id);
+            // The cache may know of a spend newer than this snapshot, while
+            // the table still has the output
+            outputJson = utxos->get(dbTx, id);
+            if(!outputJson.isObject()) {
+                throw NotFoundException("Output " + id);
+            }
         }
     }
 
@@ -246,7 +630,7 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::verifyTransaction(Storage::Tran
     uint64_t outputTotal = 0;
 
     for(const output& out : tx.getOutputs()) {
-        if(utxos->get(dbTransaction, out.getId().toString()).isObject() ||
+        if(utxoCache->get(dbTransaction, out.getId().toString()).isObject() ||
                 stxos->get(dbTransaction, out.getId().toString()).isObject()) {
             log->printf(LOG_LEVEL_INFO, "blockchain::verifyTransaction(): Output already exists");
             //Duplicate output
@@ -256,12 +640,12 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::verifyTransaction(Storage::Tran
         outputTotal += out.getValue();
     }
 
-    const CryptoKernel::BigNum outputHash = tx.getOutputSetId();
+    const CryptoKernel::uint256 outputHash = tx.getOutputSetId();
 
     std::set<dbOutput> maybeAggregated;
 
     for(const input& inp : tx.getInputs()) {
-        const Json::Value outJson = utxos->get(dbTransaction, inp.getOutputId().toString());
+        const Json::Value outJson = utxoCache->get(dbTransaction, inp.getOutputId().toString());
         if(!outJson.isObject()) {
             log->printf(LOG_LEVEL_INFO,
                         "blockchain::verifyTransaction(): Output has already been spent");
@@ -283,15 +667,18 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::verifyTransaction(Storage::Tran
                 log->printf(LOG_LEVEL_WARN, "blockchain::verifyTransaction(): Output has a malformed schnorr key, not checking its signature");
                 maybeAggregated.erase(out);
             } else if(spendData["signature"].isString()) {
-                CryptoKernel::Schnorr schnorr;
-                if(!schnorr.setPublicKey(outData["schnorrKey"].asString())) {
-                    log->printf(LOG_LEVEL_INFO,
-                                "blockchain::verifyTransaction(): Schnorr key is malformed");
-                    return std::make_tuple(false, true);
-                }
-
-                if(!schnorr.verify(out.getId().toString() + outputHash.toString(),
-                                spendData["signature"].asString())) {
+                const std::string message = out.getId().toString() + outputHash.toString();
+                if(!sigCache->verify("schnorr", outData["schnorrKey"].asString(), message,
+                                     spendData["signature"].asString(), [&]() {
+                    CryptoKernel::Schnorr schnorr;
+                    if(!schnorr.setPublicKey(outData["schnorrKey"].asString())) {
+                        log->printf(LOG_LEVEL_INFO,
+                                    "blockchain::verifyTransaction(): Schnorr key is malformed");
+                        return false;
+                    }
+
+                    return schnorr.verify(message, spendData["signature"].asString());
+                })) {
                     log->printf(LOG_LEVEL_INFO,
                                 "blockchain::verifyTransaction(): Could not verify input signature");
                     return std::make_tuple(false, true);
@@ -342,8 +729,8 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::verifyTransaction(Storage::Tran
             }
 
             // Verify if the spending script/pubkey hash is the first item in the proof
-            const BigNum& proofValue = proof->leaves.at(0);
-            const BigNum& spendValue = CryptoKernel::BigNum(CryptoKernel::Crypto::sha256(spendData["pubKeyOrScript"].asString()));
+            const uint256& proofValue = proof->leaves.at(0);
+            const uint256& spendValue = CryptoKernel::uint256(CryptoKernel::Crypto::sha256(spendData["pubKeyOrScript"].asString()));
             if(proofValue != spendValue) {
                 log->printf(LOG_LEVEL_INFO,
                             "blockchain::verifyTransaction(): Merkle proof does not start with the spending script or pubkey's hash");
@@ -370,10 +757,13 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::verifyTransaction(Storage::Tran
                 // Verify if the signature is valid for the given pubkey
                 // We already checked that that pub key is allowed to spend
                 // the input by the checks above.
-                CryptoKernel::Crypto crypto;
-                crypto.setPublicKey(spendData["pubKeyOrScript"].asString());
-                if(!crypto.verify(out.getId().toString() + outputHash.toString(),
-                                spendData["signature"].asString())) {
+                const std::string message = out.getId().toString() + outputHash.toString();
+                if(!sigCache->verify("ecdsa", spendData["pubKeyOrScript"].asString(), message,
+                                     spendData["signature"].asString(), [&]() {
+                    CryptoKernel::Crypto crypto;
+                    crypto.setPublicKey(spendData["pubKeyOrScript"].asString());
+                    return crypto.verify(message, spendData["signature"].asString());
+                })) {
                     log->printf(LOG_LEVEL_INFO,
                                 "blockchain::verifyTransaction(): Could not verify input signature for p2mr output");
                     return std::make_tuple(false, true);
@@ -394,10 +784,13 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::verifyTransaction(Storage::Tran
                 return std::make_tuple(false, true);
             }
 
-            CryptoKernel::Crypto crypto;
-            crypto.setPublicKey(outData["publicKey"].asString());
-            if(!crypto.verify(out.getId().toString() + outputHash.toString(),
-                              spendData["signature"].asString())) {
+            const std::string message = out.getId().toString() + outputHash.toString();
+            if(!sigCache->verify("ecdsa", outData["publicKey"].asString(), message,
+                                 spendData["signature"].asString(), [&]() {
+                CryptoKernel::Crypto crypto;
+                crypto.setPublicKey(outData["publicKey"].asString());
+                return crypto.verify(message, spendData["signature"].asString());
+            })) {
                 log->printf(LOG_LEVEL_INFO,
                             "blockchain::verifyTransaction(): Could not verify input signature");
                 return std::make_tuple(false, true);
@@ -432,7 +825,7 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::verifyTransaction(Storage::Tran
             }
 
             std::set<std::string> pubkeys;
-            std::set<BigNum> outputIds;
+            std::set<uint256> outputIds;
             for(const auto out : signs) {
                 auto it = maybeAggregated.begin();
                 std::advance(it, out);
@@ -441,21 +834,30 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::verifyTransaction(Storage::Tran
                 outputIds.emplace(it->getId());
             }
 
-            CryptoKernel::Schnorr schnorr;
-            const std::string aggregatedPubkey = schnorr.pubkeyAggregate(pubkeys);
-            if(!schnorr.setPublicKey(aggregatedPubkey)) {
-                log->printf(LOG_LEVEL_INFO,
-                            "blockchain::verifyTransaction(): Aggregate signature malformed. Aggregated pubkey is invalid");
-                return std::make_tuple(false, true);
-            }
-
             std::string signaturePayload;
             for(const auto& id : outputIds) {
                 signaturePayload += id.toString();
             }
             signaturePayload += outputHash.toString();
 
-            if(!schnorr.verify(signaturePayload, spendData["aggregateSignature"]["signature"].asString())) {
+            // Cached under the set of keys, so a hit also skips aggregating them
+            std::string pubkeyList;
+            for(const auto& pubkey : pubkeys) {
+                pubkeyList += pubkey + ",";
+            }
+
+            const std::string signature = spendData["aggregateSignature"]["signature"].asString();
+            if(!sigCache->verify("aggregate", pubkeyList, signaturePayload, signature, [&]() {
+                CryptoKernel::Schnorr schnorr;
+                const std::string aggregatedPubkey = schnorr.pubkeyAggregate(pubkeys);
+                if(!schnorr.setPublicKey(aggregatedPubkey)) {
+                    log->printf(LOG_LEVEL_INFO,
+                                "blockchain::verifyTransaction(): Aggregate signature malformed. Aggregated pubkey is invalid");
+                    return false;
+                }
+
+                return schnorr.verify(signaturePayload, signature);
+            })) {
                 log->printf(LOG_LEVEL_INFO,
                             "blockchain::verifyTransaction(): Could not verify input signature");
                 return std::make_tuple(false, true);
@@ -513,8 +915,21 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::verifyTransaction(Storage::Tran
 }
 
 std::tuple<bool, bool> CryptoKernel::Blockchain::submitTransaction(const transaction& tx) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
     std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
-    const auto result = submitTransaction(dbTx.get(), tx);
+
+    // Unconfirmed transactions change no outputs, but let the cache keep
+    // what this one reads
+    utxoCache->begin(dbTx.get());
+    std::tuple<bool, bool> result;
+    try {
+        result = submitTransaction(dbTx.get(), tx);
+    } catch(...) {
+        utxoCache->abort();
+        throw;
+    }
+    utxoCache->abort();
+
     if(std::get<0>(result)) {
         dbTx->commit();
     }
@@ -522,11 +937,41 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitTransaction(const transac
 }
 
 std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(const block& newBlock, bool genesisBlock) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
     std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
-    const auto result = submitBlock(dbTx.get(), newBlock, genesisBlock);
+    utxoCache->begin(dbTx.get());
+    blockIndex.begin();
+
+    std::tuple<bool, bool> result;
+    bool flushed = false;
+    try {
+        result = submitBlock(dbTx.get(), newBlock, genesisBlock);
+        if(std::get<0>(result)) {
+            // The genesis block is always flushed so the marker exists from
+            // the start
+            flushed = genesisBlock || utxoCache->needsFlush();
+            if(flushed) {
+                flushUtxos(dbTx.get());
+            }
+            dbTx->commit();
+        }
+    } catch(...) {
+        utxoCache->abort();
+        blockIndex.abort();
+        throw;
+    }
+
     if(std::get<0>(result)) {
-        dbTx->commit();
+        utxoCache->commit();
+        blockIndex.commit();
+        if(flushed) {
+            unflushedBlocks.clear();
+        }
+    } else {
+        utxoCache->abort();
+        blockIndex.abort();
     }
+
     return result;
 }
 
@@ -535,14 +980,17 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitTransaction(Storage::Tran
 	const auto verifyResult = verifyTransaction(dbTx, tx);
     if(std::get<0>(verifyResult)) {
         if(consensus->submitTransaction(dbTx, tx)) {
+            const uint64_t fee = calculateTransactionFee(dbTx, tx);
+            const bool scripts = runsScripts(dbTx, tx);
             std::lock_guard<std::mutex> lock(mempoolMutex);
-			if(unconfirmedTransactions.insert(tx)) {
+			if(unconfirmedTransactions.insert(tx, fee, scripts)) {
 				log->printf(LOG_LEVEL_INFO,
 							"blockchain::submitTransaction(): Received transaction " + tx.getId().toString());
 				return std::make_tuple(true, false);
 			} else {
 				log->printf(LOG_LEVEL_INFO,
-							"blockchain::submitTransaction(): " + tx.getId().toString() + " has a mempool conflict");
+							"blockchain::submitTransaction(): " + tx.getId().toString() +
+                            " has a mempool conflict or pays too little to fit in the mempool");
 				return std::make_tuple(false, false);
 			}
         } else {
@@ -557,6 +1005,26 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitTransaction(Storage::Tran
     }
 }
 
+bool CryptoKernel::Blockchain::runsScripts(Storage::Transaction* dbTx, const transaction& tx) {
+    // Scripts can read blocks and transactions, so their result may change
+    // with any block rather than only with the outputs spent
+    for(const input& inp : tx.getInputs()) {
+        const Json::Value outJson = utxoCache->get(dbTx, inp.getOutputId().toString());
+        if(!outJson.isObject()) {
+            continue;
+        }
+
+        const Json::Value spendData = inp.getData();
+        if(!dbOutput(outJson).getData()["contract"].empty() ||
+                (spendData["spendType"].isString() &&
+                 spendData["spendType"].asString() == "script")) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(Storage::Transaction* dbTx,
         const block& Block, bool genesisBlock) {
     block newBlock = Block;
@@ -600,62 +1068,57 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(Storage::Transactio
             return std::make_tuple(false, true);
         }
 
-        const dbBlock tip = getBlockDB(dbTx, "tip");
-        if(previousBlock.getId() != tip.getId()) {
+        const BlockIndex::Entry tip = blockIndex.getTip();
+        if(previousBlock.getId() != tip.id) {
             //This block does not directly lead on from last block
             //Check if the verifier should've come before the current tip
             //If so, reorg, otherwise ignore it
-            if(consensus->isBlockBetter(dbTx, newBlock, tip)) {
+            if(consensus->isBlockBetter(dbTx, newBlock, getBlockDB(dbTx, tip.id.toString()))) {
                 log->printf(LOG_LEVEL_INFO, "blockchain::submitBlock(): Forking the chain");
                 if(!reorgChain(dbTx, previousBlock.getId())) {
                     log->printf(LOG_LEVEL_INFO, "blockchain::submitBlock(): Alternative chain is not valid");
                     return std::make_tuple(false, true);
                 }
 
-                blockHeight = getBlockDB(dbTx, "tip").getHeight() + 1;
+                blockHeight = blockIndex.getHeight() + 1;
             } else {
                 log->printf(LOG_LEVEL_WARN,
                             "blockchain::submitBlock(): Chain has less verifier backing than current chain");
-                blockHeight = getBlockDB(dbTx, newBlock.getPreviousBlockId().toString()).getHeight() + 1;
+                blockHeight = previousBlock.getHeight() + 1;
                 onlySave = true;
             }
         } else {
-            blockHeight = tip.getHeight() + 1;
+            blockHeight = tip.height + 1;
         }
     }
 
+    // What the block spends, so it can be disconnected without rebuilding
+    // anything from the database
+    Json::Value spentOutputs(Json::objectValue);
+
     if(!onlySave) {
         uint64_t fees = 0;
 
-        const unsigned int threads = std::thread::hardware_concurrency();
-        const auto& txs = newBlock.getTransactions();
-        bool failure = false;
-        unsigned int nTx = 0;
-        std::vector<std::thread> threadsVec;
-
+        // Transactions in a block cannot spend each other's outputs, so they
+        // are verified in parallel against the state before the block
+        const std::set<transaction>& txs = newBlock.getTransactions();
+        std::vector<const transaction*> txList;
+        txList.reserve(txs.size());
         for(const auto& tx : txs) {
-            threadsVec.push_back(std::thread([&]{
-                if(!std::get<0>(verifyTransaction(dbTx, tx))) {
-                    failure = true;
-                }
-            }));
-            nTx++;
+            txList.push_back(&tx);
+        }
 
-            if(nTx % threads == 0 || nTx >= txs.size()) {
-                for(auto& thread : threadsVec) {
-                    thread.join();
-                }
-                threadsVec.clear();
+        const size_t failed = verifyPool->run(txList.size(), [&](const size_t i) {
+            return std::get<0>(verifyTransaction(dbTx, *txList[i]));
+        });
 
-                if(failure) {
-                    log->printf(LOG_LEVEL_INFO,
-                            "blockchain::submitBlock(): Transaction could not be verified");
-                    return std::make_tuple(false, true);
-                }
-            }
+        if(failed < txList.size()) {
+            log->printf(LOG_LEVEL_INFO,
+                        "blockchain::submitBlock(): Transaction " +
+                        txList[failed]->getId().toString() + " could not be verified");
+            return std::make_tuple(false, true);
         }
 
-
         //Verify Transactions
         for(const transaction& tx : newBlock.getTransactions()) {
             fees += calculateTransactionFee(dbTx, tx);
@@ -684,14 +1147,22 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(Storage::Transactio
             return std::make_tuple(false, true);
         }
 
-        confirmTransaction(dbTx, newBlock.getCoinbaseTx(), newBlock.getId(), true);
+        confirmTransaction(dbTx, newBlock.getCoinbaseTx(), newBlock.getId(), spentOutputs, true);
 
         //Move transactions from unconfirmed to confirmed and add transaction utxos to db
         for(const transaction& tx : newBlock.getTransactions()) {
-            confirmTransaction(dbTx, tx, newBlock.getId());
+            confirmTransaction(dbTx, tx, newBlock.getId(), spentOutputs);
         }
     }
 
+    BlockIndex::Entry entry;
+    entry.id = newBlock.getId();
+    entry.previousId = newBlock.getPreviousBlockId();
+    entry.height = blockHeight;
+    entry.timestamp = newBlock.getTimestamp();
+    entry.consensusData = newBlock.getConsensusData();
+    blockIndex.add(entry);
+
     if(onlySave) {
         Json::Value jsonBlock = newBlock.toJson();
         jsonBlock["height"] = blockHeight;
@@ -699,12 +1170,39 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(Storage::Transactio
     } else {
         const dbBlock toSave = dbBlock(newBlock, blockHeight);
         const Json::Value blockAsJson = toSave.toJson();
+        blockIndex.connect(entry.id);
         candidates->erase(dbTx, idAsString);
         blocks->put(dbTx, "tip", blockAsJson);
         blocks->put(dbTx, std::to_string(blockHeight), Json::Value(idAsString), 0);
         blocks->put(dbTx, idAsString, blockAsJson);
+
+        Json::Value undo;
+        undo["spent"] = spentOutputs;
+        undos->put(dbTx, idAsString, undo);
+
+        Json::Value created(Json::objectValue);
+        const auto addCreated = [&](const transaction& tx) {
+            for(const output& out : tx.getOutputs()) {
+                created[out.getId().toString()] = dbOutput(out, tx.getId()).toJson();
+            }
+        };
+        addCreated(newBlock.getCoinbaseTx());
+        for(const transaction& tx : newBlock.getTransactions()) {
+            addCreated(tx);
+        }
+        unflushed->put(dbTx, idAsString, created);
+        unflushedBlocks.push_back(idAsString);
+        // Transactions in the block were removed as they were confirmed,
+        // so only conflicts and script transactions are left to check
         std::lock_guard<std::mutex> lock(mempoolMutex);
-		unconfirmedTransactions.rescanMempool(dbTx, this);
+        const unsigned int conflicts = unconfirmedTransactions.removeConflicts(newBlock);
+        const unsigned int invalid = unconfirmedTransactions.recheckScripts(dbTx, this);
+        if(conflicts + invalid > 0) {
+            log->printf(LOG_LEVEL_INFO,
+                        "blockchain::submitBlock(): Removed " + std::to_string(conflicts) +
+                        " conflicting and " + std::to_string(invalid) +
+                        " invalid transactions from the mempool");
+        }
     }
 
     if(genesisBlock) {
@@ -719,7 +1217,8 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(Storage::Transactio
 }
 
 void CryptoKernel::Blockchain::confirmTransaction(Storage::Transaction* dbTransaction,
-        const transaction& tx, const BigNum& confirmingBlock, const bool coinbaseTx) {
+        const transaction& tx, const uint256& confirmingBlock, Json::Value& spentOutputs,
+        const bool coinbaseTx) {
     //Execute custom transaction rules callback
     if(!consensus->confirmTransaction(dbTransaction, tx)) {
         log->printf(LOG_LEVEL_ERR, "Consensus rules failed to confirm transaction");
@@ -728,19 +1227,20 @@ void CryptoKernel::Blockchain::confirmTransaction(Storage::Transaction* dbTransa
     //"Spend" UTXOs
     for(const input& inp : tx.getInputs()) {
         const std::string outputId = inp.getOutputId().toString();
-        const Json::Value utxo = utxos->get(dbTransaction, outputId);
+        const Json::Value utxo = utxoCache->get(dbTransaction, outputId);
         const auto txoData = dbOutput(utxo).getData();
 
         stxos->put(dbTransaction, outputId, utxo);
+        spentOutputs[outputId] = utxo;
 
         if(!txoData["publicKey"].isNull()) {
-            const auto txoStr = txoData["publicKey"].asString() + outputId;
+            const auto txoStr = ownerKey(txoData["publicKey"].asString(), outputId);
 
             stxos->put(dbTransaction, txoStr, Json::nullValue, 0);
             utxos->erase(dbTransaction, txoStr, 0);
         }
 
-        utxos->erase(dbTransaction, outputId);
+        utxoCache->erase(outputId);
 
         inputs->put(dbTransaction, inp.getId().toString(), dbInput(inp).toJson());
     }
@@ -749,11 +1249,11 @@ void CryptoKernel::Blockchain::confirmTransaction(Storage::Transaction* dbTransa
     for(const output& out : tx.getOutputs()) {
         const auto txoData = out.getData();
         if(!txoData["publicKey"].isNull()) {
-            const auto txoStr = txoData["publicKey"].asString() + out.getId().toString();
+            const auto txoStr = ownerKey(txoData["publicKey"].asString(), out.getId().toString());
             utxos->put(dbTransaction, txoStr, Json::nullValue, 0);
         }
 
-        utxos->put(dbTransaction, out.getId().toString(), dbOutput(out, tx.getId()).toJson());
+        utxoCache->put(out.getId().toString(), dbOutput(out, tx.getId()).toJson());
     }
 
     //Commit transaction
@@ -766,33 +1266,28 @@ void CryptoKernel::Blockchain::confirmTransaction(Storage::Transaction* dbTransa
 }
 
 bool CryptoKernel::Blockchain::reorgChain(Storage::Transaction* dbTransaction,
-        const BigNum& newTipId) {
-    std::stack<block> blockList;
-
-    //Find common fork block
-    Json::Value blockJson = candidates->get(dbTransaction, newTipId.toString());
-    while(blockJson.isObject()) {
-        const block currentBlock = block(blockJson);
-        blockList.push(currentBlock);
-        blockJson = candidates->get(dbTransaction, currentBlock.getPreviousBlockId().toString());
-    }
+        const uint256& newTipId) {
+    //Find common fork block, which may be the new tip itself
+    const uint256 forkBlockId = blockIndex.getForkPoint(newTipId).id;
+    const std::vector<uint256> branch = blockIndex.getBranch(newTipId);
 
     //Reverse blocks to that point
-    const BigNum forkBlockId = blockList.top().getPreviousBlockId();
-    while(getBlockDB(dbTransaction, "tip").getId() != forkBlockId) {
-        reverseBlock(dbTransaction);
+    std::vector<block> disconnected;
+    while(blockIndex.getTip().id != forkBlockId) {
+        disconnected.push_back(reverseBlock(dbTransaction));
     }
+    restoreMempool(dbTransaction, disconnected);
 
     //Submit new blocks
-    while(!blockList.empty()) {
-        if(!std::get<0>(submitBlock(dbTransaction, blockList.top()))) {
+    for(const uint256& id : branch) {
+        const block candidate = block(candidates->get(dbTransaction, id.toString()));
+        if(!std::get<0>(submitBlock(dbTransaction, candidate))) {
             //TODO: should probably blacklist this fork if this happens
 
             log->printf(LOG_LEVEL_WARN, "blockchain::reorgChain(): New chain failed to verify");
 
             return false;
         }
-        blockList.pop();
     }
 
     return true;
@@ -822,21 +1317,50 @@ uint64_t CryptoKernel::Blockchain::calculateTransactionFee(Storage::Transaction*
     }
 
     for(const input& inp : tx.getInputs()) {
-        const dbOutput out = dbOutput(utxos->get(dbTx, inp.getOutputId().toString()));
+        const dbOutput out = dbOutput(utxoCache->get(dbTx, inp.getOutputId().toString()));
         inputTotal += out.getValue();
     }
 
     return inputTotal - outputTotal;
 }
 
+std::shared_ptr<const CryptoKernel::Blockchain::BlockTemplate>
+CryptoKernel::Blockchain::getBlockTemplate(const uint256& tipId) {
+    std::lock_guard<std::mutex> lock(mempoolMutex);
+
+    const uint64_t version = unconfirmedTransactions.getSelectionVersion();
+    if(blockTemplate && blockTemplate->tipId == tipId && blockTemplate->version == version) {
+        return blockTemplate;
+    }
+
+    // Fees were worked out when the transactions entered the mempool, and
+    // cannot change while they stay in it
+    std::shared_ptr<BlockTemplate> newTemplate = std::make_shared<BlockTemplate>();
+    newTemplate->tipId = tipId;
+    newTemplate->version = version;
+    newTemplate->txs = unconfirmedTransactions.getTransactions();
+    newTemplate->fees = unconfirmedTransactions.getSelectedFees();
+
+    if(!newTemplate->txs.empty()) {
+        std::set<uint256> txIds;
+        for(const auto& tx : newTemplate->txs) {
+            txIds.insert(tx.getId());
+        }
+
+        newTemplate->merkleRoot = CryptoKernel::MerkleNode::calculateRoot(txIds);
+    }
+
+    blockTemplate = newTemplate;
+
+    return blockTemplate;
+}
+
 CryptoKernel::Blockchain::block CryptoKernel::Blockchain::generateVerifyingBlock(
     const std::string& publicKey) {
     std::unique_ptr<Storage::Transaction> dbTx(blockdb->beginReadOnly());
 
-    const std::set<transaction> blockTransactions = getUnconfirmedTransactions();
-
     uint64_t height;
-    BigNum previousBlockId;
+    uint256 previousBlockId;
     bool genesisBlock = false;
     try {
         const dbBlock previousBlock = getBlockDB(dbTx.get(), "tip");
@@ -849,11 +1373,9 @@ CryptoKernel::Blockchain::block CryptoKernel::Blockchain::generateVerifyingBlock
     const time_t t = std::time(0);
     const uint64_t now = static_cast<uint64_t> (t);;
 
-    uint64_t value = getBlockReward(height);
+    const std::shared_ptr<const BlockTemplate> selection = getBlockTemplate(previousBlockId);
 
-    for(const transaction& tx : blockTransactions) {
-        value += calculateTransactionFee(dbTx.get(), tx);
-    }
+    const uint64_t value = getBlockReward(height) + selection->fees;
 
     const std::string pubKey = getCoinbaseOwner(publicKey);
 
@@ -874,8 +1396,8 @@ CryptoKernel::Blockchain::block CryptoKernel::Blockchain::generateVerifyingBlock
         consensusData = consensus->generateConsensusData(dbTx.get(), previousBlockId, publicKey);
     }
 
-    const block returning = block(blockTransactions, coinbaseTx, previousBlockId, now,
-                                  consensusData, height);
+    const block returning = block(selection->txs, selection->merkleRoot, coinbaseTx,
+                                  previousBlockId, now, consensusData, height);
 
     return returning;
 }
@@ -886,7 +1408,7 @@ std::set<CryptoKernel::Blockchain::dbOutput> CryptoKernel::Blockchain::getUnspen
 
     std::set<dbOutput> returning;
 
-    std::unique_ptr<Storage::Table::Iterator> it(new Storage::Table::Iterator(utxos.get(), blockdb.get(), dbTx->snapshot, publicKey, 0));
+    std::unique_ptr<Storage::Table::Iterator> it(new Storage::Table::Iterator(utxos.get(), blockdb.get(), dbTx->snapshot, ownerKey(publicKey, ""), 0));
 
     for(it->SeekToFirst(); it->Valid(); it->Next()) {
         returning.insert(getOutputDB(dbTx.get(), it->key()));
@@ -901,7 +1423,7 @@ std::set<CryptoKernel::Blockchain::dbOutput> CryptoKernel::Blockchain::getSpentO
 
     std::set<dbOutput> returning;
 
-    std::unique_ptr<Storage::Table::Iterator> it(new Storage::Table::Iterator(stxos.get(), blockdb.get(), dbTx->snapshot, publicKey, 0));
+    std::unique_ptr<Storage::Table::Iterator> it(new Storage::Table::Iterator(stxos.get(), blockdb.get(), dbTx->snapshot, ownerKey(publicKey, ""), 0));
 
     for(it->SeekToFirst(); it->Valid(); it->Next()) {
         returning.insert(getOutputDB(dbTx.get(), it->key()));
@@ -910,72 +1432,127 @@ std::set<CryptoKernel::Blockchain::dbOutput> CryptoKernel::Blockchain::getSpentO
     return returning;
 }
 
-void CryptoKernel::Blockchain::reverseBlock(Storage::Transaction* dbTransaction) {
-    const block tip = getBlock(dbTransaction, "tip");
+CryptoKernel::Blockchain::block CryptoKernel::Blockchain::reverseBlock(
+    Storage::Transaction* dbTransaction) {
+    const std::string tipId = blockIndex.getTip().id.toString();
+
+    // Rebuilt from its rows, as the undo record only keeps the spent
+    // outputs those rows no longer have. The full block is needed anyway
+    // to save it as a candidate and return its transactions to the mempool.
+    const block tip = getBlock(dbTransaction, tipId);
+
+    Json::Value undo = undos->get(dbTransaction, tipId);
+    if(!undo.isObject()) {
+        // Connected before undo records were written
+        undo = buildUndo(dbTransaction, tip);
+    }
+
+    const Json::Value& spentOutputs = undo["spent"];
+    if(!spentOutputs.isObject()) {
+        throw std::runtime_error("Undo record of block " + tipId + " is malformed");
+    }
 
-    auto eraseUtxo = [&](const auto& out, auto& db) {
-        db->erase(dbTransaction, out.getId().toString());
+    // Blocks replayed after a crash are found by walking back from the tip,
+    // so the last flushed block must never leave the main chain
+    utxoCache->requestFlush();
 
+    // Unspent output records go through the cache, owner index rows and
+    // spent outputs straight to their tables
+    auto eraseOwnerKey = [&](const auto& out, auto& db) {
         const auto txoData = out.getData();
         if(!txoData["publicKey"].isNull()) {
-            const auto txoStr = txoData["publicKey"].asString() + out.getId().toString();
+            const auto txoStr = ownerKey(txoData["publicKey"].asString(), out.getId().toString());
             db->erase(dbTransaction, txoStr, 0);
         }
     };
 
     for(const output& out : tip.getCoinbaseTx().getOutputs()) {
-        eraseUtxo(out, utxos);
+        utxoCache->erase(out.getId().toString());
+        eraseOwnerKey(out, utxos);
     }
 
     transactions->erase(dbTransaction, tip.getCoinbaseTx().getId().toString());
 
-	std::set<transaction> replayTxs;
-
     for(const transaction& tx : tip.getTransactions()) {
         for(const output& out : tx.getOutputs()) {
-            eraseUtxo(out, utxos);
+            utxoCache->erase(out.getId().toString());
+            eraseOwnerKey(out, utxos);
         }
 
         for(const input& inp : tx.getInputs()) {
             inputs->erase(dbTransaction, inp.getId().toString());
 
+            // Read straight from the record, as building the output would
+            // hash it again for an id that is already known
             const std::string oldOutputId = inp.getOutputId().toString();
-            const dbOutput oldOutput = dbOutput(stxos->get(dbTransaction, oldOutputId));
+            if(!spentOutputs.isMember(oldOutputId)) {
+                throw std::runtime_error("Undo record of block " + tipId +
+                                         " is missing spent output " + oldOutputId);
+            }
+            const Json::Value& oldOutput = spentOutputs[oldOutputId];
 
-            eraseUtxo(oldOutput, stxos);
+            stxos->erase(dbTransaction, oldOutputId);
+            utxoCache->put(oldOutputId, oldOutput);
 
-            utxos->put(dbTransaction, oldOutputId, oldOutput.toJson());
-            const auto txoData = oldOutput.getData();
-            if(!txoData["publicKey"].isNull()) {
-                const auto txoStr = txoData["publicKey"].asString() + oldOutputId;
+            const Json::Value& publicKey = oldOutput["data"]["publicKey"];
+            if(!publicKey.isNull()) {
+                const auto txoStr = ownerKey(publicKey.asString(), oldOutputId);
+                stxos->erase(dbTransaction, txoStr, 0);
                 utxos->put(dbTransaction, txoStr, Json::nullValue, 0);
             }
         }
 
         transactions->erase(dbTransaction, tx.getId().toString());
-
-		replayTxs.insert(tx);
     }
 
-    const dbBlock tipDB = getBlockDB(dbTransaction, "tip");
+    blockIndex.disconnect();
 
-    blocks->erase(dbTransaction, std::to_string(tipDB.getHeight()), 0);
-    blocks->erase(dbTransaction, tip.getId().toString());
-    blocks->put(dbTransaction, "tip", getBlockDB(dbTransaction,
-                tip.getPreviousBlockId().toString()).toJson());
+    blocks->erase(dbTransaction, std::to_string(tip.getHeight()), 0);
+    blocks->erase(dbTransaction, tipId);
+    undos->erase(dbTransaction, tipId);
+    unflushed->erase(dbTransaction, tipId);
+    blocks->put(dbTransaction, "tip", blocks->get(dbTransaction,
+                tip.getPreviousBlockId().toString()));
 
-    candidates->put(dbTransaction, tip.getId().toString(), tip.toJson());
+    candidates->put(dbTransaction, tipId, tip.toJson());
 
-    mempoolMutex.lock();
-	unconfirmedTransactions.rescanMempool(dbTransaction, this);
-    mempoolMutex.unlock();
+    return tip;
+}
+
+Json::Value CryptoKernel::Blockchain::buildUndo(Storage::Transaction* dbTransaction,
+        const block& connected) {
+    Json::Value undo;
+    undo["spent"] = Json::Value(Json::objectValue);
 
-	for(const auto& tx : replayTxs) {
-		if(!std::get<0>(submitTransaction(dbTransaction, tx))) {
-            log->printf(LOG_LEVEL_WARN,
-                        "Blockchain::reverseBlock(): previously moved transaction is now invalid");
+    for(const transaction& tx : connected.getTransactions()) {
+        for(const input& inp : tx.getInputs()) {
+            const std::string outputId = inp.getOutputId().toString();
+            undo["spent"][outputId] = stxos->get(dbTransaction, outputId);
         }
-	}
+    }
+
+    return undo;
+}
+
+void CryptoKernel::Blockchain::restoreMempool(Storage::Transaction* dbTransaction,
+        const std::vector<block>& disconnected) {
+    // Done once for every block a reorg disconnects, rather than after each
+    {
+        std::lock_guard<std::mutex> lock(mempoolMutex);
+        for(const block& reversed : disconnected) {
+            unconfirmedTransactions.removeSpenders(reversed);
+        }
+        unconfirmedTransactions.recheckScripts(dbTransaction, this);
+    }
+
+    for(const block& reversed : disconnected) {
+        for(const transaction& tx : reversed.getTransactions()) {
+            if(!std::get<0>(submitTransaction(dbTransaction, tx))) {
+                log->printf(LOG_LEVEL_WARN,
+                            "Blockchain::restoreMempool(): previously moved transaction is now invalid");
+            }
+        }
+    }
 }
 
 CryptoKernel::Blockchain::dbTransaction CryptoKernel::Blockchain::getTransactionDB(
@@ -997,12 +1574,12 @@ CryptoKernel::Blockchain::transaction CryptoKernel::Blockchain::getTransaction(
 
     const dbTransaction tx = dbTransaction(jsonTx);
     std::set<output> outputs;
-    for(const BigNum& id : tx.getOutputs()) {
+    for(const uint256& id : tx.getOutputs()) {
         outputs.insert(getOutput(transaction, id.toString()));
     }
 
     std::set<input> inps;
-    for(const BigNum& id : tx.getInputs()) {
+    for(const uint256& id : tx.getInputs()) {
         inps.insert(input(inputs->get(transaction, id.toString())));
     }
 
@@ -1011,9 +1588,12 @@ CryptoKernel::Blockchain::transaction CryptoKernel::Blockchain::getTransaction(
 }
 
 void CryptoKernel::Blockchain::emptyDB() {
+    utxoCache->clear();
+    unflushedBlocks.clear();
+    blockIndex.clear();
     blockdb.reset();
     CryptoKernel::Storage::destroy(dbDir);
-    blockdb.reset(new CryptoKernel::Storage(dbDir, false, 20, true));
+    openDB();
 }
 
 CryptoKernel::Storage::Transaction* CryptoKernel::Blockchain::getTxHandle() {
@@ -1021,57 +1601,122 @@ CryptoKernel::Storage::Transaction* CryptoKernel::Blockchain::getTxHandle() {
     return dbTx;
 }
 
-CryptoKernel::Blockchain::Mempool::Mempool() {
+CryptoKernel::Blockchain::Mempool::Mempool(const uint64_t maxBytes) {
 	bytes = 0;
+    this->maxBytes = maxBytes;
+    selectedBytes = 0;
+    selectedFees = 0;
+    selectionVersion = 0;
+    selectionStale = false;
+}
+
+uint64_t CryptoKernel::Blockchain::Mempool::feeRate(const uint64_t fee, const unsigned int bytes) {
+    return fee / bytes * 1024 + fee % bytes * 1024 / bytes;
 }
 
-bool CryptoKernel::Blockchain::Mempool::insert(const transaction& tx) {
+bool CryptoKernel::Blockchain::Mempool::insert(const transaction& tx, const uint64_t fee,
+        const bool runsScripts) {
+    const uint256& txId = tx.getId();
+
 	// Check if any inputs or outputs conflict
-	if(txs.find(tx.getId()) != txs.end()) {
+	if(txs.contains(txId)) {
 		return false;
 	}
 
 	for(const input& inp : tx.getInputs()) {
-		if(inputs.find(inp.getId()) != inputs.end()) {
+		if(inputs.contains(inp.getId())) {
 			return false;
 		}
 
-        if(outputs.find(inp.getOutputId()) != outputs.end()) {
+        const uint256& outputId = inp.getOutputId();
+        if(outputs.contains(outputId) || spends.contains(outputId)) {
             return false;
         }
 	}
 
 	for(const output& out : tx.getOutputs()) {
-		if(outputs.find(out.getId()) != outputs.end()) {
+        const uint256& outputId = out.getId();
+		if(outputs.contains(outputId) || spends.contains(outputId)) {
 			return false;
 		}
 	}
 
-	txs.insert(std::pair<BigNum, transaction>(tx.getId(), tx));
+    // Only evict transactions paying strictly less per byte, and only if
+    // that frees enough room
+    const uint64_t rate = feeRate(fee, tx.size());
+    uint64_t freed = 0;
+    for(auto it = byFeeRate.begin(); bytes - freed + tx.size() > maxBytes; ++it) {
+        if(it == byFeeRate.end() || it->first >= rate) {
+            return false;
+        }
+
+        freed += txs.find(it->second)->tx.size();
+    }
+
+    removeCheapest(maxBytes - tx.size());
+
+	txs.insert(txId, Entry{tx, fee, rate});
+    byFeeRate.insert(std::make_pair(rate, txId));
 
     bytes += tx.size();
 
+    // Transactions are independent, so anything that fits can join the
+    // selection. One that does not only matters if it pays more than
+    // something already selected.
+    if(!selectionStale) {
+        if(selectedBytes + tx.size() < maxSelectedBytes) {
+            selected.insert(std::make_pair(rate, txId));
+            selectedBytes += tx.size();
+            selectedFees += fee;
+            selectionVersion++;
+        } else if(!selected.empty() && rate > selected.begin()->first) {
+            selectionStale = true;
+        }
+    }
+
 	for(const input& inp : tx.getInputs()) {
-		inputs.insert(std::pair<BigNum, BigNum>(inp.getId(), tx.getId()));
-        outputs.insert(std::pair<BigNum, BigNum>(inp.getOutputId(), tx.getId()));
+		inputs.insert(inp.getId(), txId);
+        spends.insert(inp.getOutputId(), txId);
 	}
 
 	for(const output& out : tx.getOutputs()) {
-		outputs.insert(std::pair<BigNum, BigNum>(out.getId(), tx.getId()));
+		outputs.insert(out.getId(), txId);
 	}
 
+    if(runsScripts) {
+        scriptTxs.insert(txId);
+    }
+
 	return true;
 }
 
 void CryptoKernel::Blockchain::Mempool::remove(const transaction& tx) {
-	if(txs.find(tx.getId()) != txs.end()) {
-		txs.erase(tx.getId());
+    const uint256& txId = tx.getId();
+    const Entry* entry = txs.find(txId);
+	if(entry != nullptr) {
+        const auto key = std::make_pair(entry->feeRate, txId);
+        byFeeRate.erase(key);
+
+        if(selected.erase(key) > 0) {
+            selectedBytes -= tx.size();
+            selectedFees -= entry->fee;
+            selectionVersion++;
+        }
+
+		txs.erase(txId);
+
+        // The space freed may fit transactions left out
+        if(selected.size() < txs.size()) {
+            selectionStale = true;
+        }
+
+        scriptTxs.erase(txId);
 
         bytes -= tx.size();
 
 		for(const input& inp : tx.getInputs()) {
 			inputs.erase(inp.getId());
-            outputs.erase(inp.getOutputId());
+            spends.erase(inp.getOutputId());
 		}
 
 		for(const output& out : tx.getOutputs()) {
@@ -1080,37 +1725,149 @@ void CryptoKernel::Blockchain::Mempool::remove(const transaction& tx) {
 	}
 }
 
-void CryptoKernel::Blockchain::Mempool::rescanMempool(Storage::Transaction* dbTx, Blockchain* blockchain) {
+void CryptoKernel::Blockchain::Mempool::removeCheapest(const uint64_t maxBytes) {
+    while(bytes > maxBytes && !byFeeRate.empty()) {
+        // Copied, as remove() destroys the entry
+        const transaction cheapest = txs.find(byFeeRate.begin()->second)->tx;
+        remove(cheapest);
+    }
+}
+
+void CryptoKernel::Blockchain::Mempool::setMaxSize(const uint64_t maxBytes) {
+    this->maxBytes = maxBytes;
+    removeCheapest(maxBytes);
+}
+
+unsigned int CryptoKernel::Blockchain::Mempool::removeConflicts(const block& connected) {
+    std::set<uint256> removals;
+
+    const auto collect = [&](const transaction& tx) {
+        for(const input& inp : tx.getInputs()) {
+            const uint256* spender = spends.find(inp.getOutputId());
+            if(spender != nullptr) {
+                removals.insert(*spender);
+            }
+        }
+
+        for(const output& out : tx.getOutputs()) {
+            const uint256* creator = outputs.find(out.getId());
+            if(creator != nullptr) {
+                removals.insert(*creator);
+            }
+        }
+    };
+
+    collect(connected.getCoinbaseTx());
+    for(const transaction& tx : connected.getTransactions()) {
+        collect(tx);
+    }
+
+    for(const uint256& id : removals) {
+        const transaction tx = txs.find(id)->tx;
+        remove(tx);
+    }
+
+    return removals.size();
+}
+
+unsigned int CryptoKernel::Blockchain::Mempool::removeSpenders(const block& disconnected) {
+    std::set<uint256> removals;
+
+    const auto collect = [&](const transaction& tx) {
+        for(const output& out : tx.getOutputs()) {
+            const uint256* spender = spends.find(out.getId());
+            if(spender != nullptr) {
+                removals.insert(*spender);
+            }
+        }
+    };
+
+    collect(disconnected.getCoinbaseTx());
+    for(const transaction& tx : disconnected.getTransactions()) {
+        collect(tx);
+    }
+
+    for(const uint256& id : removals) {
+        const transaction tx = txs.find(id)->tx;
+        remove(tx);
+    }
+
+    return removals.size();
+}
+
+unsigned int CryptoKernel::Blockchain::Mempool::recheckScripts(Storage::Transaction* dbTx,
+        Blockchain* blockchain) {
 	std::set<transaction> removals;
 
-	for(const auto& tx : txs) {
-        if(!std::get<0>(blockchain->verifyTransaction(dbTx, tx.second))) {
-			removals.insert(tx.second);
+	scriptTxs.forEach([&](const uint256& id) {
+        const transaction& tx = txs.find(id)->tx;
+        if(!std::get<0>(blockchain->verifyTransaction(dbTx, tx))) {
+			removals.insert(tx);
 		}
-	}
+	});
 
 	for(const auto& tx : removals) {
 		remove(tx);
 	}
+
+    return removals.size();
 }
 
-std::set<CryptoKernel::Blockchain::transaction> CryptoKernel::Blockchain::Mempool::getTransactions() const {
-	uint64_t totalSize = 0;
-	std::set<transaction> returning;
+void CryptoKernel::Blockchain::Mempool::select() {
+    // Give up on filling the block after this many transactions in a row
+    // did not fit, rather than walk the whole mempool
+    const unsigned int maxMisses = 1000;
+
+    selected.clear();
+    selectedBytes = 0;
+    selectedFees = 0;
+    unsigned int misses = 0;
+
+	for(auto it = byFeeRate.rbegin(); it != byFeeRate.rend() && misses < maxMisses; ++it) {
+        const Entry& entry = *txs.find(it->second);
+		if(selectedBytes + entry.tx.size() < maxSelectedBytes) {
+			selected.insert(*it);
+			selectedBytes += entry.tx.size();
+            selectedFees += entry.fee;
+            misses = 0;
+		} else {
+            misses++;
+        }
+	}
 
-	for(const auto& it : txs) {
-		if(totalSize + it.second.size() < 3.9 * 1024 * 1024) {
-			returning.insert(it.second);
-			totalSize += it.second.size();
-			continue;
-		}
+    selectionVersion++;
+    selectionStale = false;
+}
 
-		break;
-	}
+std::set<CryptoKernel::Blockchain::transaction> CryptoKernel::Blockchain::Mempool::getTransactions() {
+    if(selectionStale) {
+        select();
+    }
+
+	std::set<transaction> returning;
+    for(const auto& key : selected) {
+        returning.insert(txs.find(key.second)->tx);
+    }
 
 	return returning;
 }
 
+uint64_t CryptoKernel::Blockchain::Mempool::getSelectedFees() {
+    if(selectionStale) {
+        select();
+    }
+
+    return selectedFees;
+}
+
+uint64_t CryptoKernel::Blockchain::Mempool::getSelectionVersion() {
+    if(selectionStale) {
+        select();
+    }
+
+    return selectionVersion;
+}
+
 unsigned int CryptoKernel::Blockchain::Mempool::count() const {
     return txs.size();
 }
@@ -1126,3 +1883,104 @@ unsigned int CryptoKernel::Blockchain::mempoolCount() const {
 unsigned int CryptoKernel::Blockchain::mempoolSize() const {
     return unconfirmedTransactions.size();
 }
+
+CryptoKernel::Storage::CacheStats CryptoKernel::Blockchain::getCacheStats() {
+    return blockdb->getCacheStats();
+}
+
+bool CryptoKernel::Blockchain::setBulkImport(const bool bulk) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    if(bulk == bulkImport) {
+        return true;
+    }
+
+    if(!blockdb->reopen(bulk ? bulkProfile : dbProfile)) {
+        return false;
+    }
+
+    bulkImport = bulk;
+    log->printf(LOG_LEVEL_INFO, std::string("blockchain::setBulkImport(): Block database ") +
+                (bulk ? "switched to" : "switched back from") + " the bulk import profile");
+
+    return true;
+}
+
+void CryptoKernel::Blockchain::setMempoolSize(const unsigned int megabytes) {
+    std::lock_guard<std::mutex> lock(mempoolMutex);
+    unconfirmedTransactions.setMaxSize(uint64_t(megabytes) * 1024 * 1024);
+}
+
+CryptoKernel::SignatureCache::Stats CryptoKernel::Blockchain::getSignatureCacheStats() {
+    return sigCache->getStats();
+}
+
+Json::Value CryptoKernel::Blockchain::getStorageMetrics() {
+    return blockdb->getMetrics();
+}
+
+void CryptoKernel::Blockchain::setMetricsInterval(const unsigned int seconds) {
+    {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        metricsInterval = seconds;
+    }
+    metricsCondition.notify_all();
+
+    if(metricsThread) {
+        metricsThread->join();
+        metricsThread.reset();
+    }
+
+    if(seconds > 0) {
+        metricsThread.reset(new std::thread(&CryptoKernel::Blockchain::metricsFunc, this));
+    }
+}
+
+void CryptoKernel::Blockchain::metricsFunc() {
+    std::unique_lock<std::mutex> lock(metricsMutex);
+    const unsigned int seconds = metricsInterval;
+    while(metricsInterval == seconds) {
+        if(!metricsCondition.wait_for(lock, std::chrono::seconds(seconds), [&]() {
+                return metricsInterval != seconds;
+            })) {
+            logStorageMetrics();
+        }
+    }
+}
+
+void CryptoKernel::Blockchain::setVerifyThreads(const unsigned int threads) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+
+    // The thread submitting the block verifies transactions too
+    verifyPool.reset(new ThreadPool(threads > 1 ? threads - 1 : 0));
+}
+
+void CryptoKernel::Blockchain::setUtxoCacheSize(const unsigned int megabytes) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    if(status) {
+        flushUtxos();
+    }
+    utxoCache.reset(new UtxoCache(utxos.get(), uint64_t(megabytes) * 1024 * 1024));
+}
+
+void CryptoKernel::Blockchain::logStorageMetrics() {
+    const Json::Value metrics = getStorageMetrics();
+
+    log->printf(LOG_LEVEL_INFO, "blockchain::logStorageMetrics(): " +
+                metrics["commits"].asString() + " commits, " +
+                metrics["conflicts"].asString() + " conflicts, commit p50 " +
+                metrics["commitLatency"]["p50"].asString() + "us p99 " +
+                metrics["commitLatency"]["p99"].asString() + "us");
+
+    for(const std::string& name : metrics["tables"].getMemberNames()) {
+        const Json::Value& table = metrics["tables"][name];
+        log->printf(LOG_LEVEL_INFO, "blockchain::logStorageMetrics(): " + name + ": " +
+                    table["gets"].asString() + " gets, " +
+                    table["puts"].asString() + " puts, " +
+                    table["erases"].asString() + " erases, " +
+                    table["bytesRead"].asString() + " bytes read, " +
+                    table["bytesWritten"].asString() + " bytes written, " +
+                    table["scans"].asString() + " scans, get p50 " +
+                    table["getLatency"]["p50"].asString() + "us p99 " +
+                    table["getLatency"]["p99"].asString() + "us");
+    }
+}
@@ -22,17 +22,39 @@
 #include <set>
 #include <memory>
 #include <map>
+#include <thread>
+#include <condition_variable>
 
 #include "storage.h"
 #include "log.h"
+#include "blockindex.h"
 #include "ckmath.h"
+#include "idmap.h"
+#include "threadpool.h"
+#include "utxocache.h"
+#include "sigcache.h"
 
 namespace CryptoKernel {
 class Consensus;
 class Blockchain {
 public:
+    /**
+    * Constructs a blockchain using the block database in the given directory
+    *
+    * @param GlobalLog a pointer to the CK log to use
+    * @param dbDir the directory of the block database
+    * @param cacheSize the size in MB of the decoded value cache shared between
+             block database transactions, 0 turns the cache off
+    * @param dbProfile json LevelDB tuning profile for the block database, see
+             Storage::loadProfile
+    * @param bulkProfile json LevelDB tuning profile used while bulk importing
+             blocks, unset keys are taken from dbProfile
+    */
     Blockchain(CryptoKernel::Log* GlobalLog,
-               const std::string& dbDir);
+               const std::string& dbDir,
+               const unsigned int cacheSize = 32,
+               const Json::Value& dbProfile = Json::Value(),
+               const Json::Value& bulkProfile = Json::Value());
     virtual ~Blockchain();
 
     class InvalidElementException : public std::exception {
@@ -61,6 +83,14 @@ public:
         std::string message;
     };
 
+    class transaction;
+    class block;
+
+    /**
+    * Outputs, inputs and transactions cannot be changed once constructed.
+    * Their contents and the id calculated from them are shared between
+    * copies, so copying one only copies a pointer.
+    */
     class output {
     public:
         output(const uint64_t value, const uint64_t nonce, const Json::Value& data);
@@ -68,49 +98,108 @@ public:
 
         Json::Value toJson() const;
 
+        /**
+        * Returns the canonical binary encoding of the output. Decoding it
+        * gives an output with the same id and json form.
+        */
+        std::string toBinary() const;
+
+        /**
+        * Decodes an output from the encoding returned by toBinary
+        *
+        * @param data the binary encoding of the output
+        * @return the decoded output
+        * @throws InvalidElementException if the data is not the canonical
+                  encoding of a valid output
+        */
+        static output fromBinary(const std::string& data);
+
         uint64_t getValue() const;
         uint64_t getNonce() const;
-        Json::Value getData() const;
+        const Json::Value& getData() const;
 
-        BigNum getId() const;
+        const uint256& getId() const;
 
         bool operator<(const output& rhs) const;
 
     private:
+        friend class transaction;
+
+        struct State {
+            uint64_t value;
+            uint64_t nonce;
+            Json::Value data;
+
+            uint256 id;
+
+            // Length of the compact json text, without the final newline
+            unsigned int jsonSize;
+        };
+
+        void init(const std::shared_ptr<State>& newState);
+
         void checkRep();
 
-        BigNum calculateId();
+        uint256 calculateId(const std::string& dataText);
 
-        uint64_t value;
-        uint64_t nonce;
-        Json::Value data;
+        void writeBinary(std::string& out) const;
+        static output readBinary(const char*& pos, const char* end);
 
-        BigNum id;
+        std::shared_ptr<const State> state;
     };
 
     class input {
     public:
-        input(const BigNum& outputId, const Json::Value& data);
+        input(const uint256& outputId, const Json::Value& data);
         input(const Json::Value& inputJson);
 
         Json::Value toJson() const;
 
-        Json::Value getData() const;
-        BigNum getOutputId() const;
-        BigNum getId() const;
+        /**
+        * Returns the canonical binary encoding of the input. Decoding it
+        * gives an input with the same id and json form.
+        */
+        std::string toBinary() const;
+
+        /**
+        * Decodes an input from the encoding returned by toBinary
+        *
+        * @param data the binary encoding of the input
+        * @return the decoded input
+        * @throws InvalidElementException if the data is not the canonical
+                  encoding of a valid input
+        */
+        static input fromBinary(const std::string& data);
+
+        const Json::Value& getData() const;
+        const uint256& getOutputId() const;
+        const uint256& getId() const;
 
         bool operator<(const input& rhs) const;
 
     private:
-        void checkRep();
+        friend class transaction;
 
-        BigNum calculateId();
+        struct State {
+            uint256 outputId;
+            Json::Value data;
 
-        BigNum outputId;
-        Json::Value data;
+            uint256 id;
+
+            // Length of the compact json text, without the final newline
+            unsigned int jsonSize;
+        };
+
+        void init(const std::shared_ptr<State>& newState);
+
+        void checkRep();
+
+        uint256 calculateId(const std::string& dataText);
 
-        BigNum id;
+        void writeBinary(std::string& out) const;
+        static input readBinary(const char*& pos, const char* end);
 
+        std::shared_ptr<const State> state;
     };
 
     class transaction {
@@ -121,70 +210,137 @@ public:
 
         Json::Value toJson() const;
 
-        BigNum getId() const;
+        /**
+        * Returns the canonical binary encoding of the transaction. Decoding
+        * it gives a transaction with the same id and json form.
+        */
+        std::string toBinary() const;
+
+        /**
+        * Decodes a transaction from the encoding returned by toBinary
+        *
+        * @param data the binary encoding of the transaction
+        * @param coinbaseTx true if the transaction is a coinbase transaction
+        * @return the decoded transaction
+        * @throws InvalidElementException if the data is not the canonical
+                  encoding of a valid transaction
+        */
+        static transaction fromBinary(const std::string& data, const bool coinbaseTx = false);
+
+        const uint256& getId() const;
         uint64_t getTimestamp() const;
-        std::set<input> getInputs() const;
-        std::set<output> getOutputs() const;
+        const std::set<input>& getInputs() const;
+        const std::set<output>& getOutputs() const;
 
-        BigNum getOutputSetId() const;
+        const uint256& getOutputSetId() const;
 
-        static BigNum getOutputSetId(const std::set<output>& outputs);
+        static uint256 getOutputSetId(const std::set<output>& outputs);
 
         bool operator<(const transaction& rhs) const;
 
         unsigned int size() const;
 
     private:
-        void checkRep(const bool coinbaseTx);
+        struct State {
+            std::set<input> inputs;
+            std::set<output> outputs;
+            uint64_t timestamp;
 
-        BigNum calculateId();
+            uint256 outputSetId;
+            uint256 id;
 
-        std::set<input> inputs;
-        std::set<output> outputs;
-        uint64_t timestamp;
+            unsigned int bytes;
+        };
+
+        friend class block;
+
+        transaction(const std::shared_ptr<State>& newState, const bool coinbaseTx);
 
-        BigNum id;
+        void init(const std::shared_ptr<State>& newState, const bool coinbaseTx);
 
-        unsigned int bytes;
+        void checkRep(const bool coinbaseTx);
+
+        uint256 calculateId();
+
+        void writeBinary(std::string& out) const;
+        static transaction readBinary(const char*& pos, const char* end, const bool coinbaseTx);
+
+        std::shared_ptr<const State> state;
     };
 
     class block {
     public:
         block(const std::set<transaction>& transactions, const transaction& coinbaseTx,
-              const BigNum& previousBlockId, const uint64_t timestamp, const Json::Value& consensusData,
+              const uint256& previousBlockId, const uint64_t timestamp, const Json::Value& consensusData,
               const uint64_t height, const Json::Value data = Json::nullValue);
         block(const Json::Value& jsonBlock);
 
         Json::Value toJson() const;
 
-        std::set<transaction> getTransactions() const;
-        transaction getCoinbaseTx() const;
-        BigNum getPreviousBlockId() const;
+        /**
+        * Returns the canonical binary encoding of the block. Decoding it
+        * gives a block with the same id and json form.
+        */
+        std::string toBinary() const;
+
+        /**
+        * Decodes a block from the encoding returned by toBinary, checking
+        * it the same way as a block parsed from json
+        *
+        * @param data the binary encoding of the block
+        * @return the decoded block
+        * @throws InvalidElementException if the data is not the canonical
+                  encoding of a valid block
+        */
+        static block fromBinary(const std::string& data);
+
+        const std::set<transaction>& getTransactions() const;
+        const transaction& getCoinbaseTx() const;
+        const uint256& getPreviousBlockId() const;
         uint64_t getTimestamp() const;
-        Json::Value getConsensusData() const;
-		Json::Value getData() const;
+        const Json::Value& getConsensusData() const;
+		const Json::Value& getData() const;
         uint64_t getHeight() const;
-		BigNum getTransactionMerkleRoot() const;
+		const uint256& getTransactionMerkleRoot() const;
 
         void setConsensusData(const Json::Value& data);
 
-        BigNum getId() const;
+        const uint256& getId() const;
+
+        /**
+        * Returns the length of the compact json text of the block, without
+        * serializing it. The block size limit is defined on this length.
+        */
+        size_t jsonSize() const;
 
     private:
+        friend class Blockchain;
+
+        /**
+        * Constructs a block from transactions already known to be
+        * consistent with each other and whose merkle root is known, such
+        * as a selection from the mempool. Skips the checks made on blocks
+        * from elsewhere, which would serialize the whole block.
+        */
+        block(const std::set<transaction>& transactions, const uint256& transactionMerkleRoot,
+              const transaction& coinbaseTx, const uint256& previousBlockId,
+              const uint64_t timestamp, const Json::Value& consensusData, const uint64_t height,
+              const Json::Value& data = Json::nullValue);
+
         void checkRep();
 
-        BigNum calculateId();
+        uint256 calculateId();
 
         std::set<transaction> transactions;
         transaction coinbaseTx;
-        BigNum previousBlockId;
+        uint256 previousBlockId;
         uint64_t timestamp;
         Json::Value consensusData;
 		Json::Value data;
         uint64_t height;
-		BigNum transactionMerkleRoot;
+		uint256 transactionMerkleRoot;
 
-        BigNum id;
+        uint256 id;
     };
 
     class dbBlock {
@@ -195,33 +351,79 @@ public:
 
         Json::Value toJson() const;
 
-        std::set<BigNum> getTransactions() const;
-        BigNum getCoinbaseTx() const;
-        BigNum getPreviousBlockId() const;
+        std::set<uint256> getTransactions() const;
+        uint256 getCoinbaseTx() const;
+        uint256 getPreviousBlockId() const;
         uint64_t getTimestamp() const;
         Json::Value getConsensusData() const;
 		Json::Value getData() const;
-		BigNum getTransactionMerkleRoot() const;
+		uint256 getTransactionMerkleRoot() const;
 
         uint64_t getHeight() const;
 
-        BigNum getId() const;
+        uint256 getId() const;
 
     private:
         void checkRep();
 
-        BigNum calculateId();
+        uint256 calculateId();
 
-        std::set<BigNum> transactions;
-        BigNum coinbaseTx;
-        BigNum previousBlockId;
+        std::set<uint256> transactions;
+        uint256 coinbaseTx;
+        uint256 previousBlockId;
         uint64_t timestamp;
         Json::Value consensusData;
 		Json::Value data;
         uint64_t height;
-		BigNum transactionMerkleRoot;
+		uint256 transactionMerkleRoot;
+
+        uint256 id;
+    };
+
+    /**
+    * The fields of a block its id is calculated from, plus its height and
+    * consensus data, without the transactions. A chain of headers can be
+    * linked, checked and compared before any block in it is downloaded.
+    */
+    class header {
+    public:
+        header(const block& fullBlock);
+        header(const dbBlock& storedBlock);
+        header(const Json::Value& jsonHeader);
+
+        Json::Value toJson() const;
+
+        const uint256& getCoinbaseTx() const;
+        const uint256& getPreviousBlockId() const;
+        uint64_t getTimestamp() const;
+        const Json::Value& getConsensusData() const;
+        const Json::Value& getData() const;
+        uint64_t getHeight() const;
+
+        /**
+        * Returns true if the block has transactions besides the coinbase,
+        * in which case their merkle root is part of the id
+        */
+        bool hasTransactions() const;
+        const uint256& getTransactionMerkleRoot() const;
+
+        const uint256& getId() const;
+
+    private:
+        void checkRep();
+
+        uint256 calculateId();
+
+        uint256 coinbaseTx;
+        uint256 previousBlockId;
+        uint64_t timestamp;
+        Json::Value consensusData;
+        Json::Value data;
+        uint64_t height;
+        bool transactions;
+        uint256 transactionMerkleRoot;
 
-        BigNum id;
+        uint256 id;
     };
 
     class dbInput : public input {
@@ -234,41 +436,41 @@ public:
 
     class dbOutput : public output {
     public:
-        dbOutput(const output& compactOutput, const BigNum& creationTx);
+        dbOutput(const output& compactOutput, const uint256& creationTx);
         dbOutput(const Json::Value& jsonOutput);
 
         Json::Value toJson() const;
 
     private:
-        BigNum creationTx;
+        uint256 creationTx;
     };
 
     class dbTransaction {
     public:
-        dbTransaction(const transaction& compactTransaction, const BigNum& confirmingBlock,
+        dbTransaction(const transaction& compactTransaction, const uint256& confirmingBlock,
                       const bool coinbaseTx = false);
         dbTransaction(const Json::Value& jsonTransaction);
 
         Json::Value toJson() const;
 
-        BigNum getId() const;
+        uint256 getId() const;
         bool isCoinbaseTx() const;
         uint64_t getTimestamp() const;
-        std::set<BigNum> getInputs() const;
-        std::set<BigNum> getOutputs() const;
+        std::set<uint256> getInputs() const;
+        std::set<uint256> getOutputs() const;
 
     private:
         void checkRep();
 
-        BigNum calculateId();
+        uint256 calculateId();
 
-        BigNum confirmingBlock;
+        uint256 confirmingBlock;
         bool coinbaseTx;
         uint64_t timestamp;
-        std::set<BigNum> inputs;
-        std::set<BigNum> outputs;
+        std::set<uint256> inputs;
+        std::set<uint256> outputs;
 
-        BigNum id;
+        uint256 id;
     };
 
     std::tuple<bool, bool> submitTransaction(const transaction& tx);
@@ -288,6 +490,77 @@ public:
 
     block buildBlock(Storage::Transaction* transaction, const dbBlock& dbblock);
 
+    /**
+    * Retrieves a block and its ancestors from the in-memory block index,
+    * without reading the block database
+    *
+    * @param id the id of the block to start from, in the main chain or not
+    * @param count the most blocks to return
+    * @return the index entries of the block and its ancestors, newest first
+    * @throw NotFoundException if the block is not known
+    */
+    std::vector<BlockIndex::Entry> getAncestry(const uint256& id, const size_t count);
+
+    /**
+    * Retrieves the header of a block, in the main chain or not
+    *
+    * @param id the id of the block
+    * @return the header of the block
+    * @throw NotFoundException if the block is not known
+    */
+    header getHeader(const uint256& id);
+
+    /**
+    * Returns the ids of main chain blocks a peer can use to find where its
+    * chain leaves ours: the last ten blocks, then back in doubling steps,
+    * ending with the genesis block
+    *
+    * @return the block ids, newest first
+    */
+    std::vector<uint256> getLocator();
+
+    /**
+    * Returns the main chain headers after the newest block of a locator
+    * that is in our main chain, or after the genesis block if none are
+    *
+    * @param locator block ids from another chain, newest first
+    * @param count the most headers to return
+    * @return consecutive headers, oldest first
+    */
+    std::vector<header> getHeaders(const std::vector<uint256>& locator, const size_t count);
+
+    /**
+    * Checks a chain of headers with what can be checked without their
+    * transactions: that they link up, that their heights follow on, that
+    * they are not from the future and the consensus rules for headers
+    *
+    * @param headers a chain of headers building on one of our blocks,
+    *        oldest first
+    * @param from the first header to check, the ones before it having
+    *        already passed
+    * @throw NotFoundException if the first header builds on a block we do
+    *        not have
+    * @throw InvalidElementException if a header is invalid
+    */
+    void checkHeaders(const std::vector<header>& headers, const size_t from = 0);
+
+    /**
+    * Returns true if a chain ending in the given header would take over
+    * from the current main chain
+    *
+    * @param tip the last header of the chain
+    */
+    bool isChainBetter(const header& tip);
+
+    /**
+    * Returns true if a chain ending in the first header is better than
+    * one ending in the second, for choosing between peers' chains
+    *
+    * @param tip the last header of the chain
+    * @param otherTip the last header of the chain compared against
+    */
+    bool isChainBetter(const header& tip, const header& otherTip);
+
     block getBlock(const std::string& id);
 
     /**
@@ -356,6 +629,194 @@ public:
     unsigned int mempoolCount() const;
     unsigned int mempoolSize() const;
 
+    /**
+    * Returns the hit and miss counters of the block database value cache
+    *
+    * @return a CacheStats struct describing the cache
+    */
+    Storage::CacheStats getCacheStats();
+
+    /**
+    * Switches the block database to or from the bulk import profile. The
+    * database is only reopened when nothing is reading from it, so the call
+    * may need to be repeated.
+    *
+    * @param bulk true to use the bulk import profile, false for the normal one
+    * @return true if the database now uses the requested profile
+    */
+    bool setBulkImport(const bool bulk);
+
+    /**
+    * Returns the per-table counters and latency histograms of the block
+    * database
+    *
+    * @return a JSON object as described by Storage::getMetrics()
+    */
+    Json::Value getStorageMetrics();
+
+    /**
+    * Starts writing the block database metrics to the log every given
+    * number of seconds
+    *
+    * @param seconds the time between each dump, 0 stops dumping
+    */
+    void setMetricsInterval(const unsigned int seconds);
+
+    /**
+    * Sets the number of threads that verify the transactions of each new
+    * block, including the thread submitting the block. Defaults to the
+    * number of hardware threads.
+    *
+    * @param threads the number of threads to use, at least 1
+    */
+    void setVerifyThreads(const unsigned int threads);
+
+    /**
+    * Sets the memory budget of the unspent output cache. Changes to the
+    * unspent outputs are kept in memory and written to the block database
+    * together once the budget is used up, when the chain reorganizes and
+    * on shutdown. Defaults to 100MB.
+    *
+    * @param megabytes the memory the cache may use in MB
+    */
+    void setUtxoCacheSize(const unsigned int megabytes);
+
+    /**
+    * Returns the hit and miss counters of the signature cache
+    *
+    * @return a SignatureCache::Stats struct describing the cache
+    */
+    SignatureCache::Stats getSignatureCacheStats();
+
+    /**
+    * Sets the most memory unconfirmed transactions may take up. Once full,
+    * a transaction is only accepted if it pays a higher fee per byte than
+    * those it would evict. Defaults to 300MB.
+    *
+    * @param megabytes the size limit of the mempool in MB
+    */
+    void setMempoolSize(const unsigned int megabytes);
+
+	/**
+	* Unconfirmed transactions, ordered by the fee they pay per byte. The
+	* mempool never holds a transaction that spends another one's outputs,
+	* so a transaction only becomes invalid when the chain spends or
+	* creates one of its outputs, or when a connected or disconnected block
+	* changes what its scripts read.
+	*/
+	class Mempool {
+		public:
+			/**
+			* Creates an empty mempool
+			*
+			* @param maxBytes the total size of transactions it may hold
+			*/
+			Mempool(const uint64_t maxBytes = uint64_t(300) * 1024 * 1024);
+
+			/**
+			* Adds a transaction unless it conflicts with one already held.
+			* When the mempool is full, transactions paying less per byte
+			* are evicted to make room.
+			*
+			* @param tx the transaction to add
+			* @param fee the fee the transaction pays
+			* @param runsScripts true if the transaction's validity can depend
+			*        on chain state other than the outputs it spends
+			* @return true if the transaction was added, false if it conflicts
+			*         or pays too little to fit
+			*/
+			bool insert(const transaction& tx, const uint64_t fee,
+			            const bool runsScripts = false);
+			void remove(const transaction& tx);
+
+			/**
+			* Returns the transactions selected for the next block. The
+			* selection is kept up to date as transactions are added and
+			* removed, and only chosen again, highest fee per byte first,
+			* when that could change which transactions fit.
+			*
+			* @return transactions that fit in a block
+			*/
+			std::set<transaction> getTransactions();
+
+			/**
+			* Returns the total fee paid by the selected transactions
+			*/
+			uint64_t getSelectedFees();
+
+			/**
+			* Returns a number that changes whenever the selected
+			* transactions do
+			*/
+			uint64_t getSelectionVersion();
+
+			/**
+			* Changes the size limit, evicting the cheapest transactions
+			* until the mempool fits
+			*/
+			void setMaxSize(const uint64_t maxBytes);
+
+			/**
+			* Removes transactions spending the same outputs as, or creating
+			* the same outputs as, the transactions in a connected block
+			*
+			* @return the number of transactions removed
+			*/
+			unsigned int removeConflicts(const block& connected);
+
+			/**
+			* Removes transactions spending outputs created by a
+			* disconnected block
+			*
+			* @return the number of transactions removed
+			*/
+			unsigned int removeSpenders(const block& disconnected);
+
+			/**
+			* Verifies again the transactions that run scripts, removing
+			* those no longer valid
+			*
+			* @return the number of transactions removed
+			*/
+			unsigned int recheckScripts(Storage::Transaction* dbTx, Blockchain* blockchain);
+
+            unsigned int count() const;
+            unsigned int size() const;
+
+		private:
+			struct Entry {
+				transaction tx;
+				uint64_t fee;
+				uint64_t feeRate;
+			};
+
+			// Fee per kilobyte, so small fee differences still order
+			static uint64_t feeRate(const uint64_t fee, const unsigned int bytes);
+
+			void removeCheapest(const uint64_t maxBytes);
+			void select();
+
+			static const uint64_t maxSelectedBytes;
+
+			IdMap<Entry> txs;
+			std::set<std::pair<uint64_t, uint256>> byFeeRate;
+
+			// The transactions for the next block, by fee rate
+			std::set<std::pair<uint64_t, uint256>> selected;
+			uint64_t selectedBytes;
+			uint64_t selectedFees;
+			uint64_t selectionVersion;
+			bool selectionStale;
+
+			IdMap<uint256> outputs;
+			IdMap<uint256> spends;
+			IdMap<uint256> inputs;
+			IdSet scriptTxs;
+
+            uint64_t bytes;
+            uint64_t maxBytes;
+	};
+
 private:
     std::unique_ptr<Storage::Table> blocks;
     std::unique_ptr<Storage::Table> candidates;
@@ -363,48 +824,96 @@ private:
     std::unique_ptr<Storage::Table> utxos;
     std::unique_ptr<Storage::Table> stxos;
     std::unique_ptr<Storage::Table> inputs;
+    // Per main chain block, the records of the outputs it spent
+    std::unique_ptr<Storage::Table> undos;
+    // Per main chain block connected since the last flush, the outputs it
+    // created, as their records are otherwise only in the cache
+    std::unique_ptr<Storage::Table> unflushed;
 
     std::unique_ptr<Storage> blockdb;
-    BigNum genesisBlockId;
+    uint256 genesisBlockId;
+
+    // Every block in the blocks and candidates tables. Changed alongside
+    // the transaction updating the chain and undone if it aborts.
+    BlockIndex blockIndex;
+    void loadIndex();
     Log *log;
 
-	class Mempool {
-		public:
-			Mempool();
+    bool runsScripts(Storage::Transaction* dbTx, const transaction& tx);
 
-			bool insert(const transaction& tx);
-			void remove(const transaction& tx);
-			std::set<transaction> getTransactions() const;
-			void rescanMempool(Storage::Transaction* dbTx, Blockchain* blockchain);
+    Mempool unconfirmedTransactions;
+    std::mutex mempoolMutex;
 
-            unsigned int count() const;
-            unsigned int size() const;
+    /**
+    * Transactions for a block on top of a given tip, with what is needed
+    * to build the block quickly
+    */
+    struct BlockTemplate {
+        uint256 tipId;
+        uint64_t version;
+        std::set<transaction> txs;
+        uint64_t fees;
+        uint256 merkleRoot;
+    };
 
-		private:
-			std::map<BigNum, transaction> txs;
-			std::map<BigNum, BigNum> outputs;
-			std::map<BigNum, BigNum> inputs;
+    // Guarded by mempoolMutex
+    std::shared_ptr<const BlockTemplate> blockTemplate;
 
-            unsigned int bytes;
-	};
+    std::shared_ptr<const BlockTemplate> getBlockTemplate(const uint256& tipId);
 
-    Mempool unconfirmedTransactions;
-    std::mutex mempoolMutex;
+    // Storage transactions no longer exclude each other, so changes to the
+    // chain state are serialized here instead
+    std::recursive_mutex chainLock;
 
     std::string dbDir;
+    unsigned int cacheSize;
+    LevelDBEngine::Options dbProfile;
+    LevelDBEngine::Options bulkProfile;
+    bool bulkImport;
+
+    std::unique_ptr<std::thread> metricsThread;
+    std::mutex metricsMutex;
+    std::condition_variable metricsCondition;
+    unsigned int metricsInterval;
+    void metricsFunc();
+    void logStorageMetrics();
+
+    std::unique_ptr<ThreadPool> verifyPool;
+
+    // Write-back layer over the utxos table. The table is only current as
+    // of the block recorded under utxoTipKey; later blocks are replayed
+    // from their unflushed rows on load.
+    std::unique_ptr<UtxoCache> utxoCache;
+
+    // Signatures already verified, shared by the mempool and block checks
+    std::unique_ptr<SignatureCache> sigCache;
+    static const std::string utxoTipKey;
+    void flushUtxos();
+    void recoverUtxos();
+
+    // Stages a flush of the cache in the given transaction and drops the
+    // rows of unflushedBlocks, which is cleared once it commits
+    void flushUtxos(Storage::Transaction* dbTx);
+    std::vector<std::string> unflushedBlocks;
 
     std::tuple<bool, bool> verifyTransaction(Storage::Transaction* dbTransaction, const transaction& tx,
                            const bool coinbaseTx = false);
     void confirmTransaction(Storage::Transaction* dbTransaction, const transaction& tx,
-                            const BigNum& confirmingBlock, const bool coinbaseTx = false);
+                            const uint256& confirmingBlock, Json::Value& spentOutputs,
+                            const bool coinbaseTx = false);
     uint64_t getTransactionFee(const transaction& tx);
     uint64_t calculateTransactionFee(Storage::Transaction* dbTx, const transaction& tx);
     bool status;
-    void reverseBlock(Storage::Transaction* dbTransaction);
-    bool reorgChain(Storage::Transaction* dbTransaction, const BigNum& newTipId);
+    block reverseBlock(Storage::Transaction* dbTransaction);
+    Json::Value buildUndo(Storage::Transaction* dbTransaction, const block& connected);
+    void restoreMempool(Storage::Transaction* dbTransaction, const std::vector<block>& disconnected);
+    bool reorgChain(Storage::Transaction* dbTransaction, const uint256& newTipId);
     virtual uint64_t getBlockReward(const uint64_t height) = 0;
     virtual std::string getCoinbaseOwner(const std::string& publicKey) = 0;
     Consensus* consensus;
+    void openDB();
+    std::string toCompactKey(Storage::Transaction* dbTx, const std::string& key);
+    static std::string ownerKey(const std::string& publicKey, const std::string& outputId);
     void emptyDB();
     std::tuple<bool, bool> submitTransaction(Storage::Transaction* dbTx, const transaction& tx);
     std::tuple<bool, bool> submitBlock(Storage::Transaction* dbTx, const block& newBlock,
@@ -453,6 +962,37 @@ public:
                                      CryptoKernel::Blockchain::block& block,
                                      const CryptoKernel::Blockchain::dbBlock& previousBlock) = 0;
 
+    /**
+    * Checks the consensus rules that only need a block's header, before
+    * the block is downloaded. Passing is no guarantee the block will pass
+    * checkConsensusRules. The default accepts every header.
+    *
+    * @param headers a chain of headers building on a block in the block
+    *        index, oldest first, which may not be in the index themselves
+    * @param index the position of the header to check in headers
+    * @param previousHeader the header of the block it builds on
+    * @return false if the block could never pass checkConsensusRules
+    */
+    virtual bool checkHeader(const std::vector<CryptoKernel::Blockchain::header>& headers,
+                             const size_t index,
+                             const CryptoKernel::Blockchain::header& previousHeader) {
+        return true;
+    }
+
+    /**
+    * Returns true if a chain ending in the given header is better than the
+    * one ending in the tip, judged from their headers alone. Used to choose
+    * which chain to download. The default prefers the higher chain.
+    *
+    * @param header the last header of the chain to compare
+    * @param tip the header of the current chain tip
+    * @return true iff the chain ending in header takes precedence
+    */
+    virtual bool isHeaderBetter(const CryptoKernel::Blockchain::header& header,
+                                const CryptoKernel::Blockchain::header& tip) {
+        return header.getHeight() > tip.getHeight();
+    }
+
     /**
     * Pure virtual function that generates the consensus data
     * for a block owned by the given public key. In a Proof of
@@ -463,7 +1003,7 @@ public:
     * @return the consensusData for the block
     */
     virtual Json::Value generateConsensusData(Storage::Transaction* transaction,
-            const CryptoKernel::BigNum& previousBlockId, const std::string& publicKey) = 0;
+            const CryptoKernel::uint256& previousBlockId, const std::string& publicKey) = 0;
 
     /**
     * Callback for custom transaction behavior when the blockchain needs to check
@@ -1,39 +1,161 @@
 #include <sstream>
 
+#include <openssl/sha.h>
+
 #include "blockchain.h"
 #include "crypto.h"
 #include "merkletree.h"
 
+namespace {
+// Leads every top level binary encoding, so the format can change later
+const char binaryVersion = 0x01;
+
+template<size_t N>
+constexpr size_t literalSize(const char (&)[N]) {
+    return N - 1;
+}
+
+size_t digits(uint64_t value) {
+    size_t count = 1;
+    while(value >= 10) {
+        value /= 10;
+        count++;
+    }
+    return count;
+}
+
+// The id of an element is the SHA256 of its text form
+CryptoKernel::uint256 hashId(const std::string& text) {
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char*>(text.data()), text.size(), hash);
+    return CryptoKernel::uint256::fromBytes(hash);
+}
+
+// Reads an id from a JSON string. One too wide for 256 bits is reported as
+// a JSON error, so callers reject it like any other malformed field.
+CryptoKernel::uint256 jsonId(const Json::Value& value) {
+    const std::string hex = value.asString();
+    try {
+        return CryptoKernel::uint256(hex);
+    } catch(const std::runtime_error& e) {
+        throw Json::RuntimeError(e.what());
+    }
+}
+
+// Ids are written as their hex string, which the canonical value encoding
+// packs into raw bytes
+void writeId(std::string& out, const CryptoKernel::uint256& id) {
+    CryptoKernel::Storage::appendCanonical(out, id.toString());
+}
+
+CryptoKernel::uint256 readId(const char*& pos, const char* end) {
+    const Json::Value hex = CryptoKernel::Storage::readCanonical(pos, end);
+    if(!hex.isString()) {
+        throw std::runtime_error("Id is not a string");
+    }
+
+    const CryptoKernel::uint256 id(hex.asString());
+    if(id.toString() != hex.asString()) {
+        throw std::runtime_error("Id is not in canonical form");
+    }
+
+    return id;
+}
+
+template<typename Element>
+void readSetElement(std::set<Element>& elements, const Element& element) {
+    // Sets are written in order, so anything else is another encoding of
+    // the same set or holds duplicates
+    if(!elements.empty() && !(*elements.rbegin() < element)) {
+        throw std::runtime_error("Set is not in canonical order");
+    }
+    elements.insert(elements.end(), element);
+}
+
+template<typename Element, typename Read>
+Element readTopLevel(const std::string& data, const std::string& name, Read read) {
+    const char* pos = data.data();
+    const char* end = pos + data.size();
+
+    try {
+        if(pos == end || *pos++ != binaryVersion) {
+            throw std::runtime_error("Unknown binary version");
+        }
+
+        const Element returning = read(pos, end);
+        if(pos != end) {
+            throw std::runtime_error("Trailing data");
+        }
+
+        return returning;
+    } catch(const std::runtime_error& e) {
+        throw CryptoKernel::Blockchain::InvalidElementException(name + " binary is malformed");
+    }
+}
+}
+
 CryptoKernel::Blockchain::output::output(const Json::Value& jsonOutput) {
+    std::shared_ptr<State> newState = std::make_shared<State>();
     try {
-        value = jsonOutput["value"].asUInt64();
-        nonce = jsonOutput["nonce"].asUInt64();
-        data = jsonOutput["data"];
+        newState->value = jsonOutput["value"].asUInt64();
+        newState->nonce = jsonOutput["nonce"].asUInt64();
+        newState->data = jsonOutput["data"];
     } catch(const Json::Exception& e) {
         throw InvalidElementException("Output JSON is malformed");
     }
 
-    checkRep();
-
-    id = calculateId();
+    init(newState);
 }
 
 CryptoKernel::Blockchain::output::output(const uint64_t value, const uint64_t nonce,
         const Json::Value& data) {
-    this->value = value;
-    this->nonce = nonce;
-    this->data = data;
+    std::shared_ptr<State> newState = std::make_shared<State>();
+    newState->value = value;
+    newState->nonce = nonce;
+    newState->data = data;
+
+    init(newState);
+}
+
+void CryptoKernel::Blockchain::output::init(const std::shared_ptr<State>& newState) {
+    // Looking these keys up in the checks used to add them as nulls, and
+    // output ids have always been calculated with them present
+    Json::Value& data = newState->data;
+    if(data.isObject() || data.isNull()) {
+        if(!data.isMember("contract")) {
+            data["contract"] = Json::Value();
+        }
+
+        if(data["contract"].empty() && !data.isMember("publicKey")) {
+            data["publicKey"] = Json::Value();
+        }
+    }
+
+    state = newState;
 
     checkRep();
 
-    id = calculateId();
+    const std::string dataText = CryptoKernel::Storage::toString(newState->data);
+
+    // {"data":...,"nonce":...,"value":...}
+    newState->jsonSize = literalSize("{\"data\":") + dataText.size() - 1 +
+                         literalSize(",\"nonce\":") + digits(newState->nonce) +
+                         literalSize(",\"value\":") + digits(newState->value) +
+                         literalSize("}");
+
+    newState->id = calculateId(dataText);
 }
 
 void CryptoKernel::Blockchain::output::checkRep() {
-    if(value < 1) {
+    if(state->value < 1) {
         throw InvalidElementException("Output value cannot be less than 1");
     }
 
+    const Json::Value& data = state->data;
+    if(!data.isObject() && !data.isNull()) {
+        throw InvalidElementException("Output data is neither an object or null");
+    }
+
     if(data["contract"].empty() && !data["publicKey"].empty()) {
         CryptoKernel::Crypto crypto;
         try {
@@ -47,35 +169,67 @@ void CryptoKernel::Blockchain::output::checkRep() {
 }
 
 uint64_t CryptoKernel::Blockchain::output::getValue() const {
-    return value;
+    return state->value;
 }
 
 uint64_t CryptoKernel::Blockchain::output::getNonce() const {
-    return nonce;
+    return state->nonce;
 }
 
-Json::Value CryptoKernel::Blockchain::output::getData() const {
-    return data;
+const Json::Value& CryptoKernel::Blockchain::output::getData() const {
+    return state->data;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::output::calculateId() {
+CryptoKernel::uint256 CryptoKernel::Blockchain::output::calculateId(const std::string& dataText) {
     std::stringstream buffer;
-    buffer << value << nonce << CryptoKernel::Storage::toString(data, false);
+    buffer << state->value << state->nonce << dataText;
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return hashId(buffer.str());
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::output::getId() const {
-    return id;
+const CryptoKernel::uint256& CryptoKernel::Blockchain::output::getId() const {
+    return state->id;
 }
 
 Json::Value CryptoKernel::Blockchain::output::toJson() const {
     Json::Value returning;
 
-    returning["value"] = value;
-    returning["nonce"] = nonce;
-    returning["data"] = data;
+    returning["value"] = state->value;
+    returning["nonce"] = state->nonce;
+    returning["data"] = state->data;
+
+    return returning;
+}
+
+std::string CryptoKernel::Blockchain::output::toBinary() const {
+    std::string returning(1, binaryVersion);
+    writeBinary(returning);
+    return returning;
+}
+
+CryptoKernel::Blockchain::output CryptoKernel::Blockchain::output::fromBinary(
+    const std::string& data) {
+    return readTopLevel<output>(data, "Output", readBinary);
+}
+
+void CryptoKernel::Blockchain::output::writeBinary(std::string& out) const {
+    CryptoKernel::Storage::appendVarint(out, state->value);
+    CryptoKernel::Storage::appendVarint(out, state->nonce);
+    CryptoKernel::Storage::appendCanonical(out, state->data);
+}
+
+CryptoKernel::Blockchain::output CryptoKernel::Blockchain::output::readBinary(
+    const char*& pos, const char* end) {
+    const uint64_t value = CryptoKernel::Storage::readVarint(pos, end);
+    const uint64_t nonce = CryptoKernel::Storage::readVarint(pos, end);
+    const Json::Value data = CryptoKernel::Storage::readCanonical(pos, end);
+
+    // Outputs always hold the keys init adds, so data without them is
+    // another encoding of the same output
+    const output returning(value, nonce, data);
+    if(returning.getData() != data) {
+        throw std::runtime_error("Output data is not in canonical form");
+    }
 
     return returning;
 }
@@ -87,15 +241,14 @@ bool CryptoKernel::Blockchain::output::operator<(const output& rhs) const {
 CryptoKernel::Blockchain::dbOutput::dbOutput(const Json::Value& jsonOutput) : output(
         jsonOutput) {
     try {
-        creationTx = CryptoKernel::BigNum(jsonOutput["creationTx"].asString());
+        creationTx = jsonId(jsonOutput["creationTx"]);
     } catch(const Json::Exception& e) {
         throw InvalidElementException("Output JSON is malformed");
     }
 }
 
 CryptoKernel::Blockchain::dbOutput::dbOutput(const output& compactOutput,
-        const BigNum& creationTx) : output(compactOutput.getValue(), compactOutput.getNonce(),
-                    compactOutput.getData()) {
+        const uint256& creationTx) : output(compactOutput) {
     this->creationTx = creationTx;
 }
 
@@ -109,25 +262,38 @@ Json::Value CryptoKernel::Blockchain::dbOutput::toJson() const {
 }
 
 CryptoKernel::Blockchain::input::input(const Json::Value& inputJson) {
+    std::shared_ptr<State> newState = std::make_shared<State>();
     try {
-        data = inputJson["data"];
-        outputId = CryptoKernel::BigNum(inputJson["outputId"].asString());
+        newState->data = inputJson["data"];
+        newState->outputId = jsonId(inputJson["outputId"]);
     } catch(const Json::Exception& e) {
         throw InvalidElementException("Input JSON is malformed");
     }
 
-    checkRep();
+    init(newState);
+}
 
-    id = calculateId();
+CryptoKernel::Blockchain::input::input(const uint256& outputId, const Json::Value& data) {
+    std::shared_ptr<State> newState = std::make_shared<State>();
+    newState->data = data;
+    newState->outputId = outputId;
+
+    init(newState);
 }
 
-CryptoKernel::Blockchain::input::input(const BigNum& outputId, const Json::Value& data) {
-    this->data = data;
-    this->outputId = outputId;
+void CryptoKernel::Blockchain::input::init(const std::shared_ptr<State>& newState) {
+    state = newState;
 
     checkRep();
 
-    id = calculateId();
+    const std::string dataText = CryptoKernel::Storage::toString(newState->data);
+
+    // {"data":...,"outputId":"..."}
+    newState->jsonSize = literalSize("{\"data\":") + dataText.size() - 1 +
+                         literalSize(",\"outputId\":\"") + newState->outputId.toString().size() +
+                         literalSize("\"}");
+
+    newState->id = calculateId(dataText);
 }
 
 void CryptoKernel::Blockchain::input::checkRep() {
@@ -141,30 +307,52 @@ bool CryptoKernel::Blockchain::input::operator<(const input& rhs) const {
 Json::Value CryptoKernel::Blockchain::input::toJson() const {
     Json::Value returning;
 
-    returning["outputId"] = outputId.toString();
-    returning["data"] = data;
+    returning["outputId"] = state->outputId.toString();
+    returning["data"] = state->data;
 
     return returning;
 }
 
-Json::Value CryptoKernel::Blockchain::input::getData() const {
-    return data;
+std::string CryptoKernel::Blockchain::input::toBinary() const {
+    std::string returning(1, binaryVersion);
+    writeBinary(returning);
+    return returning;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::input::getOutputId() const {
-    return outputId;
+CryptoKernel::Blockchain::input CryptoKernel::Blockchain::input::fromBinary(
+    const std::string& data) {
+    return readTopLevel<input>(data, "Input", readBinary);
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::input::getId() const {
-    return id;
+void CryptoKernel::Blockchain::input::writeBinary(std::string& out) const {
+    writeId(out, state->outputId);
+    CryptoKernel::Storage::appendCanonical(out, state->data);
+}
+
+CryptoKernel::Blockchain::input CryptoKernel::Blockchain::input::readBinary(
+    const char*& pos, const char* end) {
+    const uint256 outputId = readId(pos, end);
+    const Json::Value data = CryptoKernel::Storage::readCanonical(pos, end);
+    return input(outputId, data);
+}
+
+const Json::Value& CryptoKernel::Blockchain::input::getData() const {
+    return state->data;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::input::calculateId() {
+const CryptoKernel::uint256& CryptoKernel::Blockchain::input::getOutputId() const {
+    return state->outputId;
+}
+
+const CryptoKernel::uint256& CryptoKernel::Blockchain::input::getId() const {
+    return state->id;
+}
+
+CryptoKernel::uint256 CryptoKernel::Blockchain::input::calculateId(const std::string& dataText) {
     std::stringstream buffer;
-    buffer << outputId.toString() << CryptoKernel::Storage::toString(data, false);
+    buffer << state->outputId.toString() << dataText;
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return hashId(buffer.str());
 }
 
 CryptoKernel::Blockchain::dbInput::dbInput(const Json::Value& inputJson) : input(
@@ -173,7 +361,7 @@ CryptoKernel::Blockchain::dbInput::dbInput(const Json::Value& inputJson) : input
 }
 
 CryptoKernel::Blockchain::dbInput::dbInput(const input& compactInput) : input(
-        compactInput.getOutputId(), compactInput.getData()) {
+        compactInput) {
 
 }
 
@@ -183,42 +371,69 @@ Json::Value CryptoKernel::Blockchain::dbInput::toJson() const {
 
 CryptoKernel::Blockchain::transaction::transaction(const std::set<input>& inputs,
         const std::set<output>& outputs, const uint64_t timestamp, const bool coinbaseTx) {
-    this->inputs = inputs;
-    this->outputs = outputs;
-    this->timestamp = timestamp;
-
-    bytes = CryptoKernel::Storage::toString(toJson()).size();
-
-    checkRep(coinbaseTx);
+    std::shared_ptr<State> newState = std::make_shared<State>();
+    newState->inputs = inputs;
+    newState->outputs = outputs;
+    newState->timestamp = timestamp;
 
-    id = calculateId();
+    init(newState, coinbaseTx);
 }
 
 CryptoKernel::Blockchain::transaction::transaction(const Json::Value& jsonTransaction,
         const bool coinbaseTx) {
+    std::shared_ptr<State> newState = std::make_shared<State>();
     for(const Json::Value& inp : jsonTransaction["inputs"]) {
-        inputs.insert(CryptoKernel::Blockchain::input(inp));
+        newState->inputs.insert(CryptoKernel::Blockchain::input(inp));
     }
 
     for(const Json::Value& out : jsonTransaction["outputs"]) {
-        outputs.insert(CryptoKernel::Blockchain::output(out));
+        newState->outputs.insert(CryptoKernel::Blockchain::output(out));
     }
 
     try {
-        timestamp = jsonTransaction["timestamp"].asUInt64();
+        newState->timestamp = jsonTransaction["timestamp"].asUInt64();
     } catch(const Json::Exception& e) {
         throw InvalidElementException("Transaction JSON is malformed");
     }
 
-    bytes = CryptoKernel::Storage::toString(toJson()).size();
+    init(newState, coinbaseTx);
+}
+
+CryptoKernel::Blockchain::transaction::transaction(const std::shared_ptr<State>& newState,
+        const bool coinbaseTx) {
+    init(newState, coinbaseTx);
+}
+
+void CryptoKernel::Blockchain::transaction::init(const std::shared_ptr<State>& newState,
+        const bool coinbaseTx) {
+    state = newState;
+
+    // {"inputs":[...],"outputs":[...],"timestamp":...} and a newline, with
+    // empty lists left out
+    size_t bytes = literalSize("\"timestamp\":") + digits(newState->timestamp) +
+                   literalSize("{}\n");
+    if(!newState->inputs.empty()) {
+        bytes += literalSize("\"inputs\":[],") + newState->inputs.size() - 1;
+        for(const input& inp : newState->inputs) {
+            bytes += inp.state->jsonSize;
+        }
+    }
+    if(!newState->outputs.empty()) {
+        bytes += literalSize("\"outputs\":[],") + newState->outputs.size() - 1;
+        for(const output& out : newState->outputs) {
+            bytes += out.state->jsonSize;
+        }
+    }
+    newState->bytes = bytes;
 
     checkRep(coinbaseTx);
 
-    id = calculateId();
+    newState->outputSetId = getOutputSetId(newState->outputs);
+    newState->id = calculateId();
 }
 
 unsigned int CryptoKernel::Blockchain::transaction::size() const {
-    return bytes;
+    return state->bytes;
 }
 
 void CryptoKernel::Blockchain::transaction::checkRep(const bool coinbaseTx) {
@@ -227,6 +442,9 @@ void CryptoKernel::Blockchain::transaction::checkRep(const bool coinbaseTx) {
         throw InvalidElementException("Transaction is too large");
     }
 
+    const std::set<input>& inputs = state->inputs;
+    const std::set<output>& outputs = state->outputs;
+
     if(outputs.size() < 1) {
         throw InvalidElementException("Transaction has no outputs");
     }
@@ -251,7 +469,7 @@ void CryptoKernel::Blockchain::transaction::checkRep(const bool coinbaseTx) {
         prevTotal = curTotal;
     }
 
-    std::set<BigNum> outputIds;
+    std::set<uint256> outputIds;
 
     for(const input& inp : inputs) {
         outputIds.insert(inp.getOutputId());
@@ -266,90 +484,133 @@ void CryptoKernel::Blockchain::transaction::checkRep(const bool coinbaseTx) {
     }
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::transaction::calculateId() {
+CryptoKernel::uint256 CryptoKernel::Blockchain::transaction::calculateId() {
     std::stringstream buffer;
 
-	if(!inputs.empty()) {
-		std::set<BigNum> inputIds;
-		for(const input& inp : inputs) {
+	if(!state->inputs.empty()) {
+		std::set<uint256> inputIds;
+		for(const input& inp : state->inputs) {
 			inputIds.insert(inp.getId());
 		}
 
-		buffer << CryptoKernel::MerkleNode::makeMerkleTree(inputIds)->getMerkleRoot().toString();
+		buffer << CryptoKernel::MerkleNode::calculateRoot(inputIds).toString();
 	}
 
-	buffer << getOutputSetId().toString() << timestamp;
+	buffer << state->outputSetId.toString() << state->timestamp;
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return hashId(buffer.str());
 }
 
 bool CryptoKernel::Blockchain::transaction::operator<(const transaction& rhs) const {
     return getId() < rhs.getId();
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::transaction::getId() const {
-    return id;
+const CryptoKernel::uint256& CryptoKernel::Blockchain::transaction::getId() const {
+    return state->id;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::transaction::getOutputSetId() const {
-    return getOutputSetId(outputs);
+const CryptoKernel::uint256& CryptoKernel::Blockchain::transaction::getOutputSetId() const {
+    return state->outputSetId;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::transaction::getOutputSetId(
+CryptoKernel::uint256 CryptoKernel::Blockchain::transaction::getOutputSetId(
     const std::set<output>& outputs) {
 
-	std::set<BigNum> outputIds;
+	std::set<uint256> outputIds;
     for(const output& out : outputs) {
         outputIds.insert(out.getId());
     }
 
-    return CryptoKernel::MerkleNode::makeMerkleTree(outputIds)->getMerkleRoot();
+    return CryptoKernel::MerkleNode::calculateRoot(outputIds);
 }
 
 uint64_t CryptoKernel::Blockchain::transaction::getTimestamp() const {
-    return timestamp;
+    return state->timestamp;
 }
 
-std::set<CryptoKernel::Blockchain::input>
+const std::set<CryptoKernel::Blockchain::input>&
 CryptoKernel::Blockchain::transaction::getInputs() const {
-    return inputs;
+    return state->inputs;
 }
 
-std::set<CryptoKernel::Blockchain::output>
+const std::set<CryptoKernel::Blockchain::output>&
 CryptoKernel::Blockchain::transaction::getOutputs() const {
-    return outputs;
+    return state->outputs;
 }
 
 Json::Value CryptoKernel::Blockchain::transaction::toJson() const {
     Json::Value returning;
 
-    returning["timestamp"] = timestamp;
+    returning["timestamp"] = state->timestamp;
 
-    for(const input& inp : inputs) {
+    for(const input& inp : state->inputs) {
         returning["inputs"].append(inp.toJson());
     }
 
-    for(const output& out : outputs) {
+    for(const output& out : state->outputs) {
         returning["outputs"].append(out.toJson());
     }
 
     return returning;
 }
 
+std::string CryptoKernel::Blockchain::transaction::toBinary() const {
+    std::string returning(1, binaryVersion);
+    writeBinary(returning);
+    return returning;
+}
+
+CryptoKernel::Blockchain::transaction CryptoKernel::Blockchain::transaction::fromBinary(
+    const std::string& data, const bool coinbaseTx) {
+    return readTopLevel<transaction>(data, "Transaction", [&](const char*& pos, const char* end) {
+        return readBinary(pos, end, coinbaseTx);
+    });
+}
+
+void CryptoKernel::Blockchain::transaction::writeBinary(std::string& out) const {
+    CryptoKernel::Storage::appendVarint(out, state->timestamp);
+
+    CryptoKernel::Storage::appendVarint(out, state->inputs.size());
+    for(const input& inp : state->inputs) {
+        inp.writeBinary(out);
+    }
+
+    CryptoKernel::Storage::appendVarint(out, state->outputs.size());
+    for(const output& outp : state->outputs) {
+        outp.writeBinary(out);
+    }
+}
+
+CryptoKernel::Blockchain::transaction CryptoKernel::Blockchain::transaction::readBinary(
+    const char*& pos, const char* end, const bool coinbaseTx) {
+    std::shared_ptr<State> newState = std::make_shared<State>();
+    newState->timestamp = CryptoKernel::Storage::readVarint(pos, end);
+
+    const uint64_t inputCount = CryptoKernel::Storage::readVarint(pos, end);
+    for(uint64_t i = 0; i < inputCount; i++) {
+        readSetElement(newState->inputs, input::readBinary(pos, end));
+    }
+
+    const uint64_t outputCount = CryptoKernel::Storage::readVarint(pos, end);
+    for(uint64_t i = 0; i < outputCount; i++) {
+        readSetElement(newState->outputs, output::readBinary(pos, end));
+    }
+
+    return transaction(newState, coinbaseTx);
+}
+
 CryptoKernel::Blockchain::dbTransaction::dbTransaction(const Json::Value&
         jsonTransaction) {
     try {
-        this->confirmingBlock = CryptoKernel::BigNum(
-                                    jsonTransaction["confirmingBlock"].asString());
+        this->confirmingBlock = jsonId(jsonTransaction["confirmingBlock"]);
         this->coinbaseTx = jsonTransaction["coinbaseTx"].asBool();
 
         for(const Json::Value& inp : jsonTransaction["inputs"]) {
-            inputs.insert(CryptoKernel::BigNum(inp.asString()));
+            inputs.insert(jsonId(inp));
         }
 
         for(const Json::Value& out : jsonTransaction["outputs"]) {
-            outputs.insert(CryptoKernel::BigNum(out.asString()));
+            outputs.insert(jsonId(out));
         }
 
         timestamp = jsonTransaction["timestamp"].asUInt64();
@@ -363,7 +624,7 @@ CryptoKernel::Blockchain::dbTransaction::dbTransaction(const Json::Value&
 }
 
 CryptoKernel::Blockchain::dbTransaction::dbTransaction(const transaction&
-        compactTransaction, const BigNum& confirmingBlock, const bool coinbaseTx) {
+        compactTransaction, const uint256& confirmingBlock, const bool coinbaseTx) {
     this->confirmingBlock = confirmingBlock;
     this->coinbaseTx = coinbaseTx;
 
@@ -382,19 +643,18 @@ CryptoKernel::Blockchain::dbTransaction::dbTransaction(const transaction&
     id = calculateId();
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::dbTransaction::calculateId() {
+CryptoKernel::uint256 CryptoKernel::Blockchain::dbTransaction::calculateId() {
     std::stringstream buffer;
 
 	if(!inputs.empty()) {
-		buffer << CryptoKernel::MerkleNode::makeMerkleTree(inputs)->getMerkleRoot().toString();
+		buffer << CryptoKernel::MerkleNode::calculateRoot(inputs).toString();
 	}
 
-	buffer << CryptoKernel::MerkleNode::makeMerkleTree(outputs)->getMerkleRoot().toString();
+	buffer << CryptoKernel::MerkleNode::calculateRoot(outputs).toString();
 
     buffer << timestamp;
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return hashId(buffer.str());
 }
 
 void CryptoKernel::Blockchain::dbTransaction::checkRep () {
@@ -414,11 +674,11 @@ void CryptoKernel::Blockchain::dbTransaction::checkRep () {
 Json::Value CryptoKernel::Blockchain::dbTransaction::toJson() const {
     Json::Value returning;
 
-    for(const BigNum& inp : inputs) {
+    for(const uint256& inp : inputs) {
         returning["inputs"].append(inp.toString());
     }
 
-    for(const BigNum& out : outputs) {
+    for(const uint256& out : outputs) {
         returning["outputs"].append(out.toString());
     }
 
@@ -429,7 +689,7 @@ Json::Value CryptoKernel::Blockchain::dbTransaction::toJson() const {
     return returning;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::dbTransaction::getId() const {
+CryptoKernel::uint256 CryptoKernel::Blockchain::dbTransaction::getId() const {
     return id;
 }
 
@@ -441,18 +701,18 @@ bool CryptoKernel::Blockchain::dbTransaction::isCoinbaseTx() const {
     return coinbaseTx;
 }
 
-std::set<CryptoKernel::BigNum> CryptoKernel::Blockchain::dbTransaction::getInputs()
+std::set<CryptoKernel::uint256> CryptoKernel::Blockchain::dbTransaction::getInputs()
 const {
     return inputs;
 }
 
-std::set<CryptoKernel::BigNum> CryptoKernel::Blockchain::dbTransaction::getOutputs()
+std::set<CryptoKernel::uint256> CryptoKernel::Blockchain::dbTransaction::getOutputs()
 const {
     return outputs;
 }
 
 CryptoKernel::Blockchain::block::block(const std::set<transaction>& transactions,
-                                       const transaction& coinbaseTx, const BigNum& previousBlockId, const uint64_t timestamp,
+                                       const transaction& coinbaseTx, const uint256& previousBlockId, const uint64_t timestamp,
                                        const Json::Value& consensusData, const uint64_t height, const Json::Value data)
     : coinbaseTx(coinbaseTx.getInputs(), coinbaseTx.getOutputs(), coinbaseTx.getTimestamp(),
                  true) {
@@ -464,12 +724,12 @@ CryptoKernel::Blockchain::block::block(const std::set<transaction>& transactions
 	this->data = data;
 
 	if(!this->transactions.empty()) {
-		std::set<BigNum> txIds;
+		std::set<uint256> txIds;
 		for(const auto& tx : transactions) {
 			txIds.insert(tx.getId());
 		}
 
-		transactionMerkleRoot = CryptoKernel::MerkleNode::makeMerkleTree(txIds)->getMerkleRoot();
+		transactionMerkleRoot = CryptoKernel::MerkleNode::calculateRoot(txIds);
 	}
 
     checkRep();
@@ -477,16 +737,33 @@ CryptoKernel::Blockchain::block::block(const std::set<transaction>& transactions
     id = calculateId();
 }
 
+CryptoKernel::Blockchain::block::block(const std::set<transaction>& transactions,
+                                       const uint256& transactionMerkleRoot, const transaction& coinbaseTx,
+                                       const uint256& previousBlockId, const uint64_t timestamp,
+                                       const Json::Value& consensusData, const uint64_t height,
+                                       const Json::Value& data)
+    : coinbaseTx(coinbaseTx) {
+    this->transactions = transactions;
+    this->transactionMerkleRoot = transactionMerkleRoot;
+    this->previousBlockId = previousBlockId;
+    this->timestamp = timestamp;
+    this->consensusData = consensusData;
+    this->height = height;
+    this->data = data;
+
+    id = calculateId();
+}
+
 CryptoKernel::Blockchain::block::block(const Json::Value& jsonBlock)
     : coinbaseTx(jsonBlock["coinbaseTx"], true) {
     try {
         timestamp = jsonBlock["timestamp"].asUInt64();
-        previousBlockId = CryptoKernel::BigNum(jsonBlock["previousBlockId"].asString());
+        previousBlockId = jsonId(jsonBlock["previousBlockId"]);
         consensusData = jsonBlock["consensusData"];
 		data = jsonBlock["data"];
 
 		if(!jsonBlock["transactions"].empty()) {
-			transactionMerkleRoot = CryptoKernel::BigNum(jsonBlock["transactionMerkleRoot"].asString());
+			transactionMerkleRoot = jsonId(jsonBlock["transactionMerkleRoot"]);
 		}
 
         for(const Json::Value& tx : jsonBlock["transactions"]) {
@@ -511,7 +788,7 @@ void CryptoKernel::Blockchain::block::setConsensusData(const Json::Value& data)
     consensusData = data;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::block::calculateId() {
+CryptoKernel::uint256 CryptoKernel::Blockchain::block::calculateId() {
     std::stringstream buffer;
 
     if(!transactions.empty()) {
@@ -521,13 +798,12 @@ CryptoKernel::BigNum CryptoKernel::Blockchain::block::calculateId() {
     buffer << coinbaseTx.getId().toString() << previousBlockId.toString() << timestamp
 		   << CryptoKernel::Storage::toString(data);
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return hashId(buffer.str());
 }
 
 void CryptoKernel::Blockchain::block::checkRep() {
     // Check for block size
-    if(CryptoKernel::Storage::toString(toJson()).size() > 4 * 1024 * 1024) {
+    if(jsonSize() > 4 * 1024 * 1024) {
         throw InvalidElementException("Block is too large");
     }
 
@@ -539,24 +815,27 @@ void CryptoKernel::Blockchain::block::checkRep() {
 		throw InvalidElementException("Data field is neither an object or null");
 	}
 
-    // Check for input/output conflicts
+    // Check for input/output conflicts. Only whether an id repeats matters
+    // here, so hash sets do instead of ordered ones.
     unsigned int totalPuts = 0;
     unsigned int totalInputs = 0;
-    std::set<BigNum> outputIds;
-    std::set<BigNum> inputIds;
     for(const transaction& tx : transactions) {
-        const std::set<input> inputs = tx.getInputs();
-        const std::set<output> outputs = tx.getOutputs();
+        totalPuts += tx.getInputs().size() + tx.getOutputs().size();
+        totalInputs += tx.getInputs().size();
+    }
 
-        for(const input& inp : inputs) {
-            totalPuts++;
-            totalInputs++;
+    IdSet outputIds;
+    IdSet inputIds;
+    outputIds.reserve(totalPuts + coinbaseTx.getOutputs().size());
+    inputIds.reserve(totalInputs);
+
+    for(const transaction& tx : transactions) {
+        for(const input& inp : tx.getInputs()) {
             outputIds.insert(inp.getOutputId());
             inputIds.insert(inp.getId());
         }
 
-        for(const output& out : outputs) {
-            totalPuts++;
+        for(const output& out : tx.getOutputs()) {
             outputIds.insert(out.getId());
         }
     }
@@ -565,11 +844,7 @@ void CryptoKernel::Blockchain::block::checkRep() {
         throw InvalidElementException("Block contains duplicate outputs without coinbase");
     }
 
-    // Coinbase tx should have no inputs, others should have at least 1
-    const std::set<input> inputs = coinbaseTx.getInputs();
-    const std::set<output> outputs = coinbaseTx.getOutputs();
-
-    for(const output& out : outputs) {
+    for(const output& out : coinbaseTx.getOutputs()) {
         totalPuts++;
         outputIds.insert(out.getId());
     }
@@ -583,17 +858,95 @@ void CryptoKernel::Blockchain::block::checkRep() {
     }
 
 	if(!transactions.empty()) {
-		std::set<BigNum> txIds;
+		std::set<uint256> txIds;
 		for(const auto& tx : transactions) {
 			txIds.insert(tx.getId());
 		}
 
-		if(CryptoKernel::MerkleNode::makeMerkleTree(txIds)->getMerkleRoot() != transactionMerkleRoot) {
+		if(CryptoKernel::MerkleNode::calculateRoot(txIds) != transactionMerkleRoot) {
 			throw InvalidElementException("Transaction merkle root is incorrect");
 		}
 	}
 }
 
+size_t CryptoKernel::Blockchain::block::jsonSize() const {
+    // {"coinbaseTx":...,"consensusData":...,"data":...,"height":...,
+    // "previousBlockId":"...","timestamp":...,"transactionMerkleRoot":"...",
+    // "transactions":[...]} and a newline, where the transaction sizes
+    // already count a newline each
+    size_t size = literalSize("{\"coinbaseTx\":") + coinbaseTx.size() - 1 +
+                  literalSize(",\"consensusData\":") +
+                  CryptoKernel::Storage::toString(consensusData).size() - 1 +
+                  literalSize(",\"data\":") + CryptoKernel::Storage::toString(data).size() - 1 +
+                  literalSize(",\"height\":") + digits(height) +
+                  literalSize(",\"previousBlockId\":\"") + previousBlockId.toString().size() +
+                  literalSize("\",\"timestamp\":") + digits(timestamp) +
+                  literalSize("}\n");
+
+    if(!transactions.empty()) {
+        size += literalSize(",\"transactionMerkleRoot\":\"") +
+                transactionMerkleRoot.toString().size() +
+                literalSize("\",\"transactions\":[]") - 1;
+        for(const transaction& tx : transactions) {
+            size += tx.size();
+        }
+    }
+
+    return size;
+}
+
+std::string CryptoKernel::Blockchain::block::toBinary() const {
+    std::string returning(1, binaryVersion);
+    returning.reserve(jsonSize() / 2);
+
+    CryptoKernel::Storage::appendVarint(returning, timestamp);
+    CryptoKernel::Storage::appendVarint(returning, height);
+    writeId(returning, previousBlockId);
+    CryptoKernel::Storage::appendCanonical(returning, consensusData);
+    CryptoKernel::Storage::appendCanonical(returning, data);
+    coinbaseTx.writeBinary(returning);
+
+    CryptoKernel::Storage::appendVarint(returning, transactions.size());
+    for(const transaction& tx : transactions) {
+        tx.writeBinary(returning);
+    }
+
+    if(!transactions.empty()) {
+        writeId(returning, transactionMerkleRoot);
+    }
+
+    return returning;
+}
+
+CryptoKernel::Blockchain::block CryptoKernel::Blockchain::block::fromBinary(
+    const std::string& data) {
+    return readTopLevel<block>(data, "Block", [](const char*& pos, const char* end) {
+        const uint64_t timestamp = CryptoKernel::Storage::readVarint(pos, end);
+        const uint64_t height = CryptoKernel::Storage::readVarint(pos, end);
+        const uint256 previousBlockId = readId(pos, end);
+        const Json::Value consensusData = CryptoKernel::Storage::readCanonical(pos, end);
+        const Json::Value blockData = CryptoKernel::Storage::readCanonical(pos, end);
+        const transaction coinbaseTx = transaction::readBinary(pos, end, true);
+
+        std::set<transaction> transactions;
+        const uint64_t txCount = CryptoKernel::Storage::readVarint(pos, end);
+        for(uint64_t i = 0; i < txCount; i++) {
+            readSetElement(transactions, transaction::readBinary(pos, end, false));
+        }
+
+        uint256 transactionMerkleRoot;
+        if(!transactions.empty()) {
+            transactionMerkleRoot = readId(pos, end);
+        }
+
+        block returning(transactions, transactionMerkleRoot, coinbaseTx, previousBlockId,
+                        timestamp, consensusData, height, blockData);
+        returning.checkRep();
+
+        return returning;
+    });
+}
+
 Json::Value CryptoKernel::Blockchain::block::toJson() const {
     Json::Value returning;
     returning["coinbaseTx"] = coinbaseTx.toJson();
@@ -614,25 +967,25 @@ Json::Value CryptoKernel::Blockchain::block::toJson() const {
     return returning;
 }
 
-Json::Value CryptoKernel::Blockchain::block::getData() const {
+const Json::Value& CryptoKernel::Blockchain::block::getData() const {
 	return data;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::block::getTransactionMerkleRoot() const {
+const CryptoKernel::uint256& CryptoKernel::Blockchain::block::getTransactionMerkleRoot() const {
 	return transactionMerkleRoot;
 }
 
-std::set<CryptoKernel::Blockchain::transaction>
+const std::set<CryptoKernel::Blockchain::transaction>&
 CryptoKernel::Blockchain::block::getTransactions() const {
     return transactions;
 }
 
-CryptoKernel::Blockchain::transaction CryptoKernel::Blockchain::block::getCoinbaseTx()
+const CryptoKernel::Blockchain::transaction& CryptoKernel::Blockchain::block::getCoinbaseTx()
 const {
     return coinbaseTx;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::block::getPreviousBlockId() const {
+const CryptoKernel::uint256& CryptoKernel::Blockchain::block::getPreviousBlockId() const {
     return previousBlockId;
 }
 
@@ -640,11 +993,11 @@ uint64_t CryptoKernel::Blockchain::block::getTimestamp() const {
     return timestamp;
 }
 
-Json::Value CryptoKernel::Blockchain::block::getConsensusData() const {
+const Json::Value& CryptoKernel::Blockchain::block::getConsensusData() const {
     return consensusData;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::block::getId() const {
+const CryptoKernel::uint256& CryptoKernel::Blockchain::block::getId() const {
     return id;
 }
 
@@ -654,19 +1007,19 @@ uint64_t CryptoKernel::Blockchain::block::getHeight() const {
 
 CryptoKernel::Blockchain::dbBlock::dbBlock(const Json::Value& jsonBlock) {
     try {
-        coinbaseTx = CryptoKernel::BigNum(jsonBlock["coinbaseTx"].asString());
-        previousBlockId = CryptoKernel::BigNum(jsonBlock["previousBlockId"].asString());
+        coinbaseTx = jsonId(jsonBlock["coinbaseTx"]);
+        previousBlockId = jsonId(jsonBlock["previousBlockId"]);
         timestamp = jsonBlock["timestamp"].asUInt64();
         height = jsonBlock["height"].asUInt64();
         consensusData = jsonBlock["consensusData"];
 		data = jsonBlock["data"];
 
 		if(!jsonBlock["transactions"].empty()) {
-			transactionMerkleRoot = CryptoKernel::BigNum(jsonBlock["transactionMerkleRoot"].asString());
+			transactionMerkleRoot = jsonId(jsonBlock["transactionMerkleRoot"]);
 		}
 
         for(const Json::Value& tx : jsonBlock["transactions"]) {
-            transactions.insert(CryptoKernel::BigNum(tx.asString()));
+            transactions.insert(jsonId(tx));
         }
     } catch(const Json::Exception& e) {
         throw InvalidElementException("Block JSON is malformed");
@@ -690,7 +1043,7 @@ CryptoKernel::Blockchain::dbBlock::dbBlock(const block& compactBlock) {
     }
 
 	if(!transactions.empty()) {
-		transactionMerkleRoot = CryptoKernel::MerkleNode::makeMerkleTree(transactions)->getMerkleRoot();
+		transactionMerkleRoot = CryptoKernel::MerkleNode::calculateRoot(transactions);
 	}
 
     checkRep();
@@ -712,7 +1065,7 @@ CryptoKernel::Blockchain::dbBlock::dbBlock(const block& compactBlock,
     }
 
 	if(!transactions.empty()) {
-		transactionMerkleRoot = CryptoKernel::MerkleNode::makeMerkleTree(transactions)->getMerkleRoot();
+		transactionMerkleRoot = CryptoKernel::MerkleNode::calculateRoot(transactions);
 	}
 
     checkRep();
@@ -722,7 +1075,7 @@ CryptoKernel::Blockchain::dbBlock::dbBlock(const block& compactBlock,
 
 void CryptoKernel::Blockchain::dbBlock::checkRep() {
 	if(!transactions.empty()) {
-		if(CryptoKernel::MerkleNode::makeMerkleTree(transactions)->getMerkleRoot() != transactionMerkleRoot) {
+		if(CryptoKernel::MerkleNode::calculateRoot(transactions) != transactionMerkleRoot) {
 			throw InvalidElementException("Transaction merkle root is incorrect");
 		}
 	}
@@ -736,7 +1089,7 @@ void CryptoKernel::Blockchain::dbBlock::checkRep() {
 	}
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::dbBlock::calculateId() {
+CryptoKernel::uint256 CryptoKernel::Blockchain::dbBlock::calculateId() {
     std::stringstream buffer;
 
     if(!transactions.empty()) {
@@ -746,8 +1099,7 @@ CryptoKernel::BigNum CryptoKernel::Blockchain::dbBlock::calculateId() {
     buffer << coinbaseTx.toString() << previousBlockId.toString() << timestamp
 		   << CryptoKernel::Storage::toString(data);
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return hashId(buffer.str());
 }
 
 Json::Value CryptoKernel::Blockchain::dbBlock::toJson() const {
@@ -760,7 +1112,7 @@ Json::Value CryptoKernel::Blockchain::dbBlock::toJson() const {
     returning["height"] = height;
 	returning["data"] = data;
 
-    for(const BigNum& tx : transactions) {
+    for(const uint256& tx : transactions) {
         returning["transactions"].append(tx.toString());
     }
 
@@ -775,20 +1127,20 @@ Json::Value CryptoKernel::Blockchain::dbBlock::getData() const {
 	return data;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::dbBlock::getTransactionMerkleRoot() const {
+CryptoKernel::uint256 CryptoKernel::Blockchain::dbBlock::getTransactionMerkleRoot() const {
 	return transactionMerkleRoot;
 }
 
-std::set<CryptoKernel::BigNum> CryptoKernel::Blockchain::dbBlock::getTransactions()
+std::set<CryptoKernel::uint256> CryptoKernel::Blockchain::dbBlock::getTransactions()
 const {
     return transactions;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::dbBlock::getCoinbaseTx() const {
+CryptoKernel::uint256 CryptoKernel::Blockchain::dbBlock::getCoinbaseTx() const {
     return coinbaseTx;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::dbBlock::getPreviousBlockId() const {
+CryptoKernel::uint256 CryptoKernel::Blockchain::dbBlock::getPreviousBlockId() const {
     return previousBlockId;
 }
 
@@ -804,6 +1156,131 @@ Json::Value CryptoKernel::Blockchain::dbBlock::getConsensusData() const {
     return consensusData;
 }
 
-CryptoKernel::BigNum CryptoKernel::Blockchain::dbBlock::getId() const {
+CryptoKernel::uint256 CryptoKernel::Blockchain::dbBlock::getId() const {
+    return id;
+}
+
+CryptoKernel::Blockchain::header::header(const block& fullBlock) {
+    coinbaseTx = fullBlock.getCoinbaseTx().getId();
+    previousBlockId = fullBlock.getPreviousBlockId();
+    timestamp = fullBlock.getTimestamp();
+    consensusData = fullBlock.getConsensusData();
+    data = fullBlock.getData();
+    height = fullBlock.getHeight();
+    transactions = !fullBlock.getTransactions().empty();
+    transactionMerkleRoot = fullBlock.getTransactionMerkleRoot();
+
+    id = fullBlock.getId();
+}
+
+CryptoKernel::Blockchain::header::header(const dbBlock& storedBlock) {
+    coinbaseTx = storedBlock.getCoinbaseTx();
+    previousBlockId = storedBlock.getPreviousBlockId();
+    timestamp = storedBlock.getTimestamp();
+    consensusData = storedBlock.getConsensusData();
+    data = storedBlock.getData();
+    height = storedBlock.getHeight();
+    transactions = !storedBlock.getTransactions().empty();
+    transactionMerkleRoot = storedBlock.getTransactionMerkleRoot();
+
+    id = storedBlock.getId();
+}
+
+CryptoKernel::Blockchain::header::header(const Json::Value& jsonHeader) {
+    try {
+        coinbaseTx = jsonId(jsonHeader["coinbaseTx"]);
+        previousBlockId = jsonId(jsonHeader["previousBlockId"]);
+        timestamp = jsonHeader["timestamp"].asUInt64();
+        height = jsonHeader["height"].asUInt64();
+        consensusData = jsonHeader["consensusData"];
+        data = jsonHeader["data"];
+
+        transactions = jsonHeader.isMember("transactionMerkleRoot");
+        if(transactions) {
+            transactionMerkleRoot = jsonId(jsonHeader["transactionMerkleRoot"]);
+        }
+    } catch(const Json::Exception& e) {
+        throw InvalidElementException("Header JSON is malformed");
+    }
+
+    checkRep();
+
+    id = calculateId();
+}
+
+void CryptoKernel::Blockchain::header::checkRep() {
+    if(CryptoKernel::Storage::toString(data).size() > 100 * 1024) {
+        throw InvalidElementException("Data field is too large");
+    }
+
+    if(!data.isObject() && !data.isNull()) {
+        throw InvalidElementException("Data field is neither an object or null");
+    }
+}
+
+CryptoKernel::uint256 CryptoKernel::Blockchain::header::calculateId() {
+    std::stringstream buffer;
+
+    if(transactions) {
+        buffer << transactionMerkleRoot.toString();
+    }
+
+    buffer << coinbaseTx.toString() << previousBlockId.toString() << timestamp
+           << CryptoKernel::Storage::toString(data);
+
+    return hashId(buffer.str());
+}
+
+Json::Value CryptoKernel::Blockchain::header::toJson() const {
+    Json::Value returning;
+
+    returning["coinbaseTx"] = coinbaseTx.toString();
+    returning["previousBlockId"] = previousBlockId.toString();
+    returning["timestamp"] = timestamp;
+    returning["consensusData"] = consensusData;
+    returning["height"] = height;
+    returning["data"] = data;
+
+    if(transactions) {
+        returning["transactionMerkleRoot"] = transactionMerkleRoot.toString();
+    }
+
+    return returning;
+}
+
+const CryptoKernel::uint256& CryptoKernel::Blockchain::header::getCoinbaseTx() const {
+    return coinbaseTx;
+}
+
+const CryptoKernel::uint256& CryptoKernel::Blockchain::header::getPreviousBlockId() const {
+    return previousBlockId;
+}
+
+uint64_t CryptoKernel::Blockchain::header::getTimestamp() const {
+    return timestamp;
+}
+
+const Json::Value& CryptoKernel::Blockchain::header::getConsensusData() const {
+    return consensusData;
+}
+
+const Json::Value& CryptoKernel::Blockchain::header::getData() const {
+    return data;
+}
+
+uint64_t CryptoKernel::Blockchain::header::getHeight() const {
+    return height;
+}
+
+bool CryptoKernel::Blockchain::header::hasTransactions() const {
+    return transactions;
+}
+
+const CryptoKernel::uint256& CryptoKernel::Blockchain::header::getTransactionMerkleRoot()
+const {
+    return transactionMerkleRoot;
+}
+
+const CryptoKernel::uint256& CryptoKernel::Blockchain::header::getId() const {
     return id;
 }
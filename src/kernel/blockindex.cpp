@@ -0,0 +1,315 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "blockindex.h"
+
+CryptoKernel::BlockIndex::BlockIndex() {
+    recording = false;
+}
+
+uint64_t CryptoKernel::BlockIndex::skipHeight(const uint64_t height) {
+    // Counted from 0 at height 1. Clearing the lowest set bit once or twice
+    // spreads the skip targets so that walks between any two heights take
+    // a logarithmic number of steps.
+    const uint64_t depth = height - 1;
+    if(depth < 2) {
+        return 1;
+    }
+
+    const auto clearLowest = [](const uint64_t n) {
+        return n & (n - 1);
+    };
+
+    const uint64_t skipDepth = (depth & 1) ? clearLowest(clearLowest(depth - 1)) + 1
+                                           : clearLowest(depth);
+    return skipDepth + 1;
+}
+
+CryptoKernel::BlockIndex::Node* CryptoKernel::BlockIndex::find(const uint256& id) const {
+    Node* const* node = byId.find(id);
+    if(node == nullptr) {
+        throw std::runtime_error("Block " + id.toString() + " is not in the index");
+    }
+    return *node;
+}
+
+CryptoKernel::BlockIndex::Node* CryptoKernel::BlockIndex::findAncestor(Node* node,
+        const uint64_t height) const {
+    if(height == 0 || height > node->entry.height) {
+        throw std::runtime_error("Block " + node->entry.id.toString() + " has no ancestor at height "
+                                 + std::to_string(height));
+    }
+
+    uint64_t current = node->entry.height;
+    while(current > height) {
+        if(inMainChain(node)) {
+            return mainChain[height - 1];
+        }
+
+        // Take the skip unless it overshoots, or unless the parent's skip
+        // would get closer without overshooting
+        const uint64_t skip = skipHeight(current);
+        const uint64_t previousSkip = skipHeight(current - 1);
+        if(node->skip != nullptr && (skip == height ||
+                                     (skip > height && !(previousSkip + 2 < skip && previousSkip >= height)))) {
+            node = node->skip;
+            current = skip;
+        } else {
+            node = node->previous;
+            current--;
+        }
+    }
+
+    return node;
+}
+
+bool CryptoKernel::BlockIndex::inMainChain(const Node* node) const {
+    return node->entry.status == Status::MainChain;
+}
+
+CryptoKernel::BlockIndex::Node* CryptoKernel::BlockIndex::findForkPoint(Node* node) const {
+    if(inMainChain(node)) {
+        return node;
+    }
+
+    // Ancestors are in the main chain up to the fork point and not after,
+    // so search for the last height where they are
+    uint64_t low = 0;
+    uint64_t high = std::min<uint64_t>(node->entry.height - 1, mainChain.size());
+    while(low < high) {
+        const uint64_t middle = low + (high - low + 1) / 2;
+        if(findAncestor(node, middle) == mainChain[middle - 1]) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    if(low == 0) {
+        throw std::runtime_error("Block " + node->entry.id.toString() +
+                                 " shares no ancestor with the main chain");
+    }
+
+    return mainChain[low - 1];
+}
+
+void CryptoKernel::BlockIndex::record(const Change::Type type, Node* node) {
+    if(recording) {
+        changes.push_back(Change{type, node});
+    }
+}
+
+bool CryptoKernel::BlockIndex::add(const Entry& entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(byId.contains(entry.id)) {
+        return false;
+    }
+
+    Node* previous = nullptr;
+    if(entry.height != 1) {
+        Node* const* found = byId.find(entry.previousId);
+        if(found == nullptr) {
+            throw std::runtime_error("Previous block of " + entry.id.toString() +
+                                     " is not in the index");
+        }
+
+        previous = *found;
+        if(previous->entry.height + 1 != entry.height) {
+            throw std::runtime_error("Block " + entry.id.toString() +
+                                     " does not follow on from its previous block");
+        }
+    }
+
+    nodes.push_back(Node{entry, previous, nullptr});
+    Node* node = &nodes.back();
+    node->entry.status = Status::Candidate;
+    if(previous != nullptr) {
+        node->skip = findAncestor(previous, skipHeight(entry.height));
+    }
+
+    byId.insert(entry.id, node);
+    record(Change::Type::Added, node);
+
+    return true;
+}
+
+void CryptoKernel::BlockIndex::connect(const uint256& id) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Node* node = find(id);
+    if(inMainChain(node)) {
+        throw std::runtime_error("Block " + id.toString() + " is already in the main chain");
+    }
+
+    const Node* tip = mainChain.empty() ? nullptr : mainChain.back();
+    if(node->previous != tip) {
+        throw std::runtime_error("Block " + id.toString() + " does not extend the main chain");
+    }
+
+    node->entry.status = Status::MainChain;
+    mainChain.push_back(node);
+    record(Change::Type::Connected, node);
+}
+
+void CryptoKernel::BlockIndex::disconnect() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(mainChain.empty()) {
+        throw std::runtime_error("The main chain is empty");
+    }
+
+    Node* node = mainChain.back();
+    mainChain.pop_back();
+    node->entry.status = Status::Candidate;
+    record(Change::Type::Disconnected, node);
+}
+
+bool CryptoKernel::BlockIndex::contains(const uint256& id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return byId.contains(id);
+}
+
+CryptoKernel::BlockIndex::Entry CryptoKernel::BlockIndex::get(const uint256& id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return find(id)->entry;
+}
+
+CryptoKernel::BlockIndex::Entry CryptoKernel::BlockIndex::getTip() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(mainChain.empty()) {
+        throw std::runtime_error("The main chain is empty");
+    }
+
+    return mainChain.back()->entry;
+}
+
+uint64_t CryptoKernel::BlockIndex::getHeight() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return mainChain.size();
+}
+
+CryptoKernel::BlockIndex::Entry CryptoKernel::BlockIndex::getByHeight(
+    const uint64_t height) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(height == 0 || height > mainChain.size()) {
+        throw std::runtime_error("No main chain block at height " + std::to_string(height));
+    }
+
+    return mainChain[height - 1]->entry;
+}
+
+CryptoKernel::BlockIndex::Entry CryptoKernel::BlockIndex::getAncestor(const uint256& id,
+        const uint64_t height) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return findAncestor(find(id), height)->entry;
+}
+
+CryptoKernel::BlockIndex::Entry CryptoKernel::BlockIndex::getForkPoint(
+    const uint256& id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return findForkPoint(find(id))->entry;
+}
+
+std::vector<CryptoKernel::uint256> CryptoKernel::BlockIndex::getBranch(
+    const uint256& id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Node* node = find(id);
+    const Node* forkPoint = findForkPoint(node);
+
+    std::vector<uint256> branch;
+    branch.reserve(node->entry.height - forkPoint->entry.height);
+    for(; node != forkPoint; node = node->previous) {
+        branch.push_back(node->entry.id);
+    }
+    std::reverse(branch.begin(), branch.end());
+
+    return branch;
+}
+
+std::vector<CryptoKernel::BlockIndex::Entry> CryptoKernel::BlockIndex::getAncestry(
+    const uint256& id, const size_t count) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const Node* node = find(id);
+
+    std::vector<Entry> ancestry;
+    ancestry.reserve(std::min<uint64_t>(count, node->entry.height));
+    for(; node != nullptr && ancestry.size() < count; node = node->previous) {
+        ancestry.push_back(node->entry);
+    }
+
+    return ancestry;
+}
+
+void CryptoKernel::BlockIndex::begin() {
+    std::lock_guard<std::mutex> lock(mutex);
+    changes.clear();
+    recording = true;
+}
+
+void CryptoKernel::BlockIndex::commit() {
+    std::lock_guard<std::mutex> lock(mutex);
+    changes.clear();
+    recording = false;
+}
+
+void CryptoKernel::BlockIndex::abort() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for(auto it = changes.rbegin(); it != changes.rend(); ++it) {
+        Node* node = it->node;
+        switch(it->type) {
+        case Change::Type::Added:
+            // Changes are undone newest first, so this is the last node
+            byId.erase(node->entry.id);
+            nodes.pop_back();
+            break;
+        case Change::Type::Connected:
+            mainChain.pop_back();
+            node->entry.status = Status::Candidate;
+            break;
+        case Change::Type::Disconnected:
+            mainChain.push_back(node);
+            node->entry.status = Status::MainChain;
+            break;
+        }
+    }
+
+    changes.clear();
+    recording = false;
+}
+
+void CryptoKernel::BlockIndex::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    mainChain.clear();
+    byId.clear();
+    nodes.clear();
+    changes.clear();
+    recording = false;
+}
+
+size_t CryptoKernel::BlockIndex::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nodes.size();
+}
@@ -0,0 +1,225 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLOCKINDEX_H_INCLUDED
+#define BLOCKINDEX_H_INCLUDED
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <json/value.h>
+
+#include "ckmath.h"
+#include "idmap.h"
+
+namespace CryptoKernel {
+/**
+* In-memory index of every known block, in the main chain or not, with the
+* fields needed to walk and compare chains without reading the block
+* database. Blocks link to their parent and to a further ancestor, so any
+* ancestor is found in a logarithmic number of steps, and the main chain
+* is kept as an array by height.
+*
+* Changes made between begin() and commit() can be undone with abort(),
+* so the index can follow a database transaction. Queries see those
+* changes as soon as they are made. Every method may be called from
+* several threads at once.
+*/
+class BlockIndex {
+public:
+    enum class Status {
+        // Connected to the main chain, so its transactions were verified
+        MainChain,
+        // Passed the consensus rules but is not in the main chain, so its
+        // transactions may never have been verified
+        Candidate
+    };
+
+    /**
+    * A block as the index knows it. Only the status changes once a block
+    * is added.
+    */
+    struct Entry {
+        uint256 id;
+        uint256 previousId;
+        uint64_t height;
+        uint64_t timestamp;
+        // Includes the cumulative work of the chain for consensus methods
+        // that track it
+        Json::Value consensusData;
+        Status status;
+    };
+
+    BlockIndex();
+
+    BlockIndex(const BlockIndex&) = delete;
+    BlockIndex& operator=(const BlockIndex&) = delete;
+
+    /**
+    * Adds a block as a candidate. Its parent must already be in the index
+    * unless it is at height 1.
+    *
+    * @param entry the block to add, its status is ignored
+    * @return true if the block was added, false if it was already present
+    * @throw std::runtime_error if the parent is missing or the height does
+    *        not follow on from it
+    */
+    bool add(const Entry& entry);
+
+    /**
+    * Makes a block the new tip of the main chain
+    *
+    * @param id the block to connect, whose parent must be the current tip
+    * @throw std::runtime_error if the block is unknown or does not extend the tip
+    */
+    void connect(const uint256& id);
+
+    /**
+    * Moves the tip of the main chain back to its parent, leaving the old
+    * tip as a candidate
+    *
+    * @throw std::runtime_error if the main chain is empty
+    */
+    void disconnect();
+
+    bool contains(const uint256& id) const;
+
+    /**
+    * @throw std::runtime_error if the block is not in the index
+    */
+    Entry get(const uint256& id) const;
+
+    /**
+    * @throw std::runtime_error if the main chain is empty
+    */
+    Entry getTip() const;
+
+    /**
+    * Returns the height of the main chain, 0 if it is empty
+    */
+    uint64_t getHeight() const;
+
+    /**
+    * Returns the main chain block at a height
+    *
+    * @throw std::runtime_error if the main chain is not that high
+    */
+    Entry getByHeight(const uint64_t height) const;
+
+    /**
+    * Returns the ancestor of a block at a height, the block itself if the
+    * height is its own
+    *
+    * @throw std::runtime_error if the block is unknown or below the height
+    */
+    Entry getAncestor(const uint256& id, const uint64_t height) const;
+
+    /**
+    * Returns the highest ancestor of a block that is in the main chain,
+    * the block itself if it is in the main chain
+    *
+    * @throw std::runtime_error if the block is unknown or shares no
+    *        ancestor with the main chain
+    */
+    Entry getForkPoint(const uint256& id) const;
+
+    /**
+    * Returns the ids of the blocks after the fork point of a block up to
+    * and including the block, oldest first. These are what connecting the
+    * block as the tip would add to the main chain.
+    *
+    * @throw std::runtime_error if the block is unknown or shares no
+    *        ancestor with the main chain
+    */
+    std::vector<uint256> getBranch(const uint256& id) const;
+
+    /**
+    * Returns a block followed by its ancestors, newest first
+    *
+    * @param id the block to start from
+    * @param count the most blocks to return
+    * @throw std::runtime_error if the block is unknown
+    */
+    std::vector<Entry> getAncestry(const uint256& id, const size_t count) const;
+
+    /**
+    * Starts recording changes so they can be undone
+    */
+    void begin();
+
+    /**
+    * Keeps the changes made since begin()
+    */
+    void commit();
+
+    /**
+    * Undoes the changes made since begin()
+    */
+    void abort();
+
+    /**
+    * Removes every block
+    */
+    void clear();
+
+    size_t size() const;
+
+private:
+    struct Node {
+        Entry entry;
+        Node* previous;
+        // An ancestor further back, chosen so walks take logarithmic steps
+        Node* skip;
+    };
+
+    struct Change {
+        enum class Type {
+            Added,
+            Connected,
+            Disconnected
+        };
+
+        Type type;
+        Node* node;
+    };
+
+    static uint64_t skipHeight(const uint64_t height);
+
+    Node* find(const uint256& id) const;
+    Node* findAncestor(Node* node, const uint64_t height) const;
+    Node* findForkPoint(Node* node) const;
+    bool inMainChain(const Node* node) const;
+
+    void record(const Change::Type type, Node* node);
+
+    mutable std::mutex mutex;
+
+    // Nodes are only removed by abort(), newest first, so a deque keeps
+    // the rest where they are
+    std::deque<Node> nodes;
+    IdMap<Node*> byId;
+
+    // The main chain by height, starting from height 1
+    std::vector<Node*> mainChain;
+
+    bool recording;
+    std::vector<Change> changes;
+};
+}
+
+#endif // BLOCKINDEX_H_INCLUDED
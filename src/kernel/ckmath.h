@@ -18,11 +18,15 @@
 #ifndef MATH_H_INCLUDED
 #define MATH_H_INCLUDED
 
+#include <cstdint>
+#include <cstring>
 #include <string>
 
 #include <openssl/bn.h>
 
 namespace CryptoKernel {
+class uint256;
+
 class BigNum {
 public:
     BigNum(const std::string& hexString);
@@ -51,10 +55,243 @@ public:
     bool operator<=(const BigNum& rhs) const;
 
 private:
+    friend class uint256;
+
     BIGNUM* bn;
 
     int compare(const BigNum& lhs, const BigNum& rhs) const;
 };
+
+/**
+* A 256-bit unsigned integer held inline, for ids, which are SHA256 hashes,
+* and proof of work targets. Copying, comparing and arithmetic never
+* allocate. Arithmetic wraps modulo 2^256, so use BigNum for values that
+* can grow past 256 bits, such as total chain work.
+*/
+class uint256 {
+public:
+    /**
+    * Constructs a zero value
+    */
+    constexpr uint256() : words{} {}
+
+    constexpr explicit uint256(const uint64_t value) :
+        words{static_cast<uint32_t>(value), static_cast<uint32_t>(value >> 32)} {}
+
+    /**
+    * Parses hex the way BigNum does: digits are read up to the first
+    * character that is not one, and a string without any is zero
+    *
+    * @throws std::runtime_error if the value is negative or does not fit
+    *         in 256 bits
+    */
+    explicit uint256(const std::string& hexString);
+
+    /**
+    * Converts a BigNum
+    *
+    * @throws std::runtime_error if the value is negative or does not fit
+    *         in 256 bits
+    */
+    explicit uint256(const BigNum& value);
+
+    /**
+    * Constructs a value from 32 big-endian bytes, such as a SHA256 digest
+    */
+    static uint256 fromBytes(const unsigned char* data);
+
+    BigNum toBigNum() const;
+
+    /**
+    * Returns the value as lowercase hex without leading zeros, the same
+    * as BigNum::toString
+    */
+    std::string toString() const;
+
+    /**
+    * Writes the value as 32 big-endian bytes
+    */
+    void toBytes(unsigned char* data) const;
+
+    /**
+    * Returns the number of significant bits, zero for zero
+    */
+    unsigned int bits() const;
+
+    /**
+    * Returns value * mul / div, rounded down, without overflowing in
+    * between
+    *
+    * @return the result, or the largest value if it does not fit
+    * @throws std::runtime_error if div is zero
+    */
+    uint256 mulDiv(const uint64_t mul, const uint64_t div) const;
+
+    constexpr uint256 operator~() const {
+        uint256 returning;
+        for(unsigned int i = 0; i < size; i++) {
+            returning.words[i] = ~words[i];
+        }
+        return returning;
+    }
+
+    constexpr uint256& operator+=(const uint256& rhs) {
+        uint64_t carry = 0;
+        for(unsigned int i = 0; i < size; i++) {
+            const uint64_t sum = carry + words[i] + rhs.words[i];
+            words[i] = static_cast<uint32_t>(sum);
+            carry = sum >> 32;
+        }
+        return *this;
+    }
+
+    constexpr uint256& operator-=(const uint256& rhs) {
+        uint64_t borrow = 0;
+        for(unsigned int i = 0; i < size; i++) {
+            const uint64_t difference = uint64_t(words[i]) - rhs.words[i] - borrow;
+            words[i] = static_cast<uint32_t>(difference);
+            borrow = difference >> 63;
+        }
+        return *this;
+    }
+
+    constexpr uint256& operator*=(const uint256& rhs) {
+        uint256 product;
+        for(unsigned int i = 0; i < size; i++) {
+            uint64_t carry = 0;
+            for(unsigned int j = 0; i + j < size; j++) {
+                const uint64_t term = carry + product.words[i + j] +
+                                      uint64_t(words[i]) * rhs.words[j];
+                product.words[i + j] = static_cast<uint32_t>(term);
+                carry = term >> 32;
+            }
+        }
+        *this = product;
+        return *this;
+    }
+
+    /**
+    * @throws std::runtime_error if rhs is zero
+    */
+    uint256& operator/=(const uint256& rhs);
+
+    constexpr uint256& operator<<=(const unsigned int shift) {
+        uint256 shifted;
+        const unsigned int wordShift = shift / 32;
+        const unsigned int bitShift = shift % 32;
+        for(unsigned int i = wordShift; i < size; i++) {
+            shifted.words[i] = words[i - wordShift] << bitShift;
+            if(bitShift != 0 && i > wordShift) {
+                shifted.words[i] |= words[i - wordShift - 1] >> (32 - bitShift);
+            }
+        }
+        *this = shifted;
+        return *this;
+    }
+
+    constexpr uint256& operator>>=(const unsigned int shift) {
+        uint256 shifted;
+        const unsigned int wordShift = shift / 32;
+        const unsigned int bitShift = shift % 32;
+        for(unsigned int i = 0; i + wordShift < size; i++) {
+            shifted.words[i] = words[i + wordShift] >> bitShift;
+            if(bitShift != 0 && i + wordShift + 1 < size) {
+                shifted.words[i] |= words[i + wordShift + 1] << (32 - bitShift);
+            }
+        }
+        *this = shifted;
+        return *this;
+    }
+
+    constexpr uint256 operator+(const uint256& rhs) const {
+        return uint256(*this) += rhs;
+    }
+
+    constexpr uint256 operator-(const uint256& rhs) const {
+        return uint256(*this) -= rhs;
+    }
+
+    constexpr uint256 operator*(const uint256& rhs) const {
+        return uint256(*this) *= rhs;
+    }
+
+    uint256 operator/(const uint256& rhs) const {
+        return uint256(*this) /= rhs;
+    }
+
+    constexpr uint256 operator<<(const unsigned int shift) const {
+        return uint256(*this) <<= shift;
+    }
+
+    constexpr uint256 operator>>(const unsigned int shift) const {
+        return uint256(*this) >>= shift;
+    }
+
+    constexpr bool operator==(const uint256& rhs) const {
+        return compare(rhs) == 0;
+    }
+
+    constexpr bool operator!=(const uint256& rhs) const {
+        return compare(rhs) != 0;
+    }
+
+    constexpr bool operator<(const uint256& rhs) const {
+        return compare(rhs) < 0;
+    }
+
+    constexpr bool operator>(const uint256& rhs) const {
+        return compare(rhs) > 0;
+    }
+
+    constexpr bool operator<=(const uint256& rhs) const {
+        return compare(rhs) <= 0;
+    }
+
+    constexpr bool operator>=(const uint256& rhs) const {
+        return compare(rhs) >= 0;
+    }
+
+    /**
+    * Hash function for unordered containers. Each hasher mixes in its own
+    * random seed, so ids chosen to collide in one table still spread out
+    * in others.
+    */
+    class Hasher {
+    public:
+        Hasher();
+
+        size_t operator()(const uint256& value) const {
+            uint64_t halves[4];
+            std::memcpy(halves, value.words, sizeof(halves));
+
+            uint64_t hash = seed;
+            for(const uint64_t half : halves) {
+                hash = (hash ^ half) * 0x9e3779b97f4a7c15ULL;
+                hash ^= hash >> 32;
+            }
+
+            return hash;
+        }
+
+    private:
+        uint64_t seed;
+    };
+
+private:
+    static constexpr unsigned int size = 8;
+
+    constexpr int compare(const uint256& rhs) const {
+        for(unsigned int i = size; i > 0; i--) {
+            if(words[i - 1] != rhs.words[i - 1]) {
+                return words[i - 1] < rhs.words[i - 1] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    // Least significant first
+    uint32_t words[size];
+};
 }
 
 #endif // MATH_H_INCLUDED
@@ -69,7 +69,7 @@ bool CryptoKernel::Consensus::CB::checkConsensusRules(Storage::Transaction* tran
 }
 
 Json::Value CryptoKernel::Consensus::CB::generateConsensusData(
-    Storage::Transaction* transaction, const CryptoKernel::BigNum& previousBlockId,
+    Storage::Transaction* transaction, const CryptoKernel::uint256& previousBlockId,
     const std::string& publicKey) {
     consensusData data;
     data.publicKey = publicKey;
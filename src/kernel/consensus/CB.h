@@ -47,7 +47,7 @@ public:
     * Probably just return the Central Bank pub key.
     */
     Json::Value generateConsensusData(Storage::Transaction* transaction,
-                                      const CryptoKernel::BigNum& previousBlockId, const std::string& publicKey);
+                                      const CryptoKernel::uint256& previousBlockId, const std::string& publicKey);
  
     /**
     * Always return true. No custom functionality.
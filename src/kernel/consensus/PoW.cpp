@@ -1,10 +1,48 @@
 #include <sstream>
 #include <math.h>
 
+#include <openssl/sha.h>
+
 #include "PoW.h"
 #include "Lyra2REv2/Lyra2RE.h"
 #include "../crypto.h"
 
+namespace {
+// A block's share of the total work, 2^256 - 1 minus its target
+CryptoKernel::BigNum blockWork(const CryptoKernel::uint256& target) {
+    return (~target).toBigNum();
+}
+
+CryptoKernel::uint256 parseTarget(const Json::Value& target) {
+    try {
+        return CryptoKernel::uint256(target.asString());
+    } catch(const std::runtime_error& e) {
+        // The target a block claims is replaced by the recalculated one
+        // before it is used, so one out of range is not an error by itself
+        return CryptoKernel::uint256();
+    }
+}
+
+CryptoKernel::BlockIndex::Entry headerEntry(const CryptoKernel::Blockchain::header& header) {
+    CryptoKernel::BlockIndex::Entry entry;
+    entry.id = header.getId();
+    entry.previousId = header.getPreviousBlockId();
+    entry.height = header.getHeight();
+    entry.timestamp = header.getTimestamp();
+    entry.consensusData = header.getConsensusData();
+    entry.status = CryptoKernel::BlockIndex::Status::Candidate;
+    return entry;
+}
+
+CryptoKernel::uint256 indexedTarget(const CryptoKernel::BlockIndex::Entry& entry) {
+    try {
+        return parseTarget(entry.consensusData["target"]);
+    } catch(const Json::Exception& e) {
+        throw CryptoKernel::Blockchain::InvalidElementException("Block consensusData JSON is malformed");
+    }
+}
+}
+
 CryptoKernel::Consensus::PoW::PoW(const uint64_t blockTarget,
                                   CryptoKernel::Blockchain* blockchain,
                                   const bool miner,
@@ -39,17 +77,14 @@ void CryptoKernel::Consensus::PoW::miner() {
 
         uint64_t time2 = now;
         uint64_t count = 0;
-        CryptoKernel::BigNum pow;
+        CryptoKernel::uint256 pow;
 
-        CryptoKernel::BigNum target = CryptoKernel::BigNum(
+        CryptoKernel::uint256 target = CryptoKernel::uint256(
                                           Block.getConsensusData()["target"].asString());
         CryptoKernel::Blockchain::dbBlock previousBlock = blockchain->getBlockDB(
                     Block.getPreviousBlockId().toString());
-        const CryptoKernel::BigNum inverse =
-              CryptoKernel::BigNum("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff") -
-              target;
         Json::Value consensusData = Block.getConsensusData();
-        consensusData["totalWork"] = (inverse + CryptoKernel::BigNum(
+        consensusData["totalWork"] = (blockWork(target) + CryptoKernel::BigNum(
                                           previousBlock.getConsensusData()["totalWork"].asString())).toString();
         consensusData["nonce"] = nonce;
 
@@ -61,12 +96,9 @@ void CryptoKernel::Consensus::PoW::miner() {
                 log->printf(LOG_LEVEL_INFO, "Consensus::PoW::miner(): current block is stale, generating a new one. HR: " + std::to_string(hashrate) + " KH/s");
                 Block = blockchain->generateVerifyingBlock(pubKey);
                 previousBlock = blockchain->getBlockDB(Block.getPreviousBlockId().toString());
-                target = CryptoKernel::BigNum(Block.getConsensusData()["target"].asString());
-                const CryptoKernel::BigNum inverse =
-                    CryptoKernel::BigNum("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff") -
-                    target;
+                target = CryptoKernel::uint256(Block.getConsensusData()["target"].asString());
                 consensusData = Block.getConsensusData();
-                consensusData["totalWork"] = (inverse + CryptoKernel::BigNum(
+                consensusData["totalWork"] = (blockWork(target) + CryptoKernel::BigNum(
                                                   previousBlock.getConsensusData()["totalWork"].asString())).toString();
                 now = time2;
                 count = 0;
@@ -105,7 +137,7 @@ CryptoKernel::Consensus::PoW::getConsensusData(const CryptoKernel::Blockchain::b
     consensusData data;
     const Json::Value consensusJson = block.getConsensusData();
     try {
-        data.target = CryptoKernel::BigNum(consensusJson["target"].asString());
+        data.target = parseTarget(consensusJson["target"]);
         data.totalWork = CryptoKernel::BigNum(consensusJson["totalWork"].asString());
         data.nonce = consensusJson["nonce"].asUInt64();
     } catch(const Json::Exception& e) {
@@ -120,7 +152,22 @@ CryptoKernel::Consensus::PoW::getConsensusData(const CryptoKernel::Blockchain::d
     consensusData data;
     const Json::Value consensusJson = block.getConsensusData();
     try {
-        data.target = CryptoKernel::BigNum(consensusJson["target"].asString());
+        data.target = parseTarget(consensusJson["target"]);
+        data.totalWork = CryptoKernel::BigNum(consensusJson["totalWork"].asString());
+        data.nonce = consensusJson["nonce"].asUInt64();
+    } catch(const Json::Exception& e) {
+        throw CryptoKernel::Blockchain::InvalidElementException("Block consensusData JSON is malformed");
+    }
+    return data;
+}
+
+CryptoKernel::Consensus::PoW::consensusData
+CryptoKernel::Consensus::PoW::getConsensusData(const CryptoKernel::Blockchain::header&
+        header) {
+    consensusData data;
+    const Json::Value& consensusJson = header.getConsensusData();
+    try {
+        data.target = parseTarget(consensusJson["target"]);
         data.totalWork = CryptoKernel::BigNum(consensusJson["totalWork"].asString());
         data.nonce = consensusJson["nonce"].asUInt64();
     } catch(const Json::Exception& e) {
@@ -153,10 +200,7 @@ bool CryptoKernel::Consensus::PoW::checkConsensusRules(Storage::Transaction* tra
 
         //Check total work
         const consensusData tipData = getConsensusData(previousBlock);
-        const BigNum inverse =
-            CryptoKernel::BigNum("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff") -
-            blockData.target;
-        blockData.totalWork = inverse + tipData.totalWork;
+        blockData.totalWork = blockWork(blockData.target) + tipData.totalWork;
 
         block.setConsensusData(consensusDataToJson(blockData));
 
@@ -166,15 +210,71 @@ bool CryptoKernel::Consensus::PoW::checkConsensusRules(Storage::Transaction* tra
     }
 }
 
-CryptoKernel::BigNum CryptoKernel::Consensus::PoW::calculatePoW(
+CryptoKernel::uint256 CryptoKernel::Consensus::PoW::calculatePoW(
     const CryptoKernel::Blockchain::block& block, const uint64_t nonce) {
+    return calculatePoW(block.getId(), nonce);
+}
+
+CryptoKernel::uint256 CryptoKernel::Consensus::PoW::calculatePoW(
+    const CryptoKernel::uint256& blockId, const uint64_t nonce) {
     std::stringstream buffer;
-    buffer << block.getId().toString() << nonce;
+    buffer << blockId.toString() << nonce;
     return powFunction(buffer.str());
 }
 
+bool CryptoKernel::Consensus::PoW::checkHeader(
+    const std::vector<CryptoKernel::Blockchain::header>& headers, const size_t index,
+    const CryptoKernel::Blockchain::header& previousHeader) {
+    const CryptoKernel::Blockchain::header& header = headers[index];
+
+    // The headers before this one, then the block index they build on
+    const KGWRetarget::Ancestry ancestry = [&](const CryptoKernel::uint256& id,
+                                               const size_t count) {
+        std::vector<CryptoKernel::BlockIndex::Entry> entries;
+        CryptoKernel::uint256 next = id;
+        for(size_t i = index; i > 0 && entries.size() < count; i--) {
+            if(headers[i - 1].getId() == next) {
+                entries.push_back(headerEntry(headers[i - 1]));
+                next = headers[i - 1].getPreviousBlockId();
+            }
+        }
+
+        if(entries.size() < count && (entries.empty() || entries.back().height > 1)) {
+            const std::vector<CryptoKernel::BlockIndex::Entry> indexed =
+                blockchain->getAncestry(next, count - entries.size());
+            entries.insert(entries.end(), indexed.begin(), indexed.end());
+        }
+
+        return entries;
+    };
+
+    try {
+        const consensusData headerData = getConsensusData(header);
+        const consensusData previousData = getConsensusData(previousHeader);
+
+        // Otherwise a chain of easy targets would claim nearly a block's
+        // work for every header while costing next to no hashing
+        if(headerData.target != calculateTarget(ancestry, header.getPreviousBlockId())) {
+            return false;
+        }
+
+        if(headerData.target <= calculatePoW(header.getId(), headerData.nonce)) {
+            return false;
+        }
+
+        return headerData.totalWork == blockWork(headerData.target) + previousData.totalWork;
+    } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
+        return false;
+    }
+}
+
+bool CryptoKernel::Consensus::PoW::isHeaderBetter(const CryptoKernel::Blockchain::header& header,
+        const CryptoKernel::Blockchain::header& tip) {
+    return getConsensusData(header).totalWork > getConsensusData(tip).totalWork;
+}
+
 Json::Value CryptoKernel::Consensus::PoW::generateConsensusData(
-    Storage::Transaction* transaction, const CryptoKernel::BigNum& previousBlockId,
+    Storage::Transaction* transaction, const CryptoKernel::uint256& previousBlockId,
     const std::string& publicKey) {
     consensusData data;
     data.target = calculateTarget(transaction, previousBlockId);
@@ -187,110 +287,32 @@ CryptoKernel::Consensus::PoW::KGW_SHA256::KGW_SHA256(const uint64_t blockTarget,
                                                      const bool miner,
                                                      const std::string& pubKey,
                                                      CryptoKernel::Log* log) :
-CryptoKernel::Consensus::PoW(blockTarget, blockchain, miner, pubKey, log) {
+CryptoKernel::Consensus::PoW(blockTarget, blockchain, miner, pubKey, log),
+// Read from the block index, as walking back through the block database
+// decodes every block
+retarget(blockTarget, [this](const CryptoKernel::uint256& id, const size_t count) {
+    return this->blockchain->getAncestry(id, count);
+}, indexedTarget) {
 
 }
 
-CryptoKernel::BigNum CryptoKernel::Consensus::PoW::KGW_SHA256::powFunction(
+CryptoKernel::uint256 CryptoKernel::Consensus::PoW::KGW_SHA256::powFunction(
     const std::string& inputString) {
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(inputString));
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char*>(inputString.data()), inputString.size(), hash);
+    return CryptoKernel::uint256::fromBytes(hash);
 }
 
-CryptoKernel::BigNum CryptoKernel::Consensus::PoW::KGW_SHA256::calculateTarget(
-    Storage::Transaction* transaction, const CryptoKernel::BigNum& previousBlockId) {
-    const uint64_t minBlocks = 144;
-    const uint64_t maxBlocks = 4032;
-    const CryptoKernel::BigNum minDifficulty =
-        CryptoKernel::BigNum("fffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
-
-    CryptoKernel::Blockchain::dbBlock currentBlock = blockchain->getBlockDB(transaction,
-            previousBlockId.toString());
-    consensusData currentBlockData = getConsensusData(currentBlock);
-    CryptoKernel::Blockchain::dbBlock lastSolved = currentBlock;
-
-    if(currentBlock.getHeight() < minBlocks) {
-        return minDifficulty;
-    } else if(currentBlock.getHeight() % 12 != 0) {
-        return currentBlockData.target;
-    } else {
-        uint64_t blocksScanned = 0;
-        CryptoKernel::BigNum difficultyAverage = CryptoKernel::BigNum("0");
-        CryptoKernel::BigNum previousDifficultyAverage = CryptoKernel::BigNum("0");
-        int64_t actualRate = 0;
-        int64_t targetRate = 0;
-        double rateAdjustmentRatio = 1.0;
-        double eventHorizonDeviation = 0.0;
-        double eventHorizonDeviationFast = 0.0;
-        double eventHorizonDeviationSlow = 0.0;
-
-        for(unsigned int i = 1; currentBlock.getHeight() != 1; i++) {
-            if(i > maxBlocks) {
-                break;
-            }
-
-            blocksScanned++;
-
-            if(i == 1) {
-                difficultyAverage = currentBlockData.target;
-            } else {
-                std::stringstream buffer;
-                buffer << std::hex << i;
-                difficultyAverage = ((currentBlockData.target - previousDifficultyAverage) /
-                                     CryptoKernel::BigNum(buffer.str())) + previousDifficultyAverage;
-            }
-
-            previousDifficultyAverage = difficultyAverage;
-
-            actualRate = lastSolved.getTimestamp() - currentBlock.getTimestamp();
-            targetRate = blockTarget * blocksScanned;
-            rateAdjustmentRatio = 1.0;
-
-            if(actualRate < 0) {
-                actualRate = 0;
-            }
-
-            if(actualRate != 0 && targetRate != 0) {
-                rateAdjustmentRatio = double(targetRate) / double(actualRate);
-            }
-
-            eventHorizonDeviation = 1 + (0.7084 * pow((double(blocksScanned)/double(minBlocks)),
-                                         -1.228));
-            eventHorizonDeviationFast = eventHorizonDeviation;
-            eventHorizonDeviationSlow = 1 / eventHorizonDeviation;
-
-            if(blocksScanned >= minBlocks) {
-                if((rateAdjustmentRatio <= eventHorizonDeviationSlow) ||
-                        (rateAdjustmentRatio >= eventHorizonDeviationFast)) {
-                    break;
-                }
-            }
-
-            if(currentBlock.getHeight() == 1) {
-                break;
-            }
-            currentBlock = blockchain->getBlockDB(transaction,
-                                                  currentBlock.getPreviousBlockId().toString());
-            currentBlockData = getConsensusData(currentBlock);
-        }
-
-        CryptoKernel::BigNum newTarget = difficultyAverage;
-        if(actualRate != 0 && targetRate != 0) {
-            std::stringstream buffer;
-            buffer << std::hex << actualRate;
-            newTarget = newTarget * CryptoKernel::BigNum(buffer.str());
-
-            buffer.str("");
-            buffer << std::hex << targetRate;
-            newTarget = newTarget / CryptoKernel::BigNum(buffer.str());
-        }
-
-        if(newTarget > minDifficulty) {
-            newTarget = minDifficulty;
-        }
+CryptoKernel::uint256 CryptoKernel::Consensus::PoW::KGW_SHA256::calculateTarget(
+    Storage::Transaction* transaction, const CryptoKernel::uint256& previousBlockId) {
+    return retarget.calculateTarget(previousBlockId);
+}
 
-        return newTarget;
-    }
+CryptoKernel::uint256 CryptoKernel::Consensus::PoW::KGW_SHA256::calculateTarget(
+    const KGWRetarget::Ancestry& ancestry, const uint256& previousBlockId) {
+    // The kept window follows the block index, so headers get their own
+    KGWRetarget headerRetarget(blockTarget, ancestry, indexedTarget);
+    return headerRetarget.calculateTarget(previousBlockId);
 }
 
 bool CryptoKernel::Consensus::PoW::KGW_SHA256::verifyTransaction(
@@ -320,14 +342,10 @@ CryptoKernel::Consensus::PoW::KGW_LYRA2REV2::KGW_LYRA2REV2(const uint64_t blockT
                                                            CryptoKernel::Log* log)
 : KGW_SHA256(blockTarget, blockchain, miner, pubKey, log) {}
 
-CryptoKernel::BigNum CryptoKernel::Consensus::PoW::KGW_LYRA2REV2::powFunction(const std::string& inputString) {
-    char* output = new char[32];
-
-    lyra2re2_hash(inputString.c_str(), inputString.size(), output);
+CryptoKernel::uint256 CryptoKernel::Consensus::PoW::KGW_LYRA2REV2::powFunction(const std::string& inputString) {
+    unsigned char output[32];
 
-    CryptoKernel::BigNum returning(base16_encode((unsigned char*)output, 32));
+    lyra2re2_hash(inputString.c_str(), inputString.size(), reinterpret_cast<char*>(output));
 
-    delete[] output;
-
-    return returning;
+    return CryptoKernel::uint256::fromBytes(output);
 }
@@ -4,6 +4,7 @@
 #include <thread>
 
 #include "../blockchain.h"
+#include "../retarget.h"
 
 namespace CryptoKernel {
 /**
@@ -52,16 +53,32 @@ public:
                              const CryptoKernel::Blockchain::dbBlock& previousBlock);
 
     Json::Value generateConsensusData(Storage::Transaction* transaction,
-                                      const CryptoKernel::BigNum& previousBlockId, const std::string& publicKey);
+                                      const CryptoKernel::uint256& previousBlockId, const std::string& publicKey);
+
+    /**
+    * Checks the header's target is the one retargeting gives, reading the
+    * earlier headers of the chain before the block index, that its Proof
+    * of Work is below that target and that its total work adds that
+    * target's work to the previous header's
+    */
+    bool checkHeader(const std::vector<CryptoKernel::Blockchain::header>& headers,
+                     const size_t index,
+                     const CryptoKernel::Blockchain::header& previousHeader);
+
+    /**
+    * Compares the total work claimed by the headers
+    */
+    bool isHeaderBetter(const CryptoKernel::Blockchain::header& header,
+                        const CryptoKernel::Blockchain::header& tip);
 
     /**
     * Pure virtual function that provides a proof of work hash
     * of the given input string
     *
     * @param inputString the string to hash
-    * @return the hash of the given input in hex
+    * @return the hash of the given input
     */
-    virtual CryptoKernel::BigNum powFunction(const std::string& inputString) = 0;
+    virtual CryptoKernel::uint256 powFunction(const std::string& inputString) = 0;
 
     /**
     * Pure virtual function that calculates the proof of work target
@@ -69,10 +86,22 @@ public:
     *
     * @param previousBlockId the ID of the previous block to the block
     *        to calculate the target for
-    * @return the hex target of the block
+    * @return the target of the block
+    */
+    virtual CryptoKernel::uint256 calculateTarget(Storage::Transaction* transaction,
+            const uint256& previousBlockId) = 0;
+
+    /**
+    * Pure virtual function that calculates the proof of work target
+    * for a block whose ancestors may not be in the block index yet
+    *
+    * @param ancestry where the block's ancestors are read from
+    * @param previousBlockId the ID of the previous block to the block
+    *        to calculate the target for
+    * @return the target of the block
     */
-    virtual CryptoKernel::BigNum calculateTarget(Storage::Transaction* transaction,
-            const BigNum& previousBlockId) = 0;
+    virtual CryptoKernel::uint256 calculateTarget(const KGWRetarget::Ancestry& ancestry,
+            const uint256& previousBlockId) = 0;
 
     /**
     * This class uses Kimoto Gravity Well for difficulty adjustment
@@ -90,9 +119,15 @@ public:
     * Calculate the PoW for a given block
     *
     * @param block the block to calculate the Proof of Work of
-    * @return a hex string representing the PoW hash of the given block
+    * @return the PoW hash of the given block
+    */
+    CryptoKernel::uint256 calculatePoW(const CryptoKernel::Blockchain::block& block,
+                                      const uint64_t nonce);
+
+    /**
+    * Calculate the PoW of the block with the given id
     */
-    CryptoKernel::BigNum calculatePoW(const CryptoKernel::Blockchain::block& block,
+    CryptoKernel::uint256 calculatePoW(const CryptoKernel::uint256& blockId,
                                       const uint64_t nonce);
 
     virtual void start();
@@ -101,12 +136,15 @@ protected:
     CryptoKernel::Log* log;
     uint64_t blockTarget;
     struct consensusData {
+        // Sums the work of every block back to genesis, so can outgrow
+        // 256 bits
         BigNum totalWork;
-        BigNum target;
+        uint256 target;
         uint64_t nonce;
     };
     consensusData getConsensusData(const CryptoKernel::Blockchain::block& block);
     consensusData getConsensusData(const CryptoKernel::Blockchain::dbBlock& block);
+    consensusData getConsensusData(const CryptoKernel::Blockchain::header& header);
     Json::Value consensusDataToJson(const consensusData& data);
 
 private:
@@ -127,13 +165,20 @@ public:
     /**
     * Uses SHA256 to calculate the hash
     */
-    virtual CryptoKernel::BigNum powFunction(const std::string& inputString);
+    virtual CryptoKernel::uint256 powFunction(const std::string& inputString);
 
     /**
     * Uses Kimoto Gravity Well to retarget the difficulty
     */
-    virtual CryptoKernel::BigNum calculateTarget(Storage::Transaction* transaction,
-                                         const BigNum& previousBlockId);
+    virtual CryptoKernel::uint256 calculateTarget(Storage::Transaction* transaction,
+                                         const uint256& previousBlockId);
+
+    /**
+    * Uses Kimoto Gravity Well over the given ancestry, reading the whole
+    * window each time
+    */
+    virtual CryptoKernel::uint256 calculateTarget(const KGWRetarget::Ancestry& ancestry,
+                                         const uint256& previousBlockId);
 
     /**
     * Has no effect, always returns true
@@ -158,6 +203,9 @@ public:
     */
     bool submitBlock(Storage::Transaction* transaction,
                      const CryptoKernel::Blockchain::block& block);
+
+private:
+    KGWRetarget retarget;
 };
 
 class Consensus::PoW::KGW_LYRA2REV2 : public Consensus::PoW::KGW_SHA256 {
@@ -171,7 +219,7 @@ class Consensus::PoW::KGW_LYRA2REV2 : public Consensus::PoW::KGW_SHA256 {
         /**
         * Uses Lyra2REv2 to calculate the hash
         */
-        virtual CryptoKernel::BigNum powFunction(const std::string& inputString);
+        virtual CryptoKernel::uint256 powFunction(const std::string& inputString);
 };
 
 }
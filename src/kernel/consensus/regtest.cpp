@@ -23,7 +23,7 @@ bool CryptoKernel::Consensus::Regtest::checkConsensusRules(Storage::Transaction*
 	return true;
 }
 
-Json::Value CryptoKernel::Consensus::Regtest::generateConsensusData(Storage::Transaction* transaction, const CryptoKernel::BigNum& previousBlockId, const std::string& publicKey)
+Json::Value CryptoKernel::Consensus::Regtest::generateConsensusData(Storage::Transaction* transaction, const CryptoKernel::uint256& previousBlockId, const std::string& publicKey)
 {
 	return Json::Value();
 }
@@ -32,7 +32,7 @@ public:
                              const CryptoKernel::Blockchain::dbBlock& previousBlock);
 
 	Json::Value generateConsensusData(Storage::Transaction* transaction,
-			const CryptoKernel::BigNum& previousBlockId, 
+			const CryptoKernel::uint256& previousBlockId, 
 	const std::string& publicKey);
 
 	/**
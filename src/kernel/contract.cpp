@@ -104,7 +104,7 @@ bool CryptoKernel::ContractRunner::evaluateValid(Storage::Transaction* dbTx,
         const CryptoKernel::Blockchain::transaction& tx) {
     for(const CryptoKernel::Blockchain::input& inp : tx.getInputs()) {
         const CryptoKernel::Blockchain::output out = CryptoKernel::Blockchain::dbOutput(
-                    blockchain->utxos->get(dbTx, inp.getOutputId().toString()));
+                    blockchain->utxoCache->get(dbTx, inp.getOutputId().toString()));
         const Json::Value data = out.getData();
         if(!data["contract"].empty()) {
             if(!this->evaluateScriptValid(dbTx, tx, inp, data["contract"].asString())) {
@@ -0,0 +1,222 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "downloadscheduler.h"
+
+CryptoKernel::DownloadScheduler::DownloadScheduler(const uint64_t firstHeight,
+        const uint64_t count, const uint64_t batchSize, const uint64_t windowSize,
+        const std::chrono::milliseconds stallTimeout) {
+    this->firstHeight = firstHeight;
+    this->endHeight = firstHeight + count;
+    this->batchSize = batchSize;
+    this->windowSize = windowSize;
+    this->stallTimeout = stallTimeout;
+    nextHeight = firstHeight;
+    reassigned = 0;
+    cancelled = false;
+
+    for(uint64_t start = firstHeight; start < endHeight; start += batchSize) {
+        pending.insert(start);
+        incomplete.insert(start);
+    }
+}
+
+uint64_t CryptoKernel::DownloadScheduler::rangeStart(const uint64_t height) const {
+    return firstHeight + (height - firstHeight) / batchSize * batchSize;
+}
+
+uint64_t CryptoKernel::DownloadScheduler::rangeEnd(const uint64_t start) const {
+    return std::min(start + batchSize, endHeight);
+}
+
+bool CryptoKernel::DownloadScheduler::isComplete(const uint64_t start) const {
+    for(uint64_t height = std::max(start, nextHeight); height < rangeEnd(start); height++) {
+        if(downloaded.find(height) == downloaded.end()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CryptoKernel::DownloadScheduler::release(const std::string& peer, const uint64_t start) {
+    const auto it = inFlight.find(start);
+    if(it == inFlight.end()) {
+        return;
+    }
+
+    it->second.peers.erase(peer);
+    if(it->second.peers.empty()) {
+        inFlight.erase(it);
+        if(incomplete.find(start) != incomplete.end()) {
+            pending.insert(start);
+        }
+    }
+}
+
+void CryptoKernel::DownloadScheduler::requeueStalled() {
+    const auto now = std::chrono::steady_clock::now();
+    for(auto& entry : inFlight) {
+        if(now - entry.second.since >= stallTimeout &&
+                pending.find(entry.first) == pending.end()) {
+            pending.insert(entry.first);
+            entry.second.since = now;
+            reassigned++;
+        }
+    }
+}
+
+void CryptoKernel::DownloadScheduler::addPeer(const std::string& peer, const uint64_t limit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    peers[peer] = limit;
+    changed.notify_all();
+}
+
+void CryptoKernel::DownloadScheduler::removePeer(const std::string& peer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    peers.erase(peer);
+
+    std::vector<uint64_t> starts;
+    for(const auto& entry : inFlight) {
+        if(entry.second.peers.find(peer) != entry.second.peers.end()) {
+            starts.push_back(entry.first);
+        }
+    }
+
+    for(const uint64_t start : starts) {
+        release(peer, start);
+    }
+
+    changed.notify_all();
+}
+
+bool CryptoKernel::DownloadScheduler::assign(const std::string& peer, Range& range) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        const auto peerIt = peers.find(peer);
+        if(cancelled || peerIt == peers.end()) {
+            return false;
+        }
+
+        // Ranges are in height order, so if the lowest one left is past
+        // the peer's blocks, so are all the others
+        const uint64_t limit = peerIt->second;
+        if(incomplete.empty() || rangeEnd(*incomplete.begin()) > limit) {
+            return false;
+        }
+
+        requeueStalled();
+
+        for(const uint64_t start : pending) {
+            if(start >= nextHeight + windowSize || rangeEnd(start) > limit) {
+                break;
+            }
+
+            // A stalled range goes to a different peer
+            const auto it = inFlight.find(start);
+            if(it != inFlight.end() && it->second.peers.find(peer) != it->second.peers.end()) {
+                continue;
+            }
+
+            pending.erase(start);
+            InFlight& flight = inFlight[start];
+            flight.peers.insert(peer);
+            flight.since = std::chrono::steady_clock::now();
+            range = Range{start, rangeEnd(start)};
+            return true;
+        }
+
+        // Woken early if the window moves, otherwise in time to look for
+        // stalled ranges
+        changed.wait_for(lock, stallTimeout);
+    }
+}
+
+void CryptoKernel::DownloadScheduler::complete(const std::string& peer, const Range& range,
+        const std::vector<Blockchain::block>& blocks) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(uint64_t i = 0; i < blocks.size() && range.start + i < range.end; i++) {
+        const uint64_t height = range.start + i;
+        if(height >= nextHeight && downloaded.find(height) == downloaded.end()) {
+            downloaded.emplace(height, Delivery{blocks[i], peer});
+        }
+    }
+
+    if(isComplete(range.start)) {
+        incomplete.erase(range.start);
+        pending.erase(range.start);
+        inFlight.erase(range.start);
+    } else {
+        release(peer, range.start);
+    }
+
+    changed.notify_all();
+}
+
+void CryptoKernel::DownloadScheduler::fail(const std::string& peer, const Range& range) {
+    std::lock_guard<std::mutex> lock(mutex);
+    release(peer, range.start);
+    changed.notify_all();
+}
+
+std::unique_ptr<CryptoKernel::DownloadScheduler::Delivery>
+CryptoKernel::DownloadScheduler::next() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        const auto it = downloaded.find(nextHeight);
+        if(it != downloaded.end()) {
+            std::unique_ptr<Delivery> delivery(new Delivery(it->second));
+            downloaded.erase(it);
+            nextHeight++;
+            // The window moved up
+            changed.notify_all();
+            return delivery;
+        }
+
+        if(cancelled || nextHeight >= endHeight) {
+            return nullptr;
+        }
+
+        const uint64_t end = rangeEnd(rangeStart(nextHeight));
+        bool deliverable = false;
+        for(const auto& peer : peers) {
+            if(peer.second >= end) {
+                deliverable = true;
+                break;
+            }
+        }
+
+        if(!deliverable) {
+            return nullptr;
+        }
+
+        changed.wait(lock);
+    }
+}
+
+void CryptoKernel::DownloadScheduler::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    cancelled = true;
+    changed.notify_all();
+}
+
+uint64_t CryptoKernel::DownloadScheduler::getReassigned() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return reassigned;
+}
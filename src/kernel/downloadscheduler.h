@@ -0,0 +1,181 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOWNLOADSCHEDULER_H_INCLUDED
+#define DOWNLOADSCHEDULER_H_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "blockchain.h"
+
+namespace CryptoKernel {
+/**
+* Splits the download of a run of blocks into fixed size ranges of
+* heights and hands them out to peers as they ask for work, so every peer
+* downloads at once. Only ranges within a window above the next block to
+* be validated are handed out, which bounds the blocks held in memory. A
+* range that takes too long is handed to another peer as well, and the
+* first copy to arrive is used. Blocks come back out in height order,
+* whichever peer they came from.
+*
+* Peer threads loop on assign() and report back with complete() or
+* fail(), while one thread takes the blocks with next().
+*/
+class DownloadScheduler {
+public:
+    /**
+    * Heights [start, end)
+    */
+    struct Range {
+        uint64_t start;
+        uint64_t end;
+    };
+
+    /**
+    * A downloaded block and the peer it came from
+    */
+    struct Delivery {
+        Blockchain::block block;
+        std::string peer;
+    };
+
+    /**
+    * @param firstHeight the height of the first block to download
+    * @param count the number of blocks to download
+    * @param batchSize the number of blocks in a range
+    * @param windowSize how far above the next block to be validated ranges
+    *        are handed out
+    * @param stallTimeout how long a range is left with a peer before it is
+    *        handed to another one
+    */
+    DownloadScheduler(const uint64_t firstHeight, const uint64_t count,
+                      const uint64_t batchSize, const uint64_t windowSize,
+                      const std::chrono::milliseconds stallTimeout);
+
+    /**
+    * Adds a peer to download from
+    *
+    * @param peer the address of the peer
+    * @param limit the height up to which the peer has the blocks being
+    *        downloaded, exclusive
+    */
+    void addPeer(const std::string& peer, const uint64_t limit);
+
+    /**
+    * Stops handing ranges to a peer, and gives those it was downloading to
+    * others
+    */
+    void removePeer(const std::string& peer);
+
+    /**
+    * Waits for a range the peer can download
+    *
+    * @param peer the peer asking for work
+    * @param range set to the range to download
+    * @return false once there is nothing left for the peer to download, or
+    *         the download was cancelled
+    */
+    bool assign(const std::string& peer, Range& range);
+
+    /**
+    * Hands over the blocks a peer downloaded for a range. If there are
+    * fewer than the range holds, the rest of the range is downloaded again.
+    *
+    * @param peer the peer the blocks came from
+    * @param range the range assigned to the peer
+    * @param blocks the blocks of the range, oldest first
+    */
+    void complete(const std::string& peer, const Range& range,
+                  const std::vector<Blockchain::block>& blocks);
+
+    /**
+    * Gives back a range the peer could not download
+    */
+    void fail(const std::string& peer, const Range& range);
+
+    /**
+    * Waits for the next block in height order
+    *
+    * @return the block, or nullptr once every block has been taken, the
+    *         download was cancelled or no peer left can download it
+    */
+    std::unique_ptr<Delivery> next();
+
+    /**
+    * Stops the download, waking every waiting thread
+    */
+    void cancel();
+
+    /**
+    * Returns the number of times a stalled range was handed out again
+    */
+    uint64_t getReassigned();
+
+private:
+    struct InFlight {
+        std::set<std::string> peers;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    uint64_t rangeStart(const uint64_t height) const;
+    uint64_t rangeEnd(const uint64_t start) const;
+    bool isComplete(const uint64_t start) const;
+
+    /**
+    * Takes a peer off a range and hands the range out again if no peer is
+    * left downloading it
+    */
+    void release(const std::string& peer, const uint64_t start);
+
+    /**
+    * Hands out again the ranges that have been in flight for longer than
+    * the stall timeout
+    */
+    void requeueStalled();
+
+    uint64_t firstHeight;
+    uint64_t endHeight;
+    uint64_t batchSize;
+    uint64_t windowSize;
+    std::chrono::milliseconds stallTimeout;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // Peers and the height up to which they have blocks
+    std::map<std::string, uint64_t> peers;
+    // Starts of the ranges waiting to be handed out
+    std::set<uint64_t> pending;
+    // Starts of the ranges not yet fully downloaded
+    std::set<uint64_t> incomplete;
+    std::map<uint64_t, InFlight> inFlight;
+    // Downloaded blocks not yet taken, by height
+    std::map<uint64_t, Delivery> downloaded;
+    uint64_t nextHeight;
+    uint64_t reassigned;
+    bool cancelled;
+};
+}
+
+#endif // DOWNLOADSCHEDULER_H_INCLUDED
@@ -0,0 +1,293 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IDMAP_H_INCLUDED
+#define IDMAP_H_INCLUDED
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "ckmath.h"
+
+namespace CryptoKernel {
+/**
+* Hash table keyed by 256-bit ids. Entries live in one array and collisions
+* probe the following slots, so a lookup usually touches a single cache
+* line and never follows a pointer. Iteration order is arbitrary, so only
+* use it where order cannot affect consensus.
+*/
+template<typename Value>
+class IdMap {
+public:
+    IdMap() {
+        slots = nullptr;
+        capacity = 0;
+        used = 0;
+    }
+
+    IdMap(const IdMap&) = delete;
+    IdMap& operator=(const IdMap&) = delete;
+
+    ~IdMap() {
+        clear();
+        delete[] slots;
+    }
+
+    /**
+    * Returns the value stored for a key, or nullptr if there is none
+    */
+    Value* find(const uint256& key) {
+        if(used == 0) {
+            return nullptr;
+        }
+
+        for(size_t i = home(key);; i = next(i)) {
+            if(!slots[i].full) {
+                return nullptr;
+            } else if(slots[i].key == key) {
+                return &slots[i].value();
+            }
+        }
+    }
+
+    const Value* find(const uint256& key) const {
+        return const_cast<IdMap*>(this)->find(key);
+    }
+
+    bool contains(const uint256& key) const {
+        return find(key) != nullptr;
+    }
+
+    /**
+    * Adds a value unless the key is already present
+    *
+    * @return true if the value was added
+    */
+    bool insert(const uint256& key, const Value& value) {
+        if(contains(key)) {
+            return false;
+        }
+
+        // Probe sequences get long quickly beyond half full
+        if((used + 1) * 2 > capacity) {
+            rehash(capacity == 0 ? 16 : capacity * 2);
+        }
+
+        place(key, value);
+        used++;
+
+        return true;
+    }
+
+    /**
+    * Removes a key and its value
+    *
+    * @return true if the key was present
+    */
+    bool erase(const uint256& key) {
+        if(used == 0) {
+            return false;
+        }
+
+        size_t hole = home(key);
+        while(true) {
+            if(!slots[hole].full) {
+                return false;
+            } else if(slots[hole].key == key) {
+                break;
+            }
+            hole = next(hole);
+        }
+
+        slots[hole].destroy();
+        used--;
+
+        // Shift later entries of the run back into the hole, unless that
+        // would move them in front of their home slot. This keeps every
+        // entry reachable without leaving markers behind.
+        for(size_t i = next(hole); slots[i].full; i = next(i)) {
+            const size_t target = home(slots[i].key);
+            const bool stays = hole <= i ? (hole < target && target <= i)
+                                         : (hole < target || target <= i);
+            if(!stays) {
+                slots[hole].construct(slots[i].key, std::move(slots[i].value()));
+                slots[i].destroy();
+                hole = i;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+    * Makes room for a number of entries so they can be added without
+    * growing the table
+    */
+    void reserve(const size_t count) {
+        size_t wanted = 16;
+        while(wanted < count * 2) {
+            wanted *= 2;
+        }
+
+        if(wanted > capacity) {
+            rehash(wanted);
+        }
+    }
+
+    void clear() {
+        for(size_t i = 0; i < capacity; i++) {
+            if(slots[i].full) {
+                slots[i].destroy();
+            }
+        }
+        used = 0;
+    }
+
+    size_t size() const {
+        return used;
+    }
+
+    bool empty() const {
+        return used == 0;
+    }
+
+    /**
+    * Calls a function with every key and value, in no particular order.
+    * The function must not change the table.
+    */
+    template<typename Func>
+    void forEach(Func func) const {
+        for(size_t i = 0; i < capacity; i++) {
+            if(slots[i].full) {
+                func(slots[i].key, const_cast<const Value&>(slots[i].value()));
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        uint256 key;
+        bool full = false;
+        typename std::aligned_storage<sizeof(Value), alignof(Value)>::type storage;
+
+        Value& value() {
+            return *reinterpret_cast<Value*>(&storage);
+        }
+
+        template<typename V>
+        void construct(const uint256& newKey, V&& newValue) {
+            key = newKey;
+            new(&storage) Value(std::forward<V>(newValue));
+            full = true;
+        }
+
+        void destroy() {
+            value().~Value();
+            full = false;
+        }
+    };
+
+    size_t home(const uint256& key) const {
+        return hasher(key) & (capacity - 1);
+    }
+
+    size_t next(const size_t i) const {
+        return (i + 1) & (capacity - 1);
+    }
+
+    template<typename V>
+    void place(const uint256& key, V&& value) {
+        size_t i = home(key);
+        while(slots[i].full) {
+            i = next(i);
+        }
+        slots[i].construct(key, std::forward<V>(value));
+    }
+
+    void rehash(const size_t newCapacity) {
+        Slot* oldSlots = slots;
+        const size_t oldCapacity = capacity;
+
+        slots = new Slot[newCapacity];
+        capacity = newCapacity;
+
+        for(size_t i = 0; i < oldCapacity; i++) {
+            if(oldSlots[i].full) {
+                place(oldSlots[i].key, std::move(oldSlots[i].value()));
+                oldSlots[i].destroy();
+            }
+        }
+
+        delete[] oldSlots;
+    }
+
+    Slot* slots;
+    size_t capacity;
+    size_t used;
+    uint256::Hasher hasher;
+};
+
+/**
+* Set of 256-bit ids on the same table as IdMap
+*/
+class IdSet {
+public:
+    bool insert(const uint256& key) {
+        return ids.insert(key, Empty());
+    }
+
+    bool erase(const uint256& key) {
+        return ids.erase(key);
+    }
+
+    bool contains(const uint256& key) const {
+        return ids.contains(key);
+    }
+
+    void reserve(const size_t count) {
+        ids.reserve(count);
+    }
+
+    void clear() {
+        ids.clear();
+    }
+
+    size_t size() const {
+        return ids.size();
+    }
+
+    bool empty() const {
+        return ids.empty();
+    }
+
+    template<typename Func>
+    void forEach(Func func) const {
+        ids.forEach([&](const uint256& key, const Empty&) {
+            func(key);
+        });
+    }
+
+private:
+    struct Empty {};
+
+    IdMap<Empty> ids;
+};
+}
+
+#endif // IDMAP_H_INCLUDED
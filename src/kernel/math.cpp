@@ -17,6 +17,9 @@
 
 #include <sstream>
 #include <algorithm>
+#include <array>
+#include <random>
+#include <stdexcept>
 
 #include "ckmath.h"
 
@@ -116,3 +119,254 @@ bool CryptoKernel::BigNum::operator>=(const BigNum& rhs) const {
 bool CryptoKernel::BigNum::operator<=(const BigNum& rhs) const {
     return compare(*this, rhs) <= 0;
 }
+
+CryptoKernel::uint256::uint256(const std::string& hexString) : uint256() {
+    // A table rather than comparisons, as branches on random hex digits
+    // mispredict about half the time
+    static const std::array<signed char, 256> digitValues = []() {
+        std::array<signed char, 256> values;
+        values.fill(-1);
+        for(unsigned int i = 0; i < 10; i++) {
+            values['0' + i] = i;
+        }
+        for(unsigned int i = 0; i < 6; i++) {
+            values['a' + i] = 10 + i;
+            values['A' + i] = 10 + i;
+        }
+        return values;
+    }();
+    const auto digitValue = [](const char c) {
+        return digitValues[static_cast<unsigned char>(c)];
+    };
+
+    size_t start = 0;
+    const bool negative = !hexString.empty() && hexString[0] == '-';
+    if(negative) {
+        start++;
+    }
+
+    size_t end = start;
+    while(end < hexString.size() && digitValue(hexString[end]) >= 0) {
+        end++;
+    }
+
+    while(start < end && hexString[start] == '0') {
+        start++;
+    }
+
+    if(end - start > size * 8) {
+        throw std::runtime_error("Value does not fit in 256 bits");
+    } else if(negative && start < end) {
+        throw std::runtime_error("Value is negative");
+    }
+
+    for(size_t i = start; i < end; i++) {
+        const size_t shift = (end - 1 - i) * 4;
+        words[shift / 32] |= uint32_t(digitValue(hexString[i])) << (shift % 32);
+    }
+}
+
+CryptoKernel::uint256::uint256(const BigNum& value) {
+    unsigned char data[size * 4];
+    if(BN_is_negative(value.bn) || BN_bn2binpad(value.bn, data, sizeof(data)) < 0) {
+        throw std::runtime_error("Value does not fit in 256 bits");
+    }
+
+    *this = fromBytes(data);
+}
+
+CryptoKernel::uint256 CryptoKernel::uint256::fromBytes(const unsigned char* data) {
+    uint256 returning;
+    for(unsigned int i = 0; i < size; i++) {
+        const unsigned char* word = data + (size - 1 - i) * 4;
+        returning.words[i] = (uint32_t(word[0]) << 24) | (uint32_t(word[1]) << 16) |
+                             (uint32_t(word[2]) << 8) | uint32_t(word[3]);
+    }
+    return returning;
+}
+
+void CryptoKernel::uint256::toBytes(unsigned char* data) const {
+    for(unsigned int i = 0; i < size; i++) {
+        unsigned char* word = data + (size - 1 - i) * 4;
+        word[0] = static_cast<unsigned char>(words[i] >> 24);
+        word[1] = static_cast<unsigned char>(words[i] >> 16);
+        word[2] = static_cast<unsigned char>(words[i] >> 8);
+        word[3] = static_cast<unsigned char>(words[i]);
+    }
+}
+
+CryptoKernel::BigNum CryptoKernel::uint256::toBigNum() const {
+    unsigned char data[size * 4];
+    toBytes(data);
+
+    BigNum returning;
+    BN_bin2bn(data, sizeof(data), returning.bn);
+    return returning;
+}
+
+std::string CryptoKernel::uint256::toString() const {
+    static const char digits[] = "0123456789abcdef";
+
+    char hex[size * 8];
+    for(unsigned int i = 0; i < size; i++) {
+        for(unsigned int j = 0; j < 8; j++) {
+            hex[(size - 1 - i) * 8 + j] = digits[(words[i] >> (28 - j * 4)) & 0x0f];
+        }
+    }
+
+    unsigned int start = 0;
+    while(start < sizeof(hex) - 1 && hex[start] == '0') {
+        start++;
+    }
+
+    return std::string(hex + start, hex + sizeof(hex));
+}
+
+unsigned int CryptoKernel::uint256::bits() const {
+    for(unsigned int i = size; i > 0; i--) {
+        if(words[i - 1] != 0) {
+            unsigned int bits = 32;
+            while((words[i - 1] >> (bits - 1)) == 0) {
+                bits--;
+            }
+            return (i - 1) * 32 + bits;
+        }
+    }
+
+    return 0;
+}
+
+CryptoKernel::uint256& CryptoKernel::uint256::operator/=(const uint256& rhs) {
+    const unsigned int divisorBits = rhs.bits();
+    if(divisorBits == 0) {
+        throw std::runtime_error("Division by zero");
+    }
+
+    // Small divisors, such as counts, go a word at a time
+    if(divisorBits <= 32) {
+        const uint64_t divisor = rhs.words[0];
+        uint64_t remainder = 0;
+        for(unsigned int i = size; i > 0; i--) {
+            const uint64_t part = (remainder << 32) | words[i - 1];
+            words[i - 1] = static_cast<uint32_t>(part / divisor);
+            remainder = part % divisor;
+        }
+        return *this;
+    }
+
+    // Otherwise long division a word at a time, Knuth's algorithm D. Both
+    // sides are shifted so the divisor's top bit is set, which keeps each
+    // estimated quotient word at most two too large.
+    const unsigned int n = (divisorBits + 31) / 32;
+    const unsigned int m = (bits() + 31) / 32;
+    if(m < n) {
+        *this = uint256();
+        return *this;
+    }
+
+    const unsigned int shift = (32 - divisorBits % 32) % 32;
+    const uint256 divisor = rhs << shift;
+    const uint256 shifted = *this << shift;
+    uint32_t dividend[size + 1];
+    for(unsigned int i = 0; i < m; i++) {
+        dividend[i] = shifted.words[i];
+    }
+    dividend[m] = static_cast<uint32_t>(uint64_t(words[m - 1]) >> (32 - shift));
+
+    const uint64_t base = uint64_t(1) << 32;
+    const uint64_t top = divisor.words[n - 1];
+    const uint64_t next = divisor.words[n - 2];
+    uint256 quotient;
+    for(unsigned int step = m - n + 1; step > 0; step--) {
+        const unsigned int j = step - 1;
+        const uint64_t part = (uint64_t(dividend[j + n]) << 32) | dividend[j + n - 1];
+        uint64_t estimate = part / top;
+        uint64_t rest = part % top;
+        while(estimate >= base || estimate * next > ((rest << 32) | dividend[j + n - 2])) {
+            estimate--;
+            rest += top;
+            if(rest >= base) {
+                break;
+            }
+        }
+
+        // Subtract estimate * divisor from this part of the dividend
+        int64_t borrow = 0;
+        int64_t difference = 0;
+        for(unsigned int i = 0; i < n; i++) {
+            const uint64_t product = estimate * divisor.words[i];
+            difference = int64_t(dividend[i + j]) - borrow - int64_t(product & 0xffffffff);
+            dividend[i + j] = static_cast<uint32_t>(difference);
+            borrow = int64_t(product >> 32) - (difference >> 32);
+        }
+        difference = int64_t(dividend[j + n]) - borrow;
+        dividend[j + n] = static_cast<uint32_t>(difference);
+
+        // The estimate was still one too large, so add the divisor back
+        if(difference < 0) {
+            estimate--;
+            uint64_t carry = 0;
+            for(unsigned int i = 0; i < n; i++) {
+                carry += uint64_t(dividend[i + j]) + divisor.words[i];
+                dividend[i + j] = static_cast<uint32_t>(carry);
+                carry >>= 32;
+            }
+            dividend[j + n] += static_cast<uint32_t>(carry);
+        }
+
+        quotient.words[j] = static_cast<uint32_t>(estimate);
+    }
+
+    *this = quotient;
+    return *this;
+}
+
+CryptoKernel::uint256 CryptoKernel::uint256::mulDiv(const uint64_t mul,
+                                                    const uint64_t div) const {
+    if(div == 0) {
+        throw std::runtime_error("Division by zero");
+    }
+
+    // The product needs up to 320 bits
+    const unsigned int wideSize = size + 2;
+    uint32_t wide[wideSize] = {};
+    for(const unsigned int half : {0U, 1U}) {
+        const uint64_t factor = static_cast<uint32_t>(mul >> (half * 32));
+        uint64_t carry = 0;
+        for(unsigned int i = 0; i < size; i++) {
+            const uint64_t term = carry + wide[i + half] + words[i] * factor;
+            wide[i + half] = static_cast<uint32_t>(term);
+            carry = term >> 32;
+        }
+        for(unsigned int i = size + half; carry != 0 && i < wideSize; i++) {
+            const uint64_t term = carry + wide[i];
+            wide[i] = static_cast<uint32_t>(term);
+            carry = term >> 32;
+        }
+    }
+
+    // Long division by a 64-bit divisor, keeping the remainder below it.
+    // A remainder that shifts past 64 bits is still larger than div.
+    uint256 returning;
+    uint64_t remainder = 0;
+    for(unsigned int bit = wideSize * 32; bit > 0; bit--) {
+        const unsigned int index = bit - 1;
+        const bool carry = (remainder >> 63) != 0;
+        remainder = (remainder << 1) | ((wide[index / 32] >> (index % 32)) & 1);
+
+        if(carry || remainder >= div) {
+            remainder -= div;
+            if(index >= size * 32) {
+                return ~uint256();
+            }
+            returning.words[index / 32] |= uint32_t(1) << (index % 32);
+        }
+    }
+
+    return returning;
+}
+
+CryptoKernel::uint256::Hasher::Hasher() {
+    std::random_device rd;
+    seed = (static_cast<uint64_t>(rd()) << 32) ^ rd();
+}
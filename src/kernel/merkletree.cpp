@@ -1,6 +1,10 @@
+#include <algorithm>
 #include <queue>
+#include <stdexcept>
+
+#include <openssl/sha.h>
+
 #include "merkletree.h"
-#include "crypto.h"
 
 
 CryptoKernel::MerkleNode::MerkleNode() {
@@ -8,7 +12,7 @@ CryptoKernel::MerkleNode::MerkleNode() {
     ancestor = nullptr;
 }
 
-CryptoKernel::MerkleNode::MerkleNode(const BigNum& left, const BigNum& right) {
+CryptoKernel::MerkleNode::MerkleNode(const uint256& left, const uint256& right) {
     leaf = true;
     
     leftVal = left;
@@ -18,7 +22,7 @@ CryptoKernel::MerkleNode::MerkleNode(const BigNum& left, const BigNum& right) {
     root = calcRoot(leftVal.toString(), rightVal.toString());
 }
 
-CryptoKernel::MerkleNode::MerkleNode(const BigNum& left) : MerkleNode(left, left) {
+CryptoKernel::MerkleNode::MerkleNode(const uint256& left) : MerkleNode(left, left) {
 
 }
 
@@ -40,11 +44,11 @@ CryptoKernel::MerkleNode::MerkleNode(const std::shared_ptr<MerkleNode> left)
     
 }
 
-CryptoKernel::BigNum CryptoKernel::MerkleNode::getMerkleRoot() const {
+CryptoKernel::uint256 CryptoKernel::MerkleNode::getMerkleRoot() const {
     return root;
 }
 
-CryptoKernel::BigNum CryptoKernel::MerkleNode::getLeftVal() const {
+CryptoKernel::uint256 CryptoKernel::MerkleNode::getLeftVal() const {
     if(leaf) {
         return leftVal;
     } else {
@@ -52,7 +56,7 @@ CryptoKernel::BigNum CryptoKernel::MerkleNode::getLeftVal() const {
     }
 }
 
-CryptoKernel::BigNum CryptoKernel::MerkleNode::getRightVal() const {
+CryptoKernel::uint256 CryptoKernel::MerkleNode::getRightVal() const {
     if(leaf) {
         return rightVal;
     } else {
@@ -72,23 +76,30 @@ CryptoKernel::MerkleNode* CryptoKernel::MerkleNode::getAncestor() const {
     return ancestor;
 }
 
-CryptoKernel::BigNum CryptoKernel::MerkleNode::calcRoot(const std::string& left,
-                                                        const std::string& right) {
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(left + right));
+CryptoKernel::uint256 CryptoKernel::MerkleNode::calcRoot(const std::string& left,
+                                                         const std::string& right) {
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, left.data(), left.size());
+    SHA256_Update(&ctx, right.data(), right.size());
+
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256_Final(hash, &ctx);
+
+    return uint256::fromBytes(hash);
 }
 
-CryptoKernel::MerkleRootNode::MerkleRootNode(const BigNum& merkleRoot) {
+CryptoKernel::MerkleRootNode::MerkleRootNode(const uint256& merkleRoot) {
     leaf = true;
     root = merkleRoot;
 }
 
 std::shared_ptr<CryptoKernel::MerkleNode> CryptoKernel::MerkleNode::makeMerkleTree(
-                                                    const std::set<BigNum>& leaves) {
+                                                    const std::set<uint256>& leaves) {
     std::vector<std::shared_ptr<MerkleNode>> nodes;
-    std::queue<BigNum> leafQueue;
+    std::queue<uint256> leafQueue;
     
-    for(const BigNum& leaf : leaves) {
+    for(const uint256& leaf : leaves) {
         if(leafQueue.size() < 2) {
             leafQueue.push(leaf);
         } else {
@@ -129,7 +140,31 @@ std::shared_ptr<CryptoKernel::MerkleNode> CryptoKernel::MerkleNode::makeMerkleTr
     return nodes[0];
 }
 
-const CryptoKernel::MerkleNode* CryptoKernel::MerkleNode::findDescendant(const BigNum& needle) const{
+CryptoKernel::uint256 CryptoKernel::MerkleNode::calculateRoot(const std::set<uint256>& leaves) {
+    if(leaves.empty()) {
+        throw std::runtime_error("Merkle tree has no leaves");
+    }
+
+    // Pair up neighbours level by level, repeating the last node of an odd
+    // level, exactly as makeMerkleTree does
+    std::vector<uint256> nodes(leaves.begin(), leaves.end());
+    std::vector<std::string> level;
+    do {
+        level.clear();
+        for(const uint256& node : nodes) {
+            level.push_back(node.toString());
+        }
+
+        nodes.clear();
+        for(size_t i = 0; i < level.size(); i += 2) {
+            nodes.push_back(calcRoot(level[i], level[std::min(i + 1, level.size() - 1)]));
+        }
+    } while(nodes.size() > 1);
+
+    return nodes[0];
+}
+
+const CryptoKernel::MerkleNode* CryptoKernel::MerkleNode::findDescendant(const uint256& needle) const{
     if(leftVal == needle || rightVal == needle) {
         return this;
     }
@@ -143,7 +178,7 @@ const CryptoKernel::MerkleNode* CryptoKernel::MerkleNode::findDescendant(const B
     }
 }
 
-std::shared_ptr<CryptoKernel::MerkleProof> CryptoKernel::MerkleNode::makeProof(BigNum proof) {
+std::shared_ptr<CryptoKernel::MerkleProof> CryptoKernel::MerkleNode::makeProof(uint256 proof) {
     const CryptoKernel::MerkleNode* proofNode = findDescendant(proof);
     if(proofNode == nullptr) {
         throw CryptoKernel::Blockchain::NotFoundException("Tree node " + proof.toString());
@@ -165,11 +200,11 @@ std::shared_ptr<CryptoKernel::MerkleProof> CryptoKernel::MerkleNode::makeProof(B
 }
 
 std::shared_ptr<CryptoKernel::MerkleNode> CryptoKernel::MerkleNode::makeMerkleTreeFromProof(std::shared_ptr<CryptoKernel::MerkleProof> proof) {
-    const BigNum& provingElement = proof->leaves.at(0);
+    const uint256& provingElement = proof->leaves.at(0);
     // If the set size is just 1, it was a merkle tree of 1 node
     if(proof->leaves.size() == 1) return std::make_shared<MerkleRootNode>(provingElement);
 
-    const BigNum& firstSibling = proof->leaves.at(1);
+    const uint256& firstSibling = proof->leaves.at(1);
 
     std::shared_ptr<CryptoKernel::MerkleNode> result;
     
@@ -181,10 +216,10 @@ std::shared_ptr<CryptoKernel::MerkleNode> CryptoKernel::MerkleNode::makeMerkleTr
     if(proof->leaves.size() == 2) return result;    
 
     int positionInLayer = (proof->positionInTotalSet/2);
-    std::set<BigNum>::iterator it;
+    std::set<uint256>::iterator it;
     for (int i = 2; i < proof->leaves.size(); i++)
 	{
-        const BigNum& siblingValue = proof->leaves.at(i);
+        const uint256& siblingValue = proof->leaves.at(i);
 
         std::shared_ptr<CryptoKernel::MerkleNode> sibling = std::make_shared<CryptoKernel::MerkleRootNode>(siblingValue);
 
@@ -203,7 +238,7 @@ Json::Value CryptoKernel::MerkleProof::toJson() const {
     Json::Value result;
 
     result["position"] = positionInTotalSet;
-    for(const BigNum& leaf : leaves) {
+    for(const uint256& leaf : leaves) {
         result["leaves"].append(leaf.toString());
     }
     return result;
@@ -230,9 +265,11 @@ CryptoKernel::MerkleProof::MerkleProof(const Json::Value& jsonProof) {
         leaves = {};
         positionInTotalSet = jsonProof["position"].asInt();
         for(const Json::Value leaf : jsonProof["leaves"]) {
-            leaves.push_back(CryptoKernel::BigNum(leaf.asString()));
+            leaves.push_back(CryptoKernel::uint256(leaf.asString()));
         }
     } catch(const Json::Exception& e) {
         throw CryptoKernel::Blockchain::InvalidElementException("Merkle proof JSON is malformed");
+    } catch(const std::runtime_error& e) {
+        throw CryptoKernel::Blockchain::InvalidElementException("Merkle proof JSON is malformed");
     }
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "network.h"
 #include "networkpeer.h"
+#include "downloadscheduler.h"
 #include "version.h"
 
 #include <list>
@@ -49,6 +50,12 @@ std::vector<CryptoKernel::Blockchain::block> CryptoKernel::Network::Connection::
 	return peer->getBlocks(start, end);
 }
 
+std::vector<CryptoKernel::Blockchain::header> CryptoKernel::Network::Connection::getHeaders(
+	const std::vector<CryptoKernel::uint256>& locator) {
+	std::lock_guard<std::mutex> mm(modMutex);
+	return peer->getHeaders(locator);
+}
+
 CryptoKernel::Network::peerStats CryptoKernel::Network::Connection::getPeerStats() {
 	std::lock_guard<std::mutex> mm(modMutex);
 	return peer->getPeerStats();
@@ -109,7 +116,8 @@ CryptoKernel::Network::Connection::~Connection() {
 CryptoKernel::Network::Network(CryptoKernel::Log* log,
                                CryptoKernel::Blockchain* blockchain,
                                const unsigned int port,
-                               const std::string& dbDir) {
+                               const std::string& dbDir,
+                               const Json::Value& dbProfile) {
     this->log = log;
     this->blockchain = blockchain;
     this->port = port;
@@ -118,7 +126,10 @@ CryptoKernel::Network::Network(CryptoKernel::Log* log,
 
     myAddress = sf::IpAddress::getPublicAddress();
 
-    networkdb.reset(new CryptoKernel::Storage(dbDir, false, 8, false));
+    LevelDBEngine::Options defaults;
+    defaults.cache = 8;
+    networkdb.reset(new CryptoKernel::Storage(dbDir, false,
+                                              Storage::loadProfile(dbProfile, defaults)));
     peers.reset(new Storage::Table("peers"));
 
     std::unique_ptr<Storage::Transaction> dbTx(networkdb->begin());
@@ -199,6 +210,25 @@ void CryptoKernel::Network::infoOutgoingConnectionsWrapper() {
 	}
 }
 
+bool CryptoKernel::Network::splitAddress(const std::string& url, std::string& host,
+        unsigned int& peerPort) {
+    const size_t colon = url.find(':');
+    host = url.substr(0, colon);
+    peerPort = port;
+    if(colon == std::string::npos) {
+        return true;
+    }
+
+    const std::string portString = url.substr(colon + 1);
+    if(portString.empty() || portString.size() > 5 ||
+            portString.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+
+    peerPort = std::stoul(portString);
+    return peerPort > 0 && peerPort <= 65535;
+}
+
 void CryptoKernel::Network::makeOutgoingConnections(bool& wait) {
 	std::map<std::string, Json::Value> peersToTry;
 	std::vector<std::string> peerIps;
@@ -234,11 +264,18 @@ void CryptoKernel::Network::makeOutgoingConnections(bool& wait) {
 			continue;
 		}
 
-		sf::IpAddress addr(it->key());
+		std::string host;
+		unsigned int peerPort;
+		if(!splitAddress(it->key(), host, peerPort)) {
+			continue;
+		}
+
+		sf::IpAddress addr(host);
 
-		if(addr == sf::IpAddress::getLocalAddress()
+		// Nodes sharing a machine listen on different ports
+		if(((addr == sf::IpAddress::getLocalAddress()
 				|| addr == myAddress
-				|| addr == sf::IpAddress::LocalHost
+				|| addr == sf::IpAddress::LocalHost) && peerPort == port)
 				|| addr == sf::IpAddress::None) {
 			continue;
 		}
@@ -257,9 +294,13 @@ void CryptoKernel::Network::makeOutgoingConnections(bool& wait) {
 		auto entry = peersToTry.find(peerIp);
 		Json::Value peerData = entry->second;
 
+		std::string host;
+		unsigned int peerPort;
+		splitAddress(peerIp, host, peerPort);
+
 		sf::TcpSocket* socket = new sf::TcpSocket();
 		log->printf(LOG_LEVEL_INFO, "Network(): Attempting to connect to " + peerIp);
-		if(socket->connect(peerIp, port, sf::seconds(3)) == sf::Socket::Done) {
+		if(socket->connect(host, peerPort, sf::seconds(3)) == sf::Socket::Done) {
 			log->printf(LOG_LEVEL_INFO, "Network(): Successfully connected to " + peerIp);
 			Connection* connection = new Connection;
 			connection->setPeer(new Peer(socket, blockchain, this, false));
@@ -353,15 +394,213 @@ void CryptoKernel::Network::infoOutgoingConnections() {
 		}
 	}
 
-	dbTx->commit();
+	try {
+		dbTx->commit();
+	} catch(const Storage::ConflictException& e) {
+		// An incoming connection updated the same peer, the next round will
+		// record its info again
+		log->printf(LOG_LEVEL_INFO, "Network(): Peer info update conflicted, retrying next round");
+	}
+}
+
+std::vector<CryptoKernel::Blockchain::header> CryptoKernel::Network::downloadHeaders(
+    Connection* connection, const std::string& url) {
+    // Headers are served in batches of up to 2000
+    const size_t batchSize = 2000;
+    const unsigned int maxBatches = 50;
+    const size_t wanted = 2000;
+
+    const std::vector<CryptoKernel::uint256> ourLocator = blockchain->getLocator();
+    std::vector<CryptoKernel::uint256> locator = ourLocator;
+
+    std::vector<CryptoKernel::Blockchain::header> headers;
+    try {
+        for(unsigned int batch = 0; batch < maxBatches && running; batch++) {
+            std::vector<CryptoKernel::Blockchain::header> newHeaders;
+            try {
+                newHeaders = connection->getHeaders(locator);
+            } catch(const Peer::NetworkError& e) {
+                log->printf(LOG_LEVEL_WARN,
+                            "Network(): Failed to contact " + url + " " + e.what() +
+                            " while downloading headers");
+                return {};
+            }
+
+            if(newHeaders.empty()) {
+                break;
+            }
+
+            if(headers.empty()) {
+                // The first header builds on the last block we have in
+                // common with the peer, so any fork is found here
+                std::unique_ptr<CryptoKernel::Blockchain::header> forkPoint;
+                try {
+                    forkPoint.reset(new CryptoKernel::Blockchain::header(blockchain->getHeader(
+                                        newHeaders.front().getPreviousBlockId())));
+                } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
+                    // None of our locator is in the peer's chain, not even
+                    // our genesis block
+                    changeScore(url, 250);
+                    return {};
+                }
+
+                log->printf(LOG_LEVEL_INFO, "Network(): Found common block " +
+                            std::to_string(forkPoint->getHeight()) + " with " + url);
+            } else if(newHeaders.front().getPreviousBlockId() != headers.back().getId()) {
+                // The peer moved to another chain since the last batch
+                break;
+            }
+
+            // Checked with the earlier batches, which later targets depend on
+            const size_t checkFrom = headers.size();
+            headers.insert(headers.end(), newHeaders.begin(), newHeaders.end());
+            blockchain->checkHeaders(headers, checkFrom);
+
+            if(newHeaders.size() < batchSize ||
+                    (headers.size() >= wanted && blockchain->isChainBetter(headers.back()))) {
+                break;
+            }
+
+            locator = ourLocator;
+            locator.insert(locator.begin(), headers.back().getId());
+        }
+
+        if(headers.empty() || !blockchain->isChainBetter(headers.back())) {
+            return {};
+        }
+    } catch(CryptoKernel::Blockchain::NotFoundException& e) {
+        // Our chain changed under us, which is no fault of the peer's
+        log->printf(LOG_LEVEL_WARN, "Network(): Failed to check headers from " + url + ": " +
+                    e.what());
+        return {};
+    } catch(CryptoKernel::Blockchain::InvalidElementException& e) {
+        log->printf(LOG_LEVEL_WARN, "Network(): " + url + " sent invalid headers: " + e.what());
+        changeScore(url, 50);
+        return {};
+    }
+
+    return headers;
+}
+
+uint64_t CryptoKernel::Network::downloadBlocks(const std::vector<HeaderChain>& chains,
+        const size_t best, const size_t count) {
+    // The most blocks a peer serves per request
+    const uint64_t batchSize = 5;
+    // The most blocks downloaded ahead of the next one to submit
+    const uint64_t windowSize = 500;
+    // Well inside the time a peer has to answer a request
+    const std::chrono::seconds stallTimeout(5);
+
+    const std::vector<CryptoKernel::Blockchain::header>& headers = chains[best].headers;
+    const uint64_t firstHeight = headers.front().getHeight();
+
+    CryptoKernel::DownloadScheduler scheduler(firstHeight, count, batchSize, windowSize,
+            stallTimeout);
+
+    // Peers download blocks as far as their headers agree with the chain
+    // being downloaded
+    std::vector<size_t> downloading;
+    for(size_t i = 0; i < chains.size(); i++) {
+        size_t agreed = 0;
+        while(agreed < count && agreed < chains[i].headers.size() &&
+                chains[i].headers[agreed].getId() == headers[agreed].getId()) {
+            agreed++;
+        }
+
+        if(agreed > 0) {
+            scheduler.addPeer(chains[i].url, firstHeight + agreed);
+            downloading.push_back(i);
+        }
+    }
+
+    std::vector<std::thread> downloaders;
+    for(const size_t i : downloading) {
+        downloaders.emplace_back([&, i]() {
+            const HeaderChain& chain = chains[i];
+            CryptoKernel::DownloadScheduler::Range range;
+            while(running && scheduler.assign(chain.url, range)) {
+                std::vector<CryptoKernel::Blockchain::block> newBlocks;
+                try {
+                    newBlocks = chain.connection->getBlocks(range.start, range.end);
+                } catch(const Peer::NetworkError& e) {
+                    log->printf(LOG_LEVEL_WARN,
+                                "Network(): Failed to contact " + chain.url + " " + e.what() +
+                                " while downloading blocks");
+                    scheduler.fail(chain.url, range);
+                    break;
+                }
+
+                // A peer that moved to another chain since sending its
+                // headers serves different blocks at these heights
+                bool matches = true;
+                for(size_t j = 0; j < newBlocks.size() && range.start + j < range.end; j++) {
+                    if(newBlocks[j].getId() != headers[range.start + j - firstHeight].getId()) {
+                        matches = false;
+                        break;
+                    }
+                }
+
+                if(!matches) {
+                    log->printf(LOG_LEVEL_WARN, "Network(): " + chain.url +
+                                " sent a block that does not match its header");
+                    scheduler.fail(chain.url, range);
+                    break;
+                }
+
+                scheduler.complete(chain.url, range, newBlocks);
+                if(newBlocks.size() < range.end - range.start) {
+                    break;
+                }
+            }
+
+            scheduler.removePeer(chain.url);
+        });
+    }
+
+    // Blocks are submitted in order as they arrive, while the rest of the
+    // window downloads
+    uint64_t submitted = 0;
+    while(running) {
+        const std::unique_ptr<CryptoKernel::DownloadScheduler::Delivery> delivery =
+            scheduler.next();
+        if(!delivery) {
+            break;
+        }
+
+        const auto blockResult = blockchain->submitBlock(delivery->block);
+
+        if(std::get<1>(blockResult)) {
+            changeScore(delivery->peer, 50);
+        }
+
+        if(!std::get<0>(blockResult)) {
+            changeScore(delivery->peer, 25);
+            log->printf(LOG_LEVEL_WARN, "Network(): offending block: " +
+                        delivery->block.toJson().toStyledString());
+            break;
+        }
+
+        submitted++;
+    }
+
+    scheduler.cancel();
+    for(std::thread& downloader : downloaders) {
+        downloader.join();
+    }
+
+    log->printf(LOG_LEVEL_INFO, "Network(): Submitted " + std::to_string(submitted) + " of " +
+                std::to_string(count) + " blocks, " + std::to_string(scheduler.getReassigned()) +
+                " stalled requests reassigned");
+
+    return submitted;
 }
 
 void CryptoKernel::Network::networkFunc() {
-    std::unique_ptr<std::thread> blockProcessor;
-    bool failure = false;
+    const uint64_t bulkImportThreshold = 1000;
+    const size_t maxBlocksPerRound = 2000;
+
     uint64_t currentHeight = blockchain->getBlockDB("tip").getHeight();
     this->currentHeight = currentHeight;
-    uint64_t startHeight = currentHeight;
 
     while(running) {
         //Determine best chain
@@ -386,150 +625,94 @@ void CryptoKernel::Network::networkFunc() {
 
         log->printf(LOG_LEVEL_INFO,
                     "Network(): Current height: " + std::to_string(currentHeight) + ", best height: " +
-                    std::to_string(bestHeight) + ", start height: " + std::to_string(startHeight));
+                    std::to_string(bestHeight));
+
+        // Far behind the best peer we are mostly importing blocks, so let the
+        // block database buffer writes until we have caught up
+        if(bestHeight > currentHeight + bulkImportThreshold) {
+            blockchain->setBulkImport(true);
+        } else if(bestHeight <= currentHeight) {
+            blockchain->setBulkImport(false);
+        }
 
         bool madeProgress = false;
 
         //Detect if we are behind
         if(bestHeight > currentHeight) {
+            // Headers first, so the best chain is chosen before any block is
+            // downloaded and none are downloaded from worse chains
+            // Only the peers downloaded from stay acquired, so the others
+            // are still free for relaying and pings
+            std::vector<HeaderChain> chains;
+            defer releaseAll([&]{
+                for(const HeaderChain& chain : chains) {
+                    chain.connection->release();
+                }
+            });
+
             keys = connected.keys();
             std::random_shuffle(keys.begin(), keys.end());
-			for(auto key : keys) {
-				auto it = connected.find(key);
-				if(it != connected.end() && it->second->acquire()) {
-                    defer d([&]{it->second->release();});
-					if(it->second->getInfo("height").asUInt64() > currentHeight) {
-						std::list<CryptoKernel::Blockchain::block> blocks;
-
-						const std::string peerUrl = it->first;
-
-						if(currentHeight == startHeight) {
-							auto nBlocks = 0;
-							do {
-								log->printf(LOG_LEVEL_INFO,
-											"Network(): Downloading blocks " + std::to_string(currentHeight + 1) + " to " +
-											std::to_string(currentHeight + 6));
-								try {
-									const auto newBlocks = it->second->getBlocks(currentHeight + 1, currentHeight + 6);
-									nBlocks = newBlocks.size();
-									blocks.insert(blocks.end(), newBlocks.rbegin(), newBlocks.rend());
-									if(nBlocks > 0) {
-										madeProgress = true;
-									} else {
-										log->printf(LOG_LEVEL_WARN, "Network(): Peer responded with no blocks");
-									}
-								} catch(const Peer::NetworkError& e) {
-									log->printf(LOG_LEVEL_WARN,
-												"Network(): Failed to contact " + it->first + " " + e.what() +
-												" while downloading blocks");
-									break;
-								}
-
-								log->printf(LOG_LEVEL_INFO, "Network(): Testing if we have block " + std::to_string(blocks.rbegin()->getHeight() - 1));
-
-								try {
-									blockchain->getBlockDB(blocks.rbegin()->getPreviousBlockId().toString());
-								} catch(const CryptoKernel::Blockchain::NotFoundException& e) {
-									if(currentHeight == 1) {
-										// This peer has a different genesis block to us
-										changeScore(it->first, 250);
-										break;
-									} else {
-										log->printf(LOG_LEVEL_INFO, "Network(): got block h: " + std::to_string(blocks.rbegin()->getHeight()) + " with prevBlock: " + blocks.rbegin()->getPreviousBlockId().toString() + " prev not found");
-
-
-										currentHeight = std::max(1, (int)currentHeight - nBlocks);
-										continue;
-									}
-								}
-
-								break;
-							} while(running);
-
-							currentHeight += nBlocks;
-						}
-
-						log->printf(LOG_LEVEL_INFO, "Network(): Found common block " + std::to_string(currentHeight-1) + " with peer, starting block download");
-
-						while(blocks.size() < 2000 && running && !failure && currentHeight < bestHeight) {
-							log->printf(LOG_LEVEL_INFO,
-										"Network(): Downloading blocks " + std::to_string(currentHeight + 1) + " to " +
-										std::to_string(currentHeight + 6));
-
-							auto nBlocks = 0;
-							try {
-								const auto newBlocks = it->second->getBlocks(currentHeight + 1, currentHeight + 6);
-								nBlocks = newBlocks.size();
-								blocks.insert(blocks.begin(), newBlocks.rbegin(), newBlocks.rend());
-								if(nBlocks > 0) {
-									madeProgress = true;
-								} else {
-									log->printf(LOG_LEVEL_WARN, "Network(): Peer responded with no blocks");
-									break;
-								}
-							} catch(const Peer::NetworkError& e) {
-								log->printf(LOG_LEVEL_WARN,
-											"Network(): Failed to contact " + it->first + " " + e.what() +
-											" while downloading blocks");
-								break;
-							}
-
-							currentHeight = std::min(currentHeight + std::max(nBlocks, 1), bestHeight);
-						}
-
-						if(blockProcessor) {
-							log->printf(LOG_LEVEL_INFO, "Network(): Waiting for previous block processor thread to finish");
-							blockProcessor->join();
-							blockProcessor.reset();
-
-							if(failure) {
-								log->printf(LOG_LEVEL_WARN, "Network(): Failure processing blocks");
-								blocks.clear();
-								currentHeight = blockchain->getBlockDB("tip").getHeight();
-								this->currentHeight = currentHeight;
-								startHeight = currentHeight;
-								bestHeight = currentHeight;
-								failure = false;
-								break;
-							}
-						}
-
-						blockProcessor.reset(new std::thread([&, blocks](const std::string& peer){
-							failure = false;
+            for(auto key : keys) {
+                auto it = connected.find(key);
+                if(it != connected.end() && it->second->acquire()) {
+                    Connection* connection = it->second.get();
+                    std::vector<CryptoKernel::Blockchain::header> headers;
+                    if(connection->getInfo("height").asUInt64() > currentHeight) {
+                        headers = downloadHeaders(connection, it->first);
+                    }
+
+                    if(headers.empty()) {
+                        connection->release();
+                    } else {
+                        chains.push_back(HeaderChain{it->first, connection, headers});
+                    }
+                }
+            }
 
-							log->printf(LOG_LEVEL_INFO, "Network(): Submitting " + std::to_string(blocks.size()) + " blocks to blockchain");
+            size_t best = 0;
+            for(size_t i = 1; i < chains.size(); i++) {
+                if(blockchain->isChainBetter(chains[i].headers.back(), chains[best].headers.back())) {
+                    best = i;
+                }
+            }
 
-							for(auto rit = blocks.rbegin(); rit != blocks.rend() && running; ++rit) {
-								const auto blockResult = blockchain->submitBlock(*rit);
+            // Peers on other forks have none of the blocks to download
+            if(!chains.empty()) {
+                const CryptoKernel::uint256 firstId = chains[best].headers.front().getId();
+                std::vector<HeaderChain> agreeing;
+                for(size_t i = 0; i < chains.size(); i++) {
+                    if(chains[i].headers.front().getId() == firstId) {
+                        if(i == best) {
+                            best = agreeing.size();
+                        }
+                        agreeing.push_back(chains[i]);
+                    } else {
+                        chains[i].connection->release();
+                    }
+                }
+                chains = agreeing;
+            }
 
-								if(std::get<1>(blockResult)) {
-									changeScore(peer, 50);
-								}
+            if(!chains.empty()) {
+                const std::vector<CryptoKernel::Blockchain::header>& headers = chains[best].headers;
+                const size_t count = std::min(headers.size(), maxBlocksPerRound);
+                log->printf(LOG_LEVEL_INFO,
+                            "Network(): Downloading blocks " + std::to_string(headers.front().getHeight()) +
+                            " to " + std::to_string(headers[count - 1].getHeight()) + " of the chain from " +
+                            chains[best].url);
 
-								if(!std::get<0>(blockResult)) {
-									failure = true;
-									changeScore(peer, 25);
-									log->printf(LOG_LEVEL_WARN, "Network(): offending block: " + rit->toJson().toStyledString());
-									break;
-								}
-							}
-						}, peerUrl));
-					}
-				}
+                madeProgress = downloadBlocks(chains, best, count) > 0;
+                currentHeight = blockchain->getBlockDB("tip").getHeight();
+                this->currentHeight = currentHeight;
             }
         }
 
         if(bestHeight <= currentHeight || connected.size() == 0 || !madeProgress) {
             std::this_thread::sleep_for(std::chrono::milliseconds(20000));
             currentHeight = blockchain->getBlockDB("tip").getHeight();
-            startHeight = currentHeight;
             this->currentHeight = currentHeight;
         }
     }
-
-    if(blockProcessor) {
-        blockProcessor->join();
-    }
 }
 
 void CryptoKernel::Network::connectionFunc() {
@@ -565,9 +748,10 @@ void CryptoKernel::Network::connectionFunc() {
 
             sf::IpAddress addr(client->getRemoteAddress());
 
+            // We never dial our own port on localhost, so a connection from
+            // there is another node on this machine
             if(addr == sf::IpAddress::getLocalAddress()
                     || addr == myAddress
-                    || addr == sf::IpAddress::LocalHost
                     || addr == sf::IpAddress::None) {
                 log->printf(LOG_LEVEL_INFO,
                             "Network(): Incoming connection " + client->getRemoteAddress().toString() +
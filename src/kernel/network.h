@@ -18,16 +18,20 @@ class Network {
 public:
     /**
     * Constructs a network object with the given log and blockchain. Attempts
-    * to connect to saved seeds or those specified in peers.txt. Causes the
-    * program to listen for incoming connections on port 49000.
+    * to connect to saved seeds or those specified in peers.txt, one host or
+    * host:port per line. Causes the program to listen for incoming
+    * connections on the given port.
     *
     * @param log a pointer to the CK log to use
     * @param blockchain a pointer to the blockchain to sync
     * @param port the port to listen on
     * @param dbDir the directory of the peers database
+    * @param dbProfile json LevelDB tuning profile for the peers database, see
+             Storage::loadProfile
     */
     Network(CryptoKernel::Log* log, CryptoKernel::Blockchain* blockchain,
-            const unsigned int port, const std::string& dbDir);
+            const unsigned int port, const std::string& dbDir,
+            const Json::Value& dbProfile = Json::Value());
 
     /**
     * Default destructor
@@ -110,6 +114,7 @@ private:
 		std::vector<CryptoKernel::Blockchain::transaction> getUnconfirmedTransactions();
 		CryptoKernel::Blockchain::block getBlock(const uint64_t height, const std::string& id);
 		std::vector<CryptoKernel::Blockchain::block> getBlocks(const uint64_t start, const uint64_t end);
+		std::vector<CryptoKernel::Blockchain::header> getHeaders(const std::vector<CryptoKernel::uint256>& locator);
     CryptoKernel::Network::peerStats getPeerStats();
 
 		bool acquire();
@@ -151,9 +156,57 @@ private:
     void networkFunc();
     std::unique_ptr<std::thread> networkThread;
 
+    /**
+    * The headers a peer offers after the last block it has in common with
+    * us
+    */
+    struct HeaderChain {
+        std::string url;
+        Connection* connection;
+        std::vector<CryptoKernel::Blockchain::header> headers;
+    };
+
+    /**
+    * Downloads the headers a peer has after our main chain, checking each
+    * batch as it arrives. Stops once the headers make a better chain than
+    * ours and there are enough for a round of block downloads.
+    *
+    * @param connection the peer, which must be acquired
+    * @param url the address of the peer
+    * @return the headers, oldest first, or none if the peer offers no
+    *         better chain than ours
+    */
+    std::vector<CryptoKernel::Blockchain::header> downloadHeaders(Connection* connection,
+            const std::string& url);
+
+    /**
+    * Downloads the blocks of the first headers of a chain from every peer
+    * whose headers agree with it, and submits them in order as they
+    * arrive. See DownloadScheduler.
+    *
+    * @param chains the header chains of the peers, which must be acquired
+    * @param best the chain to download
+    * @param count the number of blocks to download
+    * @return the number of blocks submitted before one failed or could not
+    *         be downloaded
+    */
+    uint64_t downloadBlocks(const std::vector<HeaderChain>& chains, const size_t best,
+                            const size_t count);
+
     void connectionFunc();
 	std::unique_ptr<std::thread> connectionThread;
 
+    /**
+    * Splits a peer address into its host and port. Peers are listed by
+    * host alone, on our own port, or as host:port.
+    *
+    * @param url the address of the peer
+    * @param host set to the host
+    * @param peerPort set to the port
+    * @return false if the port is malformed
+    */
+    bool splitAddress(const std::string& url, std::string& host, unsigned int& peerPort);
+
 	void makeOutgoingConnections(bool& wait);
 	void makeOutgoingConnectionsWrapper();
     std::unique_ptr<std::thread> makeOutgoingConnectionsThread;
@@ -205,6 +205,30 @@ void CryptoKernel::Network::Peer::requestFunc() {
                                 response["nonce"] = request["nonce"].asUInt64();
                                 send(response);
                             }
+                        } else if(request["command"] == "getheaders") {
+                            // A locator of an honest peer halves the
+                            // distance back with each id after the tenth
+                            Json::Value response;
+                            if(request["data"]["locator"].size() <= 128) {
+                                std::vector<CryptoKernel::uint256> locator;
+                                try {
+                                    for(const Json::Value& id : request["data"]["locator"]) {
+                                        locator.push_back(CryptoKernel::uint256(id.asString()));
+                                    }
+                                } catch(const std::runtime_error& e) {
+                                    throw CryptoKernel::Blockchain::InvalidElementException(
+                                        "Locator id is out of range");
+                                }
+
+                                for(const auto& header : blockchain->getHeaders(locator, 2000)) {
+                                    response["data"].append(header.toJson());
+                                }
+                            } else {
+                                network->changeScore(client->getRemoteAddress().toString(), 50);
+                            }
+
+                            response["nonce"] = request["nonce"].asUInt64();
+                            send(response);
                         } else if(request["command"] == "getblock") {
                             if(request["data"]["id"].empty()) {
                                 Json::Value response;
@@ -351,6 +375,28 @@ std::vector<CryptoKernel::Blockchain::block> CryptoKernel::Network::Peer::getBlo
     return returning;
 }
 
+std::vector<CryptoKernel::Blockchain::header> CryptoKernel::Network::Peer::getHeaders(
+    const std::vector<CryptoKernel::uint256>& locator) {
+    Json::Value request;
+    request["command"] = "getheaders";
+    for(const CryptoKernel::uint256& id : locator) {
+        request["data"]["locator"].append(id.toString());
+    }
+    Json::Value headers = sendRecv(request);
+
+    std::vector<CryptoKernel::Blockchain::header> returning;
+    for(unsigned int i = 0; i < headers.size(); i++) {
+        try {
+            returning.push_back(CryptoKernel::Blockchain::header(headers[i]));
+        } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
+            network->changeScore(client->getRemoteAddress().toString(), 50);
+            throw NetworkError("peer sent a malformed header");
+        }
+    }
+
+    return returning;
+}
+
 CryptoKernel::Network::peerStats CryptoKernel::Network::Peer::getPeerStats() const {
     return stats;
 }
@@ -22,6 +22,8 @@ public:
     CryptoKernel::Blockchain::block getBlock(const uint64_t height, const std::string& id);
     std::vector<CryptoKernel::Blockchain::block> getBlocks(const uint64_t start,
                                                            const uint64_t end);
+    std::vector<CryptoKernel::Blockchain::header> getHeaders(
+        const std::vector<CryptoKernel::uint256>& locator);
     
     Network::peerStats getPeerStats() const;
 
@@ -0,0 +1,189 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <math.h>
+
+#include "retarget.h"
+
+const uint64_t CryptoKernel::KGWRetarget::minBlocks;
+const uint64_t CryptoKernel::KGWRetarget::maxBlocks;
+const uint64_t CryptoKernel::KGWRetarget::interval;
+constexpr CryptoKernel::uint256 CryptoKernel::KGWRetarget::minDifficulty;
+
+CryptoKernel::KGWRetarget::KGWRetarget(const uint64_t blockTarget, const Ancestry& ancestry,
+                                       const TargetReader& readTarget) {
+    this->blockTarget = blockTarget;
+    this->ancestry = ancestry;
+    this->readTarget = readTarget;
+}
+
+CryptoKernel::KGWRetarget::Sample CryptoKernel::KGWRetarget::makeSample(
+    const BlockIndex::Entry& entry) const {
+    return Sample{entry.id, entry.previousId, entry.height, entry.timestamp, readTarget(entry)};
+}
+
+void CryptoKernel::KGWRetarget::moveTo(const BlockIndex::Entry& newest) {
+    const auto inWindow = [&](const uint64_t height) {
+        return !window.empty() && height >= window.front().height &&
+               height <= window.back().height;
+    };
+
+    const auto matches = [&](const uint64_t height, const uint256& id) {
+        return inWindow(height) && window[height - window.front().height].id == id;
+    };
+
+    // Walk back from the block to where it joins the window. Anything
+    // further than a full window away is read in one go.
+    std::vector<Sample> added;
+    if(inWindow(newest.height) || (!window.empty() && newest.height > window.back().height &&
+                                   newest.height - window.back().height < maxBlocks)) {
+        BlockIndex::Entry current = newest;
+        while(!matches(current.height, current.id)) {
+            added.push_back(makeSample(current));
+            if(current.height == 1 || added.size() == maxBlocks) {
+                break;
+            }
+
+            current = ancestry(current.previousId, 1).front();
+        }
+    } else {
+        for(const BlockIndex::Entry& entry : ancestry(newest.id, maxBlocks)) {
+            added.push_back(makeSample(entry));
+        }
+    }
+
+    const uint64_t joinHeight = added.empty() ? newest.height : added.back().height - 1;
+    const uint256 joinId = added.empty() ? newest.id : added.back().previousId;
+    if(matches(joinHeight, joinId)) {
+        // Drop the blocks that were disconnected since
+        while(window.back().height > joinHeight) {
+            window.pop_back();
+        }
+    } else {
+        window.clear();
+    }
+
+    for(auto it = added.rbegin(); it != added.rend(); ++it) {
+        window.push_back(*it);
+        if(window.size() > maxBlocks) {
+            window.pop_front();
+        }
+    }
+
+    // Disconnecting leaves the window short, so read the older blocks that
+    // are back in range
+    const uint64_t wanted = std::min(maxBlocks, newest.height);
+    if(window.size() < wanted) {
+        const std::vector<BlockIndex::Entry> older = ancestry(window.front().previousId,
+                wanted - window.size());
+        for(const BlockIndex::Entry& entry : older) {
+            window.push_front(makeSample(entry));
+        }
+    }
+}
+
+CryptoKernel::uint256 CryptoKernel::KGWRetarget::calculateTarget(
+    const uint256& previousBlockId) {
+    const BlockIndex::Entry lastSolved = ancestry(previousBlockId, 1).front();
+
+    if(lastSolved.height < minBlocks) {
+        return minDifficulty;
+    } else if(lastSolved.height % interval != 0) {
+        return readTarget(lastSolved);
+    }
+
+    std::lock_guard<std::mutex> lock(windowMutex);
+    moveTo(lastSolved);
+
+    uint64_t blocksScanned = 0;
+    uint256 difficultyAverage;
+    uint256 previousDifficultyAverage;
+    int64_t actualRate = 0;
+    int64_t targetRate = 0;
+    double rateAdjustmentRatio = 1.0;
+    double eventHorizonDeviation = 0.0;
+    double eventHorizonDeviationFast = 0.0;
+    double eventHorizonDeviationSlow = 0.0;
+
+    // The window is oldest first, so the ith block back is counted from
+    // the end
+    for(unsigned int i = 1; i <= window.size() && window[window.size() - i].height != 1; i++) {
+        const Sample& currentBlock = window[window.size() - i];
+
+        blocksScanned++;
+
+        if(i == 1) {
+            difficultyAverage = currentBlock.target;
+        } else {
+            // The average moves a 1/i step towards this target, the step
+            // rounded towards zero
+            const uint256 count(i);
+            if(currentBlock.target >= previousDifficultyAverage) {
+                difficultyAverage = previousDifficultyAverage +
+                                    (currentBlock.target - previousDifficultyAverage) / count;
+            } else {
+                difficultyAverage = previousDifficultyAverage -
+                                    (previousDifficultyAverage - currentBlock.target) / count;
+            }
+        }
+
+        previousDifficultyAverage = difficultyAverage;
+
+        actualRate = lastSolved.timestamp - currentBlock.timestamp;
+        targetRate = blockTarget * blocksScanned;
+        rateAdjustmentRatio = 1.0;
+
+        if(actualRate < 0) {
+            actualRate = 0;
+        }
+
+        if(actualRate != 0 && targetRate != 0) {
+            rateAdjustmentRatio = double(targetRate) / double(actualRate);
+        }
+
+        eventHorizonDeviation = 1 + (0.7084 * pow((double(blocksScanned)/double(minBlocks)),
+                                     -1.228));
+        eventHorizonDeviationFast = eventHorizonDeviation;
+        eventHorizonDeviationSlow = 1 / eventHorizonDeviation;
+
+        if(blocksScanned >= minBlocks) {
+            if((rateAdjustmentRatio <= eventHorizonDeviationSlow) ||
+                    (rateAdjustmentRatio >= eventHorizonDeviationFast)) {
+                break;
+            }
+        }
+    }
+
+    uint256 newTarget = difficultyAverage;
+    if(actualRate != 0 && targetRate != 0) {
+        // Saturates rather than overflowing, and anything that large is
+        // capped below anyway
+        newTarget = newTarget.mulDiv(actualRate, targetRate);
+    }
+
+    if(newTarget > minDifficulty) {
+        newTarget = minDifficulty;
+    }
+
+    return newTarget;
+}
+
+void CryptoKernel::KGWRetarget::clear() {
+    std::lock_guard<std::mutex> lock(windowMutex);
+    window.clear();
+}
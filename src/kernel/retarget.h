@@ -0,0 +1,111 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RETARGET_H_INCLUDED
+#define RETARGET_H_INCLUDED
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "blockindex.h"
+#include "ckmath.h"
+
+namespace CryptoKernel {
+/**
+* Kimoto Gravity Well difficulty retargeting. The timestamps and targets
+* of the last blocks before the most recent retarget are kept in a window,
+* which follows the chain it is asked about: each block connected since
+* adds one entry, each block disconnected removes one, and only the
+* blocks that changed are read from the block index. Targets are the same
+* as scanning the ancestors of the block every time.
+*/
+class KGWRetarget {
+public:
+    /**
+    * Returns a block followed by its ancestors, newest first, as
+    * Blockchain::getAncestry does
+    */
+    typedef std::function<std::vector<BlockIndex::Entry>(const uint256& id, const size_t count)>
+    Ancestry;
+
+    /**
+    * Reads the target out of a block's consensus data
+    */
+    typedef std::function<uint256(const BlockIndex::Entry& entry)> TargetReader;
+
+    // Blocks before this height use the minimum difficulty
+    static const uint64_t minBlocks = 144;
+    // The most blocks scanned back for a retarget
+    static const uint64_t maxBlocks = 4032;
+    // The target changes only after blocks at a multiple of this height
+    static const uint64_t interval = 12;
+
+    static constexpr uint256 minDifficulty = ~uint256() >> 20;
+
+    /**
+    * @param blockTarget the target number of seconds per block
+    * @param ancestry where block timestamps and targets are read from
+    * @param readTarget reads the target of a block
+    */
+    KGWRetarget(const uint64_t blockTarget, const Ancestry& ancestry,
+                const TargetReader& readTarget);
+
+    /**
+    * Calculates the target of the block after a given one
+    *
+    * @param previousBlockId the block the new block builds on, in the main
+    *        chain or not
+    * @return the target of the new block
+    * @throw whatever the ancestry or readTarget functions throw
+    */
+    uint256 calculateTarget(const uint256& previousBlockId);
+
+    /**
+    * Forgets the window, so the next retarget reads it all again
+    */
+    void clear();
+
+private:
+    struct Sample {
+        uint256 id;
+        uint256 previousId;
+        uint64_t height;
+        uint64_t timestamp;
+        uint256 target;
+    };
+
+    Sample makeSample(const BlockIndex::Entry& entry) const;
+
+    /**
+    * Moves the newest end of the window to a block, and fills the window
+    * to maxBlocks blocks or back to height 1
+    */
+    void moveTo(const BlockIndex::Entry& newest);
+
+    uint64_t blockTarget;
+    Ancestry ancestry;
+    TargetReader readTarget;
+
+    std::mutex windowMutex;
+    // Consecutive blocks, oldest first
+    std::deque<Sample> window;
+};
+}
+
+#endif // RETARGET_H_INCLUDED
@@ -0,0 +1,101 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <random>
+#include <stdexcept>
+
+#include "sigcache.h"
+
+CryptoKernel::SignatureCache::SignatureCache(const size_t capacity) {
+    this->capacity = capacity;
+    hits = 0;
+    misses = 0;
+
+    std::random_device rd;
+    unsigned char salt[32];
+    for(unsigned int i = 0; i < sizeof(salt); i++) {
+        salt[i] = static_cast<unsigned char>(rd());
+    }
+
+    if(!SHA256_Init(&salted) || !SHA256_Update(&salted, salt, sizeof(salt))) {
+        throw std::runtime_error("Failed to initialise SHA256 context");
+    }
+}
+
+std::string CryptoKernel::SignatureCache::entryKey(const std::string& scheme,
+        const std::string& publicKey, const std::string& message,
+        const std::string& signature) const {
+    SHA256_CTX ctx = salted;
+
+    // Length prefixes keep the boundaries between the fields unambiguous
+    for(const std::string* field : {&scheme, &publicKey, &message, &signature}) {
+        const uint64_t length = field->size();
+        SHA256_Update(&ctx, &length, sizeof(length));
+        SHA256_Update(&ctx, field->data(), field->size());
+    }
+
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256_Final(hash, &ctx);
+
+    return std::string(reinterpret_cast<const char*>(hash), sizeof(hash));
+}
+
+bool CryptoKernel::SignatureCache::verify(const std::string& scheme,
+        const std::string& publicKey, const std::string& message,
+        const std::string& signature, const std::function<bool()>& check) {
+    const std::string key = entryKey(scheme, publicKey, message, signature);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(entries.count(key) > 0) {
+            hits++;
+            return true;
+        }
+    }
+
+    misses++;
+
+    // Verify without the lock so other threads can use the cache meanwhile
+    if(!check()) {
+        return false;
+    }
+
+    if(capacity > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(entries.insert(key).second) {
+            order.push_back(key);
+            while(order.size() > capacity) {
+                entries.erase(order.front());
+                order.pop_front();
+            }
+        }
+    }
+
+    return true;
+}
+
+CryptoKernel::SignatureCache::Stats CryptoKernel::SignatureCache::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Stats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.entries = entries.size();
+    stats.capacity = capacity;
+
+    return stats;
+}
@@ -0,0 +1,96 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIGCACHE_H_INCLUDED
+#define SIGCACHE_H_INCLUDED
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+#include <openssl/sha.h>
+
+namespace CryptoKernel {
+/**
+* Remembers signatures that have been verified, so a transaction checked
+* on entering the mempool is not checked again when it is confirmed.
+* Entries are salted hashes of the signature scheme, public key, message
+* and signature, with a salt chosen at random on construction, so which
+* entries collide cannot be predicted. Only valid signatures are stored. When full, the oldest
+* entries are forgotten first.
+*/
+class SignatureCache {
+public:
+    /**
+    * Creates an empty cache
+    *
+    * @param capacity the maximum number of signatures to remember
+    */
+    SignatureCache(const size_t capacity);
+
+    /**
+    * Checks a signature, using the cache if it was already found valid
+    *
+    * @param scheme the signature scheme, such as "ecdsa", "schnorr" or
+    *        "aggregate", so a signature valid under one scheme is never
+    *        taken as valid under another
+    * @param publicKey the public key the signature is checked against
+    * @param message the signed message
+    * @param signature the signature
+    * @param check performs the actual verification, called on a cache miss
+    * @return true if the signature is valid
+    */
+    bool verify(const std::string& scheme, const std::string& publicKey,
+                const std::string& message, const std::string& signature,
+                const std::function<bool()>& check);
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t entries;
+        uint64_t capacity;
+    };
+
+    /**
+    * Returns the usage counters of the cache
+    *
+    * @return a Stats struct describing the cache
+    */
+    Stats getStats();
+
+private:
+    std::string entryKey(const std::string& scheme, const std::string& publicKey,
+                         const std::string& message, const std::string& signature) const;
+
+    size_t capacity;
+
+    // Hash state after absorbing the salt, copied for every lookup
+    SHA256_CTX salted;
+
+    std::mutex mutex;
+    std::unordered_set<std::string> entries;
+    std::deque<std::string> order;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+};
+}
+
+#endif // SIGCACHE_H_INCLUDED
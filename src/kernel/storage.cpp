@@ -17,46 +17,826 @@
 
 #include <sstream>
 #include <memory>
+#include <cstring>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <chrono>
+#include <vector>
 
 #include <json/writer.h>
 #include <json/reader.h>
 
-#include <leveldb/write_batch.h>
-#include <leveldb/cache.h>
-#include <leveldb/filter_policy.h>
-
 #include "storage.h"
 
-CryptoKernel::Storage::Storage(const std::string& filename, const bool sync, const unsigned int cache, const bool bloom) {
-    leveldb::Options options;
-    options.create_if_missing = true;
+namespace {
+    // Binary records start with a zero byte, which can never begin a json
+    // document, followed by the encoding version
+    const char binaryMarker = 0x00;
+    const char binaryVersion = 0x01;
+
+    const std::string encodingKey = "_meta/encoding";
+    const std::string binaryEncodingName = "binary1";
+
+    // Database names with this prefix are kept in memory rather than on disk
+    const std::string memoryPrefix = "memory:";
+
+    CryptoKernel::LevelDBEngine::Options basicProfile(const unsigned int cache, const bool bloom) {
+        CryptoKernel::LevelDBEngine::Options profile;
+        profile.cache = cache;
+        profile.bloomBits = bloom ? 10 : 0;
+        return profile;
+    }
+
+    enum BinaryTag : unsigned char {
+        TAG_NULL = 0,
+        TAG_FALSE = 1,
+        TAG_TRUE = 2,
+        TAG_INT = 3,
+        TAG_UINT = 4,
+        TAG_REAL = 5,
+        TAG_STRING = 6,
+        TAG_ID = 7,
+        TAG_ARRAY = 8,
+        TAG_OBJECT = 9
+    };
+
+    class MalformedRecord : public std::exception {};
 
-    if(cache > 0) {
-        options.block_cache = leveldb::NewLRUCache(cache * 1024 * 1024);
+    void putVarint(std::string& out, uint64_t value) {
+        while(value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    // Only accepts the shortest encoding of each value, which is the one
+    // putVarint writes
+    uint64_t getVarint(const char*& pos, const char* end) {
+        uint64_t value = 0;
+        for(unsigned int shift = 0; shift < 64; shift += 7) {
+            if(pos >= end) {
+                throw MalformedRecord();
+            }
+            const unsigned char byte = *pos++;
+            if(shift == 63 && byte > 1) {
+                throw MalformedRecord();
+            }
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if(!(byte & 0x80)) {
+                if(byte == 0 && shift > 0) {
+                    throw MalformedRecord();
+                }
+                return value;
+            }
+        }
+        throw MalformedRecord();
     }
 
-    if(bloom) {
-        options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    // Table lookup rather than range checks, ids are random so the
+    // branches would be mispredicted on nearly every character
+    struct HexTable {
+        signed char values[256];
+
+        HexTable() {
+            std::memset(values, -1, sizeof(values));
+            for(int i = 0; i < 10; i++) {
+                values['0' + i] = i;
+            }
+            for(int i = 0; i < 6; i++) {
+                values['a' + i] = 10 + i;
+            }
+        }
+    };
+
+    const HexTable hexTable;
+
+    inline int hexValue(const char c) {
+        return hexTable.values[static_cast<unsigned char>(c)];
     }
 
+    // Ids are written by uint256::toString as lowercase hex without leading
+    // zeros. Only strings in exactly that form are packed so decoding
+    // reproduces them byte for byte.
+    bool isPackableId(const char* str, const size_t len) {
+        if(len <= 32 || len > 64 || str[0] == '0') {
+            return false;
+        }
+
+        for(size_t i = 0; i < len; i++) {
+            if(hexValue(str[i]) < 0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void putId(std::string& out, const char* str, const size_t len) {
+        unsigned char bytes[32] = {0};
+        for(size_t i = 0; i < len; i++) {
+            const size_t nibble = 64 - len + i;
+            bytes[nibble / 2] |= hexValue(str[i]) << ((nibble % 2) ? 0 : 4);
+        }
+        out.append(reinterpret_cast<const char*>(bytes), 32);
+    }
+
+    void toHex(const char* bytes, char* hex) {
+        static const char digits[] = "0123456789abcdef";
+        for(unsigned int i = 0; i < 32; i++) {
+            const unsigned char byte = bytes[i];
+            hex[i * 2] = digits[byte >> 4];
+            hex[i * 2 + 1] = digits[byte & 0x0f];
+        }
+    }
+
+    Json::Value getId(const char*& pos, const char* end) {
+        if(end - pos < 32) {
+            throw MalformedRecord();
+        }
+
+        char hex[64];
+        toHex(pos, hex);
+        pos += 32;
+
+        unsigned int start = 0;
+        while(start < 63 && hex[start] == '0') {
+            start++;
+        }
+
+        return Json::Value(hex + start, hex + 64);
+    }
+
+    // In canonical form non-negative integers are always written as
+    // unsigned, as json text does not tell the two apart
+    void encodeValue(std::string& out, const Json::Value& json, const bool canonical) {
+        switch(json.type()) {
+            case Json::nullValue:
+                out.push_back(TAG_NULL);
+                break;
+            case Json::booleanValue:
+                out.push_back(json.asBool() ? TAG_TRUE : TAG_FALSE);
+                break;
+            case Json::intValue: {
+                const int64_t value = json.asInt64();
+                if(canonical && value >= 0) {
+                    out.push_back(TAG_UINT);
+                    putVarint(out, value);
+                    break;
+                }
+                out.push_back(TAG_INT);
+                putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+                break;
+            }
+            case Json::uintValue:
+                out.push_back(TAG_UINT);
+                putVarint(out, json.asUInt64());
+                break;
+            case Json::realValue: {
+                const double value = json.asDouble();
+                char bytes[sizeof(double)];
+                memcpy(bytes, &value, sizeof(double));
+                out.push_back(TAG_REAL);
+                out.append(bytes, sizeof(double));
+                break;
+            }
+            case Json::stringValue: {
+                const char* str;
+                const char* strEnd;
+                json.getString(&str, &strEnd);
+                const size_t len = strEnd - str;
+                if(isPackableId(str, len)) {
+                    out.push_back(TAG_ID);
+                    putId(out, str, len);
+                } else {
+                    out.push_back(TAG_STRING);
+                    putVarint(out, len);
+                    out.append(str, len);
+                }
+                break;
+            }
+            case Json::arrayValue:
+                out.push_back(TAG_ARRAY);
+                putVarint(out, json.size());
+                for(const Json::Value& element : json) {
+                    encodeValue(out, element, canonical);
+                }
+                break;
+            case Json::objectValue:
+                out.push_back(TAG_OBJECT);
+                putVarint(out, json.size());
+                for(auto it = json.begin(); it != json.end(); ++it) {
+                    const char* keyEnd;
+                    const char* key = it.memberName(&keyEnd);
+                    putVarint(out, keyEnd - key);
+                    out.append(key, keyEnd - key);
+                    encodeValue(out, *it, canonical);
+                }
+                break;
+        }
+    }
+
+    Json::Value decodeValue(const char*& pos, const char* end, const unsigned int depth) {
+        if(pos >= end || depth > 1000) {
+            throw MalformedRecord();
+        }
+
+        switch(static_cast<unsigned char>(*pos++)) {
+            case TAG_NULL:
+                return Json::Value();
+            case TAG_FALSE:
+                return Json::Value(false);
+            case TAG_TRUE:
+                return Json::Value(true);
+            case TAG_INT: {
+                const uint64_t zigzag = getVarint(pos, end);
+                return Json::Value(static_cast<Json::Int64>((zigzag >> 1) ^ (~(zigzag & 1) + 1)));
+            }
+            case TAG_UINT:
+                return Json::Value(static_cast<Json::UInt64>(getVarint(pos, end)));
+            case TAG_REAL: {
+                if(end - pos < static_cast<ptrdiff_t>(sizeof(double))) {
+                    throw MalformedRecord();
+                }
+                double value;
+                memcpy(&value, pos, sizeof(double));
+                pos += sizeof(double);
+                return Json::Value(value);
+            }
+            case TAG_STRING: {
+                const uint64_t len = getVarint(pos, end);
+                if(static_cast<uint64_t>(end - pos) < len) {
+                    throw MalformedRecord();
+                }
+                const Json::Value returning(pos, pos + len);
+                pos += len;
+                return returning;
+            }
+            case TAG_ID:
+                return getId(pos, end);
+            case TAG_ARRAY: {
+                const uint64_t count = getVarint(pos, end);
+                Json::Value returning(Json::arrayValue);
+                for(uint64_t i = 0; i < count; i++) {
+                    returning.append(decodeValue(pos, end, depth + 1));
+                }
+                return returning;
+            }
+            case TAG_OBJECT: {
+                const uint64_t count = getVarint(pos, end);
+                Json::Value returning(Json::objectValue);
+                for(uint64_t i = 0; i < count; i++) {
+                    const uint64_t keyLen = getVarint(pos, end);
+                    if(static_cast<uint64_t>(end - pos) < keyLen) {
+                        throw MalformedRecord();
+                    }
+                    const char* key = pos;
+                    pos += keyLen;
+                    returning[std::string(key, keyLen)] = decodeValue(pos, end, depth + 1);
+                }
+                return returning;
+            }
+            default:
+                throw MalformedRecord();
+        }
+    }
+}
+
+namespace {
+    // Compact table keys are the table id byte, the index byte and the key.
+    // A trailing run of 33 to 64 lowercase hex characters, which is how ids
+    // are written, is replaced by a zero byte, the run length and the run
+    // packed into 32 bytes. Everything before it is kept as is, so any
+    // prefix of that part still matches with a plain byte comparison.
+    const char packedKeyMarker = 0x00;
+
+    void appendKeyBody(std::string& out, const std::string& key) {
+        if(key.find(packedKeyMarker) != std::string::npos) {
+            throw std::runtime_error("Table keys must not contain null bytes");
+        }
+
+        size_t start = key.size();
+        while(start > 0 && hexValue(key[start - 1]) >= 0) {
+            start--;
+        }
+
+        const size_t run = key.size() - start;
+        if(run <= 32 || run > 64) {
+            out += key;
+            return;
+        }
+
+        out.append(key, 0, start);
+        out.push_back(packedKeyMarker);
+        out.push_back(static_cast<char>(run));
+        putId(out, key.data() + start, run);
+    }
+
+    // Decodes into an existing string so scans can reuse its buffer
+    void decodeKeyBody(std::string& key, const char* data, const size_t size) {
+        const char* marker = static_cast<const char*>(std::memchr(data, packedKeyMarker, size));
+        if(marker == nullptr) {
+            key.assign(data, size);
+            return;
+        }
+
+        const size_t start = marker - data;
+        const unsigned char run = marker[1];
+        if(size != start + 34 || run <= 32 || run > 64) {
+            throw std::runtime_error("Malformed table key");
+        }
+
+        char hex[64];
+        toHex(marker + 2, hex);
+
+        key.assign(data, start);
+        key.append(hex + 64 - run, run);
+    }
+}
+
+/**
+* Bounded LRU cache of decoded values shared between all transactions on a
+* database. Each commit bumps the generation and drops the keys it wrote, and
+* values are only inserted or served when the reader's generation matches, so
+* a reader can never see a value newer or older than its own view.
+*/
+class CryptoKernel::Storage::ValueCache {
+public:
+    ValueCache(const uint64_t capacity) {
+        this->capacity = capacity;
+        generation = 0;
+        bytes = 0;
+        hits = 0;
+        misses = 0;
+    }
+
+    bool get(const std::string& key, const uint64_t readerGeneration, Json::Value& value) {
+        std::lock_guard<std::mutex> lock(cacheLock);
+        if(readerGeneration == generation) {
+            const auto it = entries.find(key);
+            if(it != entries.end()) {
+                lru.splice(lru.begin(), lru, it->second.position);
+                value = it->second.value;
+                hits++;
+                return true;
+            }
+        }
+
+        misses++;
+        return false;
+    }
+
+    void put(const std::string& key, const Json::Value& value, const uint64_t size,
+             const uint64_t readerGeneration) {
+        // Charge a fixed overhead per entry for the map node, list node and
+        // Json::Value tree on top of the encoded size
+        const uint64_t entrySize = key.size() + size + 128;
+
+        std::lock_guard<std::mutex> lock(cacheLock);
+        if(readerGeneration != generation || entrySize > capacity
+           || entries.find(key) != entries.end()) {
+            return;
+        }
+
+        lru.push_front(key);
+        entries[key] = Entry{value, entrySize, lru.begin()};
+        bytes += entrySize;
+
+        while(bytes > capacity) {
+            const auto it = entries.find(lru.back());
+            bytes -= it->second.size;
+            entries.erase(it);
+            lru.pop_back();
+        }
+    }
+
+    void invalidate(const std::vector<std::string>& keys) {
+        std::lock_guard<std::mutex> lock(cacheLock);
+        generation++;
+        for(const auto& key : keys) {
+            const auto it = entries.find(key);
+            if(it != entries.end()) {
+                bytes -= it->second.size;
+                lru.erase(it->second.position);
+                entries.erase(it);
+            }
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(cacheLock);
+        generation++;
+        entries.clear();
+        lru.clear();
+        bytes = 0;
+    }
+
+    uint64_t getGeneration() {
+        std::lock_guard<std::mutex> lock(cacheLock);
+        return generation;
+    }
+
+    CacheStats getStats() {
+        std::lock_guard<std::mutex> lock(cacheLock);
+        return CacheStats{hits, misses, entries.size(), bytes, capacity};
+    }
+
+private:
+    struct Entry {
+        Json::Value value;
+        uint64_t size;
+        std::list<std::string>::iterator position;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;
+    std::mutex cacheLock;
+    uint64_t capacity;
+    uint64_t generation;
+    uint64_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+namespace {
+    const unsigned int histogramBuckets = 32;
+
+    /**
+    * Latency histogram with buckets doubling in width from one microsecond.
+    * Recording is lock-free so it can sit on every read path.
+    */
+    class Histogram {
+    public:
+        Histogram() {
+            for(auto& bucket : buckets) {
+                bucket = 0;
+            }
+            count = 0;
+            total = 0;
+            max = 0;
+        }
+
+        void record(const uint64_t micros) {
+            unsigned int bucket = 0;
+            while(bucket < histogramBuckets - 1 && (uint64_t(1) << bucket) <= micros) {
+                bucket++;
+            }
+
+            buckets[bucket]++;
+            count++;
+            total += micros;
+
+            uint64_t current = max;
+            while(micros > current && !max.compare_exchange_weak(current, micros)) {}
+        }
+
+        Json::Value toJson() const {
+            Json::Value returning;
+            const uint64_t samples = count;
+            returning["count"] = Json::UInt64(samples);
+            returning["mean"] = samples > 0 ? double(total) / samples : 0.0;
+            returning["max"] = Json::UInt64(max);
+
+            // Percentiles are reported as the upper edge of their bucket
+            const std::pair<const char*, double> percentiles[] = {{"p50", 0.5}, {"p90", 0.9},
+                                                                  {"p99", 0.99}};
+            for(const auto& percentile : percentiles) {
+                const uint64_t rank = uint64_t(samples * percentile.second);
+                uint64_t seen = 0;
+                unsigned int bucket = 0;
+                for(; bucket < histogramBuckets - 1; bucket++) {
+                    seen += buckets[bucket];
+                    if(seen > rank) {
+                        break;
+                    }
+                }
+                returning[percentile.first] = Json::UInt64(samples > 0 ? uint64_t(1) << bucket : 0);
+            }
+
+            return returning;
+        }
+
+    private:
+        std::atomic<uint64_t> buckets[histogramBuckets];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> total;
+        std::atomic<uint64_t> max;
+    };
+
+    uint64_t elapsedMicros(const std::chrono::steady_clock::time_point& start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Records the lifetime of the object, so every return path is timed
+    class ScopedLatency {
+    public:
+        ScopedLatency(Histogram& histogram) : histogram(histogram) {
+            start = std::chrono::steady_clock::now();
+        }
+
+        ~ScopedLatency() {
+            histogram.record(elapsedMicros(start));
+        }
+
+    private:
+        Histogram& histogram;
+        std::chrono::steady_clock::time_point start;
+    };
+}
+
+struct CryptoKernel::Storage::TableMetrics {
+    TableMetrics() : gets(0), puts(0), erases(0), bytesRead(0), bytesWritten(0), scans(0),
+        rowsScanned(0) {}
+
+    std::atomic<uint64_t> gets;
+    std::atomic<uint64_t> puts;
+    std::atomic<uint64_t> erases;
+    std::atomic<uint64_t> bytesRead;
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<uint64_t> scans;
+    std::atomic<uint64_t> rowsScanned;
+    Histogram getLatency;
+    Histogram scanLatency;
+
+    Json::Value toJson() const {
+        Json::Value returning;
+        returning["gets"] = Json::UInt64(gets);
+        returning["puts"] = Json::UInt64(puts);
+        returning["erases"] = Json::UInt64(erases);
+        returning["bytesRead"] = Json::UInt64(bytesRead);
+        returning["bytesWritten"] = Json::UInt64(bytesWritten);
+        returning["scans"] = Json::UInt64(scans);
+        returning["rowsScanned"] = Json::UInt64(rowsScanned);
+        returning["getLatency"] = getLatency.toJson();
+        returning["scanLatency"] = scanLatency.toJson();
+        return returning;
+    }
+};
+
+/**
+* Activity counters for a database. Tables are registered by name the first
+* time they are used; reads and writes made without a table are counted
+* under "other".
+*/
+class CryptoKernel::Storage::Metrics {
+public:
+    Metrics() : commits(0), conflicts(0) {
+        untabled = getTable("other");
+    }
+
+    TableMetrics* getTable(const std::string& name) {
+        std::lock_guard<std::mutex> lock(tablesLock);
+        std::unique_ptr<TableMetrics>& table = tables[name];
+        if(!table) {
+            table.reset(new TableMetrics());
+        }
+        return table.get();
+    }
+
+    Json::Value toJson() {
+        Json::Value returning;
+        returning["commits"] = Json::UInt64(commits);
+        returning["conflicts"] = Json::UInt64(conflicts);
+        returning["commitLatency"] = commitLatency.toJson();
+
+        std::lock_guard<std::mutex> lock(tablesLock);
+        for(const auto& table : tables) {
+            returning["tables"][table.first] = table.second->toJson();
+        }
+
+        return returning;
+    }
+
+    TableMetrics* untabled;
+    std::atomic<uint64_t> commits;
+    std::atomic<uint64_t> conflicts;
+    Histogram commitLatency;
+
+private:
+    std::mutex tablesLock;
+    std::map<std::string, std::unique_ptr<TableMetrics>> tables;
+};
+
+CryptoKernel::Storage::Storage(const std::string& filename, const bool sync, const unsigned int cache, const bool bloom,
+                               const bool binary, const unsigned int valueCache) :
+    Storage(filename, sync, basicProfile(cache, bloom), binary, valueCache) {
+}
+
+CryptoKernel::Storage::Storage(const std::string& filename, const bool sync,
+                               const LevelDBEngine::Options& profile, const bool binary,
+                               const unsigned int valueCache) {
+    if(filename.compare(0, memoryPrefix.size(), memoryPrefix) == 0) {
+        init(new MemoryEngine(filename.substr(memoryPrefix.size())), sync, binary, valueCache);
+    } else {
+        this->filename = filename;
+        init(new LevelDBEngine(filename, profile), sync, binary, valueCache);
+    }
+}
+
+CryptoKernel::Storage::Storage(StorageEngine* engine, const bool sync, const bool binary,
+                               const unsigned int valueCache) {
+    init(engine, sync, binary, valueCache);
+}
+
+void CryptoKernel::Storage::init(StorageEngine* engine, const bool sync, const bool binary,
+                                 const unsigned int valueCache) {
+    this->engine.reset(engine);
     this->sync = sync;
+    this->binary = binary;
+    commitSequence = 0;
+    openSnapshots = 0;
+    reopening = false;
+    groupLeader = false;
+    metrics.reset(new Metrics());
 
-    readLock.lock();
-    writeLock.lock();
-    leveldb::Status dbstatus = leveldb::DB::Open(options, filename, &db);
-    writeLock.unlock();
-    readLock.unlock();
+    if(binary) {
+        migrateToBinary();
+    }
+
+    if(valueCache > 0) {
+        this->valueCache.reset(new ValueCache(uint64_t(valueCache) * 1024 * 1024));
+    }
+
+    std::lock_guard<std::mutex> lock(readLock);
+    publishView();
+}
+
+struct CryptoKernel::Storage::ReadView {
+    ReadView(StorageEngine* engine, const uint64_t sequence, const uint64_t generation) :
+        engine(engine), snapshot(engine->getSnapshot()), sequence(sequence),
+        generation(generation) {}
+
+    ~ReadView() {
+        engine->releaseSnapshot(snapshot);
+    }
+
+    StorageEngine* engine;
+    const StorageEngine::Snapshot* snapshot;
+    uint64_t sequence;
+    uint64_t generation;
+};
+
+void CryptoKernel::Storage::publishView() {
+    // Called with readLock held after every write so the view always
+    // matches commitSequence
+    std::shared_ptr<const ReadView> view(new ReadView(engine.get(), commitSequence,
+                                                      valueCache ? valueCache->getGeneration() : 0));
+    std::atomic_store(&currentView, view);
+}
+
+std::shared_ptr<const CryptoKernel::Storage::ReadView> CryptoKernel::Storage::acquireView() {
+    // Counting the reader before checking for a reopen means that either
+    // reopen() sees the count, or we see the flag and wait for it to finish
+    openSnapshots++;
+    if(reopening) {
+        openSnapshots--;
+        std::lock_guard<std::mutex> lock(readLock);
+        openSnapshots++;
+        return std::atomic_load(&currentView);
+    }
+
+    return std::atomic_load(&currentView);
+}
+
+void CryptoKernel::Storage::releaseView(std::shared_ptr<const ReadView>& view) {
+    view.reset();
+    openSnapshots--;
+}
+
+void CryptoKernel::Storage::migrateToBinary() {
+    std::string encoding;
+    engine->get(encodingKey, &encoding);
+    if(encoding == binaryEncodingName) {
+        return;
+    }
+
+    // Rewrite every json text record in place. Reads detect the encoding
+    // of each record, so being interrupted part way through is harmless.
+    std::lock_guard<std::mutex> lock(readLock);
+
+    std::unique_ptr<StorageEngine::Iterator> it(engine->newIterator());
+    std::unique_ptr<StorageEngine::WriteBatch> batch(engine->newBatch());
+    unsigned int batchSize = 0;
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        const leveldb::Slice value = it->value();
+        if(value.size() == 0 || value[0] == binaryMarker) {
+            continue;
+        }
+
+        batch->put(it->key(), toBinary(toJson(value.ToString())));
+        batchSize++;
+
+        if(batchSize >= 10000) {
+            engine->write(batch.get(), sync);
+            batch->clear();
+            batchSize = 0;
+        }
+    }
+
+    batch->put(encodingKey, binaryEncodingName);
+    engine->write(batch.get(), sync);
+}
 
-    if(!dbstatus.ok()) {
-        throw std::runtime_error("Failed to open the database");
+void CryptoKernel::Storage::rekey(const std::string& name,
+                                  const std::function<std::string(const std::string&)>& func) {
+    const std::string markerKey = "_meta/" + name;
+
+    std::string done;
+    engine->get(markerKey, &done);
+    if(done == "done") {
+        return;
     }
+
+    std::unique_ptr<StorageEngine::WriteBatch> batch(engine->newBatch());
+    const auto writeBatch = [&]() {
+        engine->write(batch.get(), sync);
+        batch->clear();
+
+        if(valueCache) {
+            valueCache->clear();
+        }
+
+        std::lock_guard<std::mutex> lock(readLock);
+        publishView();
+    };
+
+    std::unique_ptr<Transaction> dbTx(beginReadOnly());
+    std::unique_ptr<StorageEngine::Iterator> it(engine->newIterator(dbTx->snapshot));
+    unsigned int batchSize = 0;
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        const std::string key = it->key().ToString();
+        if(key.compare(0, 6, "_meta/") == 0) {
+            continue;
+        }
+
+        const std::string newKey = func(key);
+        if(newKey == key) {
+            continue;
+        }
+
+        if(!newKey.empty()) {
+            batch->put(newKey, it->value());
+        }
+        batch->erase(key);
+        batchSize++;
+
+        if(batchSize >= 10000) {
+            writeBatch();
+            batchSize = 0;
+        }
+    }
+
+    batch->put(markerKey, "done");
+    writeBatch();
+}
+
+bool CryptoKernel::Storage::reopen(const LevelDBEngine::Options& profile) {
+    if(filename.empty()) {
+        return true;
+    }
+
+    // Readers that see the flag wait for this lock instead of taking the
+    // current view, so none can start on the old engine while it is replaced
+    std::lock_guard<std::mutex> lock(readLock);
+    reopening = true;
+    if(openSnapshots > 0) {
+        reopening = false;
+        return false;
+    }
+
+    std::atomic_store(&currentView, std::shared_ptr<const ReadView>());
+    engine.reset();
+    engine.reset(new LevelDBEngine(filename, profile));
+    publishView();
+    reopening = false;
+
+    return true;
+}
+
+CryptoKernel::LevelDBEngine::Options CryptoKernel::Storage::loadProfile(
+    const Json::Value& json, const LevelDBEngine::Options& defaults) {
+    LevelDBEngine::Options profile = defaults;
+    if(!json.isObject()) {
+        return profile;
+    }
+
+    profile.cache = json.get("cache", profile.cache).asUInt();
+    profile.bloomBits = json.get("bloomBits", profile.bloomBits).asUInt();
+    profile.writeBuffer = json.get("writeBuffer", profile.writeBuffer).asUInt();
+    profile.maxOpenFiles = json.get("maxOpenFiles", profile.maxOpenFiles).asUInt();
+    profile.blockSize = json.get("blockSize", profile.blockSize).asUInt();
+    profile.compression = json.get("compression", profile.compression).asBool();
+
+    return profile;
 }
 
 CryptoKernel::Storage::~Storage() {
     readLock.lock();
-    writeLock.lock();
-    delete db;
-    writeLock.unlock();
+    currentView.reset();
+    engine.reset();
     readLock.unlock();
 }
 
@@ -89,9 +869,109 @@ std::string CryptoKernel::Storage::toString(const Json::Value& json, const bool
     return buf.str() + "\n";
 }
 
+std::string CryptoKernel::Storage::toBinary(const Json::Value& json) {
+    std::string returning;
+    returning.reserve(128);
+    returning.push_back(binaryMarker);
+    returning.push_back(binaryVersion);
+    encodeValue(returning, json, false);
+    return returning;
+}
+
+Json::Value CryptoKernel::Storage::fromBinary(const std::string& data) {
+    return decode(data.data(), data.size());
+}
+
+Json::Value CryptoKernel::Storage::decode(const char* data, const size_t size) {
+    if(size == 0) {
+        return Json::Value();
+    }
+
+    if(data[0] != binaryMarker) {
+        return toJson(std::string(data, size));
+    }
+
+    if(size < 2 || data[1] != binaryVersion) {
+        return Json::Value();
+    }
+
+    const char* pos = data + 2;
+    const char* end = data + size;
+    try {
+        Json::Value returning = decodeValue(pos, end, 0);
+        if(pos != end) {
+            return Json::Value();
+        }
+        return returning;
+    } catch(const MalformedRecord& e) {
+        return Json::Value();
+    }
+}
+
+void CryptoKernel::Storage::appendVarint(std::string& out, const uint64_t value) {
+    putVarint(out, value);
+}
+
+uint64_t CryptoKernel::Storage::readVarint(const char*& pos, const char* end) {
+    try {
+        return getVarint(pos, end);
+    } catch(const MalformedRecord& e) {
+        throw std::runtime_error("Malformed varint");
+    }
+}
+
+void CryptoKernel::Storage::appendCanonical(std::string& out, const Json::Value& json) {
+    encodeValue(out, json, true);
+}
+
+Json::Value CryptoKernel::Storage::readCanonical(const char*& pos, const char* end) {
+    const char* start = pos;
+    Json::Value returning;
+    try {
+        returning = decodeValue(pos, end, 0);
+    } catch(const MalformedRecord& e) {
+        throw std::runtime_error("Malformed binary value");
+    }
+
+    // Cheaper than checking every rule while decoding, and values embedded
+    // in blocks are small
+    std::string encoded;
+    encoded.reserve(pos - start);
+    encodeValue(encoded, returning, true);
+    if(encoded.size() != static_cast<size_t>(pos - start)
+       || std::memcmp(encoded.data(), start, encoded.size()) != 0) {
+        throw std::runtime_error("Binary value is not in canonical form");
+    }
+
+    return returning;
+}
+
+std::string CryptoKernel::Storage::encode(const Json::Value& json) const {
+    if(binary) {
+        return toBinary(json);
+    } else {
+        return toString(json);
+    }
+}
+
+Json::Value CryptoKernel::Storage::getMetrics() {
+    return metrics->toJson();
+}
+
+CryptoKernel::Storage::CacheStats CryptoKernel::Storage::getCacheStats() {
+    if(valueCache) {
+        return valueCache->getStats();
+    } else {
+        return CacheStats{0, 0, 0, 0, 0};
+    }
+}
+
 bool CryptoKernel::Storage::destroy(const std::string& filename) {
-    leveldb::Options options;
-    leveldb::DestroyDB(filename, options);
+    if(filename.compare(0, memoryPrefix.size(), memoryPrefix) == 0) {
+        MemoryEngine::destroy(filename.substr(memoryPrefix.size()));
+    } else {
+        LevelDBEngine::destroy(filename);
+    }
 
     return true;
 }
@@ -111,33 +991,38 @@ CryptoKernel::Storage::Transaction* CryptoKernel::Storage::beginReadOnly() {
 
 CryptoKernel::Storage::Transaction::Transaction(CryptoKernel::Storage* db,
                                                 const bool readonly) {
-    if(!readonly) {
-        db->writeLock.lock();
-        finished = false;
-    } else {
-        std::lock_guard<std::mutex> lock(db->readLock);
-        snapshot = db->db->GetSnapshot();
-        finished = true;
-    }
-    this->db = db;
-    this->readonly = readonly;
+    init(db, readonly);
     mut = nullptr;
 }
 
 CryptoKernel::Storage::Transaction::Transaction(CryptoKernel::Storage* db,
                                                 std::recursive_mutex& mut,
                                                 const bool readonly) {
-    if(!readonly) {
-        db->writeLock.lock();
-        finished = false;
+    init(db, readonly);
+    this->mut = &mut;
+}
+
+void CryptoKernel::Storage::Transaction::init(CryptoKernel::Storage* db,
+                                              const bool readonly) {
+    this->db = db;
+    this->readonly = readonly;
+    finished = readonly;
+    generation = 0;
+
+    if(readonly) {
+        view = db->acquireView();
     } else {
+        // Writers register under the lock so a commit finishing meanwhile
+        // knows to record its keys for conflict checks
         std::lock_guard<std::mutex> lock(db->readLock);
-        snapshot = db->db->GetSnapshot();
-        finished = true;
+        db->openSnapshots++;
+        view = std::atomic_load(&db->currentView);
+        db->activeWriters.insert(view->sequence);
     }
-    this->db = db;
-    this->mut = &mut;
-    this->readonly = readonly;
+
+    snapshot = view->snapshot;
+    startSequence = view->sequence;
+    generation = view->generation;
 }
 
 CryptoKernel::Storage::Transaction::~Transaction() {
@@ -145,10 +1030,7 @@ CryptoKernel::Storage::Transaction::~Transaction() {
         abort();
     }
 
-    if(readonly) {
-        std::lock_guard<std::mutex> lock(db->readLock);
-        db->db->ReleaseSnapshot(snapshot);
-    }
+    db->releaseView(view);
 
     if(mut != nullptr) {
         mut->unlock();
@@ -159,141 +1041,468 @@ bool CryptoKernel::Storage::Transaction::ended() {
     return finished;
 }
 
+/**
+* A commit handed to the group leader. The leader fills in the outcome and
+* sets done before waking the committing thread.
+*/
+struct CryptoKernel::Storage::PendingCommit {
+    std::unique_ptr<StorageEngine::WriteBatch> batch;
+    std::vector<std::string> keys;
+    const std::set<std::string>* readSet;
+    uint64_t startSequence;
+
+    bool done;
+    std::string conflict;
+    std::string error;
+};
+
 void CryptoKernel::Storage::Transaction::commit() {
     if(!finished) {
-        leveldb::WriteBatch batch;
+        ScopedLatency latency(db->metrics->commitLatency);
+
+        // Encode outside the lock so concurrent writers only serialize on
+        // validation and the write itself
+        PendingCommit pending;
+        pending.batch.reset(db->engine->newBatch());
+        pending.keys.reserve(dbStateCache.size());
         for(auto& update : dbStateCache) {
+            pending.keys.push_back(update.first);
             if(update.second.erased) {
-                batch.Delete(update.first);
+                pending.batch->erase(update.first);
             } else {
-                batch.Put(update.first, CryptoKernel::Storage::toString(update.second.data));
+                const std::string encoded = db->encode(update.second.data);
+                update.second.size = encoded.size();
+                pending.batch->put(update.first, encoded);
             }
         }
+        pending.readSet = &readSet;
+        pending.startSequence = startSequence;
+        pending.done = false;
 
-        leveldb::WriteOptions options;
-        options.sync = db->sync;
+        {
+            std::unique_lock<std::mutex> lock(db->groupLock);
+            db->pendingCommits.push_back(&pending);
 
-        std::lock_guard<std::mutex> lock(db->readLock);
-        leveldb::Status status = db->db->Write(options, &batch);
+            // Whoever finds no leader writes everything queued so far, then
+            // hands over to one of the commits that queued up meanwhile
+            while(!pending.done) {
+                if(!db->groupLeader) {
+                    db->groupLeader = true;
+                    std::vector<PendingCommit*> group(db->pendingCommits.begin(),
+                                                      db->pendingCommits.end());
+                    db->pendingCommits.clear();
+
+                    lock.unlock();
+                    db->writeGroup(group);
+                    lock.lock();
 
-        if(!status.ok()) {
-            throw std::runtime_error("Could not commit transaction " + status.ToString());
+                    for(PendingCommit* commit : group) {
+                        commit->done = true;
+                    }
+                    db->groupLeader = false;
+                    db->groupCondition.notify_all();
+                } else {
+                    db->groupCondition.wait(lock);
+                }
+            }
         }
 
         abort();
+
+        if(!pending.error.empty()) {
+            throw std::runtime_error(pending.error);
+        }
+
+        if(!pending.conflict.empty()) {
+            db->metrics->conflicts++;
+            throw ConflictException(pending.conflict);
+        }
+
+        db->metrics->commits++;
+        for(const auto& update : dbStateCache) {
+            if(update.second.erased) {
+                update.second.metrics->erases++;
+            } else {
+                update.second.metrics->puts++;
+                update.second.metrics->bytesWritten += update.second.size;
+            }
+        }
     } else {
         throw std::runtime_error("Attempted to commit finished transaction");
     }
 }
 
+void CryptoKernel::Storage::writeGroup(const std::vector<PendingCommit*>& group) {
+    std::unique_lock<std::mutex> lock(readLock);
+
+    // Commits are validated in queue order, so a commit also conflicts with
+    // the writes of those ahead of it in the same group
+    std::vector<PendingCommit*> accepted;
+    std::unordered_set<std::string> groupWrites;
+    for(PendingCommit* commit : group) {
+        for(const auto& key : *commit->readSet) {
+            const auto it = lastWritten.find(key);
+            if((it != lastWritten.end() && it->second > commit->startSequence)
+               || groupWrites.count(key) > 0) {
+                commit->conflict = key;
+                break;
+            }
+        }
+
+        if(commit->conflict.empty()) {
+            accepted.push_back(commit);
+            if(group.size() > 1) {
+                groupWrites.insert(commit->keys.begin(), commit->keys.end());
+            }
+        }
+    }
+
+    if(accepted.empty()) {
+        return;
+    }
+
+    // Only one group is written at a time, so nothing can change what was
+    // validated above while the write runs without the lock
+    lock.unlock();
+
+    try {
+        if(accepted.size() == 1) {
+            engine->write(accepted[0]->batch.get(), sync);
+        } else {
+            std::unique_ptr<StorageEngine::WriteBatch> batch(engine->newBatch());
+            for(PendingCommit* commit : accepted) {
+                batch->append(*commit->batch);
+            }
+            engine->write(batch.get(), sync);
+        }
+    } catch(const std::runtime_error& e) {
+        for(PendingCommit* commit : accepted) {
+            commit->error = e.what();
+        }
+        return;
+    }
+
+    lock.lock();
+    for(PendingCommit* commit : accepted) {
+        commitSequence++;
+
+        if(valueCache) {
+            valueCache->invalidate(commit->keys);
+        }
+
+        // Only writers that are still running can conflict with this
+        // commit, so there is nothing to record when we are the only one
+        if(activeWriters.size() > 1) {
+            for(const auto& key : commit->keys) {
+                lastWritten[key] = commitSequence;
+            }
+            commitLog[commitSequence] = std::move(commit->keys);
+        }
+    }
+
+    publishView();
+}
+
 void CryptoKernel::Storage::Transaction::abort() {
+    if(!finished && !readonly) {
+        db->finishWriter(startSequence);
+    }
     finished = true;
-    if(!readonly) {
-        db->writeLock.unlock();
+}
+
+void CryptoKernel::Storage::finishWriter(const uint64_t startSequence) {
+    std::lock_guard<std::mutex> lock(readLock);
+    activeWriters.erase(activeWriters.find(startSequence));
+
+    // Commits at or before the start of the oldest running writer can no
+    // longer conflict with anything
+    const uint64_t oldest = activeWriters.empty() ? commitSequence : *activeWriters.begin();
+    auto it = commitLog.begin();
+    while(it != commitLog.end() && it->first <= oldest) {
+        for(const auto& key : it->second) {
+            const auto written = lastWritten.find(key);
+            if(written != lastWritten.end() && written->second == it->first) {
+                lastWritten.erase(written);
+            }
+        }
+        it = commitLog.erase(it);
     }
 }
 
 void CryptoKernel::Storage::Transaction::put(const std::string& key,
         const Json::Value& data) {
-    dbStateCache[key] = dbObject{data, false};
+    put(key, data, db->metrics->untabled);
+}
+
+void CryptoKernel::Storage::Transaction::put(const std::string& key,
+        const Json::Value& data, TableMetrics* metrics) {
+    std::lock_guard<std::mutex> lock(stateLock);
+    dbStateCache[key] = dbObject{data, false, metrics, 0};
 }
 
 void CryptoKernel::Storage::Transaction::erase(const std::string& key) {
-    dbStateCache[key] = dbObject{Json::Value(), true};
+    erase(key, db->metrics->untabled);
+}
+
+void CryptoKernel::Storage::Transaction::erase(const std::string& key,
+        TableMetrics* metrics) {
+    std::lock_guard<std::mutex> lock(stateLock);
+    dbStateCache[key] = dbObject{Json::Value(), true, metrics, 0};
 }
 
 Json::Value CryptoKernel::Storage::Transaction::get(const std::string& key) {
-    const auto it = dbStateCache.find(key);
-    if(it != dbStateCache.end()) {
-        return it->second.data;
-    } else {
-        std::string data;
-        
-        leveldb::ReadOptions options;
-        if(readonly) {
-            options.snapshot = snapshot;
+    return get(key, db->metrics->untabled);
+}
+
+Json::Value CryptoKernel::Storage::Transaction::get(const std::string& key,
+        TableMetrics* metrics) {
+    ScopedLatency latency(metrics->getLatency);
+    metrics->gets++;
+
+    {
+        std::lock_guard<std::mutex> lock(stateLock);
+        const auto it = dbStateCache.find(key);
+        if(it != dbStateCache.end()) {
+            return it->second.data;
         }
 
-        db->db->Get(options, key, &data);
-        return CryptoKernel::Storage::toJson(data);
+        if(!readonly) {
+            readSet.insert(key);
+        }
+    }
+
+    Json::Value value;
+    if(db->valueCache && db->valueCache->get(key, generation, value)) {
+        return value;
+    }
+
+    std::string data;
+    db->engine->get(key, &data, snapshot);
+    metrics->bytesRead += data.size();
+    value = CryptoKernel::Storage::decode(data.data(), data.size());
+
+    if(db->valueCache) {
+        db->valueCache->put(key, value, data.size(), generation);
     }
+
+    return value;
 }
 
-CryptoKernel::Storage::Table::Table(const std::string& name) {
+CryptoKernel::Storage::Table::Table(const std::string& name, const unsigned char id) {
     tableName = name;
+    this->id = id;
+}
+
+bool CryptoKernel::Storage::Table::isCompact() const {
+    return id != 0;
+}
+
+std::string CryptoKernel::Storage::Table::getName() const {
+    return tableName;
 }
 
 std::string CryptoKernel::Storage::Table::getKey(const std::string& key,
         const int index) {
+    if(isCompact()) {
+        std::string rawKey = getPrefix("", index);
+        rawKey.reserve(2 + 34 + key.size());
+        appendKeyBody(rawKey, key);
+        return rawKey;
+    }
+
     return tableName + "/" + std::to_string(index + 1) + "/" + key;
 }
 
+std::string CryptoKernel::Storage::Table::getPrefix(const std::string& keyPrefix,
+        const int index) {
+    if(isCompact()) {
+        if(index < -1 || index > 254) {
+            throw std::runtime_error("Table index out of range");
+        }
+
+        std::string rawPrefix;
+        rawPrefix.reserve(2 + keyPrefix.size());
+        rawPrefix.push_back(static_cast<char>(id));
+        rawPrefix.push_back(static_cast<char>(index + 1));
+        rawPrefix += keyPrefix;
+        return rawPrefix;
+    }
+
+    return getKey(keyPrefix, index);
+}
+
+std::string CryptoKernel::Storage::Table::fromKey(const leveldb::Slice& rawKey) {
+    if(isCompact()) {
+        if(rawKey.size() < 2) {
+            throw std::runtime_error("Malformed table key");
+        }
+        std::string key;
+        decodeKeyBody(key, rawKey.data() + 2, rawKey.size() - 2);
+        return key;
+    }
+
+    const std::string key = rawKey.ToString();
+    return key.substr(key.find('/', tableName.size() + 1) + 1);
+}
+
 void CryptoKernel::Storage::Table::put(Transaction* transaction, const std::string& key,
                                        const Json::Value& data, const int index) {
-    transaction->put(getKey(key, index), data);
+    transaction->put(getKey(key, index), data, transaction->db->metrics->getTable(tableName));
 }
 
 void CryptoKernel::Storage::Table::erase(Transaction* transaction, const std::string& key,
         const int index) {
-    transaction->erase(getKey(key, index));
+    transaction->erase(getKey(key, index), transaction->db->metrics->getTable(tableName));
 }
 
 Json::Value CryptoKernel::Storage::Table::get(Transaction* transaction,
         const std::string& key, const int index) {
-    return transaction->get(getKey(key, index));
+    return transaction->get(getKey(key, index), transaction->db->metrics->getTable(tableName));
 }
 
 CryptoKernel::Storage::Table::Iterator::Iterator(Table* table, Storage* db, const 
-leveldb::Snapshot* snapshot, const std::string& prefix, const int index) {
+StorageEngine::Snapshot* snapshot, const std::string& prefix, const int index) {
     this->table = table;
     this->db = db;
-    
-    leveldb::ReadOptions options;
+
+    if(snapshot == nullptr) {
+        view = db->acquireView();
+        snapshot = view->snapshot;
+    }
 
     this->snapshot = snapshot;
 
-    if(snapshot != nullptr) {
-        options.snapshot = snapshot;
-    } else {
-         db->writeLock.lock();
-    }
+    it.reset(db->engine->newIterator(snapshot));
 
-    it = db->db->NewIterator(options);
+    metrics = db->metrics->getTable(table->getName());
+    metrics->scans++;
+    started = std::chrono::steady_clock::now();
 
-    this->prefix = table->getKey("", index);
+    this->prefix = table->getPrefix(prefix, index);
+    this->keyPrefix = prefix;
+    this->index = index;
 
-    if(prefix != "") {
-        this->prefix += prefix;
-    }
+    moved();
 }
 
 CryptoKernel::Storage::Table::Iterator::~Iterator() {
-    delete it;
-    if(snapshot == nullptr) {
-        db->writeLock.unlock();
+    metrics->scanLatency.record(elapsedMicros(started));
+
+    it.reset();
+    if(view) {
+        db->releaseView(view);
     }
 }
 
+void CryptoKernel::Storage::Table::Iterator::moved() {
+    keyDecoded = false;
+    valueDecoded = false;
+    counted = false;
+}
+
 void CryptoKernel::Storage::Table::Iterator::SeekToFirst() {
     it->Seek(prefix);
+    moved();
 }
 
-bool CryptoKernel::Storage::Table::Iterator::Valid() {
-    if(it->Valid()) {
-        return it->key().ToString().compare(0, prefix.size(), prefix) == 0;
+void CryptoKernel::Storage::Table::Iterator::SeekToLast() {
+    // Find the first key past the range, then step back from it
+    std::string end = upperBound;
+    if(end.empty()) {
+        end = prefix;
+        while(!end.empty() && static_cast<unsigned char>(end.back()) == 0xff) {
+            end.pop_back();
+        }
+        if(!end.empty()) {
+            end.back()++;
+        }
+    }
+
+    if(end.empty()) {
+        it->SeekToLast();
     } else {
+        it->Seek(end);
+        if(it->Valid()) {
+            it->Prev();
+        } else {
+            it->SeekToLast();
+        }
+    }
+
+    moved();
+}
+
+void CryptoKernel::Storage::Table::Iterator::Seek(const std::string& key) {
+    it->Seek(table->getKey(keyPrefix + key, index));
+    moved();
+}
+
+bool CryptoKernel::Storage::Table::Iterator::Valid() {
+    if(!it->Valid()) {
         return false;
     }
+
+    const leveldb::Slice current = it->key();
+    if(!current.starts_with(prefix) ||
+       (!upperBound.empty() && current.compare(upperBound) >= 0)) {
+        return false;
+    }
+
+    if(!counted) {
+        metrics->rowsScanned++;
+        metrics->bytesRead += it->value().size();
+        counted = true;
+    }
+
+    return true;
 }
 
 void CryptoKernel::Storage::Table::Iterator::Next() {
     it->Next();
+    moved();
+}
+
+void CryptoKernel::Storage::Table::Iterator::Prev() {
+    it->Prev();
+    moved();
+}
+
+void CryptoKernel::Storage::Table::Iterator::setUpperBound(const std::string& key) {
+    upperBound = table->getKey(keyPrefix + key, index);
 }
 
 std::string CryptoKernel::Storage::Table::Iterator::key() {
-    return it->key().ToString().substr(prefix.size());
+    return keySlice().ToString();
+}
+
+leveldb::Slice CryptoKernel::Storage::Table::Iterator::keySlice() {
+    if(table->isCompact()) {
+        if(!keyDecoded) {
+            const leveldb::Slice rawKey = it->key();
+            if(rawKey.size() < 2) {
+                throw std::runtime_error("Malformed table key");
+            }
+            decodeKeyBody(keyBuffer, rawKey.data() + 2, rawKey.size() - 2);
+            keyDecoded = true;
+        }
+        return leveldb::Slice(keyBuffer.data() + keyPrefix.size(),
+                              keyBuffer.size() - keyPrefix.size());
+    }
+
+    leveldb::Slice rawKey = it->key();
+    rawKey.remove_prefix(prefix.size());
+    return rawKey;
 }
 
-Json::Value CryptoKernel::Storage::Table::Iterator::value() {
-    return CryptoKernel::Storage::toJson(it->value().ToString());
+leveldb::Slice CryptoKernel::Storage::Table::Iterator::rawValue() {
+    return it->value();
+}
+
+const Json::Value& CryptoKernel::Storage::Table::Iterator::value() {
+    if(!valueDecoded) {
+        const leveldb::Slice value = it->value();
+        current = CryptoKernel::Storage::decode(value.data(), value.size());
+        valueDecoded = true;
+    }
+    return current;
 }
@@ -19,17 +19,27 @@
 #define STORAGE_H_INCLUDED
 
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <map>
+#include <set>
+#include <vector>
+#include <stdexcept>
+#include <functional>
+#include <chrono>
+#include <atomic>
 
 #include <json/writer.h>
 #include <json/reader.h>
-#include <leveldb/db.h>
+
+#include "storageengine.h"
 
 namespace CryptoKernel {
 /**
 * The storage class provide a key-value json storage database
-* interface. This particular implementation uses LevelDB as the
-* underlying storage. It provides functions for saving, retrieving,
+* interface. By default it uses LevelDB as the underlying storage, but any
+* StorageEngine can be used. It provides functions for saving, retrieving,
 * deleting and iterating over the database.
 */
 class Storage {
@@ -39,19 +49,84 @@ public:
     * is found in the given directory then it is created. Otherwise open
     * the existing database.
     *
-    * @param filename the directory of the LevelDB database to use
+    * @param filename the directory of the LevelDB database to use. Names starting with
+             "memory:" open an in-memory store instead, which lasts until destroyed
+             or the process exits.
     * @param sync set to true if fsync should take place after every write
     * @param cache 0 turns off the cache, any number higher than zero uses a cache with that size in MB
     * @param bloom set to true to use a bloom filter for lookups
+    * @param binary set to true to store values in the compact binary encoding
+             rather than as json text. Existing json records are migrated the
+             first time the database is opened this way.
+    * @param valueCache 0 turns off the decoded value cache, any number higher than
+             zero caches decoded values shared between transactions up to that size in MB
+    * @throw std::runtime_error if there is a failure
+    */
+    Storage(const std::string& filename, const bool sync, const unsigned int cache, const bool bloom,
+            const bool binary = false, const unsigned int valueCache = 0);
+
+    /**
+    * Constructs a storage database in the given directory using the given
+    * LevelDB tuning profile
+    *
+    * @param filename the directory of the LevelDB database to use, or a "memory:" name
+    * @param sync set to true if fsync should take place after every write
+    * @param profile the LevelDB options to open the database with
+    * @param binary set to true to store values in the compact binary encoding
+    * @param valueCache the size of the decoded value cache in MB, 0 turns it off
+    * @throw std::runtime_error if there is a failure
+    */
+    Storage(const std::string& filename, const bool sync, const LevelDBEngine::Options& profile,
+            const bool binary = false, const unsigned int valueCache = 0);
+
+    /**
+    * Constructs a storage database on top of the given engine
+    *
+    * @param engine the engine to use, Storage takes ownership of it
+    * @param sync set to true if fsync should take place after every write
+    * @param binary set to true to store values in the compact binary encoding
+    * @param valueCache the size of the decoded value cache in MB, 0 turns it off
     * @throw std::runtime_error if there is a failure
     */
-    Storage(const std::string& filename, const bool sync, const unsigned int cache, const bool bloom);
+    Storage(StorageEngine* engine, const bool sync, const bool binary = false,
+            const unsigned int valueCache = 0);
 
     /**
     * Default destructor, saves and closes the database
     */
     ~Storage();
 
+    /**
+    * Thrown by Transaction::commit when another transaction committed a
+    * change to a key this transaction read after it began. Nothing is
+    * written and the caller may retry from a fresh transaction.
+    */
+    class ConflictException : public std::runtime_error {
+    public:
+        ConflictException(const std::string& key) :
+            std::runtime_error("Transaction conflicted on key " + key) {}
+    };
+
+private:
+    // Activity counters of one table, defined with Metrics
+    struct TableMetrics;
+
+    // A snapshot of the database after a given commit, shared by every
+    // transaction that begins before the next one
+    struct ReadView;
+
+public:
+    class Table;
+
+    /**
+    * A set of reads and writes against the database. Every transaction
+    * reads from a snapshot of the last commit made before it began.
+    * Transactions that begin between the same two commits share one
+    * snapshot, so beginning one does not wait for a commit in progress.
+    * Writable transactions stage their changes in memory and may run
+    * concurrently with each other; only the final write at commit is
+    * serialized.
+    */
     class Transaction {
     public:
         Transaction(Storage* db, const bool readonly = false);
@@ -59,27 +134,65 @@ public:
 
         ~Transaction();
 
+        /**
+        * Writes the staged changes to the database atomically. Commits
+        * that arrive while another is being written are combined into a
+        * single write, with a single fsync if the database is synced. This
+        * returns once the changes of this transaction are written.
+        *
+        * @throw ConflictException if a key read by this transaction was
+        *        changed by another commit since this transaction began
+        * @throw std::runtime_error if the write fails
+        */
         void commit();
         void abort();
 
         void put(const std::string& key, const Json::Value& data);
         void erase(const std::string& key);
+
+        /**
+        * Reads a key, seeing the changes staged by this transaction. Reads
+        * may be made from several threads at once, such as when verifying
+        * the transactions of a block in parallel, but not while the
+        * transaction commits.
+        *
+        * @param key the key to read
+        * @return the value of the key, or null if it does not exist
+        */
         Json::Value get(const std::string& key);
 
         bool ended();
 
-        const leveldb::Snapshot* snapshot;
+        const StorageEngine::Snapshot* snapshot;
 
     private:
+        friend class Table;
+
+        void init(Storage* db, const bool readonly);
+
+        void put(const std::string& key, const Json::Value& data, TableMetrics* metrics);
+        void erase(const std::string& key, TableMetrics* metrics);
+        Json::Value get(const std::string& key, TableMetrics* metrics);
+
         struct dbObject {
             Json::Value data;
             bool erased;
+            TableMetrics* metrics;
+            size_t size;
         };
         std::map<std::string, dbObject> dbStateCache;
+        std::set<std::string> readSet;
+
+        // Guards the staged changes and read set against concurrent reads
+        std::mutex stateLock;
+
         Storage* db;
         bool finished;
         bool readonly;
         std::recursive_mutex* mut;
+        std::shared_ptr<const ReadView> view;
+        uint64_t generation;
+        uint64_t startSequence;
     };
 
     Transaction* begin();
@@ -90,16 +203,31 @@ public:
 
     class Table {
     public:
-        Table(const std::string& name);
+        /**
+        * Constructs a table with the given name
+        *
+        * @param name the name of the table
+        * @param id a unique non-zero byte identifying the table in the compact key
+                 schema, or 0 to use the text key schema. Compact keys are the table
+                 id, the index and the key with any trailing hex id packed into
+                 32 raw bytes.
+        */
+        Table(const std::string& name, const unsigned char id = 0);
 
         void put(Transaction* transaction, const std::string& key, const Json::Value& data,
                  const int index = -1);
         void erase(Transaction* transaction, const std::string& key, const int index = -1);
         Json::Value get(Transaction* transaction, const std::string& key, const int index = -1);
 
+        /**
+        * Iterates over the keys of a table. The iterator always reads from
+        * a snapshot, either the one given or that of the last commit made
+        * before construction, so it never blocks or is blocked by writers. Stepping does not
+        * copy keys or values; values are only decoded when asked for.
+        */
         class Iterator {
         public:
-            Iterator(Table* table, Storage* db, const leveldb::Snapshot* snapshot = nullptr,
+            Iterator(Table* table, Storage* db, const StorageEngine::Snapshot* snapshot = nullptr,
                      const std::string& prefix = "", const int index = -1);
 
             ~Iterator();
@@ -109,6 +237,21 @@ public:
             */
             void SeekToFirst();
 
+            /**
+            * Sets the iterator to the last key in the database, or the last
+            * key before the upper bound if one is set
+            */
+            void SeekToLast();
+
+            /**
+            * Sets the iterator to the given key, or the key after it in
+            * storage order if it does not exist. The key is relative to
+            * the iterator prefix.
+            *
+            * @param key the key to seek to
+            */
+            void Seek(const std::string& key);
+
             /**
             * Determines whether there are additional keys still in the database
             *
@@ -121,6 +264,19 @@ public:
             */
             void Next();
 
+            /**
+            * Shifts the iterator to the previous key in the database
+            */
+            void Prev();
+
+            /**
+            * Limits the iterator to keys before the given key. The key is
+            * relative to the iterator prefix.
+            *
+            * @param key the first key to exclude
+            */
+            void setUpperBound(const std::string& key);
+
             /**
             * Returns the current key the iterator points to
             *
@@ -129,29 +285,123 @@ public:
             std::string key();
 
             /**
-            * Returns the current json value the iterator points to
+            * Returns the current key the iterator points to without
+            * copying it. The slice is valid until the iterator is moved.
+            *
+            * @return the key the iterator points to
+            */
+            leveldb::Slice keySlice();
+
+            /**
+            * Returns the stored bytes of the current value without
+            * decoding them. The slice is valid until the iterator is moved.
+            *
+            * @return the encoded value the iterator points to
+            */
+            leveldb::Slice rawValue();
+
+            /**
+            * Returns the current json value the iterator points to. The
+            * value is decoded on first use and the reference is valid until
+            * the iterator is moved.
             *
             * @return the json value the iterator points to
             */
-            Json::Value value();
+            const Json::Value& value();
         private:
-            leveldb::Iterator* it;
+            void moved();
+
+            std::unique_ptr<StorageEngine::Iterator> it;
             Table* table;
             Storage* db;
             std::string prefix;
-            const leveldb::Snapshot* snapshot;
+            std::string keyPrefix;
+            int index;
+            const StorageEngine::Snapshot* snapshot;
+            std::shared_ptr<const ReadView> view;
+            TableMetrics* metrics;
+            std::chrono::steady_clock::time_point started;
+            bool counted;
+            std::string upperBound;
+            std::string keyBuffer;
+            bool keyDecoded;
+            Json::Value current;
+            bool valueDecoded;
         };
 
         std::string getKey(const std::string& key, const int index = -1);
+
+        /**
+        * Returns the prefix shared by every key in the given index that starts
+        * with the given key prefix. In the compact schema the key prefix must
+        * not reach into a trailing packed id.
+        *
+        * @param keyPrefix the start of the keys to match
+        * @param index the index to match, -1 for the table itself
+        * @return the raw database key prefix
+        */
+        std::string getPrefix(const std::string& keyPrefix, const int index = -1);
+
+        /**
+        * Converts a raw database key belonging to this table back to the key
+        * it was stored under
+        *
+        * @param rawKey the database key
+        * @return the key without the table and index prefix
+        */
+        std::string fromKey(const leveldb::Slice& rawKey);
+
+        bool isCompact() const;
+
+        std::string getName() const;
     private:
         std::string tableName;
+        unsigned char id;
     };
 
+    /**
+    * Rewrites the key of every record in the database using the given
+    * function, in batches. Records whose new key is empty are dropped.
+    * Completion is recorded under the given name so the rewrite only ever
+    * runs once. It must complete before the database is used by other
+    * threads and is safe to resume if interrupted.
+    *
+    * @param name a unique name for this migration
+    * @param func returns the new key for a given key
+    * @throw std::runtime_error if a write fails
+    */
+    void rekey(const std::string& name,
+               const std::function<std::string(const std::string&)>& func);
+
+
+    /**
+    * Closes the LevelDB database and opens it again with a different tuning
+    * profile. This only happens when no transaction or iterator is open on
+    * the database, otherwise nothing is changed. Databases that are not
+    * LevelDB directories ignore the profile.
+    *
+    * @param profile the LevelDB options to reopen the database with
+    * @return true if the database now uses the given profile, false if it was busy
+    * @throw std::runtime_error if the database cannot be reopened
+    */
+    bool reopen(const LevelDBEngine::Options& profile);
+
+    /**
+    * Reads a LevelDB tuning profile from a json object. Any of the keys
+    * "cache", "bloomBits", "writeBuffer", "maxOpenFiles", "blockSize" and
+    * "compression" may be given, the rest are taken from the defaults.
+    *
+    * @param json the json profile, may be null
+    * @param defaults the options to use for keys that are not set
+    * @return the resulting options
+    */
+    static LevelDBEngine::Options loadProfile(const Json::Value& json,
+                                              const LevelDBEngine::Options& defaults);
 
     /**
     * Deletes the LevelDB database in the given directory
     *
-    * @param filename the directory of the database to delete
+    * @param filename the directory of the database to delete, or a "memory:" name
     * @return true if the database was deleted successfully, false otherwise
     */
     static bool destroy(const std::string& filename);
@@ -174,11 +424,156 @@ public:
     */
     static std::string toString(const Json::Value& json, const bool pretty = false);
 
+    /**
+    * Converts a Json::Value to the versioned binary record encoding. Hex
+    * strings that look like 256-bit ids are packed into 32 raw bytes.
+    *
+    * @param json a Json::Value to encode
+    * @return the binary representation of the given json value
+    */
+    static std::string toBinary(const Json::Value& json);
+
+    /**
+    * Converts a binary record produced by toBinary back to a Json::Value
+    *
+    * @param data the binary record to decode
+    * @return the decoded Json::Value, or a null value if the record is malformed
+    */
+    static Json::Value fromBinary(const std::string& data);
+
+    /**
+    * Appends an unsigned integer in the variable length form used by the
+    * binary encoding
+    *
+    * @param out the string to append to
+    * @param value the integer to append
+    */
+    static void appendVarint(std::string& out, const uint64_t value);
+
+    /**
+    * Reads an integer written by appendVarint
+    *
+    * @param pos the position to read from, moved past the integer
+    * @param end the end of the data
+    * @return the integer read
+    * @throws std::runtime_error if the integer is truncated or not in its
+              shortest form
+    */
+    static uint64_t readVarint(const char*& pos, const char* end);
+
+    /**
+    * Appends the canonical binary encoding of a value, without the record
+    * header, for embedding in larger binary structures. A value always has
+    * the same encoding, and integers are written the same way whether held
+    * as signed or unsigned, as their json text is too.
+    *
+    * @param out the string to append to
+    * @param json the value to encode
+    */
+    static void appendCanonical(std::string& out, const Json::Value& json);
+
+    /**
+    * Reads a value written by appendCanonical
+    *
+    * @param pos the position to read from, moved past the value
+    * @param end the end of the data
+    * @return the decoded value
+    * @throws std::runtime_error if the encoding is malformed or is not the
+              canonical encoding of the value
+    */
+    static Json::Value readCanonical(const char*& pos, const char* end);
+
+    /**
+    * Decodes a stored record, detecting whether it is in the binary
+    * encoding or legacy json text
+    *
+    * @param data pointer to the start of the record
+    * @param size the length of the record in bytes
+    * @return the decoded Json::Value, or a null value if the record is malformed
+    */
+    static Json::Value decode(const char* data, const size_t size);
+
+    /**
+    * Usage counters for the decoded value cache
+    */
+    struct CacheStats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t entries;
+        uint64_t bytes;
+        uint64_t capacity;
+    };
+
+    /**
+    * Returns the current usage counters of the decoded value cache. All
+    * counters are zero if the cache is turned off.
+    *
+    * @return a CacheStats struct describing the cache
+    */
+    CacheStats getCacheStats();
+
+    /**
+    * Returns the operation counters and latency histograms of the database.
+    * Counters are kept per table: gets, puts, erases, bytes read and
+    * written, scans and rows scanned, along with get and scan latencies.
+    * Commit latency is kept for the database as a whole. Latencies are
+    * given in microseconds.
+    *
+    * @return a json object describing the database activity since it was opened
+    */
+    Json::Value getMetrics();
+
 private:
-    leveldb::DB* db;
+    std::string encode(const Json::Value& json) const;
+
+    void migrateToBinary();
+
+    class ValueCache;
+    std::unique_ptr<ValueCache> valueCache;
+
+    class Metrics;
+    std::unique_ptr<Metrics> metrics;
+
+    void init(StorageEngine* engine, const bool sync, const bool binary,
+              const unsigned int valueCache);
+
+    void finishWriter(const uint64_t startSequence);
+
+    struct PendingCommit;
+    void writeGroup(const std::vector<PendingCommit*>& group);
+
+    // Commits waiting to be written by the current group leader
+    std::mutex groupLock;
+    std::condition_variable groupCondition;
+    std::deque<PendingCommit*> pendingCommits;
+    bool groupLeader;
+
+    std::unique_ptr<StorageEngine> engine;
+
+    // Empty unless the engine is a LevelDB database opened by this class
+    std::string filename;
+
+    // Guards the commit sequence and conflict tracking below. Writable
+    // transactions take it to register themselves; read-only ones only
+    // wait on it while the engine is being reopened.
     std::mutex readLock;
-    std::mutex writeLock;
+
+    // The view new transactions read from. Only replaced under readLock,
+    // but loaded without it through std::atomic_load.
+    std::shared_ptr<const ReadView> currentView;
+    void publishView();
+    std::shared_ptr<const ReadView> acquireView();
+    void releaseView(std::shared_ptr<const ReadView>& view);
+
+    uint64_t commitSequence;
+    std::atomic<unsigned int> openSnapshots;
+    std::atomic<bool> reopening;
+    std::multiset<uint64_t> activeWriters;
+    std::map<std::string, uint64_t> lastWritten;
+    std::map<uint64_t, std::vector<std::string>> commitLog;
+
     bool sync;
+    bool binary;
 };
 }
 
@@ -0,0 +1,498 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <stdexcept>
+
+#include <leveldb/db.h>
+#include <leveldb/write_batch.h>
+#include <leveldb/cache.h>
+#include <leveldb/filter_policy.h>
+
+#include "storageengine.h"
+
+namespace {
+    class LevelDBSnapshot : public CryptoKernel::StorageEngine::Snapshot {
+    public:
+        LevelDBSnapshot(const leveldb::Snapshot* snapshot) {
+            this->snapshot = snapshot;
+        }
+
+        const leveldb::Snapshot* snapshot;
+    };
+
+    class LevelDBBatch : public CryptoKernel::StorageEngine::WriteBatch {
+    public:
+        void put(const leveldb::Slice& key, const leveldb::Slice& value) {
+            batch.Put(key, value);
+        }
+
+        void erase(const leveldb::Slice& key) {
+            batch.Delete(key);
+        }
+
+        void clear() {
+            batch.Clear();
+        }
+
+        void append(const CryptoKernel::StorageEngine::WriteBatch& other) {
+            // Replayed rather than using WriteBatch::Append, which older
+            // LevelDB releases do not have
+            class Appender : public leveldb::WriteBatch::Handler {
+            public:
+                Appender(leveldb::WriteBatch* batch) {
+                    this->batch = batch;
+                }
+
+                void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
+                    batch->Put(key, value);
+                }
+
+                void Delete(const leveldb::Slice& key) {
+                    batch->Delete(key);
+                }
+
+            private:
+                leveldb::WriteBatch* batch;
+            };
+
+            Appender appender(&batch);
+            static_cast<const LevelDBBatch&>(other).batch.Iterate(&appender);
+        }
+
+        leveldb::WriteBatch batch;
+    };
+
+    class LevelDBIterator : public CryptoKernel::StorageEngine::Iterator {
+    public:
+        LevelDBIterator(leveldb::Iterator* it) {
+            this->it.reset(it);
+        }
+
+        void SeekToFirst() {
+            it->SeekToFirst();
+        }
+
+        void SeekToLast() {
+            it->SeekToLast();
+        }
+
+        void Seek(const leveldb::Slice& target) {
+            it->Seek(target);
+        }
+
+        bool Valid() const {
+            return it->Valid();
+        }
+
+        void Next() {
+            it->Next();
+        }
+
+        void Prev() {
+            it->Prev();
+        }
+
+        leveldb::Slice key() const {
+            return it->key();
+        }
+
+        leveldb::Slice value() const {
+            return it->value();
+        }
+
+    private:
+        std::unique_ptr<leveldb::Iterator> it;
+    };
+
+    leveldb::ReadOptions readOptions(const CryptoKernel::StorageEngine::Snapshot* snapshot) {
+        leveldb::ReadOptions options;
+        if(snapshot != nullptr) {
+            options.snapshot = static_cast<const LevelDBSnapshot*>(snapshot)->snapshot;
+        }
+        return options;
+    }
+}
+
+CryptoKernel::LevelDBEngine::LevelDBEngine(const std::string& filename,
+                                           const Options& engineOptions) {
+    leveldb::Options options;
+    options.create_if_missing = true;
+    options.write_buffer_size = size_t(engineOptions.writeBuffer) * 1024 * 1024;
+    options.max_open_files = engineOptions.maxOpenFiles;
+    options.block_size = size_t(engineOptions.blockSize) * 1024;
+    options.compression = engineOptions.compression ? leveldb::kSnappyCompression :
+                                                      leveldb::kNoCompression;
+
+    blockCache = nullptr;
+    filterPolicy = nullptr;
+
+    if(engineOptions.cache > 0) {
+        blockCache = leveldb::NewLRUCache(size_t(engineOptions.cache) * 1024 * 1024);
+        options.block_cache = blockCache;
+    }
+
+    if(engineOptions.bloomBits > 0) {
+        filterPolicy = leveldb::NewBloomFilterPolicy(engineOptions.bloomBits);
+        options.filter_policy = filterPolicy;
+    }
+
+    leveldb::Status dbstatus = leveldb::DB::Open(options, filename, &db);
+
+    if(!dbstatus.ok()) {
+        delete blockCache;
+        delete filterPolicy;
+        throw std::runtime_error("Failed to open the database");
+    }
+}
+
+CryptoKernel::LevelDBEngine::~LevelDBEngine() {
+    delete db;
+    delete blockCache;
+    delete filterPolicy;
+}
+
+bool CryptoKernel::LevelDBEngine::get(const std::string& key, std::string* value,
+                                      const Snapshot* snapshot) {
+    const leveldb::Status status = db->Get(readOptions(snapshot), key, value);
+    if(status.IsNotFound()) {
+        return false;
+    } else if(!status.ok()) {
+        throw std::runtime_error("Could not read from database " + status.ToString());
+    }
+
+    return true;
+}
+
+CryptoKernel::StorageEngine::WriteBatch* CryptoKernel::LevelDBEngine::newBatch() {
+    return new LevelDBBatch();
+}
+
+void CryptoKernel::LevelDBEngine::write(WriteBatch* batch, const bool sync) {
+    leveldb::WriteOptions options;
+    options.sync = sync;
+
+    const leveldb::Status status = db->Write(options,
+                                             &static_cast<LevelDBBatch*>(batch)->batch);
+
+    if(!status.ok()) {
+        throw std::runtime_error("Could not write to database " + status.ToString());
+    }
+}
+
+const CryptoKernel::StorageEngine::Snapshot* CryptoKernel::LevelDBEngine::getSnapshot() {
+    return new LevelDBSnapshot(db->GetSnapshot());
+}
+
+void CryptoKernel::LevelDBEngine::releaseSnapshot(const Snapshot* snapshot) {
+    db->ReleaseSnapshot(static_cast<const LevelDBSnapshot*>(snapshot)->snapshot);
+    delete snapshot;
+}
+
+CryptoKernel::StorageEngine::Iterator* CryptoKernel::LevelDBEngine::newIterator(
+    const Snapshot* snapshot) {
+    return new LevelDBIterator(db->NewIterator(readOptions(snapshot)));
+}
+
+void CryptoKernel::LevelDBEngine::destroy(const std::string& filename) {
+    leveldb::Options options;
+    leveldb::DestroyDB(filename, options);
+}
+
+/**
+* Each key keeps a list of versions tagged with the write sequence that
+* created them, newest last. A null value marks a deletion. Versions that no
+* open snapshot can see are dropped the next time the key is written.
+*/
+struct CryptoKernel::MemoryEngine::Store {
+    struct Version {
+        uint64_t sequence;
+        std::shared_ptr<const std::string> value;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, std::vector<Version>> data;
+    uint64_t sequence = 0;
+    std::multiset<uint64_t> snapshots;
+    unsigned int iterators = 0;
+    bool open = false;
+
+    const Version* visible(const std::vector<Version>& versions, const uint64_t at) const {
+        for(auto it = versions.rbegin(); it != versions.rend(); ++it) {
+            if(it->sequence <= at) {
+                return it->value ? &*it : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    void prune(std::map<std::string, std::vector<Version>>::iterator entry) {
+        const uint64_t oldest = snapshots.empty() ? sequence : *snapshots.begin();
+        auto& versions = entry->second;
+
+        size_t keep = 0;
+        for(size_t i = 0; i < versions.size(); i++) {
+            if(versions[i].sequence <= oldest) {
+                keep = i;
+            }
+        }
+        versions.erase(versions.begin(), versions.begin() + keep);
+
+        // Map nodes can only be removed while no iterator might point at them
+        if(versions.size() == 1 && !versions[0].value && versions[0].sequence <= oldest
+           && iterators == 0) {
+            data.erase(entry);
+        }
+    }
+};
+
+namespace {
+    typedef CryptoKernel::MemoryEngine::Store Store;
+
+    std::map<std::string, std::shared_ptr<Store>>& memoryStores() {
+        static std::map<std::string, std::shared_ptr<Store>> stores;
+        return stores;
+    }
+
+    std::mutex& memoryStoresMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    class MemorySnapshot : public CryptoKernel::StorageEngine::Snapshot {
+    public:
+        MemorySnapshot(const uint64_t sequence) {
+            this->sequence = sequence;
+        }
+
+        uint64_t sequence;
+    };
+
+    class MemoryBatch : public CryptoKernel::StorageEngine::WriteBatch {
+    public:
+        void put(const leveldb::Slice& key, const leveldb::Slice& value) {
+            ops.emplace_back(key.ToString(), std::make_shared<const std::string>(value.ToString()));
+        }
+
+        void erase(const leveldb::Slice& key) {
+            ops.emplace_back(key.ToString(), nullptr);
+        }
+
+        void clear() {
+            ops.clear();
+        }
+
+        void append(const CryptoKernel::StorageEngine::WriteBatch& other) {
+            const auto& otherOps = static_cast<const MemoryBatch&>(other).ops;
+            ops.insert(ops.end(), otherOps.begin(), otherOps.end());
+        }
+
+        std::vector<std::pair<std::string, std::shared_ptr<const std::string>>> ops;
+    };
+
+    class MemoryIterator : public CryptoKernel::StorageEngine::Iterator {
+    public:
+        MemoryIterator(std::shared_ptr<Store> store, const uint64_t at, const bool latest = false) {
+            this->store = store;
+            std::lock_guard<std::mutex> lock(store->mutex);
+            this->at = latest ? store->sequence : at;
+            store->iterators++;
+            store->snapshots.insert(this->at);
+            pos = store->data.end();
+        }
+
+        ~MemoryIterator() {
+            std::lock_guard<std::mutex> lock(store->mutex);
+            store->iterators--;
+            store->snapshots.erase(store->snapshots.find(at));
+        }
+
+        void SeekToFirst() {
+            std::lock_guard<std::mutex> lock(store->mutex);
+            pos = store->data.begin();
+            skipForward();
+        }
+
+        void SeekToLast() {
+            std::lock_guard<std::mutex> lock(store->mutex);
+            pos = store->data.end();
+            skipBackward();
+        }
+
+        void Seek(const leveldb::Slice& target) {
+            std::lock_guard<std::mutex> lock(store->mutex);
+            pos = store->data.lower_bound(target.ToString());
+            skipForward();
+        }
+
+        bool Valid() const {
+            return current != nullptr;
+        }
+
+        void Next() {
+            std::lock_guard<std::mutex> lock(store->mutex);
+            ++pos;
+            skipForward();
+        }
+
+        void Prev() {
+            std::lock_guard<std::mutex> lock(store->mutex);
+            skipBackward();
+        }
+
+        leveldb::Slice key() const {
+            return leveldb::Slice(pos->first);
+        }
+
+        leveldb::Slice value() const {
+            return leveldb::Slice(*current);
+        }
+
+    private:
+        void skipForward() {
+            current.reset();
+            while(pos != store->data.end()) {
+                const Store::Version* version = store->visible(pos->second, at);
+                if(version != nullptr) {
+                    current = version->value;
+                    return;
+                }
+                ++pos;
+            }
+        }
+
+        void skipBackward() {
+            current.reset();
+            while(pos != store->data.begin()) {
+                --pos;
+                const Store::Version* version = store->visible(pos->second, at);
+                if(version != nullptr) {
+                    current = version->value;
+                    return;
+                }
+            }
+            pos = store->data.end();
+        }
+
+        std::shared_ptr<Store> store;
+        uint64_t at;
+        std::map<std::string, std::vector<Store::Version>>::iterator pos;
+        std::shared_ptr<const std::string> current;
+    };
+}
+
+CryptoKernel::MemoryEngine::MemoryEngine(const std::string& name) {
+    std::lock_guard<std::mutex> lock(memoryStoresMutex());
+    std::shared_ptr<Store>& existing = memoryStores()[name];
+    if(!existing) {
+        existing = std::make_shared<Store>();
+    }
+
+    if(existing->open) {
+        throw std::runtime_error("Failed to open the database");
+    }
+
+    existing->open = true;
+    store = existing;
+}
+
+CryptoKernel::MemoryEngine::~MemoryEngine() {
+    std::lock_guard<std::mutex> lock(memoryStoresMutex());
+    store->open = false;
+}
+
+bool CryptoKernel::MemoryEngine::get(const std::string& key, std::string* value,
+                                     const Snapshot* snapshot) {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    const uint64_t at = snapshot != nullptr ?
+                        static_cast<const MemorySnapshot*>(snapshot)->sequence : store->sequence;
+
+    const auto it = store->data.find(key);
+    if(it == store->data.end()) {
+        return false;
+    }
+
+    const Store::Version* version = store->visible(it->second, at);
+    if(version == nullptr) {
+        return false;
+    }
+
+    *value = *version->value;
+    return true;
+}
+
+CryptoKernel::StorageEngine::WriteBatch* CryptoKernel::MemoryEngine::newBatch() {
+    return new MemoryBatch();
+}
+
+void CryptoKernel::MemoryEngine::write(WriteBatch* batch, const bool sync) {
+    MemoryBatch* memoryBatch = static_cast<MemoryBatch*>(batch);
+
+    std::lock_guard<std::mutex> lock(store->mutex);
+    const uint64_t sequence = ++store->sequence;
+    for(auto& op : memoryBatch->ops) {
+        auto entry = store->data.find(op.first);
+        if(entry == store->data.end()) {
+            if(!op.second) {
+                continue;
+            }
+            entry = store->data.emplace(op.first, std::vector<Store::Version>()).first;
+        }
+
+        // A batch may write the same key more than once, the last write wins
+        if(!entry->second.empty() && entry->second.back().sequence == sequence) {
+            entry->second.back().value = op.second;
+        } else {
+            entry->second.push_back(Store::Version{sequence, op.second});
+        }
+
+        store->prune(entry);
+    }
+}
+
+const CryptoKernel::StorageEngine::Snapshot* CryptoKernel::MemoryEngine::getSnapshot() {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    store->snapshots.insert(store->sequence);
+    return new MemorySnapshot(store->sequence);
+}
+
+void CryptoKernel::MemoryEngine::releaseSnapshot(const Snapshot* snapshot) {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    const uint64_t sequence = static_cast<const MemorySnapshot*>(snapshot)->sequence;
+    store->snapshots.erase(store->snapshots.find(sequence));
+    delete snapshot;
+}
+
+CryptoKernel::StorageEngine::Iterator* CryptoKernel::MemoryEngine::newIterator(
+    const Snapshot* snapshot) {
+    if(snapshot != nullptr) {
+        return new MemoryIterator(store, static_cast<const MemorySnapshot*>(snapshot)->sequence);
+    }
+
+    return new MemoryIterator(store, 0, true);
+}
+
+void CryptoKernel::MemoryEngine::destroy(const std::string& name) {
+    std::lock_guard<std::mutex> lock(memoryStoresMutex());
+    const auto it = memoryStores().find(name);
+    if(it != memoryStores().end() && !it->second->open) {
+        memoryStores().erase(it);
+    }
+}
@@ -0,0 +1,217 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STORAGEENGINE_H_INCLUDED
+#define STORAGEENGINE_H_INCLUDED
+
+#include <memory>
+#include <string>
+
+#include <leveldb/slice.h>
+
+namespace leveldb {
+class DB;
+class Cache;
+class FilterPolicy;
+}
+
+namespace CryptoKernel {
+/**
+* Interface to the ordered key-value store underneath Storage. Keys are
+* ordered bytewise. Implementations must be safe to use from multiple
+* threads at once.
+*/
+class StorageEngine {
+public:
+    virtual ~StorageEngine() {}
+
+    /**
+    * A consistent read-only view of the store at a point in time
+    */
+    class Snapshot {
+    public:
+        virtual ~Snapshot() {}
+    };
+
+    /**
+    * Iterates over the keys of the store in order. The key and value slices
+    * remain valid until the iterator is moved or destroyed.
+    */
+    class Iterator {
+    public:
+        virtual ~Iterator() {}
+
+        virtual void SeekToFirst() = 0;
+        virtual void SeekToLast() = 0;
+        virtual void Seek(const leveldb::Slice& target) = 0;
+        virtual bool Valid() const = 0;
+        virtual void Next() = 0;
+        virtual void Prev() = 0;
+        virtual leveldb::Slice key() const = 0;
+        virtual leveldb::Slice value() const = 0;
+    };
+
+    /**
+    * A set of changes applied atomically by write()
+    */
+    class WriteBatch {
+    public:
+        virtual ~WriteBatch() {}
+
+        virtual void put(const leveldb::Slice& key, const leveldb::Slice& value) = 0;
+        virtual void erase(const leveldb::Slice& key) = 0;
+        virtual void clear() = 0;
+
+        /**
+        * Adds the changes in another batch from the same engine to the end
+        * of this one
+        */
+        virtual void append(const WriteBatch& other) = 0;
+    };
+
+    /**
+    * Reads the value of a key
+    *
+    * @param key the key to read
+    * @param value set to the value of the key if it exists
+    * @param snapshot the snapshot to read from, or nullptr for the latest state
+    * @return true if the key exists, false otherwise
+    */
+    virtual bool get(const std::string& key, std::string* value,
+                     const Snapshot* snapshot = nullptr) = 0;
+
+    /**
+    * Creates an empty batch for use with this engine
+    */
+    virtual WriteBatch* newBatch() = 0;
+
+    /**
+    * Applies a batch of changes atomically
+    *
+    * @param batch a batch created by newBatch()
+    * @param sync set to true to wait for the changes to reach disk
+    * @throw std::runtime_error if the write fails
+    */
+    virtual void write(WriteBatch* batch, const bool sync) = 0;
+
+    virtual const Snapshot* getSnapshot() = 0;
+    virtual void releaseSnapshot(const Snapshot* snapshot) = 0;
+
+    /**
+    * Creates an iterator over the store
+    *
+    * @param snapshot the snapshot to iterate over, or nullptr for the latest state
+    */
+    virtual Iterator* newIterator(const Snapshot* snapshot = nullptr) = 0;
+};
+
+/**
+* Storage engine backed by a LevelDB database on disk
+*/
+class LevelDBEngine : public StorageEngine {
+public:
+    /**
+    * Tuning options for a LevelDB database. The defaults are LevelDB's own.
+    */
+    struct Options {
+        /** Block cache size in MB, 0 turns off the cache */
+        unsigned int cache = 0;
+
+        /** Bloom filter bits per key, 0 turns off the filter */
+        unsigned int bloomBits = 0;
+
+        /** Size of the in-memory write buffer in MB */
+        unsigned int writeBuffer = 4;
+
+        /** Number of table files LevelDB may keep open */
+        unsigned int maxOpenFiles = 1000;
+
+        /** Uncompressed size of each table block in KB */
+        unsigned int blockSize = 4;
+
+        /** Set to false to store table blocks uncompressed */
+        bool compression = true;
+    };
+
+    /**
+    * Opens the LevelDB database in the given directory, creating it if it
+    * does not exist
+    *
+    * @param filename the directory of the LevelDB database to use
+    * @param options the tuning options to open the database with
+    * @throw std::runtime_error if the database cannot be opened
+    */
+    LevelDBEngine(const std::string& filename, const Options& options);
+
+    ~LevelDBEngine();
+
+    bool get(const std::string& key, std::string* value, const Snapshot* snapshot = nullptr);
+    WriteBatch* newBatch();
+    void write(WriteBatch* batch, const bool sync);
+    const Snapshot* getSnapshot();
+    void releaseSnapshot(const Snapshot* snapshot);
+    Iterator* newIterator(const Snapshot* snapshot = nullptr);
+
+    /**
+    * Deletes the LevelDB database in the given directory
+    */
+    static void destroy(const std::string& filename);
+
+private:
+    leveldb::DB* db;
+    leveldb::Cache* blockCache;
+    const leveldb::FilterPolicy* filterPolicy;
+};
+
+/**
+* Storage engine that keeps an ordered map in memory. Stores are named and
+* live until destroyed or the process exits, so closing and reopening a
+* store by name behaves like reopening a database on disk.
+*/
+class MemoryEngine : public StorageEngine {
+public:
+    /**
+    * Opens the in-memory store with the given name, creating it if it does
+    * not exist
+    *
+    * @param name the name of the store
+    * @throw std::runtime_error if the store is already open
+    */
+    MemoryEngine(const std::string& name);
+
+    ~MemoryEngine();
+
+    bool get(const std::string& key, std::string* value, const Snapshot* snapshot = nullptr);
+    WriteBatch* newBatch();
+    void write(WriteBatch* batch, const bool sync);
+    const Snapshot* getSnapshot();
+    void releaseSnapshot(const Snapshot* snapshot);
+    Iterator* newIterator(const Snapshot* snapshot = nullptr);
+
+    /**
+    * Deletes the in-memory store with the given name
+    */
+    static void destroy(const std::string& name);
+
+    struct Store;
+
+private:
+    std::shared_ptr<Store> store;
+};
+}
+
+#endif // STORAGEENGINE_H_INCLUDED
@@ -0,0 +1,142 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "threadpool.h"
+
+CryptoKernel::ThreadPool::ThreadPool(const unsigned int threads) {
+    batch = nullptr;
+    batchNumber = 0;
+    stopping = false;
+
+    for(unsigned int i = 0; i < threads; i++) {
+        workers.emplace_back(&CryptoKernel::ThreadPool::workerFunc, this);
+    }
+}
+
+CryptoKernel::ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for(auto& worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned int CryptoKernel::ThreadPool::size() const {
+    return workers.size();
+}
+
+size_t CryptoKernel::ThreadPool::run(const size_t count,
+                                     const std::function<bool(const size_t)>& task) {
+    if(count == 0) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> runGuard(runLock);
+
+    Batch current;
+    current.task = &task;
+    current.count = count;
+    current.next = 0;
+    current.failed = count;
+    current.active = 0;
+
+    if(!workers.empty() && count > 1) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch = &current;
+            batchNumber++;
+        }
+        wake.notify_all();
+    }
+
+    work(current);
+
+    {
+        // Workers that have not picked the batch up yet will not see it now
+        std::unique_lock<std::mutex> lock(mutex);
+        batch = nullptr;
+        finished.wait(lock, [&]() {
+            return current.active == 0;
+        });
+    }
+
+    if(current.error) {
+        std::rethrow_exception(current.error);
+    }
+
+    return current.failed;
+}
+
+void CryptoKernel::ThreadPool::workerFunc() {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t seen = 0;
+    while(true) {
+        wake.wait(lock, [&]() {
+            return stopping || batchNumber != seen;
+        });
+
+        if(stopping) {
+            return;
+        }
+
+        seen = batchNumber;
+        Batch* current = batch;
+        if(current == nullptr) {
+            continue;
+        }
+
+        current->active++;
+        lock.unlock();
+        work(*current);
+        lock.lock();
+
+        current->active--;
+        if(current->active == 0) {
+            finished.notify_all();
+        }
+    }
+}
+
+void CryptoKernel::ThreadPool::work(Batch& current) {
+    while(true) {
+        const size_t i = current.next++;
+        if(i >= current.count || i > current.failed) {
+            return;
+        }
+
+        bool ok = false;
+        std::exception_ptr error;
+        try {
+            ok = (*current.task)(i);
+        } catch(...) {
+            error = std::current_exception();
+        }
+
+        if(!ok) {
+            // Keep the lowest failing index, and its exception if it threw
+            std::lock_guard<std::mutex> lock(mutex);
+            if(i < current.failed) {
+                current.failed = i;
+                current.error = error;
+            }
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CryptoKernel {
+/**
+* A fixed set of worker threads that run batches of independent checks,
+* such as verifying the transactions of a block. The threads live as long
+* as the pool, so running a batch costs no thread creation.
+*/
+class ThreadPool {
+public:
+    /**
+    * Starts the pool
+    *
+    * @param threads the number of worker threads to start. The thread that
+    *        calls run() also does work, so 0 runs every batch serially.
+    */
+    ThreadPool(const unsigned int threads);
+
+    ~ThreadPool();
+
+    /**
+    * Calls task once for every index in [0, count) across the workers and
+    * the calling thread, and waits for them to finish. Once a task fails,
+    * tasks with higher indices are skipped, but all lower ones still run,
+    * so the result is the same however the work was split up.
+    *
+    * @param count the number of tasks to run
+    * @param task returns false if the item at the given index failed
+    * @return the lowest index whose task failed, or count if none did
+    * @throw the exception thrown by the lowest failing index, if it threw
+    */
+    size_t run(const size_t count, const std::function<bool(const size_t)>& task);
+
+    /**
+    * Returns the number of worker threads in the pool
+    */
+    unsigned int size() const;
+
+private:
+    struct Batch {
+        const std::function<bool(const size_t)>* task;
+        size_t count;
+        std::atomic<size_t> next;
+        std::atomic<size_t> failed;
+        std::exception_ptr error;
+        unsigned int active;
+    };
+
+    void workerFunc();
+    void work(Batch& batch);
+
+    std::vector<std::thread> workers;
+
+    // Only one batch runs at a time
+    std::mutex runLock;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    Batch* batch;
+    uint64_t batchNumber;
+    bool stopping;
+};
+}
+
+#endif // THREADPOOL_H_INCLUDED
@@ -0,0 +1,216 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "utxocache.h"
+
+namespace {
+// Rough heap footprint of a decoded json value
+size_t jsonSize(const Json::Value& value) {
+    size_t size = sizeof(Json::Value);
+
+    const char* begin;
+    const char* end;
+    if(value.isString() && value.getString(&begin, &end)) {
+        size += end - begin;
+    } else if(value.isObject() || value.isArray()) {
+        for(auto it = value.begin(); it != value.end(); ++it) {
+            size += 48 + jsonSize(*it);
+            if(value.isObject()) {
+                size += it.name().size();
+            }
+        }
+    }
+
+    return size;
+}
+}
+
+CryptoKernel::UtxoCache::UtxoCache(Storage::Table* table, const uint64_t budget) {
+    this->table = table;
+    this->budget = budget;
+    usage = 0;
+    dirty = 0;
+    activeTx = nullptr;
+    flushing = false;
+    flushRequested = false;
+}
+
+size_t CryptoKernel::UtxoCache::estimateSize(const std::string& id, const Json::Value& value) {
+    // The key is stored once in the hash table node, plus the node itself
+    return id.size() + 64 + jsonSize(value);
+}
+
+Json::Value CryptoKernel::UtxoCache::get(Storage::Transaction* dbTx, const std::string& id) {
+    bool active;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active = activeTx != nullptr && dbTx == activeTx;
+        if(active) {
+            const auto it = staged.find(id);
+            if(it != staged.end()) {
+                return it->second;
+            }
+        }
+
+        const auto it = entries.find(id);
+        if(it != entries.end()) {
+            return it->second.value;
+        }
+    }
+
+    const Json::Value value = table->get(dbTx, id);
+
+    // Other transactions may have older snapshots than the committed state,
+    // so only what the active one reads is safe to keep
+    if(active && value.isObject()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(entries.find(id) == entries.end()) {
+            const size_t size = estimateSize(id, value);
+            entries.emplace(id, Entry{value, false, size});
+            usage += size;
+        }
+    }
+
+    return value;
+}
+
+void CryptoKernel::UtxoCache::put(const std::string& id, const Json::Value& output) {
+    std::lock_guard<std::mutex> lock(mutex);
+    staged[id] = output;
+}
+
+void CryptoKernel::UtxoCache::erase(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    staged[id] = Json::Value();
+}
+
+void CryptoKernel::UtxoCache::begin(Storage::Transaction* dbTx) {
+    std::lock_guard<std::mutex> lock(mutex);
+    activeTx = dbTx;
+    staged.clear();
+    flushing = false;
+}
+
+void CryptoKernel::UtxoCache::commit() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for(auto& change : staged) {
+        const size_t size = estimateSize(change.first, change.second);
+        auto it = entries.find(change.first);
+        if(it == entries.end()) {
+            it = entries.emplace(change.first, Entry{std::move(change.second), false, size}).first;
+        } else {
+            usage -= it->second.size;
+            if(it->second.dirty) {
+                dirty--;
+            }
+            it->second.value = std::move(change.second);
+            it->second.size = size;
+            it->second.dirty = false;
+        }
+        usage += size;
+
+        if(!flushing) {
+            it->second.dirty = true;
+            dirty++;
+        }
+    }
+
+    if(flushing) {
+        // Everything is in the table now. Spent outputs no longer need
+        // remembering, and the rest only if they fit the budget.
+        if(usage > budget) {
+            entries.clear();
+            usage = 0;
+        } else {
+            for(auto it = entries.begin(); it != entries.end();) {
+                if(it->second.value.isNull()) {
+                    usage -= it->second.size;
+                    it = entries.erase(it);
+                } else {
+                    it->second.dirty = false;
+                    ++it;
+                }
+            }
+        }
+        dirty = 0;
+        flushRequested = false;
+    }
+
+    staged.clear();
+    activeTx = nullptr;
+    flushing = false;
+}
+
+void CryptoKernel::UtxoCache::abort() {
+    std::lock_guard<std::mutex> lock(mutex);
+    staged.clear();
+    activeTx = nullptr;
+    flushing = false;
+}
+
+void CryptoKernel::UtxoCache::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const auto write = [&](const std::string& id, const Json::Value& value) {
+        if(value.isNull()) {
+            table->erase(activeTx, id);
+        } else {
+            table->put(activeTx, id, value);
+        }
+    };
+
+    for(const auto& entry : entries) {
+        if(entry.second.dirty && staged.find(entry.first) == staged.end()) {
+            write(entry.first, entry.second.value);
+        }
+    }
+
+    for(const auto& change : staged) {
+        write(change.first, change.second);
+    }
+
+    flushing = true;
+}
+
+void CryptoKernel::UtxoCache::requestFlush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    flushRequested = true;
+}
+
+bool CryptoKernel::UtxoCache::needsFlush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return flushRequested || usage > budget;
+}
+
+void CryptoKernel::UtxoCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    staged.clear();
+    usage = 0;
+    dirty = 0;
+}
+
+uint64_t CryptoKernel::UtxoCache::memoryUsage() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return usage;
+}
+
+size_t CryptoKernel::UtxoCache::dirtyCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dirty;
+}
@@ -0,0 +1,142 @@
+/*  CryptoKernel - A library for creating blockchain based digital currency
+    Copyright (C) 2016  James Lovejoy
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef UTXOCACHE_H_INCLUDED
+#define UTXOCACHE_H_INCLUDED
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "storage.h"
+
+namespace CryptoKernel {
+/**
+* Write-back cache of the unspent output records in a table. The cache
+* has two layers: changes made by the transaction currently updating the
+* chain, and the committed state in front of the table. Committed changes
+* stay in memory until flush() writes them out together, so the table
+* lags behind the chain between flushes. Whoever owns the cache must keep
+* track of which block the table was last flushed at, and replay later
+* blocks after a crash.
+*/
+class UtxoCache {
+public:
+    /**
+    * Creates an empty cache
+    *
+    * @param table the table holding the unspent output records
+    * @param budget the memory the cache may use before it asks to be flushed, in bytes
+    */
+    UtxoCache(Storage::Table* table, const uint64_t budget);
+
+    /**
+    * Reads an unspent output. Reads through the transaction passed to
+    * begin() see its changes, and are the only ones that load records
+    * from the table into the cache. Other transactions see the committed
+    * state, which may be newer than their snapshot. May be called from
+    * several threads at once.
+    *
+    * @param dbTx the transaction to read the table with
+    * @param id the id of the output
+    * @return the output record, or null if the output is not unspent
+    */
+    Json::Value get(Storage::Transaction* dbTx, const std::string& id);
+
+    /**
+    * Stages adding an unspent output in the current transaction
+    */
+    void put(const std::string& id, const Json::Value& output);
+
+    /**
+    * Stages removing an unspent output in the current transaction
+    */
+    void erase(const std::string& id);
+
+    /**
+    * Starts staging changes for the given transaction. Only one
+    * transaction may change the cache at a time.
+    */
+    void begin(Storage::Transaction* dbTx);
+
+    /**
+    * Makes the staged changes part of the committed state. Call once the
+    * transaction given to begin() has been committed.
+    */
+    void commit();
+
+    /**
+    * Discards the staged changes
+    */
+    void abort();
+
+    /**
+    * Writes every change not yet in the table to the current transaction.
+    * The cache treats them as written once commit() is called.
+    */
+    void flush();
+
+    /**
+    * Asks for the next commit to be flushed, whatever the memory use
+    */
+    void requestFlush();
+
+    /**
+    * Returns true if the memory budget is used up or a flush was requested
+    */
+    bool needsFlush();
+
+    /**
+    * Drops every cached record, including changes not yet flushed
+    */
+    void clear();
+
+    /**
+    * Returns the estimated memory used by the cache in bytes
+    */
+    uint64_t memoryUsage();
+
+    /**
+    * Returns the number of committed changes not yet written to the table
+    */
+    size_t dirtyCount();
+
+private:
+    struct Entry {
+        Json::Value value;
+        bool dirty;
+        size_t size;
+    };
+
+    static size_t estimateSize(const std::string& id, const Json::Value& value);
+
+    Storage::Table* table;
+    uint64_t budget;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    uint64_t usage;
+    size_t dirty;
+
+    Storage::Transaction* activeTx;
+    std::unordered_map<std::string, Json::Value> staged;
+    bool flushing;
+    bool flushRequested;
+};
+}
+
+#endif // UTXOCACHE_H_INCLUDED
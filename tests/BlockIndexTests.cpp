@@ -0,0 +1,238 @@
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include "BlockIndexTests.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(BlockIndexTest);
+
+namespace {
+CryptoKernel::uint256 makeId(const uint64_t branch, const uint64_t height) {
+    return (CryptoKernel::uint256(branch + 1) << 64) + CryptoKernel::uint256(height);
+}
+
+CryptoKernel::BlockIndex::Entry makeEntry(const CryptoKernel::uint256& id,
+                                          const CryptoKernel::uint256& previousId,
+                                          const uint64_t height) {
+    CryptoKernel::BlockIndex::Entry entry;
+    entry.id = id;
+    entry.previousId = previousId;
+    entry.height = height;
+    entry.timestamp = 1000 + height * 150;
+    entry.consensusData["totalWork"] = std::to_string(height);
+    entry.status = CryptoKernel::BlockIndex::Status::MainChain;
+    return entry;
+}
+
+/**
+* Adds blocks on top of a block, optionally connecting them
+*
+* @return the ids added, oldest first
+*/
+std::vector<CryptoKernel::uint256> extend(CryptoKernel::BlockIndex& index,
+                                          const CryptoKernel::uint256& from,
+                                          const uint64_t fromHeight, const uint64_t branch,
+                                          const uint64_t count, const bool connect) {
+    std::vector<CryptoKernel::uint256> ids;
+    CryptoKernel::uint256 previous = from;
+    for(uint64_t height = fromHeight + 1; height <= fromHeight + count; height++) {
+        const CryptoKernel::uint256 id = makeId(branch, height);
+        CPPUNIT_ASSERT(index.add(makeEntry(id, previous, height)));
+        if(connect) {
+            index.connect(id);
+        }
+        ids.push_back(id);
+        previous = id;
+    }
+    return ids;
+}
+}
+
+BlockIndexTest::BlockIndexTest() {
+}
+
+BlockIndexTest::~BlockIndexTest() {
+}
+
+void BlockIndexTest::setUp() {
+}
+
+void BlockIndexTest::tearDown() {
+}
+
+void BlockIndexTest::testMainChain() {
+    CryptoKernel::BlockIndex index;
+    CPPUNIT_ASSERT_EQUAL(uint64_t(0), index.getHeight());
+    CPPUNIT_ASSERT_THROW(index.getTip(), std::runtime_error);
+
+    const std::vector<CryptoKernel::uint256> chain = extend(index, CryptoKernel::uint256(), 0, 0,
+                                                            50, true);
+
+    CPPUNIT_ASSERT_EQUAL(uint64_t(50), index.getHeight());
+    CPPUNIT_ASSERT_EQUAL(size_t(50), index.size());
+    CPPUNIT_ASSERT(index.getTip().id == chain.back());
+    CPPUNIT_ASSERT_EQUAL(std::string("50"), index.getTip().consensusData["totalWork"].asString());
+
+    for(uint64_t height = 1; height <= 50; height++) {
+        const CryptoKernel::BlockIndex::Entry entry = index.getByHeight(height);
+        CPPUNIT_ASSERT(entry.id == chain[height - 1]);
+        CPPUNIT_ASSERT_EQUAL(height, entry.height);
+        CPPUNIT_ASSERT_EQUAL(uint64_t(1000 + height * 150), entry.timestamp);
+        CPPUNIT_ASSERT(entry.status == CryptoKernel::BlockIndex::Status::MainChain);
+    }
+    CPPUNIT_ASSERT_THROW(index.getByHeight(51), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(index.getByHeight(0), std::runtime_error);
+
+    // A disconnected tip stays in the index as a candidate
+    index.disconnect();
+    CPPUNIT_ASSERT_EQUAL(uint64_t(49), index.getHeight());
+    CPPUNIT_ASSERT(index.get(chain.back()).status == CryptoKernel::BlockIndex::Status::Candidate);
+    CPPUNIT_ASSERT(index.getTip().id == chain[48]);
+
+    index.connect(chain.back());
+    CPPUNIT_ASSERT(index.getTip().id == chain.back());
+
+    // Newest first, stopping at the genesis block
+    const std::vector<CryptoKernel::BlockIndex::Entry> ancestry = index.getAncestry(chain[9], 100);
+    CPPUNIT_ASSERT_EQUAL(size_t(10), ancestry.size());
+    for(unsigned int i = 0; i < ancestry.size(); i++) {
+        CPPUNIT_ASSERT(ancestry[i].id == chain[9 - i]);
+    }
+    CPPUNIT_ASSERT_EQUAL(size_t(3), index.getAncestry(chain.back(), 3).size());
+
+    index.clear();
+    CPPUNIT_ASSERT_EQUAL(size_t(0), index.size());
+    CPPUNIT_ASSERT(!index.contains(chain[0]));
+}
+
+void BlockIndexTest::testAddErrors() {
+    CryptoKernel::BlockIndex index;
+    const std::vector<CryptoKernel::uint256> chain = extend(index, CryptoKernel::uint256(), 0, 0,
+                                                            5, true);
+
+    // Adding twice keeps the first
+    CPPUNIT_ASSERT(!index.add(makeEntry(chain[2], chain[1], 3)));
+    CPPUNIT_ASSERT_EQUAL(size_t(5), index.size());
+
+    CPPUNIT_ASSERT_THROW(index.add(makeEntry(makeId(1, 7), makeId(1, 6), 7)),
+                         std::runtime_error);
+    CPPUNIT_ASSERT_THROW(index.add(makeEntry(makeId(1, 7), chain[4], 7)), std::runtime_error);
+    CPPUNIT_ASSERT(!index.contains(makeId(1, 7)));
+
+    // Only a child of the tip can be connected
+    CPPUNIT_ASSERT(index.add(makeEntry(makeId(1, 4), chain[2], 4)));
+    CPPUNIT_ASSERT_THROW(index.connect(makeId(1, 4)), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(index.connect(chain[4]), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(index.connect(makeId(2, 6)), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(index.get(makeId(2, 6)), std::runtime_error);
+}
+
+void BlockIndexTest::testAncestor() {
+    CryptoKernel::BlockIndex index;
+    const std::vector<CryptoKernel::uint256> chain = extend(index, CryptoKernel::uint256(), 0, 0,
+                                                            3000, true);
+    const std::vector<CryptoKernel::uint256> branch = extend(index, chain[999], 1000, 1, 1500,
+                                                             false);
+
+    for(uint64_t height = 1; height <= 3000; height += 7) {
+        CPPUNIT_ASSERT(index.getAncestor(chain.back(), height).id == chain[height - 1]);
+    }
+
+    // Off the main chain the walk has to follow the skip links, so check
+    // every target from a few starting points against the plain ids
+    for(const uint64_t from : {1001, 1002, 1500, 2047, 2048, 2500}) {
+        const CryptoKernel::uint256 start = branch[from - 1001];
+        for(uint64_t height = 1; height <= from; height++) {
+            const CryptoKernel::uint256 expected = height > 1000 ? branch[height - 1001]
+                                                                 : chain[height - 1];
+            CPPUNIT_ASSERT(index.getAncestor(start, height).id == expected);
+        }
+        CPPUNIT_ASSERT_THROW(index.getAncestor(start, from + 1), std::runtime_error);
+    }
+
+    CPPUNIT_ASSERT_THROW(index.getAncestor(chain[5], 0), std::runtime_error);
+}
+
+void BlockIndexTest::testForkPoint() {
+    CryptoKernel::BlockIndex index;
+    const std::vector<CryptoKernel::uint256> chain = extend(index, CryptoKernel::uint256(), 0, 0,
+                                                            100, true);
+    const std::vector<CryptoKernel::uint256> branch = extend(index, chain[39], 40, 1, 30, false);
+    const std::vector<CryptoKernel::uint256> twig = extend(index, branch[9], 50, 2, 5, false);
+
+    CPPUNIT_ASSERT(index.getForkPoint(chain[70]).id == chain[70]);
+    CPPUNIT_ASSERT(index.getForkPoint(branch.back()).id == chain[39]);
+    CPPUNIT_ASSERT(index.getForkPoint(branch[0]).id == chain[39]);
+    CPPUNIT_ASSERT(index.getForkPoint(twig.back()).id == chain[39]);
+
+    CPPUNIT_ASSERT(index.getBranch(chain[70]).empty());
+    const std::vector<CryptoKernel::uint256> path = index.getBranch(twig.back());
+    CPPUNIT_ASSERT_EQUAL(size_t(15), path.size());
+    for(unsigned int i = 0; i < 10; i++) {
+        CPPUNIT_ASSERT(path[i] == branch[i]);
+    }
+    for(unsigned int i = 0; i < 5; i++) {
+        CPPUNIT_ASSERT(path[10 + i] == twig[i]);
+    }
+
+    // Moving the main chain onto the branch moves the fork point of the
+    // twig with it
+    while(index.getTip().id != chain[39]) {
+        index.disconnect();
+    }
+    for(const CryptoKernel::uint256& id : branch) {
+        index.connect(id);
+    }
+    CPPUNIT_ASSERT(index.getForkPoint(twig.back()).id == branch[9]);
+    CPPUNIT_ASSERT(index.getForkPoint(chain.back()).id == chain[39]);
+    CPPUNIT_ASSERT_EQUAL(size_t(60), index.getBranch(chain.back()).size());
+
+    // A second genesis block shares nothing with the main chain
+    CPPUNIT_ASSERT(index.add(makeEntry(makeId(3, 1), CryptoKernel::uint256(), 1)));
+    CPPUNIT_ASSERT_THROW(index.getForkPoint(makeId(3, 1)), std::runtime_error);
+}
+
+void BlockIndexTest::testAbort() {
+    CryptoKernel::BlockIndex index;
+    const std::vector<CryptoKernel::uint256> chain = extend(index, CryptoKernel::uint256(), 0, 0,
+                                                            20, true);
+    const std::vector<CryptoKernel::uint256> branch = extend(index, chain[14], 15, 1, 3, false);
+
+    // A reorg onto the branch plus a new block, then undone
+    index.begin();
+    for(unsigned int i = 0; i < 5; i++) {
+        index.disconnect();
+    }
+    for(const CryptoKernel::uint256& id : branch) {
+        index.connect(id);
+    }
+    CPPUNIT_ASSERT(index.add(makeEntry(makeId(1, 19), branch.back(), 19)));
+    index.connect(makeId(1, 19));
+    CPPUNIT_ASSERT(index.getTip().id == makeId(1, 19));
+    index.abort();
+
+    CPPUNIT_ASSERT_EQUAL(size_t(23), index.size());
+    CPPUNIT_ASSERT(!index.contains(makeId(1, 19)));
+    CPPUNIT_ASSERT(index.getTip().id == chain.back());
+    for(uint64_t height = 1; height <= 20; height++) {
+        CPPUNIT_ASSERT(index.getByHeight(height).id == chain[height - 1]);
+        CPPUNIT_ASSERT(index.get(chain[height - 1]).status ==
+                       CryptoKernel::BlockIndex::Status::MainChain);
+    }
+    for(const CryptoKernel::uint256& id : branch) {
+        CPPUNIT_ASSERT(index.get(id).status == CryptoKernel::BlockIndex::Status::Candidate);
+    }
+
+    // Committed changes stay
+    index.begin();
+    CPPUNIT_ASSERT(index.add(makeEntry(makeId(0, 21), chain.back(), 21)));
+    index.connect(makeId(0, 21));
+    index.commit();
+    index.abort();
+    CPPUNIT_ASSERT(index.getTip().id == makeId(0, 21));
+
+    // Outside begin() and commit() nothing is recorded to undo
+    index.disconnect();
+    index.abort();
+    CPPUNIT_ASSERT(index.getTip().id == chain.back());
+}
@@ -0,0 +1,33 @@
+#ifndef BLOCKINDEXTEST_H
+#define BLOCKINDEXTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "blockindex.h"
+
+class BlockIndexTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(BlockIndexTest);
+
+    CPPUNIT_TEST(testMainChain);
+    CPPUNIT_TEST(testAddErrors);
+    CPPUNIT_TEST(testAncestor);
+    CPPUNIT_TEST(testForkPoint);
+    CPPUNIT_TEST(testAbort);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    BlockIndexTest();
+    virtual ~BlockIndexTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testMainChain();
+    void testAddErrors();
+    void testAncestor();
+    void testForkPoint();
+    void testAbort();
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include "crypto.h"
 #include "schnorr.h"
 #include "consensus/regtest.h"
+#include "consensus/PoW.h"
 #include "contract.h"
 #include "merkletree.h"
 
@@ -27,10 +28,10 @@ void BlockchainTest::tearDown() {
     blockchain.reset();
     consensus.reset();
     std::remove("genesistest.json");
-    CryptoKernel::Storage::destroy("./testblockdb");
+    CryptoKernel::Storage::destroy("memory:testblockdb");
 }
 
-BlockchainTest::testChain::testChain(CryptoKernel::Log* GlobalLog) : CryptoKernel::Blockchain(GlobalLog, "./testblockdb") {}
+BlockchainTest::testChain::testChain(CryptoKernel::Log* GlobalLog, const std::string& dbDir) : CryptoKernel::Blockchain(GlobalLog, dbDir) {}
 
 BlockchainTest::testChain::~testChain() {}
 
@@ -936,4 +937,549 @@ void BlockchainTest::testPayToMerkleRootMalformed() {
     const auto res6 = blockchain->submitTransaction(CryptoKernel::Blockchain::transaction({CryptoKernel::Blockchain::input(p2mrout.getId(), invalidSpendData)}, {p2pkout}, 1530888581));
     CPPUNIT_ASSERT_MESSAGE("Invalid merkleProof[1] did not fail the transaction", !std::get<0>(res6));
 
-}
\ No newline at end of file
+}
+
+void BlockchainTest::testMempoolConflictRemoved() {
+    CryptoKernel::Crypto crypto(true);
+    const auto pubKey = crypto.getPublicKey();
+
+    consensus->mineBlock(true, pubKey);
+    consensus->mineBlock(true, pubKey);
+
+    const auto outs = blockchain->getUnspentOutputs(pubKey);
+    CPPUNIT_ASSERT_EQUAL(size_t(2), outs.size());
+
+    const auto spend = [&](const CryptoKernel::Blockchain::dbOutput& out, const uint64_t fee) {
+        Json::Value data;
+        data["publicKey"] = pubKey;
+        const CryptoKernel::Blockchain::output newOut(out.getValue() - fee, 0, data);
+
+        Json::Value spendData;
+        spendData["signature"] = crypto.sign(out.getId().toString() +
+                                             CryptoKernel::Blockchain::transaction::getOutputSetId({newOut}).toString());
+        const CryptoKernel::Blockchain::input inp(out.getId(), spendData);
+
+        return CryptoKernel::Blockchain::transaction({inp}, {newOut}, 1530888581);
+    };
+
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitTransaction(spend(*outs.begin(), 20000))));
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitTransaction(spend(*outs.rbegin(), 21000))));
+    CPPUNIT_ASSERT_EQUAL(2U, blockchain->mempoolCount());
+
+    {
+        // Another node on the same chain confirms a different spend of the
+        // first output
+        testChain otherChain(log.get(), "memory:testblockdb2");
+        CryptoKernel::Consensus::Regtest otherConsensus(&otherChain);
+        otherChain.loadChain(&otherConsensus, "genesistest.json");
+        otherConsensus.start();
+
+        for(uint64_t height = 2; height <= 3; height++) {
+            CPPUNIT_ASSERT(std::get<0>(otherChain.submitBlock(blockchain->getBlockByHeight(height))));
+        }
+
+        CPPUNIT_ASSERT(std::get<0>(otherChain.submitTransaction(spend(*outs.begin(), 30000))));
+        otherConsensus.mineBlock(true, pubKey);
+
+        CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(otherChain.getBlockByHeight(4))));
+    }
+
+    CryptoKernel::Storage::destroy("memory:testblockdb2");
+
+    // Only the transaction spending the same output is dropped
+    CPPUNIT_ASSERT_EQUAL(1U, blockchain->mempoolCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(1), blockchain->getUnconfirmedTransactions().size());
+}
+
+void BlockchainTest::testMempoolFeeRateEviction() {
+    // Transactions of equal size, as their nonces have the same number of digits
+    const auto makeTx = [](const unsigned int nonce) {
+        const CryptoKernel::uint256 outputId(CryptoKernel::Crypto::sha256(std::to_string(nonce)));
+        const CryptoKernel::Blockchain::input inp(outputId, Json::Value());
+        const CryptoKernel::Blockchain::output out(100000000, nonce, Json::Value());
+        return CryptoKernel::Blockchain::transaction({inp}, {out}, 1530888581);
+    };
+
+    const auto tx1 = makeTx(10);
+    const auto tx2 = makeTx(11);
+    const auto tx3 = makeTx(12);
+    const auto tx4 = makeTx(13);
+    const unsigned int txSize = tx1.size();
+
+    CryptoKernel::Blockchain::Mempool mempool(txSize * 3);
+    CPPUNIT_ASSERT(mempool.insert(tx1, 100000));
+    CPPUNIT_ASSERT(mempool.insert(tx2, 300000));
+    CPPUNIT_ASSERT(mempool.insert(tx3, 200000));
+    CPPUNIT_ASSERT(!mempool.insert(tx2, 300000));
+
+    // Full, so only a better paying transaction gets in
+    CPPUNIT_ASSERT(!mempool.insert(tx4, 100000));
+    CPPUNIT_ASSERT(mempool.insert(tx4, 250000));
+    CPPUNIT_ASSERT_EQUAL(3U, mempool.count());
+    CPPUNIT_ASSERT_EQUAL(txSize * 3, mempool.size());
+
+    auto txs = mempool.getTransactions();
+    CPPUNIT_ASSERT(txs.find(tx1) == txs.end());
+    CPPUNIT_ASSERT(txs.find(tx4) != txs.end());
+
+    // Shrinking keeps the best paying transaction
+    mempool.setMaxSize(txSize);
+    txs = mempool.getTransactions();
+    CPPUNIT_ASSERT_EQUAL(size_t(1), txs.size());
+    CPPUNIT_ASSERT(txs.find(tx2) != txs.end());
+
+    mempool.remove(tx2);
+    CPPUNIT_ASSERT_EQUAL(0U, mempool.count());
+    CPPUNIT_ASSERT_EQUAL(0U, mempool.size());
+}
+
+void BlockchainTest::testMempoolSelection() {
+    const auto makeTx = [](const unsigned int nonce) {
+        const CryptoKernel::uint256 outputId(CryptoKernel::Crypto::sha256(std::to_string(nonce)));
+        const CryptoKernel::Blockchain::input inp(outputId, Json::Value());
+        const CryptoKernel::Blockchain::output out(100000000, nonce, Json::Value());
+        return CryptoKernel::Blockchain::transaction({inp}, {out}, 1530888581);
+    };
+
+    CryptoKernel::Blockchain::Mempool mempool;
+    const uint64_t emptyVersion = mempool.getSelectionVersion();
+    CPPUNIT_ASSERT_EQUAL(uint64_t(0), mempool.getSelectedFees());
+
+    const auto tx1 = makeTx(10);
+    const auto tx2 = makeTx(11);
+    CPPUNIT_ASSERT(mempool.insert(tx1, 100000));
+    CPPUNIT_ASSERT(mempool.insert(tx2, 300000));
+
+    const uint64_t version = mempool.getSelectionVersion();
+    CPPUNIT_ASSERT(version != emptyVersion);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(400000), mempool.getSelectedFees());
+    CPPUNIT_ASSERT_EQUAL(size_t(2), mempool.getTransactions().size());
+
+    // Unchanged until the selection changes
+    CPPUNIT_ASSERT_EQUAL(version, mempool.getSelectionVersion());
+
+    mempool.remove(tx1);
+    CPPUNIT_ASSERT(mempool.getSelectionVersion() != version);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(300000), mempool.getSelectedFees());
+
+    // A block template is reused until the mempool or the tip changes
+    consensus->mineBlock(true, "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=");
+    const auto block1 = blockchain->generateVerifyingBlock("BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=");
+    const auto block2 = blockchain->generateVerifyingBlock("BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=");
+    CPPUNIT_ASSERT(block1.getTransactions().empty());
+    CPPUNIT_ASSERT_EQUAL(block1.getPreviousBlockId().toString(), block2.getPreviousBlockId().toString());
+}
+
+CryptoKernel::Blockchain::block BlockchainTest::makeBlock(
+    const CryptoKernel::uint256& previousBlockId, const bool isBetter, const uint64_t nonce) {
+    const uint64_t height = blockchain->getAncestry(previousBlockId, 1).front().height + 1;
+
+    Json::Value data;
+    data["publicKey"] = "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=";
+    const CryptoKernel::Blockchain::output reward(100000000, nonce, data);
+    const CryptoKernel::Blockchain::transaction coinbaseTx({}, {reward}, 1530888581 + nonce, true);
+
+    Json::Value consensusData;
+    consensusData["isBetter"] = isBetter;
+
+    return CryptoKernel::Blockchain::block({}, coinbaseTx, previousBlockId, 1530888581 + nonce,
+                                           consensusData, height);
+}
+
+void BlockchainTest::testReorg() {
+    for(int i = 0; i < 3; i++) {
+        consensus->mineBlock(true, "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=");
+    }
+
+    const CryptoKernel::uint256 forkPoint = blockchain->getBlockByHeight(2).getId();
+    const CryptoKernel::uint256 oldTip = blockchain->getBlockByHeight(4).getId();
+
+    // A fork off block 2 that does not beat the main chain is only saved
+    const auto fork3 = makeBlock(forkPoint, false, 3);
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(fork3)));
+    const auto fork4 = makeBlock(fork3.getId(), false, 4);
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(fork4)));
+    CPPUNIT_ASSERT(blockchain->getBlockDB("tip").getId() == oldTip);
+    CPPUNIT_ASSERT_EQUAL(size_t(4), blockchain->getAncestry(fork4.getId(), 10).size());
+
+    // Then a better block moves the main chain onto the fork
+    const auto fork5 = makeBlock(fork4.getId(), true, 5);
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(fork5)));
+    CPPUNIT_ASSERT(blockchain->getBlockDB("tip").getId() == fork5.getId());
+    CPPUNIT_ASSERT_EQUAL(uint64_t(5), blockchain->getBlockDB("tip").getHeight());
+    CPPUNIT_ASSERT(blockchain->getBlockByHeight(3).getId() == fork3.getId());
+    CPPUNIT_ASSERT(blockchain->getBlockByHeight(4).getId() == fork4.getId());
+
+    // The old main chain is still known
+    const std::vector<CryptoKernel::BlockIndex::Entry> oldChain = blockchain->getAncestry(oldTip, 10);
+    CPPUNIT_ASSERT_EQUAL(size_t(4), oldChain.size());
+    CPPUNIT_ASSERT(oldChain[0].status == CryptoKernel::BlockIndex::Status::Candidate);
+    CPPUNIT_ASSERT(oldChain[2].id == forkPoint);
+    CPPUNIT_ASSERT(oldChain[2].status == CryptoKernel::BlockIndex::Status::MainChain);
+
+    // A better block on a main chain block below the tip forks from there
+    const auto fork3b = makeBlock(forkPoint, true, 6);
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(fork3b)));
+    CPPUNIT_ASSERT(blockchain->getBlockDB("tip").getId() == fork3b.getId());
+    CPPUNIT_ASSERT_EQUAL(uint64_t(3), blockchain->getBlockDB("tip").getHeight());
+
+    CPPUNIT_ASSERT_THROW(blockchain->getAncestry(makeBlock(oldTip, true, 7).getId(), 1),
+                         CryptoKernel::Blockchain::NotFoundException);
+}
+
+void BlockchainTest::testIndexReload() {
+    for(int i = 0; i < 3; i++) {
+        consensus->mineBlock(true, "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=");
+    }
+
+    const CryptoKernel::uint256 tip = blockchain->getBlockDB("tip").getId();
+    const auto candidate = makeBlock(blockchain->getBlockByHeight(3).getId(), false, 3);
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(candidate)));
+
+    // The index is rebuilt from the block database
+    consensus.reset();
+    blockchain.reset();
+    blockchain.reset(new testChain(log.get()));
+    consensus.reset(new CryptoKernel::Consensus::Regtest(blockchain.get()));
+    blockchain->loadChain(consensus.get(), "genesistest.json");
+
+    const std::vector<CryptoKernel::BlockIndex::Entry> mainChain = blockchain->getAncestry(tip, 10);
+    CPPUNIT_ASSERT_EQUAL(size_t(4), mainChain.size());
+    for(unsigned int i = 0; i < mainChain.size(); i++) {
+        CPPUNIT_ASSERT_EQUAL(uint64_t(4 - i), mainChain[i].height);
+        CPPUNIT_ASSERT(mainChain[i].id == blockchain->getBlockByHeight(4 - i).getId());
+        CPPUNIT_ASSERT(mainChain[i].status == CryptoKernel::BlockIndex::Status::MainChain);
+    }
+
+    const CryptoKernel::BlockIndex::Entry saved = blockchain->getAncestry(candidate.getId(), 1).front();
+    CPPUNIT_ASSERT_EQUAL(uint64_t(4), saved.height);
+    CPPUNIT_ASSERT(saved.status == CryptoKernel::BlockIndex::Status::Candidate);
+    CPPUNIT_ASSERT_EQUAL(candidate.getTimestamp(), saved.timestamp);
+
+    // Blocks still extend the reloaded tip
+    consensus->mineBlock(true, "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=");
+    CPPUNIT_ASSERT(blockchain->getBlockByHeight(5).getPreviousBlockId() == tip);
+}
+
+void BlockchainTest::testReorgRestoresSpentOutputs() {
+    CryptoKernel::Crypto crypto(true);
+    const std::string pubKey = crypto.getPublicKey();
+
+    consensus->mineBlock(true, pubKey);
+    const CryptoKernel::uint256 forkPoint = blockchain->getBlockDB("tip").getId();
+    const CryptoKernel::Blockchain::dbOutput out = *blockchain->getUnspentOutputs(pubKey).begin();
+
+    Json::Value outData;
+    outData["publicKey"] = "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=";
+    const CryptoKernel::Blockchain::output out2(out.getValue() - 20000, 0, outData);
+
+    Json::Value spendData;
+    spendData["signature"] = crypto.sign(out.getId().toString() +
+                                         CryptoKernel::Blockchain::transaction::getOutputSetId({out2}).toString());
+    const CryptoKernel::Blockchain::input inp(out.getId(), spendData);
+    const CryptoKernel::Blockchain::transaction tx({inp}, {out2}, 1530888581);
+
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitTransaction(tx)));
+    consensus->mineBlock(true, pubKey);
+    consensus->mineBlock(true, pubKey);
+
+    CPPUNIT_ASSERT_EQUAL(size_t(2), blockchain->getUnspentOutputs(pubKey).size());
+    CPPUNIT_ASSERT_EQUAL(size_t(1), blockchain->getSpentOutputs(pubKey).size());
+    CPPUNIT_ASSERT_EQUAL(0U, blockchain->mempoolCount());
+
+    // Replace the block that spent the output
+    const auto fork1 = makeBlock(forkPoint, false, 11);
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(fork1)));
+    const auto fork2 = makeBlock(fork1.getId(), false, 12);
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(fork2)));
+    const auto fork3 = makeBlock(fork2.getId(), true, 13);
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(fork3)));
+    CPPUNIT_ASSERT(blockchain->getBlockDB("tip").getId() == fork3.getId());
+
+    // The output is unspent again and its spend is back in the mempool
+    const std::set<CryptoKernel::Blockchain::dbOutput> unspent = blockchain->getUnspentOutputs(pubKey);
+    CPPUNIT_ASSERT_EQUAL(size_t(1), unspent.size());
+    CPPUNIT_ASSERT(unspent.begin()->getId() == out.getId());
+    CPPUNIT_ASSERT(blockchain->getSpentOutputs(pubKey).empty());
+    CPPUNIT_ASSERT_THROW(blockchain->getTransaction(tx.getId().toString()),
+                         CryptoKernel::Blockchain::NotFoundException);
+    CPPUNIT_ASSERT_EQUAL(1U, blockchain->mempoolCount());
+
+    // And is mined again on the new chain
+    consensus->mineBlock(true, pubKey);
+    CPPUNIT_ASSERT_EQUAL(0U, blockchain->mempoolCount());
+    CPPUNIT_ASSERT_EQUAL(size_t(1), blockchain->getSpentOutputs(pubKey).size());
+}
+
+void BlockchainTest::testReorgMissingUndo() {
+    CryptoKernel::Crypto crypto(true);
+    const std::string pubKey = crypto.getPublicKey();
+
+    consensus->mineBlock(true, pubKey);
+    const CryptoKernel::uint256 forkPoint = blockchain->getBlockDB("tip").getId();
+    const CryptoKernel::Blockchain::dbOutput out = *blockchain->getUnspentOutputs(pubKey).begin();
+
+    Json::Value outData;
+    outData["publicKey"] = "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=";
+    const CryptoKernel::Blockchain::output out2(out.getValue() - 20000, 0, outData);
+
+    Json::Value spendData;
+    spendData["signature"] = crypto.sign(out.getId().toString() +
+                                         CryptoKernel::Blockchain::transaction::getOutputSetId({out2}).toString());
+    const CryptoKernel::Blockchain::input inp(out.getId(), spendData);
+    const CryptoKernel::Blockchain::transaction tx({inp}, {out2}, 1530888581);
+
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitTransaction(tx)));
+    consensus->mineBlock(true, pubKey);
+    const CryptoKernel::uint256 tip = blockchain->getBlockDB("tip").getId();
+    const auto fork1 = makeBlock(forkPoint, false, 11);
+
+    // Lose the spent output from the undo record of the spending block
+    consensus.reset();
+    blockchain.reset();
+    {
+        CryptoKernel::Storage db("memory:testblockdb", false, 8, false, true);
+        CryptoKernel::Storage::Table undos("undo", 7);
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(db.begin());
+        Json::Value undo;
+        undo["spent"] = Json::Value(Json::objectValue);
+        undos.put(dbTx.get(), tip.toString(), undo);
+        dbTx->commit();
+    }
+
+    blockchain.reset(new testChain(log.get()));
+    consensus.reset(new CryptoKernel::Consensus::Regtest(blockchain.get()));
+    blockchain->loadChain(consensus.get(), "genesistest.json");
+
+    // Disconnecting the block fails rather than restoring a null output
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(fork1)));
+    const auto fork2 = makeBlock(fork1.getId(), true, 12);
+    CPPUNIT_ASSERT_THROW(blockchain->submitBlock(fork2), std::runtime_error);
+    CPPUNIT_ASSERT(blockchain->getBlockDB("tip").getId() == tip);
+    CPPUNIT_ASSERT(blockchain->getUnspentOutputs(pubKey).size() == 1);
+    CPPUNIT_ASSERT_EQUAL(size_t(1), blockchain->getSpentOutputs(pubKey).size());
+}
+
+void BlockchainTest::testUtxoRecovery() {
+    CryptoKernel::Crypto crypto(true);
+    const std::string pubKey = crypto.getPublicKey();
+    const std::string otherKey = "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=";
+
+    // Only the genesis block is flushed
+    consensus->mineBlock(true, pubKey);
+    const CryptoKernel::Blockchain::dbOutput out = *blockchain->getUnspentOutputs(pubKey).begin();
+
+    const auto spend = [&](const uint64_t value) {
+        Json::Value outData;
+        outData["publicKey"] = otherKey;
+        const CryptoKernel::Blockchain::output out2(value, 0, outData);
+
+        Json::Value spendData;
+        spendData["signature"] = crypto.sign(out.getId().toString() +
+                                             CryptoKernel::Blockchain::transaction::getOutputSetId({out2}).toString());
+        const CryptoKernel::Blockchain::input inp(out.getId(), spendData);
+        return CryptoKernel::Blockchain::transaction({inp}, {out2}, 1530888581);
+    };
+
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitTransaction(spend(out.getValue() - 20000))));
+    consensus->mineBlock(true, pubKey);
+    consensus->mineBlock(true, otherKey);
+
+    const auto unspentIds = [](CryptoKernel::Blockchain& chain, const std::string& publicKey) {
+        std::set<std::string> ids;
+        for(const auto& out : chain.getUnspentOutputs(publicKey)) {
+            ids.insert(out.getId().toString());
+        }
+        return ids;
+    };
+
+    const CryptoKernel::uint256 genesisId = blockchain->getBlockByHeight(1).getId();
+    const CryptoKernel::uint256 tip = blockchain->getBlockDB("tip").getId();
+    const CryptoKernel::uint256 offChain = makeBlock(genesisId, false, 1).getId();
+    const std::set<std::string> unspent = unspentIds(*blockchain, pubKey);
+    const std::set<std::string> otherUnspent = unspentIds(*blockchain, otherKey);
+    CPPUNIT_ASSERT_EQUAL(size_t(1), unspent.size());
+    CPPUNIT_ASSERT_EQUAL(size_t(2), otherUnspent.size());
+
+    std::map<std::string, Json::Value> created;
+    for(uint64_t height = 2; height <= 4; height++) {
+        const CryptoKernel::Blockchain::block block = blockchain->getBlockByHeight(height);
+        Json::Value& outputs = created[block.getId().toString()];
+        const auto addOutputs = [&](const CryptoKernel::Blockchain::transaction& tx) {
+            for(const auto& out : tx.getOutputs()) {
+                outputs[out.getId().toString()] = CryptoKernel::Blockchain::dbOutput(out, tx.getId()).toJson();
+            }
+        };
+        addOutputs(block.getCoinbaseTx());
+        for(const auto& tx : block.getTransactions()) {
+            addOutputs(tx);
+        }
+    }
+
+    // Closing flushes the cache, so put the database back as it was before
+    // the flush, as if the node had stopped without closing
+    consensus.reset();
+    blockchain.reset();
+    {
+        CryptoKernel::Storage db("memory:testblockdb", false, 8, false, true);
+        CryptoKernel::Storage::Table utxos("utxos", 3);
+        CryptoKernel::Storage::Table unflushed("unflushed", 8);
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(db.begin());
+        for(const auto& block : created) {
+            for(const std::string& id : block.second.getMemberNames()) {
+                utxos.erase(dbTx.get(), id);
+            }
+            unflushed.put(dbTx.get(), block.first, block.second);
+        }
+        dbTx->put("utxotip", genesisId.toString());
+        dbTx->commit();
+    }
+
+    blockchain.reset(new testChain(log.get()));
+    consensus.reset(new CryptoKernel::Consensus::Regtest(blockchain.get()));
+    blockchain->loadChain(consensus.get(), "genesistest.json");
+
+    CPPUNIT_ASSERT(blockchain->getBlockDB("tip").getId() == tip);
+    CPPUNIT_ASSERT(unspentIds(*blockchain, pubKey) == unspent);
+    CPPUNIT_ASSERT(unspentIds(*blockchain, otherKey) == otherUnspent);
+    for(const std::string& id : otherUnspent) {
+        CPPUNIT_ASSERT_EQUAL(id, blockchain->getOutput(id).getId().toString());
+    }
+
+    // The output spent after the flush stays spent
+    CPPUNIT_ASSERT(!std::get<0>(blockchain->submitTransaction(spend(out.getValue() - 30000))));
+
+    consensus.reset();
+    blockchain.reset();
+    {
+        CryptoKernel::Storage db("memory:testblockdb", false, 8, false, true);
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(db.begin());
+        CPPUNIT_ASSERT_EQUAL(tip.toString(), dbTx->get("utxotip").asString());
+
+        // A flushed block outside the main chain means the table cannot
+        // be trusted
+        dbTx->put("utxotip", offChain.toString());
+        dbTx->commit();
+    }
+
+    blockchain.reset(new testChain(log.get()));
+    consensus.reset(new CryptoKernel::Consensus::Regtest(blockchain.get()));
+    CPPUNIT_ASSERT_THROW(blockchain->loadChain(consensus.get(), "genesistest.json"),
+                         std::runtime_error);
+}
+
+void BlockchainTest::testHeaders() {
+    for(int i = 0; i < 15; i++) {
+        consensus->mineBlock(true, "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=");
+    }
+
+    const CryptoKernel::Blockchain::dbBlock tip = blockchain->getBlockDB("tip");
+    const CryptoKernel::uint256 genesisId = blockchain->getBlockByHeight(1).getId();
+    CPPUNIT_ASSERT_EQUAL(uint64_t(16), tip.getHeight());
+
+    // Dense near the tip, sparse further back and always ending at genesis
+    const std::vector<CryptoKernel::uint256> locator = blockchain->getLocator();
+    CPPUNIT_ASSERT(locator.front() == tip.getId());
+    CPPUNIT_ASSERT(locator.back() == genesisId);
+    CPPUNIT_ASSERT(locator.size() < 16);
+
+    // Headers carry on from the newest locator block we have
+    const CryptoKernel::Blockchain::dbBlock block10 = blockchain->getBlockByHeight(10);
+    const std::vector<CryptoKernel::Blockchain::header> headers = blockchain->getHeaders(
+        {makeBlock(tip.getId(), true, 1).getId(), block10.getId(), genesisId}, 2000);
+    CPPUNIT_ASSERT_EQUAL(size_t(6), headers.size());
+    CPPUNIT_ASSERT(headers.front().getPreviousBlockId() == block10.getId());
+    CPPUNIT_ASSERT(headers.back().getId() == tip.getId());
+
+    const std::vector<CryptoKernel::Blockchain::header> first = blockchain->getHeaders({genesisId}, 3);
+    CPPUNIT_ASSERT_EQUAL(size_t(3), first.size());
+    CPPUNIT_ASSERT_EQUAL(uint64_t(2), first.front().getHeight());
+
+    // A header's id is worked out from its fields, so it survives the wire
+    const CryptoKernel::Blockchain::header fromJson(headers.back().toJson());
+    CPPUNIT_ASSERT(fromJson.getId() == tip.getId());
+    Json::Value tampered = headers.back().toJson();
+    tampered["timestamp"] = tampered["timestamp"].asUInt64() + 1;
+    CPPUNIT_ASSERT(CryptoKernel::Blockchain::header(tampered).getId() != tip.getId());
+    tampered["previousBlockId"] = Json::Value(Json::arrayValue);
+    CPPUNIT_ASSERT_THROW(CryptoKernel::Blockchain::header{tampered},
+                         CryptoKernel::Blockchain::InvalidElementException);
+
+    blockchain->checkHeaders(headers);
+    blockchain->checkHeaders(headers, 3);
+    CPPUNIT_ASSERT_THROW(blockchain->checkHeaders({headers[0], headers[2]}),
+                         CryptoKernel::Blockchain::InvalidElementException);
+
+    // The height is not part of the id, so is checked separately
+    Json::Value wrongHeight = headers[1].toJson();
+    wrongHeight["height"] = wrongHeight["height"].asUInt64() + 1;
+    CPPUNIT_ASSERT_THROW(blockchain->checkHeaders({headers[0],
+                                                   CryptoKernel::Blockchain::header(wrongHeight)}),
+                         CryptoKernel::Blockchain::InvalidElementException);
+
+    Json::Value orphan = headers[1].toJson();
+    orphan["previousBlockId"] = CryptoKernel::uint256(12345).toString();
+    CPPUNIT_ASSERT_THROW(blockchain->checkHeaders({CryptoKernel::Blockchain::header(orphan)}),
+                         CryptoKernel::Blockchain::NotFoundException);
+
+    // Only chains past our tip are worth downloading
+    const CryptoKernel::Blockchain::header longer(makeBlock(tip.getId(), true, 2));
+    const CryptoKernel::Blockchain::header shorter(makeBlock(block10.getId(), true, 3));
+    CPPUNIT_ASSERT(!blockchain->isChainBetter(headers.back()));
+    CPPUNIT_ASSERT(blockchain->isChainBetter(longer));
+    CPPUNIT_ASSERT(!blockchain->isChainBetter(shorter));
+    CPPUNIT_ASSERT(blockchain->isChainBetter(longer, shorter));
+    CPPUNIT_ASSERT(!blockchain->isChainBetter(shorter, longer));
+}
+
+void BlockchainTest::testPowHeaderTargets() {
+    std::unique_ptr<testChain> powChain(new testChain(log.get(), "memory:testpowdb"));
+    CryptoKernel::Consensus::PoW::KGW_SHA256 pow(150, powChain.get(), false, "", log.get());
+    powChain->loadChain(&pow, "genesispowtest.json");
+    pow.start();
+
+    const CryptoKernel::Blockchain::header genesis(powChain->getBlockByHeight(1));
+
+    // A header claiming a target, with the total work and a nonce that
+    // match it
+    const auto makeHeader = [&](const CryptoKernel::Blockchain::header& previous,
+                                const CryptoKernel::uint256& target) {
+        Json::Value headerJson = genesis.toJson();
+        headerJson["previousBlockId"] = previous.getId().toString();
+        headerJson["height"] = previous.getHeight() + 1;
+        headerJson["timestamp"] = previous.getTimestamp() + 150;
+        headerJson.removeMember("transactionMerkleRoot");
+        headerJson["consensusData"]["target"] = target.toString();
+        headerJson["consensusData"]["totalWork"] = ((~target).toBigNum() + CryptoKernel::BigNum(
+                    previous.getConsensusData()["totalWork"].asString())).toString();
+
+        const CryptoKernel::uint256 id = CryptoKernel::Blockchain::header(headerJson).getId();
+        uint64_t nonce = 0;
+        while(pow.calculatePoW(id, nonce) >= target) {
+            nonce++;
+        }
+        headerJson["consensusData"]["nonce"] = nonce;
+
+        return CryptoKernel::Blockchain::header(headerJson);
+    };
+
+    // Every other hash passes a target this easy, yet each header would
+    // claim almost as much work as a real block
+    const CryptoKernel::uint256 easy = CryptoKernel::uint256(1) << 255;
+    CPPUNIT_ASSERT_THROW(powChain->checkHeaders({makeHeader(genesis, easy)}),
+                         CryptoKernel::Blockchain::InvalidElementException);
+
+    // The retargeted one passes, also on top of a header not in the index
+    std::vector<CryptoKernel::Blockchain::header> headers;
+    headers.push_back(makeHeader(genesis, CryptoKernel::KGWRetarget::minDifficulty));
+    headers.push_back(makeHeader(headers.back(), CryptoKernel::KGWRetarget::minDifficulty));
+    powChain->checkHeaders(headers);
+
+    headers.back() = makeHeader(headers.front(), easy);
+    CPPUNIT_ASSERT_THROW(powChain->checkHeaders(headers, 1),
+                         CryptoKernel::Blockchain::InvalidElementException);
+
+    powChain.reset();
+    std::remove("genesispowtest.json");
+    CryptoKernel::Storage::destroy("memory:testpowdb");
+}
@@ -18,6 +18,16 @@ class BlockchainTest : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(testPayToMerkleRoot);
     CPPUNIT_TEST(testPayToMerkleRootScript);
     CPPUNIT_TEST(testPayToMerkleRootMalformed);
+    CPPUNIT_TEST(testMempoolConflictRemoved);
+    CPPUNIT_TEST(testMempoolFeeRateEviction);
+    CPPUNIT_TEST(testMempoolSelection);
+    CPPUNIT_TEST(testReorg);
+    CPPUNIT_TEST(testIndexReload);
+    CPPUNIT_TEST(testReorgRestoresSpentOutputs);
+    CPPUNIT_TEST(testReorgMissingUndo);
+    CPPUNIT_TEST(testUtxoRecovery);
+    CPPUNIT_TEST(testHeaders);
+    CPPUNIT_TEST(testPowHeaderTargets);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -29,7 +39,8 @@ public:
 private:
     class testChain : public CryptoKernel::Blockchain {
         public:
-            testChain(CryptoKernel::Log* GlobalLog);
+            testChain(CryptoKernel::Log* GlobalLog,
+                      const std::string& dbDir = "memory:testblockdb");
             virtual ~testChain();
         private:
             virtual std::string getCoinbaseOwner(const std::string& publicKey);
@@ -47,6 +58,19 @@ private:
     void testPayToMerkleRoot();
     void testPayToMerkleRootScript();
     void testPayToMerkleRootMalformed();
+    void testMempoolConflictRemoved();
+    void testMempoolFeeRateEviction();
+    void testMempoolSelection();
+    void testReorg();
+    void testIndexReload();
+    void testReorgRestoresSpentOutputs();
+    void testReorgMissingUndo();
+    void testUtxoRecovery();
+    void testHeaders();
+    void testPowHeaderTargets();
+
+    CryptoKernel::Blockchain::block makeBlock(const CryptoKernel::uint256& previousBlockId,
+                                              const bool isBetter, const uint64_t nonce);
 
     
     std::unique_ptr<CryptoKernel::Blockchain> blockchain;
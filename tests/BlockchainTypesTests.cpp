@@ -1,6 +1,88 @@
 #include "BlockchainTypesTests.h"
 
+#include <random>
+
 #include "blockchain.h"
+#include "crypto.h"
+
+namespace {
+/**
+* Builds a random json value of every type the writer handles
+*/
+Json::Value randomData(std::mt19937& generator, const unsigned int depth) {
+    std::uniform_int_distribution<int> typeDist(0, depth > 2 ? 5 : 7);
+    switch(typeDist(generator)) {
+        case 0:
+            return Json::Value();
+        case 1:
+            return Json::Value(generator() % 2 == 0);
+        case 2:
+            return Json::Value(static_cast<Json::Int64>(generator()) - (static_cast<Json::Int64>(1) << 31));
+        case 3:
+            return Json::Value(static_cast<Json::UInt64>(generator()) << 20);
+        case 4:
+            return Json::Value(std::ldexp(static_cast<double>(generator()), -16));
+        case 5:
+            if(generator() % 2 == 0) {
+                return Json::Value(CryptoKernel::Crypto::sha256(std::to_string(generator())));
+            } else {
+                // Ascii, including the characters that need escaping
+                std::string str;
+                for(unsigned int i = generator() % 12; i > 0; i--) {
+                    str.push_back(static_cast<char>(1 + generator() % 127));
+                }
+                return Json::Value(str);
+            }
+        case 6: {
+            Json::Value returning(Json::arrayValue);
+            for(unsigned int i = generator() % 4; i > 0; i--) {
+                returning.append(randomData(generator, depth + 1));
+            }
+            return returning;
+        }
+        default: {
+            Json::Value returning(Json::objectValue);
+            for(unsigned int i = generator() % 4; i > 0; i--) {
+                returning["k" + std::to_string(generator() % 10)] = randomData(generator, depth + 1);
+            }
+            return returning;
+        }
+    }
+}
+
+/**
+* Builds a block of unsigned transactions with random data fields
+*/
+CryptoKernel::Blockchain::block randomBlock(std::mt19937& generator, const unsigned int txCount) {
+    std::set<CryptoKernel::Blockchain::transaction> txs;
+    for(unsigned int i = 0; i < txCount; i++) {
+        std::set<CryptoKernel::Blockchain::input> inputs;
+        for(unsigned int j = 0; j < 1 + generator() % 3; j++) {
+            const CryptoKernel::uint256 outputId(CryptoKernel::Crypto::sha256(std::to_string(generator())));
+            inputs.insert(CryptoKernel::Blockchain::input(outputId, randomData(generator, 0)));
+        }
+
+        std::set<CryptoKernel::Blockchain::output> outputs;
+        for(unsigned int j = 0; j < 1 + generator() % 3; j++) {
+            Json::Value data(Json::objectValue);
+            data["value"] = randomData(generator, 0);
+            outputs.insert(CryptoKernel::Blockchain::output(1 + generator(), generator(), data));
+        }
+
+        txs.insert(CryptoKernel::Blockchain::transaction(inputs, outputs, generator()));
+    }
+
+    const CryptoKernel::Blockchain::output reward(100000000, generator(), Json::Value());
+    const CryptoKernel::Blockchain::transaction coinbaseTx({}, {reward}, generator(), true);
+
+    Json::Value data(Json::objectValue);
+    data["note"] = randomData(generator, 0);
+
+    return CryptoKernel::Blockchain::block(txs, coinbaseTx,
+                                           CryptoKernel::uint256(CryptoKernel::Crypto::sha256("prev")),
+                                           generator(), randomData(generator, 0), 1 + generator(), data);
+}
+}
 
 CPPUNIT_TEST_SUITE_REGISTRATION(BlockchainTypesTest);
 
@@ -30,11 +112,152 @@ void BlockchainTypesTest::testOutputId() {
  * invalid
  */
 void BlockchainTypesTest::testTransactionOutputOverflow() {
-    CryptoKernel::BigNum outputToSpend("fffa934e3065e856e16c2f4ee0ec1591f4b80e5150e7cd3c75714d5f8dba2bb3");
+    CryptoKernel::uint256 outputToSpend("fffa934e3065e856e16c2f4ee0ec1591f4b80e5150e7cd3c75714d5f8dba2bb3");
 
     CryptoKernel::Blockchain::input inp(outputToSpend, Json::nullValue);
     CryptoKernel::Blockchain::output out1(std::numeric_limits<uint64_t>::max(), 0, Json::nullValue);
     CryptoKernel::Blockchain::output out2(10, 0, Json::nullValue);
 
     CPPUNIT_ASSERT_THROW(CryptoKernel::Blockchain::transaction({inp}, {out1, out2}, 1), CryptoKernel::Blockchain::InvalidElementException);
-}
\ No newline at end of file
+}
+/**
+* Tests that the sizes worked out from the elements match the json text
+* the size limits are defined on
+*/
+void BlockchainTypesTest::testJsonSize() {
+    std::mt19937 generator(1);
+
+    for(unsigned int i = 0; i < 20; i++) {
+        const CryptoKernel::Blockchain::block testBlock = randomBlock(generator, 5);
+
+        for(const auto& tx : testBlock.getTransactions()) {
+            CPPUNIT_ASSERT_EQUAL(CryptoKernel::Storage::toString(tx.toJson()).size(),
+                                 static_cast<size_t>(tx.size()));
+        }
+
+        const auto& coinbaseTx = testBlock.getCoinbaseTx();
+        CPPUNIT_ASSERT_EQUAL(CryptoKernel::Storage::toString(coinbaseTx.toJson()).size(),
+                             static_cast<size_t>(coinbaseTx.size()));
+    }
+
+    // Blocks with no, one and several transactions, with and without data
+    // and consensus data
+    for(const unsigned int txCount : {0, 1, 2, 7}) {
+        for(unsigned int i = 0; i < 5; i++) {
+            const CryptoKernel::Blockchain::block testBlock = randomBlock(generator, txCount);
+            CPPUNIT_ASSERT(!testBlock.getData().isNull());
+            CPPUNIT_ASSERT_EQUAL(CryptoKernel::Storage::toString(testBlock.toJson()).size(),
+                                 testBlock.jsonSize());
+
+            const CryptoKernel::Blockchain::block bareBlock(testBlock.getTransactions(),
+                    testBlock.getCoinbaseTx(), testBlock.getPreviousBlockId(),
+                    testBlock.getTimestamp(), Json::nullValue, testBlock.getHeight());
+            CPPUNIT_ASSERT_EQUAL(CryptoKernel::Storage::toString(bareBlock.toJson()).size(),
+                                 bareBlock.jsonSize());
+        }
+    }
+}
+
+/**
+* Tests that elements decoded from their binary encoding are the same as
+* the originals, down to their ids and json text
+*/
+void BlockchainTypesTest::testBinaryRoundTrip() {
+    std::mt19937 generator(2);
+
+    for(unsigned int i = 0; i < 20; i++) {
+        const CryptoKernel::Blockchain::block expected = randomBlock(generator, i % 4);
+        const std::string binary = expected.toBinary();
+
+        const CryptoKernel::Blockchain::block actual = CryptoKernel::Blockchain::block::fromBinary(binary);
+        CPPUNIT_ASSERT(expected.getId() == actual.getId());
+        CPPUNIT_ASSERT_EQUAL(CryptoKernel::Storage::toString(expected.toJson()),
+                             CryptoKernel::Storage::toString(actual.toJson()));
+        CPPUNIT_ASSERT(binary == actual.toBinary());
+
+        for(const auto& tx : expected.getTransactions()) {
+            const auto decodedTx = CryptoKernel::Blockchain::transaction::fromBinary(tx.toBinary());
+            CPPUNIT_ASSERT(tx.getId() == decodedTx.getId());
+
+            for(const auto& inp : tx.getInputs()) {
+                CPPUNIT_ASSERT(inp.getId() == CryptoKernel::Blockchain::input::fromBinary(
+                                   inp.toBinary()).getId());
+            }
+
+            for(const auto& out : tx.getOutputs()) {
+                CPPUNIT_ASSERT(out.getId() == CryptoKernel::Blockchain::output::fromBinary(
+                                   out.toBinary()).getId());
+            }
+        }
+
+        const auto& coinbaseTx = expected.getCoinbaseTx();
+        CPPUNIT_ASSERT_THROW(CryptoKernel::Blockchain::transaction::fromBinary(coinbaseTx.toBinary()),
+                             CryptoKernel::Blockchain::InvalidElementException);
+        CPPUNIT_ASSERT(coinbaseTx.getId() == CryptoKernel::Blockchain::transaction::fromBinary(
+                           coinbaseTx.toBinary(), true).getId());
+    }
+}
+
+/**
+* Tests that an element parsed from json text, where integers are signed,
+* has the same encoding as the element it was written from
+*/
+void BlockchainTypesTest::testBinaryFromJson() {
+    std::mt19937 generator(3);
+
+    for(unsigned int i = 0; i < 20; i++) {
+        const CryptoKernel::Blockchain::block expected = randomBlock(generator, 3);
+        const CryptoKernel::Blockchain::block parsed(CryptoKernel::Storage::toJson(
+                    CryptoKernel::Storage::toString(expected.toJson())));
+
+        CPPUNIT_ASSERT(expected.getId() == parsed.getId());
+        CPPUNIT_ASSERT(expected.toBinary() == parsed.toBinary());
+    }
+}
+
+/**
+* Tests that damaged encodings are either rejected or decode to a block
+* whose canonical encoding is exactly the damaged one
+*/
+void BlockchainTypesTest::testBinaryFuzz() {
+    std::mt19937 generator(4);
+
+    const std::string original = randomBlock(generator, 3).toBinary();
+
+    for(unsigned int i = 0; i < 5000; i++) {
+        std::string binary = original;
+        for(unsigned int j = 1 + generator() % 4; j > 0 && !binary.empty(); j--) {
+            const size_t pos = generator() % binary.size();
+            switch(generator() % 4) {
+                case 0:
+                    binary[pos] ^= static_cast<char>(1 << (generator() % 8));
+                    break;
+                case 1:
+                    binary[pos] = static_cast<char>(generator() % 256);
+                    break;
+                case 2:
+                    binary.erase(pos, 1 + generator() % 8);
+                    break;
+                default:
+                    binary.insert(pos, 1, static_cast<char>(generator() % 256));
+                    break;
+            }
+        }
+
+        try {
+            const CryptoKernel::Blockchain::block decoded =
+                CryptoKernel::Blockchain::block::fromBinary(binary);
+
+            CPPUNIT_ASSERT(binary == decoded.toBinary());
+            CPPUNIT_ASSERT(decoded.getId() == CryptoKernel::Blockchain::block(
+                               decoded.toJson()).getId());
+        } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
+        }
+    }
+
+    // Truncations are always rejected
+    for(size_t size = 0; size < original.size(); size++) {
+        CPPUNIT_ASSERT_THROW(CryptoKernel::Blockchain::block::fromBinary(original.substr(0, size)),
+                             CryptoKernel::Blockchain::InvalidElementException);
+    }
+}
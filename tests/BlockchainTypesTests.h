@@ -8,6 +8,10 @@ class BlockchainTypesTest : public CPPUNIT_NS::TestFixture {
 
     CPPUNIT_TEST(testOutputId);
     CPPUNIT_TEST(testTransactionOutputOverflow);
+    CPPUNIT_TEST(testJsonSize);
+    CPPUNIT_TEST(testBinaryRoundTrip);
+    CPPUNIT_TEST(testBinaryFromJson);
+    CPPUNIT_TEST(testBinaryFuzz);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -20,6 +24,10 @@ public:
 private:
     void testOutputId();
     void testTransactionOutputOverflow();
+    void testJsonSize();
+    void testBinaryRoundTrip();
+    void testBinaryFromJson();
+    void testBinaryFuzz();
 
 };
 
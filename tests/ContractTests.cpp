@@ -9,7 +9,7 @@
 
 CPPUNIT_TEST_SUITE_REGISTRATION(ContractTest);
 
-ContractTest::contractTestChain::contractTestChain(CryptoKernel::Log* GlobalLog) : CryptoKernel::Blockchain(GlobalLog, "./testblockdb") {}
+ContractTest::contractTestChain::contractTestChain(CryptoKernel::Log* GlobalLog) : CryptoKernel::Blockchain(GlobalLog, "memory:testblockdb") {}
 
 ContractTest::contractTestChain::~contractTestChain() {}
 
@@ -38,7 +38,7 @@ void ContractTest::tearDown() {
     blockchain.reset();
     consensus.reset();
     std::remove("genesistest.json");
-    CryptoKernel::Storage::destroy("./testblockdb");
+    CryptoKernel::Storage::destroy("memory:testblockdb");
 }
 
 void ContractTest::testSimpleFail() {
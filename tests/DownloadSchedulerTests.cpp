@@ -0,0 +1,168 @@
+#include "DownloadSchedulerTests.h"
+
+#include <atomic>
+#include <thread>
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DownloadSchedulerTest);
+
+namespace {
+CryptoKernel::Blockchain::block makeBlock(const uint64_t height) {
+    Json::Value data;
+    data["publicKey"] = "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=";
+    const CryptoKernel::Blockchain::output reward(100000000, height, data);
+    const CryptoKernel::Blockchain::transaction coinbaseTx({}, {reward}, 1530888581 + height, true);
+
+    return CryptoKernel::Blockchain::block({}, coinbaseTx, CryptoKernel::uint256(height - 1),
+                                           1530888581 + height, Json::Value(), height);
+}
+
+std::vector<CryptoKernel::Blockchain::block> makeBlocks(
+    const CryptoKernel::DownloadScheduler::Range& range) {
+    std::vector<CryptoKernel::Blockchain::block> blocks;
+    for(uint64_t height = range.start; height < range.end; height++) {
+        blocks.push_back(makeBlock(height));
+    }
+    return blocks;
+}
+}
+
+DownloadSchedulerTest::DownloadSchedulerTest() {
+}
+
+DownloadSchedulerTest::~DownloadSchedulerTest() {
+}
+
+void DownloadSchedulerTest::setUp() {
+}
+
+void DownloadSchedulerTest::tearDown() {
+}
+
+void DownloadSchedulerTest::testInOrder() {
+    CryptoKernel::DownloadScheduler scheduler(1, 23, 5, 100, std::chrono::seconds(60));
+    scheduler.addPeer("a", 24);
+    scheduler.addPeer("b", 24);
+
+    CryptoKernel::DownloadScheduler::Range first;
+    CryptoKernel::DownloadScheduler::Range second;
+    CPPUNIT_ASSERT(scheduler.assign("a", first));
+    CPPUNIT_ASSERT(scheduler.assign("b", second));
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), first.start);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(6), first.end);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(6), second.start);
+
+    // Blocks come out in height order whichever range arrives first
+    scheduler.complete("b", second, makeBlocks(second));
+    scheduler.complete("a", first, makeBlocks(first));
+    for(uint64_t height = 1; height < 11; height++) {
+        const auto delivery = scheduler.next();
+        CPPUNIT_ASSERT(delivery);
+        CPPUNIT_ASSERT_EQUAL(height, delivery->block.getHeight());
+        CPPUNIT_ASSERT_EQUAL(std::string(height < 6 ? "a" : "b"), delivery->peer);
+    }
+
+    CryptoKernel::DownloadScheduler::Range range;
+    while(scheduler.assign("a", range)) {
+        scheduler.complete("a", range, makeBlocks(range));
+    }
+    CPPUNIT_ASSERT_EQUAL(uint64_t(24), range.end);
+
+    for(uint64_t height = 11; height < 24; height++) {
+        CPPUNIT_ASSERT_EQUAL(height, scheduler.next()->block.getHeight());
+    }
+    CPPUNIT_ASSERT(!scheduler.next());
+    CPPUNIT_ASSERT(!scheduler.assign("b", range));
+}
+
+void DownloadSchedulerTest::testWindow() {
+    CryptoKernel::DownloadScheduler scheduler(1, 100, 5, 10, std::chrono::seconds(60));
+    scheduler.addPeer("a", 101);
+
+    CryptoKernel::DownloadScheduler::Range first;
+    CryptoKernel::DownloadScheduler::Range second;
+    CPPUNIT_ASSERT(scheduler.assign("a", first));
+    CPPUNIT_ASSERT(scheduler.assign("a", second));
+
+    // The window is full until the first blocks are taken
+    std::atomic<bool> assigned(false);
+    CryptoKernel::DownloadScheduler::Range third;
+    std::thread waiter([&]() {
+        assigned = scheduler.assign("a", third);
+    });
+
+    scheduler.complete("a", first, makeBlocks(first));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CPPUNIT_ASSERT(!assigned);
+
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), scheduler.next()->block.getHeight());
+    waiter.join();
+    CPPUNIT_ASSERT(assigned);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(11), third.start);
+}
+
+void DownloadSchedulerTest::testStalledRange() {
+    CryptoKernel::DownloadScheduler scheduler(1, 5, 5, 100, std::chrono::milliseconds(20));
+    scheduler.addPeer("slow", 6);
+    scheduler.addPeer("fast", 6);
+
+    CryptoKernel::DownloadScheduler::Range slowRange;
+    CPPUNIT_ASSERT(scheduler.assign("slow", slowRange));
+
+    // Waits until the slow peer's range stalls, then takes it over
+    CryptoKernel::DownloadScheduler::Range fastRange;
+    CPPUNIT_ASSERT(scheduler.assign("fast", fastRange));
+    CPPUNIT_ASSERT_EQUAL(slowRange.start, fastRange.start);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), scheduler.getReassigned());
+
+    scheduler.complete("fast", fastRange, makeBlocks(fastRange));
+    scheduler.complete("slow", slowRange, makeBlocks(slowRange));
+    for(uint64_t height = 1; height < 6; height++) {
+        const auto delivery = scheduler.next();
+        CPPUNIT_ASSERT_EQUAL(height, delivery->block.getHeight());
+        CPPUNIT_ASSERT_EQUAL(std::string("fast"), delivery->peer);
+    }
+    CPPUNIT_ASSERT(!scheduler.next());
+}
+
+void DownloadSchedulerTest::testFailures() {
+    CryptoKernel::DownloadScheduler scheduler(1, 20, 5, 100, std::chrono::seconds(60));
+    scheduler.addPeer("short", 6);
+    scheduler.addPeer("full", 21);
+
+    // A peer only gets ranges it has all the blocks of
+    CryptoKernel::DownloadScheduler::Range range;
+    CPPUNIT_ASSERT(scheduler.assign("short", range));
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), range.start);
+    scheduler.fail("short", range);
+    CPPUNIT_ASSERT(scheduler.assign("short", range));
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), range.start);
+
+    // Only part of the range arrived, so the rest is downloaded again
+    std::vector<CryptoKernel::Blockchain::block> blocks = makeBlocks(range);
+    blocks.erase(blocks.begin() + 3, blocks.end());
+    scheduler.complete("short", range, blocks);
+    for(uint64_t height = 1; height < 4; height++) {
+        CPPUNIT_ASSERT_EQUAL(height, scheduler.next()->block.getHeight());
+    }
+
+    CPPUNIT_ASSERT(scheduler.assign("short", range));
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), range.start);
+    scheduler.complete("short", range, makeBlocks(range));
+    CPPUNIT_ASSERT(!scheduler.assign("short", range));
+    CPPUNIT_ASSERT_EQUAL(uint64_t(4), scheduler.next()->block.getHeight());
+    CPPUNIT_ASSERT_EQUAL(uint64_t(5), scheduler.next()->block.getHeight());
+
+    // With the only peer that has them gone, the rest never arrive
+    CPPUNIT_ASSERT(scheduler.assign("full", range));
+    CPPUNIT_ASSERT_EQUAL(uint64_t(6), range.start);
+    scheduler.removePeer("full");
+    CPPUNIT_ASSERT(!scheduler.next());
+    CPPUNIT_ASSERT(!scheduler.assign("full", range));
+
+    scheduler.addPeer("full", 21);
+    CPPUNIT_ASSERT(scheduler.assign("full", range));
+    CPPUNIT_ASSERT_EQUAL(uint64_t(6), range.start);
+    scheduler.cancel();
+    CPPUNIT_ASSERT(!scheduler.assign("full", range));
+    CPPUNIT_ASSERT(!scheduler.next());
+}
@@ -0,0 +1,31 @@
+#ifndef DOWNLOADSCHEDULERTEST_H
+#define DOWNLOADSCHEDULERTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "downloadscheduler.h"
+
+class DownloadSchedulerTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(DownloadSchedulerTest);
+
+    CPPUNIT_TEST(testInOrder);
+    CPPUNIT_TEST(testWindow);
+    CPPUNIT_TEST(testStalledRange);
+    CPPUNIT_TEST(testFailures);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    DownloadSchedulerTest();
+    virtual ~DownloadSchedulerTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testInOrder();
+    void testWindow();
+    void testStalledRange();
+    void testFailures();
+};
+
+#endif
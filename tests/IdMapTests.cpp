@@ -0,0 +1,148 @@
+#include <map>
+#include <vector>
+
+#include "IdMapTests.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(IdMapTest);
+
+namespace {
+CryptoKernel::uint256 makeId(const uint64_t low, const uint64_t high = 0) {
+    return (CryptoKernel::uint256(high) << 192) + CryptoKernel::uint256(low);
+}
+}
+
+IdMapTest::IdMapTest() {
+}
+
+IdMapTest::~IdMapTest() {
+}
+
+void IdMapTest::setUp() {
+}
+
+void IdMapTest::tearDown() {
+}
+
+void IdMapTest::testInsertFind() {
+    CryptoKernel::IdMap<std::string> map;
+    CPPUNIT_ASSERT(map.empty());
+    CPPUNIT_ASSERT(map.find(makeId(1)) == nullptr);
+
+    for(uint64_t i = 0; i < 1000; i++) {
+        CPPUNIT_ASSERT(map.insert(makeId(i), std::to_string(i)));
+    }
+
+    CPPUNIT_ASSERT_EQUAL(size_t(1000), map.size());
+
+    // Existing values are kept
+    CPPUNIT_ASSERT(!map.insert(makeId(5), "other"));
+    CPPUNIT_ASSERT_EQUAL(std::string("5"), *map.find(makeId(5)));
+
+    for(uint64_t i = 0; i < 1000; i++) {
+        const std::string* value = map.find(makeId(i));
+        CPPUNIT_ASSERT(value != nullptr);
+        CPPUNIT_ASSERT_EQUAL(std::to_string(i), *value);
+    }
+
+    CPPUNIT_ASSERT(!map.contains(makeId(1000)));
+
+    map.clear();
+    CPPUNIT_ASSERT(map.empty());
+    CPPUNIT_ASSERT(!map.contains(makeId(5)));
+}
+
+void IdMapTest::testErase() {
+    CryptoKernel::IdMap<uint64_t> map;
+    std::map<uint64_t, uint64_t> expected;
+
+    // Interleaved inserts and erases against an ordered map
+    for(uint64_t i = 0; i < 5000; i++) {
+        const uint64_t key = (i * 7919) % 1500;
+        if(i % 3 == 0) {
+            CPPUNIT_ASSERT_EQUAL(expected.erase(key) > 0, map.erase(makeId(key)));
+        } else {
+            CPPUNIT_ASSERT_EQUAL(expected.insert(std::make_pair(key, i)).second,
+                                 map.insert(makeId(key), i));
+        }
+    }
+
+    CPPUNIT_ASSERT_EQUAL(expected.size(), map.size());
+    for(uint64_t key = 0; key < 1500; key++) {
+        const uint64_t* value = map.find(makeId(key));
+        const auto it = expected.find(key);
+        if(it == expected.end()) {
+            CPPUNIT_ASSERT(value == nullptr);
+        } else {
+            CPPUNIT_ASSERT(value != nullptr);
+            CPPUNIT_ASSERT_EQUAL(it->second, *value);
+        }
+    }
+}
+
+void IdMapTest::testCollisions() {
+    // A table filled to its limit, where entries share probe runs and
+    // some wrap past the end, must keep them reachable after erasing from
+    // the middle of a run
+    CryptoKernel::IdMap<uint64_t> map;
+    map.reserve(8);
+
+    std::vector<CryptoKernel::uint256> ids;
+    for(uint64_t i = 0; i < 8; i++) {
+        ids.push_back(makeId(i, i));
+        CPPUNIT_ASSERT(map.insert(ids.back(), i));
+    }
+
+    for(uint64_t i = 0; i < 8; i += 2) {
+        CPPUNIT_ASSERT(map.erase(ids[i]));
+        CPPUNIT_ASSERT(!map.erase(ids[i]));
+    }
+
+    for(uint64_t i = 0; i < 8; i++) {
+        CPPUNIT_ASSERT_EQUAL(i % 2 == 1, map.contains(ids[i]));
+    }
+
+    for(uint64_t i = 0; i < 8; i += 2) {
+        CPPUNIT_ASSERT(map.insert(ids[i], i));
+    }
+
+    for(uint64_t i = 0; i < 8; i++) {
+        CPPUNIT_ASSERT_EQUAL(i, *map.find(ids[i]));
+    }
+}
+
+void IdMapTest::testForEach() {
+    CryptoKernel::IdMap<uint64_t> map;
+    for(uint64_t i = 0; i < 100; i++) {
+        map.insert(makeId(i), i);
+    }
+
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    map.forEach([&](const CryptoKernel::uint256& key, const uint64_t& value) {
+        CPPUNIT_ASSERT(key == makeId(value));
+        count++;
+        sum += value;
+    });
+
+    CPPUNIT_ASSERT_EQUAL(uint64_t(100), count);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(4950), sum);
+}
+
+void IdMapTest::testSet() {
+    CryptoKernel::IdSet set;
+    CPPUNIT_ASSERT(set.insert(makeId(1)));
+    CPPUNIT_ASSERT(!set.insert(makeId(1)));
+    CPPUNIT_ASSERT(set.insert(makeId(2)));
+    CPPUNIT_ASSERT_EQUAL(size_t(2), set.size());
+
+    CPPUNIT_ASSERT(set.erase(makeId(1)));
+    CPPUNIT_ASSERT(!set.contains(makeId(1)));
+    CPPUNIT_ASSERT(set.contains(makeId(2)));
+
+    unsigned int visited = 0;
+    set.forEach([&](const CryptoKernel::uint256& key) {
+        CPPUNIT_ASSERT(key == makeId(2));
+        visited++;
+    });
+    CPPUNIT_ASSERT_EQUAL(1U, visited);
+}
@@ -0,0 +1,33 @@
+#ifndef IDMAPTEST_H
+#define IDMAPTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "idmap.h"
+
+class IdMapTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(IdMapTest);
+
+    CPPUNIT_TEST(testInsertFind);
+    CPPUNIT_TEST(testErase);
+    CPPUNIT_TEST(testCollisions);
+    CPPUNIT_TEST(testForEach);
+    CPPUNIT_TEST(testSet);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    IdMapTest();
+    virtual ~IdMapTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testInsertFind();
+    void testErase();
+    void testCollisions();
+    void testForEach();
+    void testSet();
+};
+
+#endif
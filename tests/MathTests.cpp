@@ -1,7 +1,28 @@
+#include <random>
+#include <vector>
+
 #include "MathTests.h"
 
 CPPUNIT_TEST_SUITE_REGISTRATION(MathTest);
 
+namespace {
+// Shifting is checked at compile time as well
+static_assert((~CryptoKernel::uint256() >> 255) == CryptoKernel::uint256(1), "uint256 shift");
+static_assert(CryptoKernel::uint256(3) * CryptoKernel::uint256(5) > CryptoKernel::uint256(14),
+              "uint256 multiply");
+
+/**
+* Makes a random value with the given number of significant bits at most
+*/
+CryptoKernel::uint256 randomValue(std::mt19937_64& generator, const unsigned int bits) {
+    CryptoKernel::uint256 value;
+    for(unsigned int i = 0; i < 4; i++) {
+        value = (value << 64) + CryptoKernel::uint256(generator());
+    }
+    return bits == 0 ? CryptoKernel::uint256() : value >> (256 - bits);
+}
+}
+
 MathTest::MathTest() {
 }
 
@@ -76,3 +97,121 @@ void MathTest::testEmptyOperand() {
 
     CPPUNIT_ASSERT_EQUAL(expected, actual);
 }
+
+void MathTest::testUint256Convert() {
+    for(const std::string hex : {"0", "1", "abc381023c383def",
+                                 "639d30b6811f703aac5a8296e4878e7ab6eeadf9b05e2821390ed0776bdd96be",
+                                 "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"}) {
+        const CryptoKernel::BigNum value(hex);
+        const CryptoKernel::uint256 converted(value);
+
+        CPPUNIT_ASSERT_EQUAL(hex, converted.toString());
+        CPPUNIT_ASSERT_EQUAL(value.toString(), converted.toString());
+        CPPUNIT_ASSERT(converted.toBigNum() == value);
+    }
+
+    CPPUNIT_ASSERT(CryptoKernel::uint256() == CryptoKernel::uint256(CryptoKernel::BigNum("0")));
+}
+
+void MathTest::testUint256Order() {
+    const std::string first = "aBc381023c383Def";
+    const std::string second = "bAc391045cEE3Dfe";
+    const std::string third = "1" + std::string(60, '0');
+
+    const CryptoKernel::uint256 a((CryptoKernel::BigNum(first)));
+    const CryptoKernel::uint256 b((CryptoKernel::BigNum(second)));
+    const CryptoKernel::uint256 c((CryptoKernel::BigNum(third)));
+
+    CPPUNIT_ASSERT(a < b);
+    CPPUNIT_ASSERT(!(b < a));
+    CPPUNIT_ASSERT(b < c);
+    CPPUNIT_ASSERT(!(a < a));
+    CPPUNIT_ASSERT(a != b);
+
+    const CryptoKernel::uint256::Hasher hasher;
+    CPPUNIT_ASSERT_EQUAL(hasher(a), hasher(CryptoKernel::uint256(CryptoKernel::BigNum(first))));
+}
+
+void MathTest::testUint256OutOfRange() {
+    CPPUNIT_ASSERT_THROW(CryptoKernel::uint256(CryptoKernel::BigNum("1" + std::string(64, '0'))),
+                         std::runtime_error);
+    CPPUNIT_ASSERT_THROW(CryptoKernel::uint256(CryptoKernel::BigNum("-1")), std::runtime_error);
+}
+
+void MathTest::testUint256Parse() {
+    // Parsed the way BigNum parses, stopping at the first non-hex character
+    for(const std::string& hex : std::vector<std::string>{"", "0", "xyz", "12xyz", "ABCdef", "-0", "-xyz",
+                                                           std::string(70, '0') + "1f"}) {
+        CPPUNIT_ASSERT_EQUAL(CryptoKernel::BigNum(hex).toString(), CryptoKernel::uint256(hex).toString());
+    }
+
+    CPPUNIT_ASSERT_THROW(CryptoKernel::uint256("-5"), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(CryptoKernel::uint256("1" + std::string(64, '0')), std::runtime_error);
+
+    const CryptoKernel::uint256 value("639d30b6811f703aac5a8296e4878e7ab6eeadf9b05e2821390ed0776bdd96be");
+    unsigned char bytes[32];
+    value.toBytes(bytes);
+    CPPUNIT_ASSERT_EQUAL(static_cast<unsigned int>(0x63), static_cast<unsigned int>(bytes[0]));
+    CPPUNIT_ASSERT_EQUAL(static_cast<unsigned int>(0xbe), static_cast<unsigned int>(bytes[31]));
+    CPPUNIT_ASSERT(CryptoKernel::uint256::fromBytes(bytes) == value);
+    CPPUNIT_ASSERT_EQUAL(255U, value.bits());
+}
+
+void MathTest::testUint256Arithmetic() {
+    // Against BigNum, on values where neither wraps
+    std::mt19937_64 generator(12345);
+    for(unsigned int i = 0; i < 500; i++) {
+        const CryptoKernel::uint256 a = randomValue(generator, generator() % 257);
+        const CryptoKernel::uint256 b = randomValue(generator, generator() % 257);
+        const CryptoKernel::uint256& larger = a < b ? b : a;
+        const CryptoKernel::uint256& smaller = a < b ? a : b;
+
+        CPPUNIT_ASSERT_EQUAL((larger.toBigNum() - smaller.toBigNum()).toString(),
+                             (larger - smaller).toString());
+        CPPUNIT_ASSERT_EQUAL(a.toBigNum() < b.toBigNum(), a < b);
+
+        const CryptoKernel::uint256 halfA = a >> 129;
+        const CryptoKernel::uint256 halfB = b >> 129;
+        CPPUNIT_ASSERT_EQUAL((halfA.toBigNum() + halfB.toBigNum()).toString(),
+                             (halfA + halfB).toString());
+        CPPUNIT_ASSERT_EQUAL((halfA.toBigNum() * halfB.toBigNum()).toString(),
+                             (halfA * halfB).toString());
+
+        if(b != CryptoKernel::uint256()) {
+            CPPUNIT_ASSERT_EQUAL((a.toBigNum() / b.toBigNum()).toString(), (a / b).toString());
+        }
+
+        const CryptoKernel::uint256 small(generator() % 1000 + 1);
+        CPPUNIT_ASSERT_EQUAL((a.toBigNum() / small.toBigNum()).toString(), (a / small).toString());
+    }
+
+    // Wrapping at 2^256
+    const CryptoKernel::uint256 max = ~CryptoKernel::uint256();
+    CPPUNIT_ASSERT(max + CryptoKernel::uint256(1) == CryptoKernel::uint256());
+    CPPUNIT_ASSERT(CryptoKernel::uint256() - CryptoKernel::uint256(1) == max);
+    CPPUNIT_ASSERT(max * max == CryptoKernel::uint256(1));
+
+    CPPUNIT_ASSERT_THROW(max / CryptoKernel::uint256(), std::runtime_error);
+}
+
+void MathTest::testUint256MulDiv() {
+    std::mt19937_64 generator(54321);
+    for(unsigned int i = 0; i < 500; i++) {
+        const CryptoKernel::uint256 value = randomValue(generator, generator() % 257);
+        const uint64_t mul = generator() >> (generator() % 64);
+        const uint64_t div = (generator() >> (generator() % 64)) | 1;
+
+        const CryptoKernel::BigNum expected = value.toBigNum() *
+                                              CryptoKernel::uint256(mul).toBigNum() /
+                                              CryptoKernel::uint256(div).toBigNum();
+        const CryptoKernel::uint256 actual = value.mulDiv(mul, div);
+
+        if(expected > (~CryptoKernel::uint256()).toBigNum()) {
+            CPPUNIT_ASSERT(actual == ~CryptoKernel::uint256());
+        } else {
+            CPPUNIT_ASSERT_EQUAL(expected.toString(), actual.toString());
+        }
+    }
+
+    CPPUNIT_ASSERT_THROW(CryptoKernel::uint256(1).mulDiv(1, 0), std::runtime_error);
+}
@@ -14,6 +14,12 @@ class MathTest : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(testDivide);
     CPPUNIT_TEST(testHexGreater);
     CPPUNIT_TEST(testEmptyOperand);
+    CPPUNIT_TEST(testUint256Convert);
+    CPPUNIT_TEST(testUint256Order);
+    CPPUNIT_TEST(testUint256OutOfRange);
+    CPPUNIT_TEST(testUint256Parse);
+    CPPUNIT_TEST(testUint256Arithmetic);
+    CPPUNIT_TEST(testUint256MulDiv);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -30,6 +36,12 @@ private:
     void testDivide();
     void testHexGreater();
     void testEmptyOperand();
+    void testUint256Convert();
+    void testUint256Order();
+    void testUint256OutOfRange();
+    void testUint256Parse();
+    void testUint256Arithmetic();
+    void testUint256MulDiv();
 };
 
 #endif
@@ -19,6 +19,7 @@ class MerkletreeTest : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(testProofSerialize);
     CPPUNIT_TEST(testProofDeserialize);
     CPPUNIT_TEST(testProofDeserializeInvalid);
+    CPPUNIT_TEST(testCalculateRoot);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -43,6 +44,7 @@ private:
     void testProofSerialize();
     void testProofDeserialize();
     void testProofDeserializeInvalid();
+    void testCalculateRoot();
 };
 
 #endif
\ No newline at end of file
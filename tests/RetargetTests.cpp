@@ -0,0 +1,268 @@
+#include <math.h>
+#include <random>
+
+#include "RetargetTests.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(RetargetTest);
+
+namespace {
+const uint64_t blockTarget = 150;
+
+CryptoKernel::uint256 readTarget(const CryptoKernel::BlockIndex::Entry& entry) {
+    return CryptoKernel::uint256(entry.consensusData["target"].asString());
+}
+
+/**
+* The retarget as it was before the window, scanning the ancestors of the
+* block every time
+*/
+CryptoKernel::uint256 scanTarget(const CryptoKernel::BlockIndex& index,
+                                 const CryptoKernel::uint256& previousBlockId) {
+    const uint64_t minBlocks = 144;
+    const uint64_t maxBlocks = 4032;
+    constexpr CryptoKernel::uint256 minDifficulty = ~CryptoKernel::uint256() >> 20;
+
+    const CryptoKernel::BlockIndex::Entry lastSolved = index.getAncestry(previousBlockId,
+            1).front();
+
+    if(lastSolved.height < minBlocks) {
+        return minDifficulty;
+    } else if(lastSolved.height % 12 != 0) {
+        return readTarget(lastSolved);
+    }
+
+    const std::vector<CryptoKernel::BlockIndex::Entry> ancestry = index.getAncestry(
+                previousBlockId, maxBlocks);
+    uint64_t blocksScanned = 0;
+    CryptoKernel::uint256 difficultyAverage;
+    CryptoKernel::uint256 previousDifficultyAverage;
+    int64_t actualRate = 0;
+    int64_t targetRate = 0;
+    double rateAdjustmentRatio = 1.0;
+    double eventHorizonDeviation = 0.0;
+    double eventHorizonDeviationFast = 0.0;
+    double eventHorizonDeviationSlow = 0.0;
+
+    for(unsigned int i = 1; i <= ancestry.size() && ancestry[i - 1].height != 1; i++) {
+        const CryptoKernel::BlockIndex::Entry& currentBlock = ancestry[i - 1];
+        const CryptoKernel::uint256 currentTarget = readTarget(currentBlock);
+
+        blocksScanned++;
+
+        if(i == 1) {
+            difficultyAverage = currentTarget;
+        } else {
+            const CryptoKernel::uint256 count(i);
+            if(currentTarget >= previousDifficultyAverage) {
+                difficultyAverage = previousDifficultyAverage +
+                                    (currentTarget - previousDifficultyAverage) / count;
+            } else {
+                difficultyAverage = previousDifficultyAverage -
+                                    (previousDifficultyAverage - currentTarget) / count;
+            }
+        }
+
+        previousDifficultyAverage = difficultyAverage;
+
+        actualRate = lastSolved.timestamp - currentBlock.timestamp;
+        targetRate = blockTarget * blocksScanned;
+        rateAdjustmentRatio = 1.0;
+
+        if(actualRate < 0) {
+            actualRate = 0;
+        }
+
+        if(actualRate != 0 && targetRate != 0) {
+            rateAdjustmentRatio = double(targetRate) / double(actualRate);
+        }
+
+        eventHorizonDeviation = 1 + (0.7084 * pow((double(blocksScanned)/double(minBlocks)),
+                                     -1.228));
+        eventHorizonDeviationFast = eventHorizonDeviation;
+        eventHorizonDeviationSlow = 1 / eventHorizonDeviation;
+
+        if(blocksScanned >= minBlocks) {
+            if((rateAdjustmentRatio <= eventHorizonDeviationSlow) ||
+                    (rateAdjustmentRatio >= eventHorizonDeviationFast)) {
+                break;
+            }
+        }
+    }
+
+    CryptoKernel::uint256 newTarget = difficultyAverage;
+    if(actualRate != 0 && targetRate != 0) {
+        newTarget = newTarget.mulDiv(actualRate, targetRate);
+    }
+
+    if(newTarget > minDifficulty) {
+        newTarget = minDifficulty;
+    }
+
+    return newTarget;
+}
+
+/**
+* Builds chains of blocks whose spacing and targets drift, so retargets
+* stop scanning at varied depths
+*/
+class ChainBuilder {
+public:
+    ChainBuilder() : rng(1530888581) {
+        spacing = blockTarget;
+    }
+
+    /**
+    * Adds a block on top of another, or a genesis block if the previous id
+    * is zero
+    *
+    * @return the id of the new block
+    */
+    CryptoKernel::uint256 add(const CryptoKernel::uint256& previousId) {
+        CryptoKernel::BlockIndex::Entry entry;
+        entry.id = CryptoKernel::uint256(index.size() + 1);
+        entry.previousId = previousId;
+        entry.height = 1;
+        entry.timestamp = 1530888581;
+        if(previousId != CryptoKernel::uint256()) {
+            const CryptoKernel::BlockIndex::Entry previous = index.get(previousId);
+            entry.height = previous.height + 1;
+            // Clocks disagree, so timestamps sometimes go backwards
+            entry.timestamp = previous.timestamp + rng() % (2 * spacing) - spacing / 4;
+        }
+
+        if(rng() % 200 == 0) {
+            const uint64_t spacings[] = {10, 60, blockTarget, 400, 1200};
+            spacing = spacings[rng() % 5];
+        }
+
+        const CryptoKernel::uint256 target = (CryptoKernel::KGWRetarget::minDifficulty >>
+                                              (rng() % 6)) - CryptoKernel::uint256(rng());
+        entry.consensusData["target"] = target.toString();
+        entry.status = CryptoKernel::BlockIndex::Status::Candidate;
+
+        index.add(entry);
+        return entry.id;
+    }
+
+    /**
+    * Adds blocks on top of another
+    *
+    * @return the ids added, oldest first
+    */
+    std::vector<CryptoKernel::uint256> extend(const CryptoKernel::uint256& from,
+                                              const uint64_t count) {
+        std::vector<CryptoKernel::uint256> ids;
+        CryptoKernel::uint256 previous = from;
+        for(uint64_t i = 0; i < count; i++) {
+            previous = add(previous);
+            ids.push_back(previous);
+        }
+        return ids;
+    }
+
+    CryptoKernel::KGWRetarget::Ancestry ancestry() const {
+        const CryptoKernel::BlockIndex* source = &index;
+        return [source](const CryptoKernel::uint256& id, const size_t count) {
+            return source->getAncestry(id, count);
+        };
+    }
+
+    CryptoKernel::BlockIndex index;
+    std::mt19937_64 rng;
+
+private:
+    uint64_t spacing;
+};
+
+/**
+* Checks the window gives the scanned target after a block
+*/
+void checkTarget(ChainBuilder& chain, CryptoKernel::KGWRetarget& retarget,
+                 const CryptoKernel::uint256& previousBlockId) {
+    const CryptoKernel::uint256 expected = scanTarget(chain.index, previousBlockId);
+    CPPUNIT_ASSERT_EQUAL(expected.toString(),
+                         retarget.calculateTarget(previousBlockId).toString());
+}
+}
+
+RetargetTest::RetargetTest() {
+}
+
+RetargetTest::~RetargetTest() {
+}
+
+void RetargetTest::setUp() {
+}
+
+void RetargetTest::tearDown() {
+}
+
+void RetargetTest::testShortChain() {
+    ChainBuilder chain;
+    CryptoKernel::KGWRetarget retarget(blockTarget, chain.ancestry(), readTarget);
+
+    const std::vector<CryptoKernel::uint256> ids = chain.extend(CryptoKernel::uint256(), 300);
+    for(uint64_t height = 1; height <= ids.size(); height++) {
+        const CryptoKernel::uint256 target = retarget.calculateTarget(ids[height - 1]);
+        if(height < CryptoKernel::KGWRetarget::minBlocks) {
+            CPPUNIT_ASSERT(target == CryptoKernel::KGWRetarget::minDifficulty);
+        } else if(height % CryptoKernel::KGWRetarget::interval != 0) {
+            CPPUNIT_ASSERT(target == readTarget(chain.index.get(ids[height - 1])));
+        }
+        CPPUNIT_ASSERT(target == scanTarget(chain.index, ids[height - 1]));
+    }
+
+    CPPUNIT_ASSERT_THROW(retarget.calculateTarget(CryptoKernel::uint256(1000)),
+                         std::runtime_error);
+}
+
+void RetargetTest::testMatchesScan() {
+    ChainBuilder chain;
+    CryptoKernel::KGWRetarget retarget(blockTarget, chain.ancestry(), readTarget);
+
+    // Past a full window, so the oldest blocks have to drop out
+    const std::vector<CryptoKernel::uint256> ids = chain.extend(CryptoKernel::uint256(), 6000);
+    for(const CryptoKernel::uint256& id : ids) {
+        checkTarget(chain, retarget, id);
+    }
+
+    // Going back down the chain, as disconnecting blocks does
+    for(uint64_t height = ids.size(); height > 4000; height -= 12) {
+        checkTarget(chain, retarget, ids[height - 1]);
+    }
+
+    retarget.clear();
+    checkTarget(chain, retarget, ids.back());
+}
+
+void RetargetTest::testReorgs() {
+    ChainBuilder chain;
+    CryptoKernel::KGWRetarget retarget(blockTarget, chain.ancestry(), readTarget);
+
+    std::vector<CryptoKernel::uint256> mainChain = chain.extend(CryptoKernel::uint256(), 4500);
+    checkTarget(chain, retarget, mainChain.back());
+
+    for(unsigned int round = 0; round < 40; round++) {
+        // Mostly short forks, with the odd one deeper than the window
+        uint64_t depth = 1 + chain.rng() % 30;
+        if(round % 10 == 9) {
+            depth = 1000 + chain.rng() % 4000;
+        }
+        depth = std::min<uint64_t>(depth, mainChain.size() - 1);
+
+        const uint64_t forkHeight = mainChain.size() - depth;
+        const std::vector<CryptoKernel::uint256> branch = chain.extend(
+                    mainChain[forkHeight - 1], depth + 1 + chain.rng() % 24);
+
+        for(const CryptoKernel::uint256& id : branch) {
+            checkTarget(chain, retarget, id);
+        }
+
+        // Back to the old tip, as a block building on it would be checked
+        checkTarget(chain, retarget, mainChain.back());
+
+        mainChain.resize(forkHeight);
+        mainChain.insert(mainChain.end(), branch.begin(), branch.end());
+        checkTarget(chain, retarget, mainChain.back());
+    }
+}
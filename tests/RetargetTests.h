@@ -0,0 +1,29 @@
+#ifndef RETARGETTEST_H
+#define RETARGETTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "retarget.h"
+
+class RetargetTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(RetargetTest);
+
+    CPPUNIT_TEST(testShortChain);
+    CPPUNIT_TEST(testMatchesScan);
+    CPPUNIT_TEST(testReorgs);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    RetargetTest();
+    virtual ~RetargetTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testShortChain();
+    void testMatchesScan();
+    void testReorgs();
+};
+
+#endif
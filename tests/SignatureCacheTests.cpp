@@ -0,0 +1,118 @@
+#include "SignatureCacheTests.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SignatureCacheTest);
+
+SignatureCacheTest::SignatureCacheTest() {
+}
+
+SignatureCacheTest::~SignatureCacheTest() {
+}
+
+void SignatureCacheTest::setUp() {
+}
+
+void SignatureCacheTest::tearDown() {
+}
+
+void SignatureCacheTest::testHit() {
+    CryptoKernel::SignatureCache cache(10);
+
+    unsigned int checks = 0;
+    const auto check = [&]() {
+        checks++;
+        return true;
+    };
+
+    CPPUNIT_ASSERT(cache.verify("ecdsa", "key", "message", "sig", check));
+    CPPUNIT_ASSERT(cache.verify("ecdsa", "key", "message", "sig", check));
+    CPPUNIT_ASSERT_EQUAL(1U, checks);
+
+    const CryptoKernel::SignatureCache::Stats stats = cache.getStats();
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), stats.hits);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), stats.misses);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), stats.entries);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(10), stats.capacity);
+}
+
+void SignatureCacheTest::testInvalidNotCached() {
+    CryptoKernel::SignatureCache cache(10);
+
+    unsigned int checks = 0;
+    const auto check = [&]() {
+        checks++;
+        return false;
+    };
+
+    CPPUNIT_ASSERT(!cache.verify("ecdsa", "key", "message", "sig", check));
+    CPPUNIT_ASSERT(!cache.verify("ecdsa", "key", "message", "sig", check));
+    CPPUNIT_ASSERT_EQUAL(2U, checks);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(0), cache.getStats().entries);
+}
+
+void SignatureCacheTest::testDistinctFields() {
+    CryptoKernel::SignatureCache cache(10);
+
+    CPPUNIT_ASSERT(cache.verify("ecdsa", "ab", "c", "sig", []() {
+        return true;
+    }));
+
+    // Moving bytes between fields must not reuse the entry
+    unsigned int checks = 0;
+    const auto check = [&]() {
+        checks++;
+        return false;
+    };
+
+    CPPUNIT_ASSERT(!cache.verify("ecdsa", "a", "bc", "sig", check));
+    CPPUNIT_ASSERT(!cache.verify("ecdsa", "ab", "c", "sig2", check));
+    CPPUNIT_ASSERT(!cache.verify("ecdsa", "ab", "csig", "", check));
+    CPPUNIT_ASSERT_EQUAL(3U, checks);
+}
+
+void SignatureCacheTest::testEviction() {
+    CryptoKernel::SignatureCache cache(3);
+
+    const auto valid = []() {
+        return true;
+    };
+
+    for(unsigned int i = 0; i < 5; i++) {
+        CPPUNIT_ASSERT(cache.verify("ecdsa", "key", std::to_string(i), "sig", valid));
+    }
+
+    CPPUNIT_ASSERT_EQUAL(uint64_t(3), cache.getStats().entries);
+
+    // The oldest entries went first
+    unsigned int checks = 0;
+    const auto check = [&]() {
+        checks++;
+        return true;
+    };
+
+    CPPUNIT_ASSERT(cache.verify("ecdsa", "key", "4", "sig", check));
+    CPPUNIT_ASSERT(cache.verify("ecdsa", "key", "2", "sig", check));
+    CPPUNIT_ASSERT_EQUAL(0U, checks);
+    CPPUNIT_ASSERT(cache.verify("ecdsa", "key", "0", "sig", check));
+    CPPUNIT_ASSERT_EQUAL(1U, checks);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(3), cache.getStats().entries);
+}
+
+void SignatureCacheTest::testDistinctSchemes() {
+    CryptoKernel::SignatureCache cache(10);
+
+    CPPUNIT_ASSERT(cache.verify("schnorr", "key", "message", "sig", []() {
+        return true;
+    }));
+
+    // A signature found valid as Schnorr must still be checked as ECDSA
+    unsigned int checks = 0;
+    const auto check = [&]() {
+        checks++;
+        return false;
+    };
+
+    CPPUNIT_ASSERT(!cache.verify("ecdsa", "key", "message", "sig", check));
+    CPPUNIT_ASSERT(!cache.verify("aggregate", "key", "message", "sig", check));
+    CPPUNIT_ASSERT_EQUAL(2U, checks);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(0), cache.getStats().hits);
+}
@@ -0,0 +1,33 @@
+#ifndef SIGNATURECACHETEST_H
+#define SIGNATURECACHETEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "sigcache.h"
+
+class SignatureCacheTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(SignatureCacheTest);
+
+    CPPUNIT_TEST(testHit);
+    CPPUNIT_TEST(testInvalidNotCached);
+    CPPUNIT_TEST(testDistinctFields);
+    CPPUNIT_TEST(testDistinctSchemes);
+    CPPUNIT_TEST(testEviction);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    SignatureCacheTest();
+    virtual ~SignatureCacheTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testHit();
+    void testInvalidNotCached();
+    void testDistinctFields();
+    void testDistinctSchemes();
+    void testEviction();
+};
+
+#endif
@@ -1,13 +1,71 @@
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+
 #include "StorageTests.h"
 
 CPPUNIT_TEST_SUITE_REGISTRATION(StorageTest);
 
+namespace {
+// Memory engine that counts writes and can hold the next write until released
+class GatedEngine : public CryptoKernel::MemoryEngine {
+public:
+    GatedEngine(const std::string& name) : CryptoKernel::MemoryEngine(name) {
+        writes = 0;
+        gated = false;
+        entered = false;
+    }
+
+    void write(WriteBatch* batch, const bool sync) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            writes++;
+            entered = true;
+            condition.notify_all();
+            condition.wait(lock, [&]{ return !gated; });
+        }
+        CryptoKernel::MemoryEngine::write(batch, sync);
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        gated = true;
+        entered = false;
+    }
+
+    void waitForWrite() {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]{ return entered; });
+    }
+
+    void open() {
+        std::lock_guard<std::mutex> lock(mutex);
+        gated = false;
+        condition.notify_all();
+    }
+
+    unsigned int writes;
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool gated;
+    bool entered;
+};
+}
+
 StorageTest::StorageTest() {
     CryptoKernel::Storage::destroy("./testdb");
 }
 
 StorageTest::~StorageTest() {
     CryptoKernel::Storage::destroy("./testdb");
+    CryptoKernel::Storage::destroy("./testmigratedb");
+    CryptoKernel::Storage::destroy("./testcachedb");
+    CryptoKernel::Storage::destroy("memory:testdb");
 }
 
 void StorageTest::setUp() {
@@ -147,3 +205,827 @@ void StorageTest::testIterator() {
 
     CPPUNIT_ASSERT(!it->Valid());
 }
+
+void StorageTest::testBinaryRoundTrip() {
+    Json::Value expected;
+    expected["myval"] = "this";
+    expected["anumber"][0] = 4;
+    expected["anumber"][1] = -5;
+    expected["big"] = Json::Value(Json::UInt64(18446744073709551615ULL));
+    expected["real"] = 0.1;
+    expected["flag"] = true;
+    expected["nothing"] = Json::nullValue;
+    expected["nested"]["empty"] = Json::Value(Json::objectValue);
+    expected["nested"]["list"] = Json::Value(Json::arrayValue);
+
+    const std::string binary = CryptoKernel::Storage::toBinary(expected);
+
+    CPPUNIT_ASSERT_EQUAL(expected, CryptoKernel::Storage::fromBinary(binary));
+    CPPUNIT_ASSERT(binary.size() < CryptoKernel::Storage::toString(expected).size());
+}
+
+void StorageTest::testBinaryIdPacking() {
+    Json::Value expected;
+    expected["id"] = "f2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd2";
+    expected["shortId"] = "2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd";
+    expected["leadingZero"] = "0f2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26f";
+    expected["upperCase"] = "F2CA1BB6C7E907D06DAFE4687E579FCE76B37E4E93B7605022DA52E6CCC26FD2";
+
+    const std::string binary = CryptoKernel::Storage::toBinary(expected);
+
+    CPPUNIT_ASSERT_EQUAL(expected, CryptoKernel::Storage::fromBinary(binary));
+
+    Json::Value idOnly = expected["id"];
+    CPPUNIT_ASSERT_EQUAL(size_t(2 + 1 + 32), CryptoKernel::Storage::toBinary(idOnly).size());
+}
+
+void StorageTest::testBinaryMalformed() {
+    Json::Value expected;
+    expected["myval"] = "this";
+
+    std::string binary = CryptoKernel::Storage::toBinary(expected);
+    binary.resize(binary.size() - 1);
+
+    Json::Value actual;
+    CPPUNIT_ASSERT_NO_THROW(actual = CryptoKernel::Storage::fromBinary(binary));
+    CPPUNIT_ASSERT(actual.isNull());
+}
+
+void StorageTest::testBinaryMigration() {
+    CryptoKernel::Storage::Table myTable("myTable");
+
+    Json::Value dataToStore;
+    dataToStore["myval"] = "this1";
+    dataToStore["id"] = "f2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd2";
+
+    {
+        CryptoKernel::Storage database("./testmigratedb", false, 10, true);
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+        myTable.put(dbTx.get(), "1", dataToStore);
+        dbTx->commit();
+    }
+
+    CryptoKernel::Storage database("./testmigratedb", false, 10, true, true);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    CPPUNIT_ASSERT_EQUAL(dataToStore, myTable.get(dbTx.get(), "1"));
+    dbTx->abort();
+
+    std::unique_ptr<CryptoKernel::Storage::Table::Iterator> it(new
+            CryptoKernel::Storage::Table::Iterator(&myTable, &database));
+
+    it->SeekToFirst();
+
+    CPPUNIT_ASSERT(it->Valid());
+    CPPUNIT_ASSERT_EQUAL(std::string("1"), it->key());
+    CPPUNIT_ASSERT_EQUAL(dataToStore, it->value());
+}
+
+void StorageTest::testValueCache() {
+    CryptoKernel::Storage::destroy("./testcachedb");
+    CryptoKernel::Storage database("./testcachedb", false, 10, true, true, 1);
+
+    Json::Value dataToStore;
+    dataToStore["myval"] = "this";
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    dbTx->put("mydata", dataToStore);
+    dbTx->commit();
+
+    dbTx.reset(database.begin());
+    CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("mydata"));
+    CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("mydata"));
+    CPPUNIT_ASSERT(dbTx->get("missing").isNull());
+    CPPUNIT_ASSERT(dbTx->get("missing").isNull());
+
+    CryptoKernel::Storage::CacheStats stats = database.getCacheStats();
+    CPPUNIT_ASSERT_EQUAL(uint64_t(2), stats.hits);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(2), stats.misses);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(2), stats.entries);
+
+    dataToStore["myval"] = "that";
+    dbTx->put("mydata", dataToStore);
+    dbTx->put("missing", dataToStore);
+    dbTx->commit();
+
+    dbTx.reset(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("mydata"));
+    CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("missing"));
+    CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("mydata"));
+
+    stats = database.getCacheStats();
+    CPPUNIT_ASSERT_EQUAL(uint64_t(3), stats.hits);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(4), stats.misses);
+}
+
+void StorageTest::testValueCacheSnapshot() {
+    CryptoKernel::Storage::destroy("./testcachedb");
+    CryptoKernel::Storage database("./testcachedb", false, 10, true, true, 1);
+
+    Json::Value oldData;
+    oldData["myval"] = "old";
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    dbTx->put("mydata", oldData);
+    dbTx->commit();
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> readTx(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(oldData, readTx->get("mydata"));
+
+    Json::Value newData;
+    newData["myval"] = "new";
+
+    dbTx.reset(database.begin());
+    dbTx->put("mydata", newData);
+    dbTx->commit();
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> newReadTx(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(newData, newReadTx->get("mydata"));
+
+    // The older snapshot must not be served the newer cached value
+    CPPUNIT_ASSERT_EQUAL(oldData, readTx->get("mydata"));
+}
+
+void StorageTest::testValueCacheBounded() {
+    CryptoKernel::Storage::destroy("./testcachedb");
+    CryptoKernel::Storage database("./testcachedb", false, 10, true, true, 1);
+
+    Json::Value dataToStore;
+    dataToStore["myval"] = std::string(1000, 'a');
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    for(unsigned int i = 0; i < 5000; i++) {
+        dbTx->put(std::to_string(i), dataToStore);
+    }
+    dbTx->commit();
+
+    dbTx.reset(database.beginReadOnly());
+    for(unsigned int i = 0; i < 5000; i++) {
+        CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get(std::to_string(i)));
+    }
+
+    const CryptoKernel::Storage::CacheStats stats = database.getCacheStats();
+    CPPUNIT_ASSERT(stats.bytes <= stats.capacity);
+    CPPUNIT_ASSERT(stats.entries > 0);
+    CPPUNIT_ASSERT(stats.entries < 5000);
+
+    // The most recently read value is still cached
+    CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("4999"));
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1), database.getCacheStats().hits);
+}
+
+void StorageTest::testConcurrentWriters() {
+    CryptoKernel::Storage::destroy("./testdb");
+    CryptoKernel::Storage database("./testdb", false, 10, true);
+
+    Json::Value dataToStore;
+    dataToStore["myval"] = "this";
+
+    // Two writers may be open at once and commit disjoint changes
+    std::unique_ptr<CryptoKernel::Storage::Transaction> firstTx(database.begin());
+    std::unique_ptr<CryptoKernel::Storage::Transaction> secondTx(database.begin());
+
+    firstTx->put("first", dataToStore);
+    secondTx->put("second", dataToStore);
+
+    CPPUNIT_ASSERT_NO_THROW(firstTx->commit());
+    CPPUNIT_ASSERT_NO_THROW(secondTx->commit());
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("first"));
+    CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("second"));
+}
+
+void StorageTest::testConflict() {
+    CryptoKernel::Storage::destroy("./testdb");
+    CryptoKernel::Storage database("./testdb", false, 10, true);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    dbTx->put("counter", Json::Value(0));
+    dbTx->commit();
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> firstTx(database.begin());
+    std::unique_ptr<CryptoKernel::Storage::Transaction> secondTx(database.begin());
+    std::unique_ptr<CryptoKernel::Storage::Transaction> blindTx(database.begin());
+
+    firstTx->put("counter", firstTx->get("counter").asUInt64() + 1);
+    secondTx->put("counter", secondTx->get("counter").asUInt64() + 1);
+    blindTx->put("counter", Json::Value(5));
+
+    CPPUNIT_ASSERT_NO_THROW(firstTx->commit());
+    CPPUNIT_ASSERT_THROW(secondTx->commit(), CryptoKernel::Storage::ConflictException);
+    CPPUNIT_ASSERT(secondTx->ended());
+
+    // Writes that do not depend on a read never conflict
+    CPPUNIT_ASSERT_NO_THROW(blindTx->commit());
+
+    dbTx.reset(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(uint64_t(5), dbTx->get("counter").asUInt64());
+}
+
+void StorageTest::testIteratorSnapshot() {
+    CryptoKernel::Storage::destroy("./testdb");
+    CryptoKernel::Storage database("./testdb", false, 10, true);
+
+    CryptoKernel::Storage::Table myTable("myTable");
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    myTable.put(dbTx.get(), "1", Json::Value(1));
+    dbTx->commit();
+
+    // Iterating while a writer is open must not block
+    dbTx.reset(database.begin());
+    myTable.put(dbTx.get(), "2", Json::Value(2));
+
+    std::unique_ptr<CryptoKernel::Storage::Table::Iterator> it(new
+            CryptoKernel::Storage::Table::Iterator(&myTable, &database));
+
+    dbTx->commit();
+
+    unsigned int count = 0;
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        count++;
+    }
+
+    CPPUNIT_ASSERT_EQUAL(1U, count);
+
+    it.reset(new CryptoKernel::Storage::Table::Iterator(&myTable, &database));
+
+    count = 0;
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        count++;
+    }
+
+    CPPUNIT_ASSERT_EQUAL(2U, count);
+}
+
+void StorageTest::testConcurrentStress() {
+    CryptoKernel::Storage::destroy("./testdb");
+    CryptoKernel::Storage database("./testdb", false, 10, true, true, 1);
+
+    CryptoKernel::Storage::Table myTable("myTable");
+
+    const unsigned int writers = 4;
+    const unsigned int readers = 4;
+    const unsigned int commitsPerWriter = 500;
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    myTable.put(dbTx.get(), "shared", Json::Value(0));
+    dbTx->commit();
+    dbTx.reset();
+
+    std::atomic<bool> writing(true);
+
+    std::vector<std::thread> threads;
+    for(unsigned int i = 0; i < writers; i++) {
+        threads.emplace_back([&, i]() {
+            for(unsigned int j = 0; j < commitsPerWriter; j++) {
+                // Each commit updates a private key and increments a shared
+                // counter, retrying when another writer got there first
+                while(true) {
+                    std::unique_ptr<CryptoKernel::Storage::Transaction> tx(database.begin());
+                    myTable.put(tx.get(), std::to_string(i) + "/" + std::to_string(j), Json::Value(j));
+                    myTable.put(tx.get(), "shared",
+                                myTable.get(tx.get(), "shared").asUInt64() + 1);
+                    try {
+                        tx->commit();
+                        break;
+                    } catch(const CryptoKernel::Storage::ConflictException& e) {
+                    }
+                }
+            }
+        });
+    }
+
+    for(unsigned int i = 0; i < readers; i++) {
+        threads.emplace_back([&]() {
+            while(writing) {
+                std::unique_ptr<CryptoKernel::Storage::Table::Iterator> it(new
+                        CryptoKernel::Storage::Table::Iterator(&myTable, &database));
+                for(it->SeekToFirst(); it->Valid(); it->Next()) {
+                    it->value();
+                }
+            }
+        });
+    }
+
+    for(unsigned int i = 0; i < writers; i++) {
+        threads[i].join();
+    }
+
+    writing = false;
+
+    for(unsigned int i = writers; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    dbTx.reset(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(uint64_t(writers * commitsPerWriter),
+                         myTable.get(dbTx.get(), "shared").asUInt64());
+    CPPUNIT_ASSERT_EQUAL(uint64_t(commitsPerWriter - 1),
+                         myTable.get(dbTx.get(), std::to_string(writers - 1) + "/" +
+                                     std::to_string(commitsPerWriter - 1)).asUInt64());
+}
+
+void StorageTest::testCompactKeys() {
+    CryptoKernel::Storage::destroy("./testdb");
+    CryptoKernel::Storage database("./testdb", false, 10, true, true);
+
+    CryptoKernel::Storage::Table myTable("myTable", 1);
+
+    const std::string fullId = "f2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd2";
+    const std::string shortId = "2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd";
+    const std::string paddedId = "00ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd2";
+
+    CPPUNIT_ASSERT_EQUAL(size_t(2 + 34), myTable.getKey(fullId).size());
+    CPPUNIT_ASSERT_EQUAL(size_t(2 + 34), myTable.getKey(shortId).size());
+    CPPUNIT_ASSERT_EQUAL(size_t(2 + 3), myTable.getKey("tip").size());
+    CPPUNIT_ASSERT(myTable.getKey(fullId) != myTable.getKey(fullId, 0));
+
+    const std::vector<std::string> keys = {fullId, shortId, paddedId, "tip", "12345",
+                                           "owner/" + fullId, std::string(70, 'a')};
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    for(unsigned int i = 0; i < keys.size(); i++) {
+        myTable.put(dbTx.get(), keys[i], Json::Value(i));
+    }
+    dbTx->commit();
+
+    dbTx.reset(database.beginReadOnly());
+    for(unsigned int i = 0; i < keys.size(); i++) {
+        CPPUNIT_ASSERT_EQUAL(Json::Value(i), myTable.get(dbTx.get(), keys[i]));
+        CPPUNIT_ASSERT_EQUAL(keys[i], myTable.fromKey(myTable.getKey(keys[i])));
+    }
+
+    std::set<std::string> found;
+    std::unique_ptr<CryptoKernel::Storage::Table::Iterator> it(new
+            CryptoKernel::Storage::Table::Iterator(&myTable, &database));
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        found.insert(it->key());
+    }
+
+    CPPUNIT_ASSERT(found == std::set<std::string>(keys.begin(), keys.end()));
+}
+
+void StorageTest::testCompactPrefix() {
+    CryptoKernel::Storage::destroy("./testdb");
+    CryptoKernel::Storage database("./testdb", false, 10, true, true);
+
+    CryptoKernel::Storage::Table myTable("myTable", 1);
+    CryptoKernel::Storage::Table otherTable("otherTable", 2);
+
+    const std::string firstId = "f2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd2";
+    const std::string secondId = "2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd";
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    myTable.put(dbTx.get(), "BMVPkH+/ab=/" + firstId, Json::nullValue, 0);
+    myTable.put(dbTx.get(), "BMVPkH+/ab=/" + secondId, Json::nullValue, 0);
+    myTable.put(dbTx.get(), "BMVPkH+/ac=/" + firstId, Json::nullValue, 0);
+    myTable.put(dbTx.get(), "BMVPkH+/ab=/" + firstId, Json::Value(1));
+    otherTable.put(dbTx.get(), "BMVPkH+/ab=/" + firstId, Json::nullValue, 0);
+    dbTx->commit();
+
+    std::set<std::string> found;
+    std::unique_ptr<CryptoKernel::Storage::Table::Iterator> it(new
+            CryptoKernel::Storage::Table::Iterator(&myTable, &database, nullptr, "BMVPkH+/ab=/", 0));
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        found.insert(it->key());
+    }
+
+    CPPUNIT_ASSERT_EQUAL(size_t(2), found.size());
+    CPPUNIT_ASSERT(found.count(firstId) == 1);
+    CPPUNIT_ASSERT(found.count(secondId) == 1);
+
+    it->Seek(firstId);
+    CPPUNIT_ASSERT(it->Valid());
+    CPPUNIT_ASSERT_EQUAL(firstId, it->key());
+}
+
+void StorageTest::testRekey() {
+    CryptoKernel::Storage::destroy("./testdb");
+
+    CryptoKernel::Storage::Table textTable("myTable");
+    CryptoKernel::Storage::Table compactTable("myTable", 1);
+
+    const std::string id = "f2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd2";
+
+    {
+        CryptoKernel::Storage database("./testdb", false, 10, true);
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+        textTable.put(dbTx.get(), id, Json::Value(1));
+        textTable.put(dbTx.get(), "tip", Json::Value(2));
+        textTable.put(dbTx.get(), "dropme", Json::Value(3));
+        dbTx->commit();
+    }
+
+    CryptoKernel::Storage database("./testdb", false, 10, true, true, 1);
+
+    unsigned int calls = 0;
+    const auto toCompact = [&](const std::string& key) {
+        calls++;
+        if(key.compare(0, 8, "myTable/") != 0) {
+            return key;
+        }
+
+        const std::string tableKey = textTable.fromKey(key);
+        return tableKey == "dropme" ? std::string() : compactTable.getKey(tableKey);
+    };
+
+    database.rekey("testKeys", toCompact);
+    CPPUNIT_ASSERT_EQUAL(3U, calls);
+
+    // Only ever runs once
+    database.rekey("testKeys", toCompact);
+    CPPUNIT_ASSERT_EQUAL(3U, calls);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(Json::Value(1), compactTable.get(dbTx.get(), id));
+    CPPUNIT_ASSERT_EQUAL(Json::Value(2), compactTable.get(dbTx.get(), "tip"));
+    CPPUNIT_ASSERT(compactTable.get(dbTx.get(), "dropme").isNull());
+    CPPUNIT_ASSERT(textTable.get(dbTx.get(), id).isNull());
+}
+
+void StorageTest::testMemoryEngine() {
+    CryptoKernel::Storage::destroy("memory:testdb");
+
+    CryptoKernel::Storage::Table myTable("myTable", 1);
+
+    {
+        CryptoKernel::Storage database("memory:testdb", false, 0, false, true);
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+        myTable.put(dbTx.get(), "a", Json::Value(1));
+        myTable.put(dbTx.get(), "b", Json::Value(2));
+        myTable.put(dbTx.get(), "c", Json::Value(3));
+        dbTx->commit();
+
+        dbTx.reset(database.begin());
+        myTable.erase(dbTx.get(), "b");
+        dbTx->commit();
+
+        // The store is only opened once at a time, like a database on disk
+        CPPUNIT_ASSERT_THROW(CryptoKernel::Storage("memory:testdb", false, 0, false),
+                             std::runtime_error);
+    }
+
+    // Reopening by name sees the previous contents
+    {
+        CryptoKernel::Storage database("memory:testdb", false, 0, false, true);
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.beginReadOnly());
+        CPPUNIT_ASSERT_EQUAL(Json::Value(1), myTable.get(dbTx.get(), "a"));
+        CPPUNIT_ASSERT(myTable.get(dbTx.get(), "b").isNull());
+        CPPUNIT_ASSERT_EQUAL(Json::Value(3), myTable.get(dbTx.get(), "c"));
+
+        std::string keys;
+        CryptoKernel::Storage::Table::Iterator it(&myTable, &database);
+        for(it.SeekToFirst(); it.Valid(); it.Next()) {
+            keys += it.key();
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string("ac"), keys);
+    }
+
+    CryptoKernel::Storage::destroy("memory:testdb");
+
+    CryptoKernel::Storage database("memory:testdb", false, 0, false, true);
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.beginReadOnly());
+    CPPUNIT_ASSERT(myTable.get(dbTx.get(), "a").isNull());
+}
+
+void StorageTest::testMemoryEngineSnapshot() {
+    CryptoKernel::MemoryEngine::destroy("testdb");
+    CryptoKernel::MemoryEngine engine("testdb");
+
+    std::unique_ptr<CryptoKernel::StorageEngine::WriteBatch> batch(engine.newBatch());
+    batch->put("a", "1");
+    batch->put("b", "1");
+    batch->put("c", "1");
+    engine.write(batch.get(), false);
+
+    const CryptoKernel::StorageEngine::Snapshot* snapshot = engine.getSnapshot();
+    std::unique_ptr<CryptoKernel::StorageEngine::Iterator> it(engine.newIterator());
+
+    batch->clear();
+    batch->put("a", "2");
+    batch->erase("b");
+    batch->put("d", "2");
+    engine.write(batch.get(), false);
+
+    std::string value;
+    CPPUNIT_ASSERT(engine.get("a", &value, snapshot));
+    CPPUNIT_ASSERT_EQUAL(std::string("1"), value);
+    CPPUNIT_ASSERT(engine.get("b", &value, snapshot));
+    CPPUNIT_ASSERT(!engine.get("d", &value, snapshot));
+
+    CPPUNIT_ASSERT(engine.get("a", &value));
+    CPPUNIT_ASSERT_EQUAL(std::string("2"), value);
+    CPPUNIT_ASSERT(!engine.get("b", &value));
+
+    // An iterator sees the state when it was created, in both directions
+    std::string keys;
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        keys += it->key().ToString() + it->value().ToString();
+    }
+    CPPUNIT_ASSERT_EQUAL(std::string("a1b1c1"), keys);
+
+    keys.clear();
+    for(it->SeekToLast(); it->Valid(); it->Prev()) {
+        keys += it->key().ToString();
+    }
+    CPPUNIT_ASSERT_EQUAL(std::string("cba"), keys);
+
+    engine.releaseSnapshot(snapshot);
+    it.reset(engine.newIterator());
+
+    keys.clear();
+    for(it->Seek("b"); it->Valid(); it->Next()) {
+        keys += it->key().ToString() + it->value().ToString();
+    }
+    CPPUNIT_ASSERT_EQUAL(std::string("c1d2"), keys);
+}
+
+void StorageTest::testIteratorRange() {
+    CryptoKernel::Storage::destroy("./testdb");
+    CryptoKernel::Storage database("./testdb", false, 10, true, true);
+
+    const std::string id = "f2ca1bb6c7e907d06dafe4687e579fce76b37e4e93b7605022da52e6ccc26fd2";
+
+    for(const unsigned char tableId : {0, 1}) {
+        CryptoKernel::Storage::Table myTable("myTable", tableId);
+        CryptoKernel::Storage::Table otherTable("myTablf", tableId == 0 ? 0 : tableId + 1);
+
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+        for(const std::string owner : {"a", "b", "c"}) {
+            for(unsigned int i = 0; i < 3; i++) {
+                myTable.put(dbTx.get(), owner + "/" + std::to_string(i) + id, Json::Value(i), 0);
+            }
+        }
+        myTable.put(dbTx.get(), "x", Json::Value(1));
+        otherTable.put(dbTx.get(), "y", Json::Value(2), 0);
+        dbTx->commit();
+
+        CryptoKernel::Storage::Table::Iterator it(&myTable, &database, nullptr, "b/", 0);
+
+        std::vector<std::string> keys;
+        for(it.SeekToLast(); it.Valid(); it.Prev()) {
+            keys.push_back(it.keySlice().ToString());
+        }
+        CPPUNIT_ASSERT_EQUAL(size_t(3), keys.size());
+        CPPUNIT_ASSERT_EQUAL("2" + id, keys[0]);
+        CPPUNIT_ASSERT_EQUAL("0" + id, keys[2]);
+
+        it.setUpperBound("2");
+
+        keys.clear();
+        for(it.Seek("1"); it.Valid(); it.Next()) {
+            keys.push_back(it.key());
+            CPPUNIT_ASSERT_EQUAL(1U, it.value().asUInt());
+            CPPUNIT_ASSERT(it.rawValue() == leveldb::Slice(CryptoKernel::Storage::toBinary(Json::Value(1U))));
+        }
+        CPPUNIT_ASSERT_EQUAL(size_t(1), keys.size());
+        CPPUNIT_ASSERT_EQUAL("1" + id, keys[0]);
+
+        it.SeekToLast();
+        CPPUNIT_ASSERT(it.Valid());
+        CPPUNIT_ASSERT_EQUAL("1" + id, it.key());
+
+        // A table prefix must not run into the table after it
+        CryptoKernel::Storage::Table::Iterator all(&myTable, &database, nullptr, "", 0);
+        unsigned int count = 0;
+        for(all.SeekToLast(); all.Valid(); all.Prev()) {
+            count++;
+        }
+        CPPUNIT_ASSERT_EQUAL(9U, count);
+    }
+}
+
+void StorageTest::testProfile() {
+    CryptoKernel::LevelDBEngine::Options defaults;
+    defaults.cache = 8;
+
+    const CryptoKernel::LevelDBEngine::Options profile = CryptoKernel::Storage::loadProfile(
+                CryptoKernel::Storage::toJson("{\"writeBuffer\": 64, \"compression\": false}"),
+                defaults);
+    CPPUNIT_ASSERT_EQUAL(8U, profile.cache);
+    CPPUNIT_ASSERT_EQUAL(64U, profile.writeBuffer);
+    CPPUNIT_ASSERT_EQUAL(1000U, profile.maxOpenFiles);
+    CPPUNIT_ASSERT(!profile.compression);
+
+    CPPUNIT_ASSERT_EQUAL(8U, CryptoKernel::Storage::loadProfile(Json::Value(), defaults).cache);
+
+    CryptoKernel::Storage::destroy("./testdb");
+    CryptoKernel::Storage database("./testdb", false, defaults, true);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    dbTx->put("mydata", Json::Value(1));
+    dbTx->commit();
+
+    // Nothing may be reading from the database while it is reopened
+    CPPUNIT_ASSERT(!database.reopen(profile));
+    dbTx.reset();
+
+    CPPUNIT_ASSERT(database.reopen(profile));
+
+    dbTx.reset(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(Json::Value(1), dbTx->get("mydata"));
+}
+
+void StorageTest::testGroupCommit() {
+    CryptoKernel::MemoryEngine::destroy("testgroupdb");
+    GatedEngine* engine = new GatedEngine("testgroupdb");
+    CryptoKernel::Storage database(engine, true, true);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    dbTx->put("counter", Json::Value(0));
+    dbTx->commit();
+    const unsigned int writes = engine->writes;
+
+    // Stage four transactions up front so they all read the counter before
+    // any of them commits
+    std::atomic<unsigned int> staged(0);
+    std::atomic<bool> go(false);
+    std::atomic<unsigned int> conflicts(0);
+    std::vector<std::thread> threads;
+    for(unsigned int i = 0; i < 4; i++) {
+        threads.emplace_back([&, i]() {
+            std::unique_ptr<CryptoKernel::Storage::Transaction> tx(database.begin());
+            tx->put("key" + std::to_string(i), Json::Value(i));
+            if(i < 2) {
+                tx->put("counter", tx->get("counter").asUInt() + 1);
+            }
+
+            staged++;
+            while(!go) {
+                std::this_thread::yield();
+            }
+
+            try {
+                tx->commit();
+            } catch(const CryptoKernel::Storage::ConflictException& e) {
+                conflicts++;
+            }
+        });
+    }
+
+    while(staged < 4) {
+        std::this_thread::yield();
+    }
+
+    // Hold the next commit in its write so the staged ones queue up behind it
+    engine->close();
+    std::thread first([&]() {
+        std::unique_ptr<CryptoKernel::Storage::Transaction> tx(database.begin());
+        tx->put("first", Json::Value(1));
+        tx->commit();
+    });
+    engine->waitForWrite();
+
+    go = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    engine->open();
+
+    first.join();
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    // The four queued commits were written together, and the two that read
+    // the counter cannot both have succeeded
+    CPPUNIT_ASSERT_EQUAL(writes + 2, engine->writes);
+    CPPUNIT_ASSERT_EQUAL(1U, conflicts.load());
+
+    dbTx.reset(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(Json::Value(1), dbTx->get("first"));
+    CPPUNIT_ASSERT_EQUAL(1U, dbTx->get("counter").asUInt());
+    unsigned int written = 0;
+    for(unsigned int i = 0; i < 4; i++) {
+        if(!dbTx->get("key" + std::to_string(i)).isNull()) {
+            written++;
+        }
+    }
+    CPPUNIT_ASSERT_EQUAL(3U, written);
+}
+
+void StorageTest::testMetrics() {
+    CryptoKernel::Storage::destroy("memory:testdb");
+    CryptoKernel::Storage database("memory:testdb", false, 0, false, true);
+    CryptoKernel::Storage::Table table("myTable", 1);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    table.put(dbTx.get(), "a", Json::Value("one"));
+    table.put(dbTx.get(), "b", Json::Value("two"));
+    dbTx->put("mydata", Json::Value(1));
+    dbTx->commit();
+
+    dbTx.reset(database.begin());
+    table.erase(dbTx.get(), "b");
+    dbTx->commit();
+
+    dbTx.reset(database.beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(std::string("one"), table.get(dbTx.get(), "a").asString());
+    CPPUNIT_ASSERT(table.get(dbTx.get(), "b").isNull());
+    {
+        CryptoKernel::Storage::Table::Iterator it(&table, &database);
+        for(it.SeekToFirst(); it.Valid(); it.Next()) {
+            CPPUNIT_ASSERT_EQUAL(std::string("one"), it.value().asString());
+        }
+    }
+    dbTx.reset();
+
+    const Json::Value metrics = database.getMetrics();
+    CPPUNIT_ASSERT_EQUAL(2U, metrics["commits"].asUInt());
+    CPPUNIT_ASSERT_EQUAL(0U, metrics["conflicts"].asUInt());
+    CPPUNIT_ASSERT_EQUAL(2U, metrics["commitLatency"]["count"].asUInt());
+
+    const Json::Value& tableMetrics = metrics["tables"]["myTable"];
+    CPPUNIT_ASSERT_EQUAL(2U, tableMetrics["puts"].asUInt());
+    CPPUNIT_ASSERT_EQUAL(1U, tableMetrics["erases"].asUInt());
+    CPPUNIT_ASSERT_EQUAL(2U, tableMetrics["gets"].asUInt());
+    CPPUNIT_ASSERT_EQUAL(2U, tableMetrics["getLatency"]["count"].asUInt());
+    CPPUNIT_ASSERT(tableMetrics["bytesRead"].asUInt() > 0);
+    CPPUNIT_ASSERT(tableMetrics["bytesWritten"].asUInt() > 0);
+    CPPUNIT_ASSERT_EQUAL(1U, tableMetrics["scans"].asUInt());
+    CPPUNIT_ASSERT_EQUAL(1U, tableMetrics["rowsScanned"].asUInt());
+    CPPUNIT_ASSERT_EQUAL(1U, tableMetrics["scanLatency"]["count"].asUInt());
+
+    CPPUNIT_ASSERT_EQUAL(1U, metrics["tables"]["other"]["puts"].asUInt());
+}
+
+void StorageTest::testSharedSnapshot() {
+    CryptoKernel::MemoryEngine::destroy("testshareddb");
+    GatedEngine* engine = new GatedEngine("testshareddb");
+    CryptoKernel::Storage database(engine, false, true);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    dbTx->put("mydata", Json::Value(1));
+    dbTx->commit();
+
+    // Transactions that begin between the same two commits share a snapshot
+    std::unique_ptr<CryptoKernel::Storage::Transaction> first(database.beginReadOnly());
+    std::unique_ptr<CryptoKernel::Storage::Transaction> second(database.beginReadOnly());
+    CPPUNIT_ASSERT(first->snapshot == second->snapshot);
+
+    // Beginning a transaction does not wait for a commit being written
+    engine->close();
+    std::thread writer([&]() {
+        std::unique_ptr<CryptoKernel::Storage::Transaction> tx(database.begin());
+        tx->put("mydata", Json::Value(2));
+        tx->commit();
+    });
+    engine->waitForWrite();
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> during(database.beginReadOnly());
+    CPPUNIT_ASSERT(during->snapshot == first->snapshot);
+    CPPUNIT_ASSERT_EQUAL(Json::Value(1), during->get("mydata"));
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> writable(database.begin());
+    CPPUNIT_ASSERT_EQUAL(Json::Value(1), writable->get("mydata"));
+    writable->put("mydata", Json::Value(3));
+
+    engine->open();
+    writer.join();
+
+    // The commit that was in progress changed a key this one read
+    CPPUNIT_ASSERT_THROW(writable->commit(), CryptoKernel::Storage::ConflictException);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> after(database.beginReadOnly());
+    CPPUNIT_ASSERT(after->snapshot != first->snapshot);
+    CPPUNIT_ASSERT_EQUAL(Json::Value(2), after->get("mydata"));
+    CPPUNIT_ASSERT_EQUAL(Json::Value(1), first->get("mydata"));
+}
+
+void StorageTest::testConcurrentReads() {
+    CryptoKernel::Storage::destroy("memory:testdb");
+    CryptoKernel::Storage database("memory:testdb", false, 0, false, true);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    for(unsigned int i = 0; i < 100; i++) {
+        dbTx->put("key" + std::to_string(i), Json::Value(i));
+    }
+    dbTx->commit();
+
+    dbTx.reset(database.begin());
+    dbTx->put("staged", Json::Value("yes"));
+
+    std::atomic<unsigned int> wrong(0);
+    std::vector<std::thread> threads;
+    for(unsigned int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t]() {
+            for(unsigned int i = t; i < 100; i += 4) {
+                if(dbTx->get("key" + std::to_string(i)).asUInt() != i ||
+                   dbTx->get("staged").asString() != "yes") {
+                    wrong++;
+                }
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    CPPUNIT_ASSERT_EQUAL(0U, wrong.load());
+
+    // Every key read from another thread is checked for conflicts
+    std::unique_ptr<CryptoKernel::Storage::Transaction> other(database.begin());
+    other->put("key99", Json::Value(0));
+    other->commit();
+
+    CPPUNIT_ASSERT_THROW(dbTx->commit(), CryptoKernel::Storage::ConflictException);
+}
@@ -15,6 +15,28 @@ class StorageTest : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(testToJson);
     CPPUNIT_TEST(testToString);
     CPPUNIT_TEST(testIterator);
+    CPPUNIT_TEST(testBinaryRoundTrip);
+    CPPUNIT_TEST(testBinaryIdPacking);
+    CPPUNIT_TEST(testBinaryMalformed);
+    CPPUNIT_TEST(testBinaryMigration);
+    CPPUNIT_TEST(testValueCache);
+    CPPUNIT_TEST(testValueCacheSnapshot);
+    CPPUNIT_TEST(testValueCacheBounded);
+    CPPUNIT_TEST(testConcurrentWriters);
+    CPPUNIT_TEST(testConflict);
+    CPPUNIT_TEST(testIteratorSnapshot);
+    CPPUNIT_TEST(testConcurrentStress);
+    CPPUNIT_TEST(testCompactKeys);
+    CPPUNIT_TEST(testCompactPrefix);
+    CPPUNIT_TEST(testRekey);
+    CPPUNIT_TEST(testMemoryEngine);
+    CPPUNIT_TEST(testMemoryEngineSnapshot);
+    CPPUNIT_TEST(testIteratorRange);
+    CPPUNIT_TEST(testProfile);
+    CPPUNIT_TEST(testGroupCommit);
+    CPPUNIT_TEST(testMetrics);
+    CPPUNIT_TEST(testSharedSnapshot);
+    CPPUNIT_TEST(testConcurrentReads);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -32,6 +54,28 @@ private:
     void testToJson();
     void testToString();
     void testIterator();
+    void testBinaryRoundTrip();
+    void testBinaryIdPacking();
+    void testBinaryMalformed();
+    void testBinaryMigration();
+    void testValueCache();
+    void testValueCacheSnapshot();
+    void testValueCacheBounded();
+    void testConcurrentWriters();
+    void testConflict();
+    void testIteratorSnapshot();
+    void testConcurrentStress();
+    void testCompactKeys();
+    void testCompactPrefix();
+    void testRekey();
+    void testMemoryEngine();
+    void testMemoryEngineSnapshot();
+    void testIteratorRange();
+    void testProfile();
+    void testGroupCommit();
+    void testMetrics();
+    void testSharedSnapshot();
+    void testConcurrentReads();
 };
 
 #endif
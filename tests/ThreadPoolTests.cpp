@@ -0,0 +1,82 @@
+#include "ThreadPoolTests.h"
+
+#include <stdexcept>
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ThreadPoolTest);
+
+ThreadPoolTest::ThreadPoolTest() {
+}
+
+ThreadPoolTest::~ThreadPoolTest() {
+}
+
+void ThreadPoolTest::setUp() {
+}
+
+void ThreadPoolTest::tearDown() {
+}
+
+void ThreadPoolTest::testRunAll() {
+    CryptoKernel::ThreadPool pool(3);
+
+    std::vector<std::atomic<unsigned int>> calls(1000);
+    for(auto& count : calls) {
+        count = 0;
+    }
+
+    CPPUNIT_ASSERT_EQUAL(size_t(1000), pool.run(calls.size(), [&](const size_t i) {
+        calls[i]++;
+        return true;
+    }));
+
+    for(const auto& count : calls) {
+        CPPUNIT_ASSERT_EQUAL(1U, count.load());
+    }
+
+    CPPUNIT_ASSERT_EQUAL(size_t(0), pool.run(0, [](const size_t i) {
+        return false;
+    }));
+}
+
+void ThreadPoolTest::testLowestFailure() {
+    CryptoKernel::ThreadPool pool(3);
+
+    // Whichever failure is found first, the lowest one is reported
+    for(unsigned int round = 0; round < 200; round++) {
+        CPPUNIT_ASSERT_EQUAL(size_t(37), pool.run(100, [](const size_t i) {
+            return i != 37 && i != 80;
+        }));
+    }
+}
+
+void ThreadPoolTest::testException() {
+    CryptoKernel::ThreadPool pool(3);
+
+    for(unsigned int round = 0; round < 200; round++) {
+        CPPUNIT_ASSERT_THROW(pool.run(100, [](const size_t i) {
+            if(i == 10) {
+                throw std::runtime_error("failed");
+            }
+            return i != 20;
+        }), std::runtime_error);
+
+        CPPUNIT_ASSERT_EQUAL(size_t(10), pool.run(100, [](const size_t i) {
+            if(i == 20) {
+                throw std::runtime_error("failed");
+            }
+            return i != 10;
+        }));
+    }
+}
+
+void ThreadPoolTest::testSerial() {
+    CryptoKernel::ThreadPool pool(0);
+    CPPUNIT_ASSERT_EQUAL(0U, pool.size());
+
+    unsigned int calls = 0;
+    CPPUNIT_ASSERT_EQUAL(size_t(3), pool.run(10, [&](const size_t i) {
+        calls++;
+        return i != 3;
+    }));
+    CPPUNIT_ASSERT_EQUAL(4U, calls);
+}
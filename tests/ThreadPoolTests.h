@@ -0,0 +1,31 @@
+#ifndef THREADPOOLTEST_H
+#define THREADPOOLTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "threadpool.h"
+
+class ThreadPoolTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(ThreadPoolTest);
+
+    CPPUNIT_TEST(testRunAll);
+    CPPUNIT_TEST(testLowestFailure);
+    CPPUNIT_TEST(testException);
+    CPPUNIT_TEST(testSerial);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    ThreadPoolTest();
+    virtual ~ThreadPoolTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testRunAll();
+    void testLowestFailure();
+    void testException();
+    void testSerial();
+};
+
+#endif
@@ -0,0 +1,141 @@
+#include "UtxoCacheTests.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(UtxoCacheTest);
+
+namespace {
+Json::Value makeOutput(const uint64_t value) {
+    Json::Value output;
+    output["value"] = Json::UInt64(value);
+    output["data"]["publicKey"] = "BL2AcSzFw2+rGgQwJ25r7v/misIvr3t4JzkH3U1CCknchfkncSneKLBo6tjnKDhDxZUSPXEKMDtTU/YsvkwxJR8=";
+    return output;
+}
+}
+
+UtxoCacheTest::UtxoCacheTest() {
+}
+
+UtxoCacheTest::~UtxoCacheTest() {
+}
+
+void UtxoCacheTest::setUp() {
+    CryptoKernel::Storage::destroy("memory:testutxodb");
+    database.reset(new CryptoKernel::Storage("memory:testutxodb", false, 0, false, true));
+    table.reset(new CryptoKernel::Storage::Table("utxos", 3));
+}
+
+void UtxoCacheTest::tearDown() {
+    database.reset();
+    CryptoKernel::Storage::destroy("memory:testutxodb");
+}
+
+void UtxoCacheTest::testStaged() {
+    CryptoKernel::UtxoCache cache(table.get(), 1024 * 1024);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database->begin());
+    cache.begin(dbTx.get());
+    cache.put("a", makeOutput(1));
+    CPPUNIT_ASSERT_EQUAL(Json::UInt64(1), cache.get(dbTx.get(), "a")["value"].asUInt64());
+
+    // Other transactions do not see staged changes
+    std::unique_ptr<CryptoKernel::Storage::Transaction> other(database->beginReadOnly());
+    CPPUNIT_ASSERT(cache.get(other.get(), "a").isNull());
+
+    cache.abort();
+    CPPUNIT_ASSERT(cache.get(dbTx.get(), "a").isNull());
+
+    dbTx.reset(database->begin());
+    cache.begin(dbTx.get());
+    cache.put("a", makeOutput(1));
+    dbTx->commit();
+    cache.commit();
+
+    CPPUNIT_ASSERT(cache.get(other.get(), "a").isObject());
+    CPPUNIT_ASSERT_EQUAL(size_t(1), cache.dirtyCount());
+}
+
+void UtxoCacheTest::testWriteBack() {
+    CryptoKernel::UtxoCache cache(table.get(), 1024 * 1024);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database->begin());
+    table->put(dbTx.get(), "old", makeOutput(5));
+    dbTx->commit();
+
+    dbTx.reset(database->begin());
+    cache.begin(dbTx.get());
+    cache.put("a", makeOutput(1));
+    cache.put("b", makeOutput(2));
+    cache.erase("old");
+    dbTx->commit();
+    cache.commit();
+
+    // Nothing reaches the table until a flush
+    dbTx.reset(database->beginReadOnly());
+    CPPUNIT_ASSERT(table->get(dbTx.get(), "a").isNull());
+    CPPUNIT_ASSERT(table->get(dbTx.get(), "old").isObject());
+    CPPUNIT_ASSERT(cache.get(dbTx.get(), "old").isNull());
+
+    dbTx.reset(database->begin());
+    cache.begin(dbTx.get());
+    cache.erase("b");
+    cache.flush();
+    dbTx->commit();
+    cache.commit();
+
+    dbTx.reset(database->beginReadOnly());
+    CPPUNIT_ASSERT_EQUAL(Json::UInt64(1), table->get(dbTx.get(), "a")["value"].asUInt64());
+    CPPUNIT_ASSERT(table->get(dbTx.get(), "b").isNull());
+    CPPUNIT_ASSERT(table->get(dbTx.get(), "old").isNull());
+    CPPUNIT_ASSERT_EQUAL(size_t(0), cache.dirtyCount());
+    CPPUNIT_ASSERT(!cache.needsFlush());
+}
+
+void UtxoCacheTest::testBudget() {
+    CryptoKernel::UtxoCache cache(table.get(), 4096);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database->begin());
+    cache.begin(dbTx.get());
+    for(unsigned int i = 0; i < 100; i++) {
+        cache.put(std::to_string(i), makeOutput(i));
+    }
+    dbTx->commit();
+    cache.commit();
+
+    CPPUNIT_ASSERT(cache.memoryUsage() > 4096);
+    CPPUNIT_ASSERT(cache.needsFlush());
+
+    dbTx.reset(database->begin());
+    cache.begin(dbTx.get());
+    cache.flush();
+    dbTx->commit();
+    cache.commit();
+
+    // Once written the records are dropped to get back under budget
+    CPPUNIT_ASSERT_EQUAL(uint64_t(0), cache.memoryUsage());
+    CPPUNIT_ASSERT(!cache.needsFlush());
+
+    dbTx.reset(database->begin());
+    cache.begin(dbTx.get());
+    CPPUNIT_ASSERT_EQUAL(Json::UInt64(42), cache.get(dbTx.get(), "42")["value"].asUInt64());
+    cache.abort();
+    CPPUNIT_ASSERT(cache.memoryUsage() > 0);
+}
+
+void UtxoCacheTest::testInactiveReads() {
+    CryptoKernel::UtxoCache cache(table.get(), 1024 * 1024);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database->begin());
+    table->put(dbTx.get(), "a", makeOutput(1));
+    dbTx->commit();
+
+    // A transaction that is not changing the cache may have an old
+    // snapshot, so what it reads is not kept
+    std::unique_ptr<CryptoKernel::Storage::Transaction> reader(database->beginReadOnly());
+    CPPUNIT_ASSERT(cache.get(reader.get(), "a").isObject());
+    CPPUNIT_ASSERT_EQUAL(uint64_t(0), cache.memoryUsage());
+
+    dbTx.reset(database->begin());
+    cache.begin(dbTx.get());
+    CPPUNIT_ASSERT(cache.get(dbTx.get(), "a").isObject());
+    cache.abort();
+    CPPUNIT_ASSERT(cache.memoryUsage() > 0);
+}
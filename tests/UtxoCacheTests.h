@@ -0,0 +1,34 @@
+#ifndef UTXOCACHETEST_H
+#define UTXOCACHETEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "utxocache.h"
+
+class UtxoCacheTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(UtxoCacheTest);
+
+    CPPUNIT_TEST(testStaged);
+    CPPUNIT_TEST(testWriteBack);
+    CPPUNIT_TEST(testBudget);
+    CPPUNIT_TEST(testInactiveReads);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    UtxoCacheTest();
+    virtual ~UtxoCacheTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testStaged();
+    void testWriteBack();
+    void testBudget();
+    void testInactiveReads();
+
+    std::unique_ptr<CryptoKernel::Storage> database;
+    std::unique_ptr<CryptoKernel::Storage::Table> table;
+};
+
+#endif